@@ -1,5 +1,7 @@
 #include "abstractaggregator.h"
 
+#include <QVector>
+
 class qdatacube::AbstractAggregatorPrivate {
     public:
         AbstractAggregatorPrivate(const QAbstractItemModel* underlying_model) : m_underlying_model(underlying_model), m_name("unnamed") {
@@ -22,6 +24,35 @@ const QAbstractItemModel* qdatacube::AbstractAggregator::underlyingModel() const
     return d->m_underlying_model;
 }
 
+void qdatacube::AbstractAggregator::categorize(int start, int count, int* codes) const {
+    for (int i = 0; i < count; ++i) {
+        codes[i] = (*this)(start + i);
+    }
+}
+
+void qdatacube::AbstractAggregator::matchCategories(int start, int count, const Bitset& categories, bool negated, Bitset& result) const {
+    result = Bitset(count);
+    // Categorize in chunks that stay in cache, a multiple of 64 rows so each chunk fills whole words
+    const int chunk = 4096;
+    QVector<int> codes(qMin(chunk, count));
+    for (int offset = 0; offset < count; offset += chunk) {
+        const int n = qMin(chunk, count - offset);
+        categorize(start + offset, n, codes.data());
+        const int* chunk_codes = codes.constData();
+        for (int i = 0; i < n; i += 64) {
+            quint64 word = 0;
+            for (int bit = 0, nbits = qMin(64, n - i); bit < nbits; ++bit) {
+                word |= quint64(categories.test(chunk_codes[i + bit]) != negated) << bit;
+            }
+            result.setWord((offset + i) >> 6, word);
+        }
+    }
+}
+
+qdatacube::MemoryUsage qdatacube::AbstractAggregator::memoryUsage() const {
+    return MemoryUsage();
+}
+
 qdatacube::AbstractAggregator::~AbstractAggregator() {
 
 }
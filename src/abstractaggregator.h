@@ -10,6 +10,8 @@
 #include <QList>
 
 #include "qdatacube_export.h"
+#include "bitset.h"
+#include "memoryusage.h"
 #include <QString>
 #include <QObject>
 #include <QVariant>
@@ -37,6 +39,19 @@ class QDATACUBE_EXPORT AbstractAggregator : public QObject {
          */
         virtual int operator()(int row) const = 0;
 
+        /**
+         * Categorize count rows from start in one go, writing the category of row start+i to codes[i].
+         * The default implementation calls operator() for each row; aggregators keeping their
+         * categories in an array should override it.
+         */
+        virtual void categorize(int start, int count, int* codes) const;
+
+        /**
+         * Categorize count rows from start with categorize(), setting bit i of result if the category of
+         * row start+i is in categories, or, if negated, is not. result is replaced by a set of count bits.
+         */
+        void matchCategories(int start, int count, const Bitset& categories, bool negated, Bitset& result) const;
+
         /**
          * @return the number of categories in this aggregator
          */
@@ -59,6 +74,12 @@ class QDATACUBE_EXPORT AbstractAggregator : public QObject {
         */
         const QAbstractItemModel* underlyingModel() const;
 
+        /**
+         * @return heap memory used by the categories and caches of this aggregator. Default
+         * implementation reports nothing.
+         */
+        virtual MemoryUsage memoryUsage() const;
+
         /**
         * dtor
         */
@@ -76,6 +97,19 @@ class QDATACUBE_EXPORT AbstractAggregator : public QObject {
          */
         void categoryRemoved(int index) const;
 
+        /**
+         * Implementors must emit this signal when the category of the rows set in rows changed other than
+         * by the rows changing in the model, e.g. because categories were merged. Datacubes then move those
+         * rows only.
+         */
+        void rowsRecategorized(const qdatacube::Bitset& rows) const;
+
+        /**
+         * Implementors must emit this signal when the header data of the categories first to last changed,
+         * e.g. because a category was renamed
+         */
+        void headerDataChanged(int first, int last) const;
+
     protected:
         /**
          * Sets the name of this aggregator to \param newName
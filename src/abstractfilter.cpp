@@ -1,4 +1,5 @@
 #include "abstractfilter.h"
+#include "bitset.h"
 
 namespace qdatacube {
 
@@ -31,6 +32,17 @@ QString AbstractFilter::shortName() const {
     return d->m_shortName;
 }
 
+void AbstractFilter::evaluate(int start, int count, Bitset& result) const {
+    result = Bitset(count);
+    for (int i = 0; i < count; i += 64) {
+        quint64 word = 0;
+        for (int bit = 0, nbits = qMin(64, count - i); bit < nbits; ++bit) {
+            word |= quint64((*this)(start + i + bit)) << bit;
+        }
+        result.setWord(i >> 6, word);
+    }
+}
+
 const QAbstractItemModel* AbstractFilter::underlyingModel() const {
     return d->m_underlyingModel;
 }
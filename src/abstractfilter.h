@@ -2,6 +2,7 @@
 #define ABSTRACT_FILTER_H
 
 #include <QObject>
+#include "bitset.h"
 #include "qdatacube_export.h"
 
 template<class T >
@@ -22,6 +23,14 @@ class QDATACUBE_EXPORT AbstractFilter : public QObject {
          */
         virtual bool operator()(int row) const = 0;
 
+        /**
+         * Evaluate the filter for count rows from start in one go
+         * @param result set to count bits, bit i telling if row start+i is to be included
+         * The default implementation calls operator() for each row. Filters that can work on many
+         * rows at a time should override it.
+         */
+        virtual void evaluate(int start, int count, Bitset& result) const;
+
         /**
          * @return name of filter
          */
@@ -40,6 +49,13 @@ class QDATACUBE_EXPORT AbstractFilter : public QObject {
          * dtor
          */
         virtual ~AbstractFilter();
+    Q_SIGNALS:
+        /**
+         * Implementors must emit this signal when the result of the filter may have changed for the
+         * rows set in rows, other than by the rows changing in the model, e.g. because the filter's
+         * parameters changed. Datacubes using the filter then reevaluate those rows only.
+         */
+        void resultsChanged(const qdatacube::Bitset& rows);
     protected:
         /**
          * sets name of this filter to \param newName
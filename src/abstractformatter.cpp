@@ -1,5 +1,6 @@
 #include "abstractformatter.h"
 #include "datacubeview.h"
+#include "datacube.h"
 #include <stdexcept>
 #include <QEvent>
 
@@ -57,6 +58,24 @@ bool AbstractFormatter::eventFilter(QObject* filter , QEvent* event ) {
     return QObject::eventFilter(filter, event);
 }
 
+bool AbstractFormatter::isThreadSafe() const {
+    return false;
+}
+
+bool AbstractFormatter::mergesCells() const {
+    return false;
+}
+
+QString AbstractFormatter::formatCells(const Datacube* datacube, int top_row, int left_column, int bottom_row, int right_column) const {
+    QList<int> elements;
+    for (int row = top_row; row <= bottom_row; ++row) {
+        for (int column = left_column; column <= right_column; ++column) {
+            elements << datacube->elements(row, column);
+        }
+    }
+    return format(elements);
+}
+
 void AbstractFormatter::update(AbstractFormatter::UpdateType element) {
     Q_UNUSED(element);
     // do nothing
@@ -10,6 +10,7 @@ class QAbstractItemModel;
 
 namespace qdatacube {
 
+class Datacube;
 class DatacubeView;
 
 
@@ -41,6 +42,33 @@ class QDATACUBE_EXPORT AbstractFormatter : public QObject {
          */
         virtual QString format(QList<int> rows) const = 0;
 
+        /**
+         * @return true if format() may be called from worker threads, concurrently with itself and with
+         * this formatter's slots running in its own thread.
+         * A thread safe formatter must not access the underlying model, the view or any other object
+         * living in the GUI thread from format(), and must protect any state format() reads that can
+         * change from the GUI thread.
+         * DatacubeView only formats asynchronously (see DatacubeView::setAsynchronousFormatting()) with
+         * formatters that return true.
+         * Default implementation returns false.
+         */
+        virtual bool isThreadSafe() const;
+
+        /**
+         * @return true if this formatter keeps a summary per cell of the datacube, and formats cells and
+         * totals by merging those, see formatCells(). DatacubeView then calls formatCells() rather than
+         * format(), in its own thread.
+         * Default implementation returns false.
+         */
+        virtual bool mergesCells() const;
+
+        /**
+         * @return the value for the cells of datacube from top_row, left_column to bottom_row, right_column:
+         * A single cell, the cells under a header section for a header total or all cells for the grand total.
+         * Default implementation formats the elements of the cells.
+         */
+        virtual QString formatCells(const Datacube* datacube, int top_row, int left_column, int bottom_row, int right_column) const;
+
         /**
          * @return short (3 letters or so) name of summary
          */
@@ -0,0 +1,314 @@
+#include "aggregatorregistry.h"
+#include "bitset.h"
+#include "columnaggregator.h"
+#include "filterbyaggregate.h"
+#include "memoryusage_p.h"
+
+#include <QAbstractItemModel>
+#include <QHash>
+#include <QSharedPointer>
+#include <QVector>
+#include <QWeakPointer>
+
+#include <algorithm>
+
+namespace qdatacube {
+
+/**
+ * Aggregator keeping the category of each row of another aggregator
+ */
+class SharedAggregator : public AbstractAggregator {
+    Q_OBJECT
+    public:
+        explicit SharedAggregator(AbstractAggregator::Ptr aggregator);
+        virtual int operator()(int row) const {
+            Q_ASSERT(row < m_codes.size());
+            return m_codes.at(row);
+        }
+        virtual void categorize(int start, int count, int* codes) const {
+            Q_ASSERT(start + count <= m_codes.size());
+            std::copy(m_codes.constData() + start, m_codes.constData() + start + count, codes);
+        }
+        virtual int categoryCount() const {
+            return m_aggregator->categoryCount();
+        }
+        virtual QVariant categoryHeaderData(int category, int role = Qt::DisplayRole) const {
+            return m_aggregator->categoryHeaderData(category, role);
+        }
+        virtual MemoryUsage memoryUsage() const {
+            MemoryUsage rv = m_aggregator->memoryUsage();
+            rv.add("aggregator codes", memory::vector_bytes(m_codes));
+            return rv;
+        }
+    private Q_SLOTS:
+        void refresh_rows(const QModelIndex& top_left, const QModelIndex& bottom_right);
+        void insert_rows(const QModelIndex& parent, int start, int end);
+        void remove_rows(const QModelIndex& parent, int start, int end);
+        void refresh_all();
+        void category_added(int index);
+        void category_removed(int index);
+        void recategorize_rows(const qdatacube::Bitset& rows);
+    private:
+        AbstractAggregator::Ptr m_aggregator;
+        QVector<int> m_codes;
+};
+
+SharedAggregator::SharedAggregator(AbstractAggregator::Ptr aggregator)
+  : AbstractAggregator(aggregator->underlyingModel()),
+    m_aggregator(aggregator)
+{
+  setName(aggregator->name());
+  // The wrapped aggregator must update its categories before the codes are recomputed, so connect after it
+  connect(aggregator.data(), SIGNAL(categoryAdded(int)), SLOT(category_added(int)));
+  connect(aggregator.data(), SIGNAL(categoryRemoved(int)), SLOT(category_removed(int)));
+  connect(aggregator.data(), SIGNAL(rowsRecategorized(qdatacube::Bitset)), SLOT(recategorize_rows(qdatacube::Bitset)));
+  connect(aggregator.data(), SIGNAL(headerDataChanged(int,int)), SIGNAL(headerDataChanged(int,int)));
+  connect(underlyingModel(), SIGNAL(dataChanged(QModelIndex,QModelIndex)), SLOT(refresh_rows(QModelIndex,QModelIndex)));
+  connect(underlyingModel(), SIGNAL(rowsInserted(QModelIndex,int,int)), SLOT(insert_rows(QModelIndex,int,int)));
+  connect(underlyingModel(), SIGNAL(rowsRemoved(QModelIndex,int,int)), SLOT(remove_rows(QModelIndex,int,int)));
+  connect(underlyingModel(), SIGNAL(modelReset()), SLOT(refresh_all()));
+  refresh_all();
+}
+
+void SharedAggregator::refresh_rows(const QModelIndex& top_left, const QModelIndex& bottom_right) {
+  if (top_left.parent().isValid()) {
+    return;
+  }
+  for (int row = top_left.row(); row <= bottom_right.row(); ++row) {
+    m_codes[row] = (*m_aggregator)(row);
+  }
+}
+
+void SharedAggregator::insert_rows(const QModelIndex& parent, int start, int end) {
+  if (parent.isValid()) {
+    return;
+  }
+  m_codes.insert(start, end - start + 1, -1);
+  for (int row = start; row <= end; ++row) {
+    m_codes[row] = (*m_aggregator)(row);
+  }
+}
+
+void SharedAggregator::remove_rows(const QModelIndex& parent, int start, int end) {
+  if (parent.isValid()) {
+    return;
+  }
+  m_codes.remove(start, end - start + 1);
+}
+
+void SharedAggregator::refresh_all() {
+  const int nrows = underlyingModel()->rowCount();
+  m_codes.resize(nrows);
+  m_aggregator->categorize(0, nrows, m_codes.data());
+}
+
+void SharedAggregator::category_added(int index) {
+  for (QVector<int>::iterator it = m_codes.begin(), iend = m_codes.end(); it != iend; ++it) {
+    if (*it >= index) {
+      ++*it;
+    }
+  }
+  emit categoryAdded(index);
+}
+
+void SharedAggregator::category_removed(int index) {
+  for (QVector<int>::iterator it = m_codes.begin(), iend = m_codes.end(); it != iend; ++it) {
+    if (*it == index) {
+      *it = -1; // Only rows about to be removed or changed can be in a removed category
+    } else if (*it > index) {
+      --*it;
+    }
+  }
+  emit categoryRemoved(index);
+}
+
+void SharedAggregator::recategorize_rows(const qdatacube::Bitset& rows) {
+  for (int row = rows.nextSetBit(0); row >= 0 && row < m_codes.size(); row = rows.nextSetBit(row + 1)) {
+    m_codes[row] = (*m_aggregator)(row);
+  }
+  emit rowsRecategorized(rows);
+}
+
+/**
+ * Filter keeping the result for each row of another filter
+ */
+class SharedFilter : public AbstractFilter {
+    Q_OBJECT
+    public:
+        explicit SharedFilter(AbstractFilter::Ptr filter);
+        virtual bool operator()(int row) const {
+            return m_results.test(row);
+        }
+        virtual void evaluate(int start, int count, Bitset& result) const {
+            result = m_results.mid(start, count);
+        }
+    private Q_SLOTS:
+        void refresh_rows(const QModelIndex& top_left, const QModelIndex& bottom_right);
+        void insert_rows(const QModelIndex& parent, int start, int end);
+        void remove_rows(const QModelIndex& parent, int start, int end);
+        void refresh_all();
+        void refresh_results(const qdatacube::Bitset& rows);
+    private:
+        void refresh(int row) {
+          if ((*m_filter)(row)) {
+            m_results.set(row);
+          } else {
+            m_results.reset(row);
+          }
+        }
+        AbstractFilter::Ptr m_filter;
+        Bitset m_results;
+};
+
+SharedFilter::SharedFilter(AbstractFilter::Ptr filter)
+  : AbstractFilter(filter->underlyingModel()),
+    m_filter(filter)
+{
+  setName(filter->name());
+  setShortName(filter->shortName());
+  connect(filter.data(), SIGNAL(resultsChanged(qdatacube::Bitset)), SLOT(refresh_results(qdatacube::Bitset)));
+  connect(underlyingModel(), SIGNAL(dataChanged(QModelIndex,QModelIndex)), SLOT(refresh_rows(QModelIndex,QModelIndex)));
+  connect(underlyingModel(), SIGNAL(rowsInserted(QModelIndex,int,int)), SLOT(insert_rows(QModelIndex,int,int)));
+  connect(underlyingModel(), SIGNAL(rowsRemoved(QModelIndex,int,int)), SLOT(remove_rows(QModelIndex,int,int)));
+  connect(underlyingModel(), SIGNAL(modelReset()), SLOT(refresh_all()));
+  refresh_all();
+}
+
+void SharedFilter::refresh_rows(const QModelIndex& top_left, const QModelIndex& bottom_right) {
+  if (top_left.parent().isValid()) {
+    return;
+  }
+  for (int row = top_left.row(); row <= bottom_right.row(); ++row) {
+    refresh(row);
+  }
+}
+
+void SharedFilter::insert_rows(const QModelIndex& parent, int start, int end) {
+  if (parent.isValid()) {
+    return;
+  }
+  m_results.insert(start, end - start + 1);
+  for (int row = start; row <= end; ++row) {
+    refresh(row);
+  }
+}
+
+void SharedFilter::remove_rows(const QModelIndex& parent, int start, int end) {
+  if (parent.isValid()) {
+    return;
+  }
+  m_results.remove(start, end - start + 1);
+}
+
+void SharedFilter::refresh_all() {
+  const int nrows = underlyingModel()->rowCount();
+  m_filter->evaluate(0, nrows, m_results);
+}
+
+void SharedFilter::refresh_results(const qdatacube::Bitset& rows) {
+  for (int row = rows.nextSetBit(0); row >= 0 && row < m_results.size(); row = rows.nextSetBit(row + 1)) {
+    refresh(row);
+  }
+  emit resultsChanged(rows);
+}
+
+class AggregatorRegistryPrivate {
+    public:
+        AggregatorRegistryPrivate(const QAbstractItemModel* model) : model(model) {}
+        const QAbstractItemModel* model;
+        QHash<QString, QWeakPointer<AbstractAggregator> > aggregators;
+        QHash<QString, QWeakPointer<AbstractFilter> > filters;
+
+        /**
+         * Drop entries whose shared object has been destroyed
+         */
+        template<typename T>
+        static void prune(QHash<QString, QWeakPointer<T> >& entries) {
+          for (typename QHash<QString, QWeakPointer<T> >::iterator it = entries.begin(); it != entries.end();) {
+            if (it->isNull()) {
+              it = entries.erase(it);
+            } else {
+              ++it;
+            }
+          }
+        }
+
+        /**
+         * @return number of entries whose shared object is still alive
+         */
+        template<typename T>
+        static int live(const QHash<QString, QWeakPointer<T> >& entries) {
+          int rv = 0;
+          for (typename QHash<QString, QWeakPointer<T> >::const_iterator it = entries.constBegin(); it != entries.constEnd(); ++it) {
+            if (!it->isNull()) {
+              ++rv;
+            }
+          }
+          return rv;
+        }
+};
+
+AggregatorRegistry::AggregatorRegistry(const QAbstractItemModel* model, QObject* parent)
+  : QObject(parent),
+    d(new AggregatorRegistryPrivate(model))
+{
+  Q_ASSERT(model);
+}
+
+AggregatorRegistry::~AggregatorRegistry() {
+  // Need to declare here so AggregatorRegistryPrivate's destructor is visible
+}
+
+const QAbstractItemModel* AggregatorRegistry::underlyingModel() const {
+  return d->model;
+}
+
+AbstractAggregator::Ptr AggregatorRegistry::columnAggregator(int section, int trimRight) {
+  const QString key = QString("column:%1:%2").arg(section).arg(trimRight);
+  if (AbstractAggregator::Ptr existing = d->aggregators.value(key).toStrongRef()) {
+    return existing;
+  }
+  QSharedPointer<ColumnAggregator> column_aggregator(new ColumnAggregator(d->model, section));
+  if (trimRight > 0) {
+    column_aggregator->setTrimNewCategoriesFromRight(trimRight);
+  }
+  return aggregator(key, column_aggregator);
+}
+
+AbstractAggregator::Ptr AggregatorRegistry::aggregator(const QString& key, AbstractAggregator::Ptr aggregator) {
+  if (AbstractAggregator::Ptr existing = d->aggregators.value(key).toStrongRef()) {
+    return existing;
+  }
+  Q_ASSERT(aggregator->underlyingModel() == d->model);
+  AggregatorRegistryPrivate::prune(d->aggregators);
+  AbstractAggregator::Ptr shared(new SharedAggregator(aggregator));
+  d->aggregators.insert(key, shared);
+  return shared;
+}
+
+AbstractFilter::Ptr AggregatorRegistry::categoryFilter(int section, const QString& category) {
+  const QString key = QString("category:%1=%2").arg(section).arg(category);
+  if (AbstractFilter::Ptr existing = d->filters.value(key).toStrongRef()) {
+    return existing;
+  }
+  return filter(key, AbstractFilter::Ptr(new FilterByAggregate(columnAggregator(section), category)));
+}
+
+AbstractFilter::Ptr AggregatorRegistry::filter(const QString& key, AbstractFilter::Ptr filter) {
+  if (AbstractFilter::Ptr existing = d->filters.value(key).toStrongRef()) {
+    return existing;
+  }
+  Q_ASSERT(filter->underlyingModel() == d->model);
+  AggregatorRegistryPrivate::prune(d->filters);
+  AbstractFilter::Ptr shared(new SharedFilter(filter));
+  d->filters.insert(key, shared);
+  return shared;
+}
+
+int AggregatorRegistry::count() const {
+  return AggregatorRegistryPrivate::live(d->aggregators) + AggregatorRegistryPrivate::live(d->filters);
+}
+
+}
+
+#include "aggregatorregistry.moc"
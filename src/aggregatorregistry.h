@@ -0,0 +1,77 @@
+#ifndef QDATACUBE_AGGREGATORREGISTRY_H
+#define QDATACUBE_AGGREGATORREGISTRY_H
+
+#include "qdatacube_export.h"
+#include "abstractaggregator.h"
+#include "abstractfilter.h"
+
+#include <QObject>
+
+class QAbstractItemModel;
+namespace qdatacube {
+class AggregatorRegistryPrivate;
+}
+
+namespace qdatacube {
+
+/**
+ * Shares aggregators and filters between several datacubes over the same model.
+ *
+ * Each aggregator and filter handed out by the registry evaluates every row of the model once and
+ * keeps the results, a category per row or a bit per row, up to date as the model changes. All
+ * datacubes using it then read the stored results instead of evaluating rows themselves, and the
+ * model's change notifications are processed once per aggregator or filter, not once per datacube.
+ *
+ * Aggregators and filters are identified by a key, so asking twice for the same column
+ * returns the same instance. The registry only holds weak references; an aggregator or filter
+ * is released when the last datacube using it is done with it.
+ *
+ * The registry must be asked for aggregators and filters before the datacubes using them are created,
+ * so the stored results are updated before the datacubes hear about changes in the model.
+ */
+class QDATACUBE_EXPORT AggregatorRegistry : public QObject {
+    Q_OBJECT
+    public:
+        explicit AggregatorRegistry(const QAbstractItemModel* model, QObject* parent = 0);
+        ~AggregatorRegistry();
+
+        /**
+         * @return the model the registry shares aggregators and filters for
+         */
+        const QAbstractItemModel* underlyingModel() const;
+
+        /**
+         * @return the shared ColumnAggregator on section, created on first request
+         * @param trimRight if positive, trim categories to their rightmost trimRight characters,
+         * see ColumnAggregator::setTrimNewCategoriesFromRight()
+         */
+        AbstractAggregator::Ptr columnAggregator(int section, int trimRight = 0);
+
+        /**
+         * @return the shared aggregator registered for key. If there is none, aggregator is registered for key
+         * and returned shared.
+         */
+        AbstractAggregator::Ptr aggregator(const QString& key, AbstractAggregator::Ptr aggregator);
+
+        /**
+         * @return the shared filter for rows where the column section is category, created on first request
+         */
+        AbstractFilter::Ptr categoryFilter(int section, const QString& category);
+
+        /**
+         * @return the shared filter registered for key. If there is none, filter is registered for key
+         * and returned shared.
+         */
+        AbstractFilter::Ptr filter(const QString& key, AbstractFilter::Ptr filter);
+
+        /**
+         * @return number of aggregators and filters currently shared
+         */
+        int count() const;
+    private:
+        QScopedPointer<AggregatorRegistryPrivate> d;
+};
+
+}
+
+#endif // QDATACUBE_AGGREGATORREGISTRY_H
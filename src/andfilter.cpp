@@ -1,27 +1,42 @@
 #include "andfilter.h"
+#include "bitset.h"
+#include "filtercombination_p.h"
+
 #include <QSharedPointer>
 
 namespace qdatacube {
 class AndFilterPrivate {
 public:
-    AndFilterPrivate() {};
-    QList<AbstractFilter::Ptr> m_filterComponents;
+    AndFilterPrivate() : m_combination(FilterCombination::And) {};
+    FilterCombination m_combination;
 };
 
 AndFilter::AndFilter(QAbstractItemModel* underlyingModel): AbstractFilter(underlyingModel), d(new AndFilterPrivate()) {}
 
 void AndFilter::addFilter(AbstractFilter::Ptr filter) {
     Q_ASSERT(filter->underlyingModel() == underlyingModel());
-    d->m_filterComponents.append(filter);
+    d->m_combination.append(filter);
+    connect(filter.data(), SIGNAL(resultsChanged(qdatacube::Bitset)), SIGNAL(resultsChanged(qdatacube::Bitset)));
 }
 
 bool AndFilter::operator()(int row) const {
-    Q_FOREACH(AbstractFilter::Ptr filter, d->m_filterComponents) {
-       if(!(*filter)(row))  {
-           return false;
-       }
-    }
-    return true;
+    return d->m_combination.test(row);
+}
+
+void AndFilter::evaluate(int start, int count, Bitset& result) const {
+    d->m_combination.evaluate(start, count, result);
+}
+
+void AndFilter::setAdaptiveOrdering(bool adaptive) {
+    d->m_combination.setAdaptive(adaptive);
+}
+
+bool AndFilter::adaptiveOrdering() const {
+    return d->m_combination.isAdaptive();
+}
+
+QList<AbstractFilter::Ptr> AndFilter::evaluationOrder() const {
+    return d->m_combination.evaluationOrder();
 }
 
 AndFilter::~AndFilter() {}
@@ -0,0 +1,184 @@
+#include "bitset.h"
+
+#include <QtAlgorithms>
+
+namespace qdatacube {
+
+Bitset Bitset::fromList(const QList<int>& bits, int size) {
+  int max_bit = size - 1;
+  Q_FOREACH(int bit, bits) {
+    max_bit = qMax(max_bit, bit);
+  }
+  Bitset rv(max_bit + 1);
+  Q_FOREACH(int bit, bits) {
+    if (bit >= 0) {
+      rv.m_words[bit >> 6] |= quint64(1) << (bit & 63);
+    }
+  }
+  return rv;
+}
+
+void Bitset::resize(int size) {
+  if (size < m_size && (size & 63)) {
+    // Clear the bits past the new end in the last word, so they stay unset if the set grows again
+    m_words[size >> 6] &= (quint64(1) << (size & 63)) - 1;
+  }
+  m_words.resize(word_count(size)); // new words are zero
+  m_size = size;
+}
+
+void Bitset::clear() {
+  m_words.fill(0);
+}
+
+void Bitset::setAll() {
+  m_words.fill(~quint64(0));
+  if (m_size & 63) {
+    m_words.last() = (quint64(1) << (m_size & 63)) - 1;
+  }
+}
+
+int Bitset::count() const {
+  int rv = 0;
+  for (int w = 0, nwords = m_words.size(); w < nwords; ++w) {
+    rv += qPopulationCount(m_words.at(w));
+  }
+  return rv;
+}
+
+bool Bitset::any() const {
+  for (int w = 0, nwords = m_words.size(); w < nwords; ++w) {
+    if (m_words.at(w)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+int Bitset::nextSetBit(int from) const {
+  if (from < 0) {
+    from = 0;
+  }
+  if (from >= m_size) {
+    return -1;
+  }
+  int w = from >> 6;
+  quint64 word = m_words.at(w) & (~quint64(0) << (from & 63));
+  const int nwords = m_words.size();
+  while (!word) {
+    if (++w == nwords) {
+      return -1;
+    }
+    word = m_words.at(w);
+  }
+  return (w << 6) + int(qCountTrailingZeroBits(word));
+}
+
+QList< int > Bitset::toList() const {
+  QList<int> rv;
+  for (int bit = nextSetBit(0); bit >= 0; bit = nextSetBit(bit + 1)) {
+    rv << bit;
+  }
+  return rv;
+}
+
+Bitset Bitset::mid(int position, int count) const {
+  Q_ASSERT(position >= 0);
+  Bitset rv(count);
+  const int first = position >> 6;
+  const int shift = position & 63;
+  const int nwords = m_words.size();
+  for (int w = 0, nresult = rv.m_words.size(); w < nresult && first + w < nwords; ++w) {
+    quint64 word = m_words.at(first + w) >> shift;
+    if (shift && first + w + 1 < nwords) {
+      word |= m_words.at(first + w + 1) << (64 - shift);
+    }
+    rv.setWord(w, word);
+  }
+  return rv;
+}
+
+Bitset& Bitset::operator|=(const Bitset& other) {
+  if (other.m_size > m_size) {
+    resize(other.m_size);
+  }
+  quint64* words = m_words.data();
+  const quint64* other_words = other.m_words.constData();
+  for (int w = 0, nwords = other.m_words.size(); w < nwords; ++w) {
+    words[w] |= other_words[w];
+  }
+  return *this;
+}
+
+Bitset& Bitset::operator&=(const Bitset& other) {
+  quint64* words = m_words.data();
+  const quint64* other_words = other.m_words.constData();
+  const int ncommon = qMin(m_words.size(), other.m_words.size());
+  for (int w = 0; w < ncommon; ++w) {
+    words[w] &= other_words[w];
+  }
+  for (int w = ncommon, nwords = m_words.size(); w < nwords; ++w) {
+    words[w] = 0;
+  }
+  return *this;
+}
+
+Bitset& Bitset::subtract(const Bitset& other) {
+  quint64* words = m_words.data();
+  const quint64* other_words = other.m_words.constData();
+  for (int w = 0, ncommon = qMin(m_words.size(), other.m_words.size()); w < ncommon; ++w) {
+    words[w] &= ~other_words[w];
+  }
+  return *this;
+}
+
+void Bitset::insert(int position, int count) {
+  if (position >= m_size || count <= 0) {
+    return;
+  }
+  Bitset moved(m_size + count);
+  for (int w = 0, nwords = word_count(position); w < nwords; ++w) {
+    moved.m_words[w] = m_words.at(w);
+  }
+  moved.resize(position); // drop what was copied from position and up
+  moved.resize(m_size + count);
+  for (int bit = nextSetBit(position); bit >= 0; bit = nextSetBit(bit + 1)) {
+    moved.m_words[(bit + count) >> 6] |= quint64(1) << ((bit + count) & 63);
+  }
+  *this = moved;
+}
+
+void Bitset::remove(int position, int count) {
+  if (position >= m_size || count <= 0) {
+    return;
+  }
+  count = qMin(count, m_size - position);
+  Bitset moved(m_size);
+  for (int w = 0, nwords = word_count(position); w < nwords; ++w) {
+    moved.m_words[w] = m_words.at(w);
+  }
+  moved.resize(position);
+  moved.resize(m_size - count);
+  for (int bit = nextSetBit(position + count); bit >= 0; bit = nextSetBit(bit + 1)) {
+    moved.m_words[(bit - count) >> 6] |= quint64(1) << ((bit - count) & 63);
+  }
+  *this = moved;
+}
+
+bool Bitset::operator==(const Bitset& other) const {
+  const Bitset& longer = m_words.size() >= other.m_words.size() ? *this : other;
+  const Bitset& shorter = m_words.size() >= other.m_words.size() ? other : *this;
+  for (int w = 0, nwords = shorter.m_words.size(); w < nwords; ++w) {
+    if (longer.m_words.at(w) != shorter.m_words.at(w)) {
+      return false;
+    }
+  }
+  for (int w = shorter.m_words.size(), nwords = longer.m_words.size(); w < nwords; ++w) {
+    if (longer.m_words.at(w)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+} // end of namespace
@@ -0,0 +1,166 @@
+#ifndef QDATACUBE_BITSET_H
+#define QDATACUBE_BITSET_H
+
+#include "qdatacube_export.h"
+
+#include <QList>
+#include <QVector>
+
+namespace qdatacube {
+
+/**
+ * Dense set of non-negative integers, e.g. elements, stored one bit each.
+ *
+ * Bits at or beyond size() read as unset. Set operations work on whole
+ * 64 bit words, and the result of a union is as large as the larger operand.
+ * A set of the rows of a model with 1M rows takes 128KiB.
+ *
+ * Used for the results of AbstractFilter::evaluate(), which is why it is part of the public API.
+ * Filters producing many bits at a time can fill it a word at a time with setWord().
+ */
+class QDATACUBE_EXPORT Bitset {
+    public:
+        Bitset() : m_size(0) {}
+
+        /**
+         * Construct set able to hold 0..size-1, all unset
+         */
+        explicit Bitset(int size) : m_size(size), m_words(word_count(size), 0) {}
+
+        /**
+         * @return set of the bits in list, large enough to hold them and at least size bits
+         */
+        static Bitset fromList(const QList<int>& bits, int size = 0);
+
+        int size() const {
+            return m_size;
+        }
+
+        /**
+         * @return number of 64 bit words allocated
+         */
+        int capacity() const {
+            return m_words.capacity();
+        }
+
+        /**
+         * Resize to hold 0..size-1. New bits are unset.
+         */
+        void resize(int size);
+
+        bool test(int bit) const {
+            return bit >= 0 && bit < m_size && (m_words.at(bit >> 6) >> (bit & 63)) & 1u;
+        }
+
+        /**
+         * Set bit, growing the set if needed
+         */
+        void set(int bit) {
+            if (bit >= m_size) {
+                resize(bit + 1);
+            }
+            m_words[bit >> 6] |= quint64(1) << (bit & 63);
+        }
+
+        void reset(int bit) {
+            if (bit < m_size) {
+                m_words[bit >> 6] &= ~(quint64(1) << (bit & 63));
+            }
+        }
+
+        /**
+         * Unset all bits, keeping the size
+         */
+        void clear();
+
+        /**
+         * Set all bits 0..size-1
+         */
+        void setAll();
+
+        /**
+         * @return number of 64 bit words holding the bits, bit n is bit n % 64 of word n / 64
+         */
+        int wordCount() const {
+            return m_words.size();
+        }
+
+        quint64 word(int w) const {
+            return m_words.at(w);
+        }
+
+        /**
+         * Replace 64 bits at once. Bits at or beyond size() are dropped.
+         */
+        void setWord(int w, quint64 bits) {
+            if (w == m_words.size() - 1 && (m_size & 63)) {
+                bits &= (quint64(1) << (m_size & 63)) - 1;
+            }
+            m_words[w] = bits;
+        }
+
+        /**
+         * @return number of bits set
+         */
+        int count() const;
+
+        /**
+         * @return true if any bit is set
+         */
+        bool any() const;
+
+        /**
+         * @return the first set bit at or after from, or -1 if there is none
+         */
+        int nextSetBit(int from) const;
+
+        /**
+         * @return the set bits, in increasing order
+         */
+        QList<int> toList() const;
+
+        /**
+         * @return the count bits from position, as bits 0..count-1
+         */
+        Bitset mid(int position, int count) const;
+
+        /**
+         * Union
+         */
+        Bitset& operator|=(const Bitset& other);
+
+        /**
+         * Intersection
+         */
+        Bitset& operator&=(const Bitset& other);
+
+        /**
+         * Remove the bits set in other
+         */
+        Bitset& subtract(const Bitset& other);
+
+        /**
+         * Insert count unset bits at position, moving the bits from position and up
+         */
+        void insert(int position, int count);
+
+        /**
+         * Remove count bits from position, moving the bits above down
+         */
+        void remove(int position, int count);
+
+        bool operator==(const Bitset& other) const;
+        bool operator!=(const Bitset& other) const {
+            return !(*this == other);
+        }
+    private:
+        static int word_count(int size) {
+            return (size + 63) >> 6;
+        }
+        int m_size;
+        QVector<quint64> m_words;
+};
+
+} // end of namespace
+
+#endif // QDATACUBE_BITSET_H
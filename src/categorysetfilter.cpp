@@ -0,0 +1,108 @@
+#include "categorysetfilter.h"
+
+#include "abstractaggregator.h"
+#include "bitset.h"
+
+#include <QSharedPointer>
+
+namespace qdatacube {
+
+class CategorySetFilterPrivate {
+public:
+    CategorySetFilterPrivate(CategorySetFilter* q, AbstractAggregator::Ptr aggregator, const QStringList& labels, bool negated);
+    /**
+     * @return true if the category is in the set, with the negation applied
+     */
+    bool included(int category) const {
+        return m_categories.test(category) != m_negated;
+    }
+    AbstractAggregator::Ptr m_aggregator;
+    QStringList m_labels;
+    Bitset m_categories; // bit per category of the aggregator, set if in the set
+    bool m_negated;
+};
+
+CategorySetFilterPrivate::CategorySetFilterPrivate(CategorySetFilter* q, AbstractAggregator::Ptr aggregator,
+                                                   const QStringList& labels, bool negated)
+  : m_aggregator(aggregator), m_labels(labels), m_categories(aggregator->categoryCount()), m_negated(negated)
+{
+    Q_ASSERT(aggregator);
+    for (int i = 0; i < aggregator->categoryCount(); ++i) {
+        if (m_labels.contains(aggregator->categoryHeaderData(i, Qt::DisplayRole).toString())) {
+            m_categories.set(i);
+        }
+    }
+    QObject::connect(aggregator.data(), &AbstractAggregator::categoryAdded, q, &CategorySetFilter::slot_aggregator_category_inserted);
+    QObject::connect(aggregator.data(), &AbstractAggregator::categoryRemoved, q, &CategorySetFilter::slot_aggregator_category_removed);
+    QObject::connect(aggregator.data(), &AbstractAggregator::rowsRecategorized, q, &AbstractFilter::resultsChanged);
+    const QString short_name = m_labels.isEmpty() ? QString() : m_labels.size() == 1 ? m_labels.first() : m_labels.first() + "+";
+    q->setShortName(negated ? "!" + short_name : short_name);
+    q->setName(m_aggregator->name() + (negated ? " not in " : " in ") + "{" + m_labels.join(", ") + "}");
+}
+
+// Utility function to find the display texts of categories
+static QStringList indexesToCategories(const AbstractAggregator::Ptr aggregator, const QList<int>& categoryIndexes) {
+    QStringList rv;
+    Q_FOREACH(int categoryIndex, categoryIndexes) {
+        Q_ASSERT(0 <= categoryIndex && categoryIndex < aggregator->categoryCount());
+        rv << aggregator->categoryHeaderData(categoryIndex, Qt::DisplayRole).toString();
+    }
+    return rv;
+}
+
+CategorySetFilter::CategorySetFilter(AbstractAggregator::Ptr aggregator, const QList<int>& categoryIndexes, bool negated)
+  : AbstractFilter(aggregator->underlyingModel()),
+    d(new CategorySetFilterPrivate(this, aggregator, indexesToCategories(aggregator, categoryIndexes), negated))
+{
+    // Empty
+}
+
+CategorySetFilter::CategorySetFilter(AbstractAggregator::Ptr aggregator, const QStringList& categoryLabels, bool negated)
+  : AbstractFilter(aggregator->underlyingModel()),
+    d(new CategorySetFilterPrivate(this, aggregator, categoryLabels, negated))
+{
+    // Empty
+}
+
+CategorySetFilter::~CategorySetFilter() {
+    // Empty
+}
+
+bool CategorySetFilter::operator()(int row) const {
+    return d->included(d->m_aggregator->operator()(row));
+}
+
+void CategorySetFilter::evaluate(int start, int count, Bitset& result) const {
+    d->m_aggregator->matchCategories(start, count, d->m_categories, d->m_negated, result);
+}
+
+void CategorySetFilter::slot_aggregator_category_inserted(int index) {
+    d->m_categories.insert(index, 1);
+    if (d->m_labels.contains(d->m_aggregator->categoryHeaderData(index, Qt::DisplayRole).toString())) {
+        d->m_categories.set(index);
+    }
+}
+
+void CategorySetFilter::slot_aggregator_category_removed(int index) {
+    d->m_categories.remove(index, 1);
+}
+
+AbstractAggregator::Ptr CategorySetFilter::aggregator() const {
+    return d->m_aggregator;
+}
+
+QList<int> CategorySetFilter::categoryIndexes() const {
+    return d->m_categories.toList();
+}
+
+QStringList CategorySetFilter::categoryLabels() const {
+    return d->m_labels;
+}
+
+bool CategorySetFilter::isNegated() const {
+    return d->m_negated;
+}
+
+} // namespace qdatacube
+
+#include "categorysetfilter.moc"
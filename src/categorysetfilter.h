@@ -0,0 +1,79 @@
+#ifndef QDATACUBE_CATEGORY_SET_FILTER_H
+#define QDATACUBE_CATEGORY_SET_FILTER_H
+
+#include "abstractaggregator.h"
+#include "abstractfilter.h"
+#include "qdatacube_export.h"
+
+#include <QStringList>
+
+namespace qdatacube {
+class CategorySetFilterPrivate;
+}
+
+namespace qdatacube {
+
+/**
+ * Filter in the rows in any of a set of categories of an aggregator, or, if negated, the rows in
+ * none of them. Replaces an OrFilter over a FilterByAggregate per category: the categories are kept
+ * as a bit per category, so each row costs a single aggregator evaluation and a bit test.
+ *
+ * Like FilterByAggregate, the filter follows categories being added to and removed from the aggregator.
+ * The categories are remembered by their display text, so a category removed and later added again
+ * is part of the set again.
+ */
+class QDATACUBE_EXPORT CategorySetFilter : public AbstractFilter {
+
+    Q_OBJECT
+
+public:
+
+    /**
+     * Creates a filter to filter in the categories with the given indexes in the aggregator, or to filter
+     * them out if negated.
+     */
+    CategorySetFilter(AbstractAggregator::Ptr aggregator, const QList<int>& categoryIndexes, bool negated = false);
+
+    /**
+     * Creates a filter to filter in the categories with the given display texts in the aggregator, or to
+     * filter them out if negated. Texts not (yet) among the aggregator's categories are matched when the
+     * aggregator adds them.
+     */
+    CategorySetFilter(AbstractAggregator::Ptr aggregator, const QStringList& categoryLabels, bool negated = false);
+
+    virtual ~CategorySetFilter();
+
+    // Inherited:
+    virtual bool operator()(int row) const;
+    virtual void evaluate(int start, int count, Bitset& result) const;
+
+    // Getters:
+    AbstractAggregator::Ptr aggregator() const;
+
+    /**
+     * @return indexes of the categories in the set that the aggregator currently has, in increasing order
+     */
+    QList<int> categoryIndexes() const;
+
+    /**
+     * @return display texts of the categories in the set
+     */
+    QStringList categoryLabels() const;
+
+    /**
+     * @return true if the rows in the categories are filtered out rather than in
+     */
+    bool isNegated() const;
+
+private Q_SLOTS:
+    void slot_aggregator_category_inserted(int index);
+    void slot_aggregator_category_removed(int index);
+
+private:
+    QScopedPointer<CategorySetFilterPrivate> d;
+    friend class CategorySetFilterPrivate;
+};
+
+} // namespace qdatacube
+
+#endif // QDATACUBE_CATEGORY_SET_FILTER_H
@@ -0,0 +1,47 @@
+#include "cellsketches_p.h"
+
+namespace qdatacube {
+
+CellSketchesBase::CellSketchesBase() : m_datacube(0L) {
+}
+
+void CellSketchesBase::follow(const Datacube* datacube) {
+  if (datacube == m_datacube) {
+    return;
+  }
+  if (m_datacube) {
+    m_datacube->disconnect(this);
+  }
+  clear();
+  m_datacube = datacube;
+  if (!datacube) {
+    return;
+  }
+  connect(datacube, SIGNAL(destroyed(QObject*)), SLOT(datacube_destroyed()));
+  connect(datacube, SIGNAL(dataChanged(int,int,int,int)), SLOT(forget(int,int,int,int)));
+  connect(datacube, SIGNAL(reset()), SLOT(clear()));
+  connect(datacube, SIGNAL(rowsInserted(int,int)), SLOT(clear()));
+  connect(datacube, SIGNAL(rowsRemoved(int,int)), SLOT(clear()));
+  connect(datacube, SIGNAL(columnsInserted(int,int)), SLOT(clear()));
+  connect(datacube, SIGNAL(columnsRemoved(int,int)), SLOT(clear()));
+  connect(datacube, SIGNAL(headersChanged(Qt::Orientation,int,int)), SLOT(clear()));
+  connect(datacube, SIGNAL(filterChanged()), SLOT(clear()));
+}
+
+void CellSketchesBase::forgetElement(int element) {
+  if (!m_datacube) {
+    return;
+  }
+  const int row = m_datacube->sectionForElement(element, Qt::Vertical);
+  const int column = m_datacube->sectionForElement(element, Qt::Horizontal);
+  if (row >= 0 && column >= 0) {
+    forget(row, column, row, column);
+  }
+}
+
+void CellSketchesBase::datacube_destroyed() {
+  clear();
+  m_datacube = 0L;
+}
+
+}
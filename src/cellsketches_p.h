@@ -0,0 +1,126 @@
+#ifndef QDATACUBE_CELLSKETCHES_P_H
+#define QDATACUBE_CELLSKETCHES_P_H
+
+#include <QObject>
+#include <QCache>
+#include <QList>
+#include "datacube.h"
+
+namespace qdatacube {
+
+/**
+ * Follows a datacube for CellSketches, forgetting the sketches of cells as they change
+ */
+class CellSketchesBase : public QObject {
+    Q_OBJECT
+    public:
+        CellSketchesBase();
+
+        /**
+         * Follow datacube, forgetting all sketches if it is not the datacube followed already
+         */
+        void follow(const Datacube* datacube);
+
+        /**
+         * Forget the sketch of the cell holding element, e.g. because the value measured for it changed
+         */
+        void forgetElement(int element);
+    public Q_SLOTS:
+        /**
+         * Forget the sketches of the cells from top_row, left_column to bottom_row, right_column
+         */
+        virtual void forget(int top_row, int left_column, int bottom_row, int right_column) = 0;
+
+        /**
+         * Forget all sketches
+         */
+        virtual void clear() = 0;
+    private Q_SLOTS:
+        void datacube_destroyed();
+    protected:
+        static qint64 key(int row, int column) {
+            return (qint64(row) << 32) | quint32(column);
+        }
+        const Datacube* m_datacube;
+};
+
+/**
+ * Sketches of the cells of a datacube, built on demand from the elements of each cell and merged for
+ * totals, so a total costs a merge per cell rather than a pass over its elements.
+ *
+ * Cached sketches are bounded in bytes; evicted sketches are built again when needed. A sketch is
+ * forgotten when the datacube reports its cell changed, and all are forgotten on structural changes.
+ */
+template<typename Sketch>
+class CellSketches : public CellSketchesBase {
+    public:
+        explicit CellSketches(int max_bytes = 32*1024*1024) : m_sketches(max_bytes) {}
+
+        /**
+         * Merge the sketches of the cells of datacube from top_row, left_column to bottom_row, right_column
+         * into result
+         */
+        void merge(const Datacube* datacube, int top_row, int left_column, int bottom_row, int right_column, Sketch& result);
+
+        virtual void forget(int top_row, int left_column, int bottom_row, int right_column);
+        virtual void clear() {
+            m_sketches.clear();
+        }
+    protected:
+        /**
+         * @return new sketch of elements
+         */
+        virtual Sketch* build(const QList<int>& elements) const = 0;
+
+        /**
+         * @return bytes used by sketch
+         */
+        virtual int cost(const Sketch& sketch) const = 0;
+    private:
+        QCache<qint64, Sketch> m_sketches;
+};
+
+template<typename Sketch>
+void CellSketches<Sketch>::merge(const Datacube* datacube, int top_row, int left_column, int bottom_row, int right_column, Sketch& result) {
+    follow(datacube);
+    for (int row = top_row; row <= bottom_row; ++row) {
+        for (int column = left_column; column <= right_column; ++column) {
+            if (datacube->elementCount(row, column) == 0) {
+                continue;
+            }
+            const qint64 k = key(row, column);
+            if (const Sketch* sketch = m_sketches.object(k)) {
+                result.merge(*sketch);
+                continue;
+            }
+            Sketch* sketch = build(datacube->elements(row, column));
+            result.merge(*sketch);
+            // Takes ownership, and deletes the sketch right away if it is too big to cache
+            m_sketches.insert(k, sketch, cost(*sketch));
+        }
+    }
+}
+
+template<typename Sketch>
+void CellSketches<Sketch>::forget(int top_row, int left_column, int bottom_row, int right_column) {
+    if (qint64(bottom_row - top_row + 1) * (right_column - left_column + 1) > m_sketches.count()) {
+        // Cheaper to go through the cached sketches
+        Q_FOREACH(qint64 k, m_sketches.keys()) {
+            const int row = int(k >> 32);
+            const int column = int(quint32(k));
+            if (top_row <= row && row <= bottom_row && left_column <= column && column <= right_column) {
+                m_sketches.remove(k);
+            }
+        }
+        return;
+    }
+    for (int row = top_row; row <= bottom_row; ++row) {
+        for (int column = left_column; column <= right_column; ++column) {
+            m_sketches.remove(key(row, column));
+        }
+    }
+}
+
+}
+
+#endif // QDATACUBE_CELLSKETCHES_P_H
@@ -6,6 +6,8 @@
 */
 
 #include "columnaggregator.h"
+#include "memoryusage_p.h"
+#include "tracer_p.h"
 #include <QStringList>
 #include <QAbstractItemModel>
 #include <QSet>
@@ -96,6 +98,29 @@ int ColumnAggregator::operator()(int row) const {
   return rv;
 }
 
+void ColumnAggregator::categorize(int start, int count, int* codes) const {
+  const QAbstractItemModel* model = underlyingModel();
+  Q_ASSERT(model->rowCount() >= start + count);
+  const int section = d->section;
+  const bool trim_right = d->trim_right;
+  const int max_chars = d->max_chars;
+  // Columns often repeat a value over consecutive rows, so remember the last lookup
+  QString last;
+  int last_code = -1;
+  for (int i = 0; i < count; ++i) {
+    QString data = model->data(model->index(start + i, section)).toString();
+    if (trim_right) {
+      data = data.right(max_chars);
+    }
+    if (last_code < 0 || data != last) {
+      last_code = d->cat_map.value(data, 0);
+      Q_ASSERT(d->cat_map.contains(data));
+      last = data;
+    }
+    codes[i] = last_code;
+  }
+}
+
 ColumnAggregator::~ColumnAggregator() {
 
 }
@@ -181,7 +206,20 @@ void ColumnAggregator::remove_rows_from_categories(const QModelIndex& parent, in
   }
 }
 
+MemoryUsage ColumnAggregator::memoryUsage() const {
+  // The keys of cat_map share their data with categories
+  qint64 bytes = memory::list_bytes(d->categories.size()) + memory::hash_bytes(d->cat_map);
+  Q_FOREACH(const QString& category, d->categories) {
+    bytes += memory::string_bytes(category);
+  }
+  MemoryUsage rv;
+  rv.add("aggregator categories", bytes);
+  return rv;
+}
+
 void ColumnAggregator::resetCategories() {
+  QDATACUBE_TRACE("ColumnAggregator::resetCategories");
+  QDATACUBE_TRACE_ARG("rows", underlyingModel()->rowCount());
   QSet<QString> categories;
   for (int i=0, iend = underlyingModel()->rowCount(); i<iend; ++i) {
     QString cat = underlyingModel()->data(underlyingModel()->index(i, d->section)).toString();
@@ -199,6 +237,7 @@ void ColumnAggregator::resetCategories() {
   Q_FOREACH(QString cat, categories) {
     d->add_new_category(cat);
   }
+  QDATACUBE_TRACE_ARG("categories", d->categories.size());
 
 }
 
@@ -41,6 +41,12 @@ class QDATACUBE_EXPORT ColumnAggregator : public AbstractAggregator {
         ColumnAggregator(const QAbstractItemModel* model,  int section);
         ~ColumnAggregator();
         virtual int operator()(int row) const;
+
+        /**
+         * Categorize from the column directly, looking up the model and settings once per call
+         */
+        virtual void categorize(int start, int count, int* codes) const;
+
         /**
          * Return section
          */
@@ -57,6 +63,11 @@ class QDATACUBE_EXPORT ColumnAggregator : public AbstractAggregator {
          *         change for data items except when the item is changing itself.
          **/
         void setTrimNewCategoriesFromRight(int max_chars);
+
+        /**
+         * Reports the category dictionary
+         */
+        virtual MemoryUsage memoryUsage() const;
     public Q_SLOTS:
         /**
          * Recalculate categories. This is also triggered automatically when the number of changed or removed rows
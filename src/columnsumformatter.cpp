@@ -1,7 +1,10 @@
 #include "columnsumformatter.h"
 #include <QAbstractItemModel>
 #include <QEvent>
+#include <QReadWriteLock>
+#include <QVector>
 #include <stdexcept>
+#include <algorithm>
 #include <QWidget>
 #include "datacubeview.h"
 namespace qdatacube {
@@ -14,6 +17,9 @@ class ColumnSumFormatterPrivate {
         const int m_precision;
         QString m_suffix;
         const double m_scale;
+        // The column value for each row in the underlying model. Written from the GUI thread only
+        QVector<double> m_values;
+        mutable QReadWriteLock m_lock;
 };
 
 ColumnSumFormatter::ColumnSumFormatter(QAbstractItemModel* underlying_model, qdatacube::DatacubeView* view, int column, int precision, QString suffix, double scale)
@@ -22,6 +28,11 @@ ColumnSumFormatter::ColumnSumFormatter(QAbstractItemModel* underlying_model, qda
   if (column >= underlying_model->columnCount()|| column<0) {
     throw std::runtime_error(QString("Column %1 must be in the underlying model, ie., be between 0 and %2").arg(column).arg(underlying_model->columnCount()).toStdString());
   }
+  connect(underlying_model, SIGNAL(dataChanged(QModelIndex,QModelIndex)), SLOT(refresh_rows(QModelIndex,QModelIndex)));
+  connect(underlying_model, SIGNAL(rowsInserted(QModelIndex,int,int)), SLOT(insert_rows(QModelIndex,int,int)));
+  connect(underlying_model, SIGNAL(rowsRemoved(QModelIndex,int,int)), SLOT(remove_rows(QModelIndex,int,int)));
+  connect(underlying_model, SIGNAL(modelReset()), SLOT(rebuild()));
+  rebuild();
   update(qdatacube::AbstractFormatter::CellSize);
   setShortName("SUM");
   setName(QString("Sum over %1").arg(underlyingModel()->headerData(d->m_column, Qt::Horizontal).toString()));
@@ -30,18 +41,70 @@ ColumnSumFormatter::ColumnSumFormatter(QAbstractItemModel* underlying_model, qda
 QString ColumnSumFormatter::format(QList< int > rows) const
 {
   double accumulator = 0;
-  Q_FOREACH(int element, rows) {
-    accumulator += underlyingModel()->index(element, d->m_column).data().toDouble();
+  {
+    QReadLocker lock(&d->m_lock);
+    const double* values = d->m_values.constData();
+    const int nvalues = d->m_values.size();
+    Q_FOREACH(int element, rows) {
+      if (element < nvalues) { // rows might be from before a removal when formatting in a worker thread
+        accumulator += values[element];
+      }
+    }
   }
   return QString::number(accumulator*d->m_scale,'f',d->m_precision) + d->m_suffix;
 }
+
+bool ColumnSumFormatter::isThreadSafe() const {
+  return true;
+}
+
+void ColumnSumFormatter::rebuild() {
+  const int nrows = underlyingModel()->rowCount();
+  QVector<double> values(nrows);
+  for (int row = 0; row < nrows; ++row) {
+    values[row] = underlyingModel()->index(row, d->m_column).data().toDouble();
+  }
+  QWriteLocker lock(&d->m_lock);
+  d->m_values.swap(values);
+}
+
+void ColumnSumFormatter::insert_rows(const QModelIndex& parent, int start, int end) {
+  if (parent.isValid()) {
+    return;
+  }
+  QVector<double> values(end - start + 1);
+  for (int row = start; row <= end; ++row) {
+    values[row - start] = underlyingModel()->index(row, d->m_column).data().toDouble();
+  }
+  QWriteLocker lock(&d->m_lock);
+  d->m_values.insert(start, values.size(), 0.0);
+  std::copy(values.constBegin(), values.constEnd(), d->m_values.begin() + start);
+}
+
+void ColumnSumFormatter::remove_rows(const QModelIndex& parent, int start, int end) {
+  if (parent.isValid()) {
+    return;
+  }
+  QWriteLocker lock(&d->m_lock);
+  d->m_values.remove(start, end - start + 1);
+}
+
+void ColumnSumFormatter::refresh_rows(const QModelIndex& top_left, const QModelIndex& bottom_right) {
+  if (top_left.parent().isValid() || top_left.column() > d->m_column || bottom_right.column() < d->m_column) {
+    return;
+  }
+  QWriteLocker lock(&d->m_lock);
+  for (int row = top_left.row(); row <= bottom_right.row() && row < d->m_values.size(); ++row) {
+    d->m_values[row] = underlyingModel()->index(row, d->m_column).data().toDouble();
+  }
+}
 void ColumnSumFormatter::update(AbstractFormatter::UpdateType element) {
     if(element == qdatacube::AbstractFormatter::CellSize) {
         if(datacubeView()) {
             // Set the cell size, by summing up all the data in the model, and using that as input
             double accumulator = 0;
-            for (int element = 0, nelements = underlyingModel()->rowCount(); element < nelements; ++element) {
-                accumulator += underlyingModel()->index(element, d->m_column).data().toDouble();
+            Q_FOREACH(double value, d->m_values) {
+                accumulator += value;
             }
             QString big_cell_contents = QString::number(accumulator*d->m_scale, 'f', d->m_precision) + d->m_suffix;
             setCellSize(QSize(datacubeView()->fontMetrics().width(big_cell_contents), datacubeView()->fontMetrics().lineSpacing()));
@@ -56,3 +119,5 @@ ColumnSumFormatter::~ColumnSumFormatter() {
 
 
 } // end of namespace
+
+#include "columnsumformatter.moc"
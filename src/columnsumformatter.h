@@ -3,13 +3,20 @@
 
 #include "abstractformatter.h"
 #include "qdatacube_export.h"
+
+class QModelIndex;
+
 namespace qdatacube {
 
 /**
   * Simple demonstration formatter that takes a column and uses the sum of that for display
+  *
+  * The column is converted to double once per row and kept up to date with the underlying model,
+  * so format() does not access the model and is thread safe.
   */
 class ColumnSumFormatterPrivate;
 class QDATACUBE_EXPORT ColumnSumFormatter : public AbstractFormatter {
+    Q_OBJECT
     public:
         /**
          * @param underlying_model the underlying_model
@@ -20,9 +27,15 @@ class QDATACUBE_EXPORT ColumnSumFormatter : public AbstractFormatter {
          */
         ColumnSumFormatter(QAbstractItemModel* underlying_model, qdatacube::DatacubeView* view, int column, int precision, QString suffix, double scale = 1.0 );
         virtual QString format(QList< int > rows) const;
+        virtual bool isThreadSafe() const;
         virtual ~ColumnSumFormatter();
     protected:
         virtual void update(UpdateType element);
+    private Q_SLOTS:
+        void refresh_rows(const QModelIndex& top_left, const QModelIndex& bottom_right);
+        void insert_rows(const QModelIndex& parent, int start, int end);
+        void remove_rows(const QModelIndex& parent, int start, int end);
+        void rebuild();
     private:
         QScopedPointer<ColumnSumFormatterPrivate> d;
 };
@@ -18,6 +18,10 @@ QString CountFormatter::format(QList< int > rows) const {
   return QString::number(rows.size()*m_multiplier);
 }
 
+bool CountFormatter::isThreadSafe() const {
+  return true;
+}
+
 void CountFormatter::update(AbstractFormatter::UpdateType updateType) {
     if(updateType == qdatacube::AbstractFormatter::CellSize) {
         if(datacubeView()) {
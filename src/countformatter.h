@@ -18,6 +18,11 @@ class QDATACUBE_EXPORT CountFormatter : public AbstractFormatter {
          */
         CountFormatter(QAbstractItemModel* underlyingModel, qdatacube::DatacubeView* view = 0L, const double multiplier = 1.0);
         virtual QString format(QList< int > rows) const;
+
+        /**
+         * Counting only uses the row list, so this returns true
+         */
+        virtual bool isThreadSafe() const;
     protected:
         virtual void update(qdatacube::AbstractFormatter::UpdateType updateType);
     private:
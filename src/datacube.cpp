@@ -25,6 +25,7 @@
 
 #include <QVector>
 #include <algorithm>
+#include <limits>
 
 #include <QAbstractItemModel>
 #include "cell.h"
@@ -32,13 +33,99 @@
 #include "datacubeselection_p.h"
 
 #include "datacube_p.h"
+#include "datacubesnapshot.h"
+#include "datacubesnapshot_p.h"
+#include "memoryusage_p.h"
+#include "tracer_p.h"
 
+#include <QMutex>
+#include <QSet>
 #include <QSharedPointer>
+#include <QStringList>
+#include <QSysInfo>
+
+namespace {
+
+const quint32 save_magic = 0x51444342; // "QDCB"
+const quint32 save_version = 1;
+
+/**
+ * @return the display text of every category of every aggregator, which identifies how elements are bucketed
+ */
+QList<QStringList> category_labels(const qdatacube::Datacube::Aggregators& aggregators) {
+  QList<QStringList> rv;
+  Q_FOREACH(qdatacube::AbstractAggregator::Ptr aggregator, aggregators) {
+    QStringList labels;
+    for (int category = 0, ncategories = aggregator->categoryCount(); category < ncategories; ++category) {
+      labels << aggregator->categoryHeaderData(category).toString();
+    }
+    rv << labels;
+  }
+  return rv;
+}
+
+QStringList filter_names(const qdatacube::Datacube::Filters& filters) {
+  QStringList rv;
+  Q_FOREACH(qdatacube::AbstractFilter::Ptr filter, filters) {
+    rv << filter->name();
+  }
+  return rv;
+}
+
+/**
+ * @return number of buckets for aggregators, that is, the product of their category counts
+ */
+int bucket_count(const qdatacube::Datacube::Aggregators& aggregators) {
+  int rv = 1;
+  Q_FOREACH(qdatacube::AbstractAggregator::Ptr aggregator, aggregators) {
+    rv *= aggregator->categoryCount();
+  }
+  return rv;
+}
+
+void write_counts(QDataStream& stream, const QVector<unsigned>& counts) {
+  stream << quint32(counts.size());
+  stream.writeRawData(reinterpret_cast<const char*>(counts.constData()), counts.size() * sizeof(unsigned));
+}
+
+/**
+ * @return true if count values of size bytes each can be read with a single readRawData()
+ */
+bool fits_raw_read(quint64 count, size_t size) {
+  return count <= quint64(std::numeric_limits<int>::max()) / size;
+}
+
+/**
+ * Read counts written by write_counts, expecting size counts
+ */
+bool read_counts(QDataStream& stream, int size, QVector<unsigned>& counts) {
+  quint32 saved_size;
+  stream >> saved_size;
+  if (stream.status() != QDataStream::Ok || saved_size != quint32(size) || !fits_raw_read(saved_size, sizeof(unsigned))) {
+    return false;
+  }
+  counts.resize(size);
+  const int nbytes = size * sizeof(unsigned);
+  return stream.readRawData(reinterpret_cast<char*>(counts.data()), nbytes) == nbytes;
+}
+
+/**
+ * The existing datacubes, for Datacube::totalMemoryUsage()
+ */
+struct LiveDatacubes {
+    QMutex mutex;
+    QSet<const qdatacube::DatacubePrivate*> datacubes;
+};
+
+Q_GLOBAL_STATIC(LiveDatacubes, live_datacubes)
+
+}
 
 namespace qdatacube {
 
 int DatacubePrivate::computeBucketForIndex(Qt::Orientation orientation, int index) {
   qdatacube::Datacube::Aggregators& aggregators = orientation == Qt::Horizontal ? col_aggregators : row_aggregators;
+  QDATACUBE_COUNT(this, AggregatorEvaluations, aggregators.size());
   int stride = 1;
   int rv = 0;
   for (int aggregator_index = aggregators.size()-1; aggregator_index>=0; --aggregator_index) {
@@ -51,28 +138,50 @@ int DatacubePrivate::computeBucketForIndex(Qt::Orientation orientation, int inde
 }
 
 int DatacubePrivate::bucket_for_row(const int row) const {
+  QDATACUBE_COUNT(this, BucketMappings, 1);
   int r = row;
-  for (int bucket = 0; bucket < row_counts.size(); ++bucket) {
-    if (row_counts[bucket] > 0) {
+  if (sorted(Qt::Vertical)) {
+    const QVector<unsigned>& counts = section_counts(Qt::Vertical);
+    for (int position = 0; position < counts.size(); ++position) {
+      if (counts[position] > 0 && r-- == 0) {
+        return position_bucket(Qt::Vertical, position);
+      }
+    }
+    r = -1; // Not found, so not found below either
+  }
+  const QVector<unsigned>& counts = shown_counts(Qt::Vertical);
+  for (int bucket = 0; bucket < counts.size(); ++bucket) {
+    if (counts[bucket] > 0) {
       if (r-- == 0) {
         return bucket;
       }
     }
   }
-  Q_ASSERT_X(false, "QDatacube", QString("Row %1 too big for qdatacube with %2 rows").arg(row).arg(row_counts.size() - std::count(row_counts.begin(), row_counts.end(), 0u)).toLocal8Bit().data());
+  Q_ASSERT_X(false, "QDatacube", QString("Row %1 too big for qdatacube with %2 rows").arg(row).arg(counts.size() - std::count(counts.begin(), counts.end(), 0u)).toLocal8Bit().data());
   return -1;
 }
 
 int DatacubePrivate::bucket_for_column(int column) const {
+  QDATACUBE_COUNT(this, BucketMappings, 1);
   int c = column;
-  for (int bucket = 0; bucket < col_counts.size(); ++bucket) {
-    if (col_counts[bucket] > 0) {
+  if (sorted(Qt::Horizontal)) {
+    const QVector<unsigned>& counts = section_counts(Qt::Horizontal);
+    for (int position = 0; position < counts.size(); ++position) {
+      if (counts[position] > 0 && c-- == 0) {
+        return position_bucket(Qt::Horizontal, position);
+      }
+    }
+    c = -1; // Not found, so not found below either
+  }
+  const QVector<unsigned>& counts = shown_counts(Qt::Horizontal);
+  for (int bucket = 0; bucket < counts.size(); ++bucket) {
+    if (counts[bucket] > 0) {
       if (c-- == 0) {
         return bucket;
       }
     }
   }
-  Q_ASSERT_X(false, "qdatacube", QString("Column %1 too big for qdatacube with %2 columns").arg(column).arg(col_counts.size() - std::count(col_counts.begin(), col_counts.end(), 0u)).toLocal8Bit().data());
+  Q_ASSERT_X(false, "qdatacube", QString("Column %1 too big for qdatacube with %2 columns").arg(column).arg(counts.size() - std::count(counts.begin(), counts.end(), 0u)).toLocal8Bit().data());
   return -1;
 }
 
@@ -116,6 +225,12 @@ int DatacubePrivate::hasCell(long int bucket_row, long bucket_column) const {
     return it != cells.constEnd();
 }
 
+int DatacubePrivate::cell_count(long int bucket_row, long bucket_column) const {
+    const long i = bucket_row + bucket_column*row_counts.size();
+    cells_t::const_iterator it = cells.constFind(i);
+    return it != cells.constEnd() ? it.value().size() : 0;
+}
+
 void DatacubePrivate::setCell(long int bucket_row, long bucket_column, const QList< int >& cell_content) {
     setCell(CellPoint(bucket_row, bucket_column), cell_content);
 }
@@ -139,9 +254,16 @@ void DatacubePrivate::setCell(CellPoint point, const QList< int >& cell_content)
 
 
 int DatacubePrivate::bucket_to_column(int bucket_column) const {
+  QDATACUBE_COUNT(this, BucketMappings, 1);
+  if (sorted(Qt::Horizontal)) {
+    const QVector<unsigned>& counts = section_counts(Qt::Horizontal);
+    const int position = bucket_position(Qt::Horizontal, bucket_column);
+    return position - std::count(counts.constBegin(), counts.constBegin() + position, 0u);
+  }
+  const QVector<unsigned>& counts = shown_counts(Qt::Horizontal);
   int rv = 0;
   for (int i=0; i<bucket_column; ++i) {
-    if (col_counts[i]>0) {
+    if (counts[i]>0) {
       ++rv;
     }
   }
@@ -150,33 +272,497 @@ int DatacubePrivate::bucket_to_column(int bucket_column) const {
 }
 
 int DatacubePrivate::bucket_to_row(int bucket_row) const {
+  QDATACUBE_COUNT(this, BucketMappings, 1);
+  if (sorted(Qt::Vertical)) {
+    const QVector<unsigned>& counts = section_counts(Qt::Vertical);
+    const int position = bucket_position(Qt::Vertical, bucket_row);
+    return position - std::count(counts.constBegin(), counts.constBegin() + position, 0u);
+  }
+  const QVector<unsigned>& counts = shown_counts(Qt::Vertical);
   int rv = 0;
   for (int i=0; i<bucket_row; ++i) {
-    if (row_counts[i]>0) {
+    if (counts[i]>0) {
       ++rv;
     }
   }
   return rv;
 
 }
+
+bool DatacubePrivate::HeaderOrder::before(int lhs, int rhs) const {
+  const double l = measures.at(lhs);
+  const double r = measures.at(rhs);
+  if (l != r) {
+    return order == Qt::AscendingOrder ? l < r : l > r;
+  }
+  return lhs < rhs;
+}
+
+bool DatacubePrivate::HeaderOrder::reposition(int category) {
+  int position = positions.at(category);
+  const int start = position;
+  while (position > 0 && before(category, categories.at(position - 1))) {
+    categories[position] = categories.at(position - 1);
+    positions[categories.at(position)] = position;
+    --position;
+  }
+  while (position < categories.size() - 1 && before(categories.at(position + 1), category)) {
+    categories[position] = categories.at(position + 1);
+    positions[categories.at(position)] = position;
+    ++position;
+  }
+  categories[position] = category;
+  positions[category] = position;
+  return position != start;
+}
+
+namespace {
+/**
+ * Orders categories as a HeaderOrder
+ */
+struct HeaderOrderLess {
+  explicit HeaderOrderLess(const DatacubePrivate::HeaderOrder& header_order) : header_order(header_order) {}
+  bool operator()(int lhs, int rhs) const {
+    return header_order.before(lhs, rhs);
+  }
+  const DatacubePrivate::HeaderOrder& header_order;
+};
+}
+
+bool DatacubePrivate::sorted(Qt::Orientation orientation) const {
+  const header_orders_t& orders = orientation == Qt::Horizontal ? col_orders : row_orders;
+  Q_FOREACH(const HeaderOrder& header_order, orders) {
+    if (header_order.sorted) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool DatacubePrivate::filtering(Qt::Orientation orientation) const {
+  const header_filters_t& header_filters = orientation == Qt::Horizontal ? col_header_filters : row_header_filters;
+  Q_FOREACH(const HeaderFilter& header_filter, header_filters) {
+    if (header_filter.active) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool DatacubePrivate::bucket_hidden(Qt::Orientation orientation, int bucket) const {
+  const Datacube::Aggregators& aggregators = orientation == Qt::Horizontal ? col_aggregators : row_aggregators;
+  const header_filters_t& header_filters = orientation == Qt::Horizontal ? col_header_filters : row_header_filters;
+  int group = bucket;
+  for (int headerno = header_filters.size() - 1; headerno >= 0; --headerno) {
+    const HeaderFilter& header_filter = header_filters.at(headerno);
+    if (header_filter.active && header_filter.hidden.test(group)) {
+      return true;
+    }
+    group /= aggregators.at(headerno)->categoryCount();
+  }
+  return false;
+}
+
+int DatacubePrivate::bucket_position(Qt::Orientation orientation, int bucket) const {
+  if (!sorted(orientation)) {
+    return bucket;
+  }
+  const Datacube::Aggregators& aggregators = orientation == Qt::Horizontal ? col_aggregators : row_aggregators;
+  const header_orders_t& orders = orientation == Qt::Horizontal ? col_orders : row_orders;
+  int rv = 0;
+  int stride = 1;
+  for (int headerno = aggregators.size() - 1; headerno >= 0; --headerno) {
+    const int ncats = aggregators.at(headerno)->categoryCount();
+    const int category = bucket % ncats;
+    bucket /= ncats;
+    rv += stride * (orders.at(headerno).sorted ? orders.at(headerno).positions.at(category) : category);
+    stride *= ncats;
+  }
+  return rv;
+}
+
+int DatacubePrivate::position_bucket(Qt::Orientation orientation, int position) const {
+  if (!sorted(orientation)) {
+    return position;
+  }
+  const Datacube::Aggregators& aggregators = orientation == Qt::Horizontal ? col_aggregators : row_aggregators;
+  const header_orders_t& orders = orientation == Qt::Horizontal ? col_orders : row_orders;
+  int rv = 0;
+  int stride = 1;
+  for (int headerno = aggregators.size() - 1; headerno >= 0; --headerno) {
+    const int ncats = aggregators.at(headerno)->categoryCount();
+    const int digit = position % ncats;
+    position /= ncats;
+    rv += stride * (orders.at(headerno).sorted ? orders.at(headerno).categories.at(digit) : digit);
+    stride *= ncats;
+  }
+  return rv;
+}
+
+const QVector<unsigned>& DatacubePrivate::section_counts(Qt::Orientation orientation) const {
+  const QVector<unsigned>& counts = shown_counts(orientation);
+  if (!sorted(orientation)) {
+    return counts;
+  }
+  QVector<unsigned>& rv = orientation == Qt::Horizontal ? col_section_counts : row_section_counts;
+  if (rv.size() != counts.size()) {
+    rv = QVector<unsigned>(counts.size());
+    for (int bucket = 0, nbuckets = counts.size(); bucket < nbuckets; ++bucket) {
+      rv[bucket_position(orientation, bucket)] = counts.at(bucket);
+    }
+  }
+  return rv;
+}
+
+void DatacubePrivate::sort_headers(Qt::Orientation orientation) {
+  const Datacube::Aggregators& aggregators = orientation == Qt::Horizontal ? col_aggregators : row_aggregators;
+  header_orders_t& orders = orientation == Qt::Horizontal ? col_orders : row_orders;
+  forget_section_counts(orientation);
+  for (int headerno = 0; headerno < orders.size(); ++headerno) {
+    HeaderOrder& header_order = orders[headerno];
+    header_order.measures = QVector<double>(header_order.sorted ? aggregators.at(headerno)->categoryCount() : 0);
+    header_order.values = QVector<double>(header_order.sorted && header_order.section >= 0 ? model->rowCount() : 0);
+  }
+  if (!sorted(orientation)) {
+    return;
+  }
+  for (reverse_index_t::const_iterator it = reverse_index.constBegin(), iend = reverse_index.constEnd(); it != iend; ++it) {
+    const int element = it.key();
+    int bucket = orientation == Qt::Horizontal ? it.value().column() : it.value().row();
+    for (int headerno = aggregators.size() - 1; headerno >= 0; --headerno) {
+      const int ncats = aggregators.at(headerno)->categoryCount();
+      const int category = bucket % ncats;
+      bucket /= ncats;
+      HeaderOrder& header_order = orders[headerno];
+      if (!header_order.sorted) {
+        continue;
+      }
+      if (header_order.section >= 0) {
+        header_order.values[element] = model->data(model->index(element, header_order.section), header_order.role).toDouble();
+        header_order.measures[category] += header_order.values.at(element);
+      } else {
+        header_order.measures[category] += 1.0;
+      }
+    }
+  }
+  for (int headerno = 0; headerno < orders.size(); ++headerno) {
+    HeaderOrder& header_order = orders[headerno];
+    const int ncats = header_order.measures.size();
+    header_order.categories.resize(ncats);
+    header_order.positions.resize(ncats);
+    for (int category = 0; category < ncats; ++category) {
+      header_order.categories[category] = category;
+    }
+    std::sort(header_order.categories.begin(), header_order.categories.end(), HeaderOrderLess(header_order));
+    for (int position = 0; position < ncats; ++position) {
+      header_order.positions[header_order.categories.at(position)] = position;
+    }
+  }
+}
+
+bool DatacubePrivate::update_header_orders(int element, const Cell& cell, int sign) {
+  bool rv = false;
+  for (int horizontal = 0; horizontal < 2; ++horizontal) {
+    const Qt::Orientation orientation = horizontal ? Qt::Horizontal : Qt::Vertical;
+    if (!sorted(orientation)) {
+      continue;
+    }
+    const Datacube::Aggregators& aggregators = horizontal ? col_aggregators : row_aggregators;
+    header_orders_t& orders = horizontal ? col_orders : row_orders;
+    int bucket = horizontal ? cell.column() : cell.row();
+    for (int headerno = aggregators.size() - 1; headerno >= 0; --headerno) {
+      const int ncats = aggregators.at(headerno)->categoryCount();
+      const int category = bucket % ncats;
+      bucket /= ncats;
+      HeaderOrder& header_order = orders[headerno];
+      if (!header_order.sorted) {
+        continue;
+      }
+      if (header_order.section >= 0) {
+        if (sign > 0) {
+          header_order.values[element] = model->data(model->index(element, header_order.section), header_order.role).toDouble();
+        }
+        header_order.measures[category] += sign * header_order.values.at(element);
+      } else {
+        header_order.measures[category] += sign;
+      }
+      if (header_order.reposition(category)) {
+        forget_section_counts(orientation);
+        rv = true;
+      }
+    }
+  }
+  return rv;
+}
+
+bool DatacubePrivate::refresh_header_values(int element, const Cell& cell, int first_column, int last_column) {
+  bool rv = false;
+  for (int horizontal = 0; horizontal < 2; ++horizontal) {
+    const Qt::Orientation orientation = horizontal ? Qt::Horizontal : Qt::Vertical;
+    if (!sorted(orientation)) {
+      continue;
+    }
+    const Datacube::Aggregators& aggregators = horizontal ? col_aggregators : row_aggregators;
+    header_orders_t& orders = horizontal ? col_orders : row_orders;
+    int bucket = horizontal ? cell.column() : cell.row();
+    for (int headerno = aggregators.size() - 1; headerno >= 0; --headerno) {
+      const int ncats = aggregators.at(headerno)->categoryCount();
+      const int category = bucket % ncats;
+      bucket /= ncats;
+      HeaderOrder& header_order = orders[headerno];
+      if (!header_order.sorted || header_order.section < first_column || header_order.section > last_column) {
+        continue;
+      }
+      const double value = model->data(model->index(element, header_order.section), header_order.role).toDouble();
+      header_order.measures[category] += value - header_order.values.at(element);
+      header_order.values[element] = value;
+      if (header_order.reposition(category)) {
+        forget_section_counts(orientation);
+        rv = true;
+      }
+    }
+  }
+  return rv;
+}
+
+bool DatacubePrivate::HeaderFilter::before(int lhs, int rhs) const {
+  const double l = measures.at(lhs);
+  const double r = measures.at(rhs);
+  if (l != r) {
+    return order == Qt::AscendingOrder ? l < r : l > r;
+  }
+  return lhs < rhs;
+}
+
+namespace {
+/**
+ * Orders groups as a HeaderFilter picks its top groups
+ */
+struct HeaderFilterLess {
+  explicit HeaderFilterLess(const DatacubePrivate::HeaderFilter& header_filter) : header_filter(header_filter) {}
+  bool operator()(int lhs, int rhs) const {
+    return header_filter.before(lhs, rhs);
+  }
+  const DatacubePrivate::HeaderFilter& header_filter;
+};
+}
+
+void DatacubePrivate::measure_header_filters(Qt::Orientation orientation) {
+  const Datacube::Aggregators& aggregators = orientation == Qt::Horizontal ? col_aggregators : row_aggregators;
+  header_filters_t& header_filters = orientation == Qt::Horizontal ? col_header_filters : row_header_filters;
+  int ngroups = 1;
+  for (int headerno = 0; headerno < header_filters.size(); ++headerno) {
+    ngroups *= aggregators.at(headerno)->categoryCount();
+    HeaderFilter& header_filter = header_filters[headerno];
+    header_filter.measures = QVector<double>(header_filter.active ? ngroups : 0);
+    header_filter.values = QVector<double>(header_filter.active && header_filter.section >= 0 ? model->rowCount() : 0);
+  }
+  header_filters_dirty = true;
+  if (!filtering(orientation)) {
+    return;
+  }
+  for (reverse_index_t::const_iterator it = reverse_index.constBegin(), iend = reverse_index.constEnd(); it != iend; ++it) {
+    measure_element(orientation, it.key(), orientation == Qt::Horizontal ? it.value().column() : it.value().row(), 1);
+  }
+}
+
+void DatacubePrivate::measure_element(Qt::Orientation orientation, int element, int bucket, int sign) {
+  if (!filtering(orientation)) {
+    return;
+  }
+  const Datacube::Aggregators& aggregators = orientation == Qt::Horizontal ? col_aggregators : row_aggregators;
+  header_filters_t& header_filters = orientation == Qt::Horizontal ? col_header_filters : row_header_filters;
+  int group = bucket;
+  for (int headerno = header_filters.size() - 1; headerno >= 0; --headerno) {
+    HeaderFilter& header_filter = header_filters[headerno];
+    if (header_filter.active) {
+      if (header_filter.section >= 0) {
+        if (sign > 0) {
+          header_filter.values[element] = model->data(model->index(element, header_filter.section), header_filter.role).toDouble();
+        }
+        header_filter.measures[group] += sign * header_filter.values.at(element);
+      } else {
+        header_filter.measures[group] += sign;
+      }
+      header_filters_dirty = true;
+    }
+    group /= aggregators.at(headerno)->categoryCount();
+  }
+}
+
+void DatacubePrivate::refresh_header_filter_values(int element, const Cell& cell, int first_column, int last_column) {
+  for (int horizontal = 0; horizontal < 2; ++horizontal) {
+    if (!filtering(horizontal ? Qt::Horizontal : Qt::Vertical)) {
+      continue;
+    }
+    const Datacube::Aggregators& aggregators = horizontal ? col_aggregators : row_aggregators;
+    header_filters_t& header_filters = horizontal ? col_header_filters : row_header_filters;
+    int group = horizontal ? cell.column() : cell.row();
+    for (int headerno = header_filters.size() - 1; headerno >= 0; --headerno) {
+      HeaderFilter& header_filter = header_filters[headerno];
+      if (header_filter.active && header_filter.section >= first_column && header_filter.section <= last_column) {
+        const double value = model->data(model->index(element, header_filter.section), header_filter.role).toDouble();
+        if (value != header_filter.values.at(element)) {
+          header_filter.measures[group] += value - header_filter.values.at(element);
+          header_filter.values[element] = value;
+          header_filters_dirty = true;
+        }
+      }
+      group /= aggregators.at(headerno)->categoryCount();
+    }
+  }
+}
+
+QVector<Bitset> DatacubePrivate::hidden_groups(Qt::Orientation orientation) const {
+  const Datacube::Aggregators& aggregators = orientation == Qt::Horizontal ? col_aggregators : row_aggregators;
+  const header_filters_t& header_filters = orientation == Qt::Horizontal ? col_header_filters : row_header_filters;
+  const QVector<unsigned>& counts = orientation == Qt::Horizontal ? col_counts : row_counts;
+  QVector<Bitset> rv(header_filters.size());
+  QVector<int> candidates;
+  int ngroups = 1;
+  for (int headerno = 0; headerno < header_filters.size(); ++headerno) {
+    const int ncats = aggregators.at(headerno)->categoryCount();
+    ngroups *= ncats;
+    const HeaderFilter& header_filter = header_filters.at(headerno);
+    if (!header_filter.active || ngroups == 0) {
+      continue;
+    }
+    // A group without elements has no sections to show, so it does not take a place in the top either
+    const int stride = counts.size() / ngroups;
+    QVector<unsigned> sizes(ngroups);
+    for (int bucket = 0; bucket < counts.size(); ++bucket) {
+      sizes[bucket / stride] += counts.at(bucket);
+    }
+    Bitset& hidden = rv[headerno];
+    hidden = Bitset(ngroups);
+    for (int first = 0; first < ngroups; first += ncats) {
+      candidates.clear();
+      for (int group = first; group < first + ncats; ++group) {
+        const double measure = header_filter.measures.at(group);
+        if (sizes.at(group) > 0 && measure >= header_filter.minimum && measure <= header_filter.maximum) {
+          candidates << group;
+        } else {
+          hidden.set(group);
+        }
+      }
+      if (header_filter.top_count > 0 && candidates.size() > header_filter.top_count) {
+        std::sort(candidates.begin(), candidates.end(), HeaderFilterLess(header_filter));
+        for (int i = header_filter.top_count; i < candidates.size(); ++i) {
+          hidden.set(candidates.at(i));
+        }
+      }
+    }
+  }
+  return rv;
+}
+
+void DatacubePrivate::hide_sections(bool resetting) {
+  header_filters_dirty = false;
+  const QVector<Bitset> row_hidden = hidden_groups(Qt::Vertical);
+  const QVector<Bitset> col_hidden = hidden_groups(Qt::Horizontal);
+  if (!resetting) {
+    bool changed = false;
+    for (int headerno = 0; headerno < row_hidden.size(); ++headerno) {
+      changed = changed || row_hidden.at(headerno) != row_header_filters.at(headerno).hidden;
+    }
+    for (int headerno = 0; headerno < col_hidden.size(); ++headerno) {
+      changed = changed || col_hidden.at(headerno) != col_header_filters.at(headerno).hidden;
+    }
+    if (!changed) {
+      return;
+    }
+    header_reordered();
+  }
+  for (int headerno = 0; headerno < row_hidden.size(); ++headerno) {
+    row_header_filters[headerno].hidden = row_hidden.at(headerno);
+  }
+  for (int headerno = 0; headerno < col_hidden.size(); ++headerno) {
+    col_header_filters[headerno].hidden = col_hidden.at(headerno);
+  }
+  count_shown();
+  forget_section_counts(Qt::Vertical);
+  forget_section_counts(Qt::Horizontal);
+  bump_generation();
+}
+
+void DatacubePrivate::count_shown() {
+  row_shown_counts.clear();
+  col_shown_counts.clear();
+  if (!hiding()) {
+    return;
+  }
+  row_shown_counts = QVector<unsigned>(row_counts.size());
+  col_shown_counts = QVector<unsigned>(col_counts.size());
+  const long nrows = row_counts.size();
+  for (cells_t::const_iterator it = cells.constBegin(), iend = cells.constEnd(); it != iend; ++it) {
+    const int bucket_row = it.key() % nrows;
+    const int bucket_column = it.key() / nrows;
+    if (cell_shown(bucket_row, bucket_column)) {
+      row_shown_counts[bucket_row] += it.value().size();
+      col_shown_counts[bucket_column] += it.value().size();
+    }
+  }
+}
+
+void DatacubePrivate::header_reordered() {
+  if (!reorder_pending && !signals_blocked) {
+    reorder_pending = true;
+    signals_blocked = true;
+    emit q->aboutToBeReset();
+  }
+}
+
+void DatacubePrivate::end_batch() {
+  if (header_filters_dirty) {
+    hide_sections(false);
+  }
+  if (reorder_pending) {
+    reorder_pending = false;
+    signals_blocked = false;
+    emit q->reset();
+    QDATACUBE_COUNT(this, SignalEmissions, 2);
+  }
+}
+
 DatacubePrivate::DatacubePrivate(Datacube* datacube, const QAbstractItemModel* model) :
                                q(datacube),
-                               model(model)
+                               model(model),
+                               signals_blocked(false),
+                               reorder_pending(false),
+                               generation(0),
+                               header_filters_dirty(false)
 {
   col_counts = QVector<unsigned>(1);
   row_counts = QVector<unsigned>(1);
+  QMutexLocker lock(&live_datacubes()->mutex);
+  live_datacubes()->datacubes << this;
 }
 
 DatacubePrivate::DatacubePrivate(Datacube* datacube, const QAbstractItemModel* model,
                                AbstractAggregator::Ptr row_aggregator,
                                AbstractAggregator::Ptr column_aggregator) :
     q(datacube),
-    model(model)
+    model(model),
+    signals_blocked(false),
+    reorder_pending(false),
+    generation(0),
+    header_filters_dirty(false)
 {
   col_aggregators << column_aggregator;
   row_aggregators << row_aggregator;
+  col_orders << HeaderOrder();
+  row_orders << HeaderOrder();
+  col_header_filters << HeaderFilter();
+  row_header_filters << HeaderFilter();
   col_counts = QVector<unsigned>(column_aggregator->categoryCount());
   row_counts = QVector<unsigned>(row_aggregator->categoryCount());
+  QMutexLocker lock(&live_datacubes()->mutex);
+  live_datacubes()->datacubes << this;
+}
+
+DatacubePrivate::~DatacubePrivate() {
+  QMutexLocker lock(&live_datacubes()->mutex);
+  live_datacubes()->datacubes.remove(this);
 }
 
 Datacube::Datacube(const QAbstractItemModel* model,
@@ -186,6 +772,7 @@ Datacube::Datacube(const QAbstractItemModel* model,
     QObject(parent),
     d(new DatacubePrivate(this, model, row_aggregator, column_aggregator))
 {
+  QDATACUBE_TRACE("Datacube::Datacube");
   connect(model, SIGNAL(dataChanged(QModelIndex,QModelIndex)), d.data(), SLOT(update_data(QModelIndex,QModelIndex)));
   connect(model, SIGNAL(rowsAboutToBeRemoved(QModelIndex,int,int)), d.data(), SLOT(remove_data(QModelIndex,int,int)));
   connect(model, SIGNAL(rowsInserted(QModelIndex,int,int)), d.data(), SLOT(insert_data(QModelIndex,int,int)));
@@ -193,9 +780,15 @@ Datacube::Datacube(const QAbstractItemModel* model,
   connect(row_aggregator.data(), SIGNAL(categoryAdded(int)), d.data(), SLOT(slot_aggregator_category_added(int)));
   connect(column_aggregator.data(), SIGNAL(categoryRemoved(int)), d.data(), SLOT(slot_aggregator_category_removed(int)));
   connect(row_aggregator.data(), SIGNAL(categoryRemoved(int)), d.data(), SLOT(slot_aggregator_category_removed(int)));;
+  connect(column_aggregator.data(), SIGNAL(rowsRecategorized(qdatacube::Bitset)), d.data(), SLOT(slot_aggregator_rows_recategorized(qdatacube::Bitset)));
+  connect(row_aggregator.data(), SIGNAL(rowsRecategorized(qdatacube::Bitset)), d.data(), SLOT(slot_aggregator_rows_recategorized(qdatacube::Bitset)));
+  connect(column_aggregator.data(), SIGNAL(headerDataChanged(int,int)), d.data(), SLOT(slot_aggregator_header_data_changed()));
+  connect(row_aggregator.data(), SIGNAL(headerDataChanged(int,int)), d.data(), SLOT(slot_aggregator_header_data_changed()));
   for (int element = 0, nelements = model->rowCount(); element < nelements; ++element) {
     d->add(element);
   }
+  QDATACUBE_TRACE_ARG("elements", d->reverse_index.size());
+  QDATACUBE_TRACE_ARG("cells", d->cells.size());
 #ifdef ANGE_QDATACUBE_CHECK_PRE_POST_CONDITIONS
   check();
 #endif
@@ -206,33 +799,87 @@ Datacube::Datacube(const QAbstractItemModel* model, QObject* parent)
   : QObject(parent),
     d(new DatacubePrivate(this, model))
 {
+  QDATACUBE_TRACE("Datacube::Datacube");
   connect(model, SIGNAL(dataChanged(QModelIndex,QModelIndex)), d.data(), SLOT(update_data(QModelIndex,QModelIndex)));
   connect(model, SIGNAL(rowsAboutToBeRemoved(QModelIndex,int,int)), d.data(), SLOT(remove_data(QModelIndex,int,int)));
   connect(model, SIGNAL(rowsInserted(QModelIndex,int,int)), d.data(), SLOT(insert_data(QModelIndex,int,int)));
   for (int element = 0, nelements = model->rowCount(); element < nelements; ++element) {
     d->add(element);
   }
+  QDATACUBE_TRACE_ARG("elements", d->reverse_index.size());
+  QDATACUBE_TRACE_ARG("cells", d->cells.size());
 #ifdef ANGE_QDATACUBE_CHECK_PRE_POST_CONDITIONS
   check();
 #endif
 }
 
+Datacube::Datacube(const QAbstractItemModel* model,
+                   const Aggregators& row_aggregators,
+                   const Aggregators& column_aggregators,
+                   const Filters& filters,
+                   QObject* parent)
+  : QObject(parent),
+    d(new DatacubePrivate(this, model))
+{
+  connect(model, SIGNAL(dataChanged(QModelIndex,QModelIndex)), d.data(), SLOT(update_data(QModelIndex,QModelIndex)));
+  connect(model, SIGNAL(rowsAboutToBeRemoved(QModelIndex,int,int)), d.data(), SLOT(remove_data(QModelIndex,int,int)));
+  connect(model, SIGNAL(rowsInserted(QModelIndex,int,int)), d.data(), SLOT(insert_data(QModelIndex,int,int)));
+  Q_FOREACH(AbstractAggregator::Ptr aggregator, row_aggregators + column_aggregators) {
+    connect(aggregator.data(), SIGNAL(categoryAdded(int)), d.data(), SLOT(slot_aggregator_category_added(int)));
+    connect(aggregator.data(), SIGNAL(categoryRemoved(int)), d.data(), SLOT(slot_aggregator_category_removed(int)));
+    connect(aggregator.data(), SIGNAL(rowsRecategorized(qdatacube::Bitset)), d.data(), SLOT(slot_aggregator_rows_recategorized(qdatacube::Bitset)));
+    connect(aggregator.data(), SIGNAL(headerDataChanged(int,int)), d.data(), SLOT(slot_aggregator_header_data_changed()));
+  }
+  d->row_aggregators = row_aggregators;
+  d->col_aggregators = column_aggregators;
+  d->row_orders = DatacubePrivate::header_orders_t(row_aggregators.size());
+  d->col_orders = DatacubePrivate::header_orders_t(column_aggregators.size());
+  d->row_header_filters = DatacubePrivate::header_filters_t(row_aggregators.size());
+  d->col_header_filters = DatacubePrivate::header_filters_t(column_aggregators.size());
+  d->row_counts = QVector<unsigned>(bucket_count(row_aggregators));
+  d->col_counts = QVector<unsigned>(bucket_count(column_aggregators));
+  d->filters = filters;
+  d->filter_results = QVector<DatacubePrivate::FilterResults>(filters.size(), DatacubePrivate::FilterResults(model->rowCount()));
+  Q_FOREACH(AbstractFilter::Ptr filter, filters) {
+    connect(filter.data(), SIGNAL(resultsChanged(qdatacube::Bitset)), d.data(), SLOT(slot_filter_results_changed(qdatacube::Bitset)), Qt::UniqueConnection);
+  }
+}
+
 
 void Datacube::addFilter(AbstractFilter::Ptr filter) {
+  QDATACUBE_TIME(d, AddFilter);
+  QDATACUBE_TRACE("Datacube::addFilter");
+  QDATACUBE_TRACE_ARG("rows", d->model->rowCount());
 #ifdef ANGE_QDATACUBE_CHECK_PRE_POST_CONDITIONS
   check();
 #endif
   if (!filter) {
     return;
   }
-  for (int row = 0, nrows = d->model->rowCount(); row<nrows; ++row) {
-    const bool was_included = d->reverse_index.contains(row);
-    const bool included = (*filter)(row);
-    if (was_included && !included) {
-      d->remove(row);
+  // The new filter can only narrow the datacube, so only evaluate it for the rows other filters let through
+  const int nrows = d->model->rowCount();
+  const Bitset excluded = d->excluded_rows();
+  d->filters << filter;
+  d->filter_results << DatacubePrivate::FilterResults(nrows);
+  connect(filter.data(), SIGNAL(resultsChanged(qdatacube::Bitset)), d.data(), SLOT(slot_filter_results_changed(qdatacube::Bitset)), Qt::UniqueConnection);
+  const int index = d->filters.size() - 1;
+  Bitset removed(nrows);
+  if (!excluded.any()) {
+    // Every row is asked about, so let the filter evaluate them in one go
+    DatacubePrivate::FilterResults& results = d->filter_results[index];
+    filter->evaluate(0, nrows, results.included);
+    results.evaluated.setAll();
+    removed = results.evaluated;
+    removed.subtract(results.included);
+  } else {
+    for (int row = 0; row < nrows; ++row) {
+      if (!excluded.test(row) && !d->filter_result(index, row)) {
+        removed.set(row);
+      }
     }
   }
-  d->filters << filter;
+  QDATACUBE_COUNT(d, ElementsTouched, nrows - excluded.count());
+  d->apply_changes(removed, Bitset());
   emit filterChanged();
 #ifdef ANGE_QDATACUBE_CHECK_PRE_POST_CONDITIONS
   check();
@@ -241,23 +888,33 @@ void Datacube::addFilter(AbstractFilter::Ptr filter) {
 
 bool Datacube::removeFilter(AbstractFilter::Ptr filter)
 {
-  for (Filters::iterator it = d->filters.begin(), iend = d->filters.end(); it != iend; ++it) {
-    if (*it == filter) {
-      Filters::value_type removed_filter = *it;
-      d->filters.erase(it);
-      for (int row = 0, nrows = d->model->rowCount(); row<nrows; ++row) {
-        if (d->filtered_in(row)) {
-          const bool excluded = !(*filter)(row);
-          if (excluded) {
-            d->add(row);
-          }
-        }
-      }
-      emit filterChanged();
-      return true;
+  QDATACUBE_TIME(d, RemoveFilter);
+  QDATACUBE_TRACE("Datacube::removeFilter");
+  QDATACUBE_TRACE_ARG("rows", d->model->rowCount());
+  const int index = d->filters.indexOf(filter);
+  if (index < 0) {
+    return false;
+  }
+  // Only the rows this filter excluded can come back, if the remaining filters include them
+  Bitset added = d->filter_results.at(index).evaluated;
+  added.subtract(d->filter_results.at(index).included);
+  d->filters.removeAt(index);
+  d->filter_results.remove(index);
+  if (!d->filters.contains(filter)) {
+    disconnect(filter.data(), SIGNAL(resultsChanged(qdatacube::Bitset)), d.data(), SLOT(slot_filter_results_changed(qdatacube::Bitset)));
+  }
+  for (int other = 0; other < d->filters.size(); ++other) {
+    Bitset unknown = added;
+    unknown.subtract(d->filter_results.at(other).evaluated);
+    QDATACUBE_COUNT(d, ElementsTouched, unknown.count());
+    for (int row = unknown.nextSetBit(0); row >= 0; row = unknown.nextSetBit(row + 1)) {
+      d->filter_result(other, row);
     }
+    added &= d->filter_results.at(other).included;
   }
-  return false;
+  d->apply_changes(Bitset(), added);
+  emit filterChanged();
+  return true;
 }
 
 
@@ -307,16 +964,19 @@ void Datacube::check() const {
 }
 
 void Datacube::resetFilter() {
+  QDATACUBE_TIME(d, ResetFilter);
+  QDATACUBE_TRACE("Datacube::resetFilter");
+  QDATACUBE_TRACE_ARG("rows", d->model->rowCount());
   if (d->filters.empty()) {
     return;
   }
-  d->filters.clear();
-  for (int row = 0, nrows = d->model->rowCount(); row<nrows; ++row) {
-    const bool was_included = d->reverse_index.contains(row);
-    if (!was_included) {
-      d->add(row);
-    }
+  const Bitset added = d->excluded_rows();
+  Q_FOREACH(AbstractFilter::Ptr filter, d->filters) {
+    disconnect(filter.data(), SIGNAL(resultsChanged(qdatacube::Bitset)), d.data(), SLOT(slot_filter_results_changed(qdatacube::Bitset)));
   }
+  d->filters.clear();
+  d->filter_results.clear();
+  d->apply_changes(Bitset(), added);
   emit filterChanged();
 
 }
@@ -330,11 +990,13 @@ int Datacube::elementCount(int row, int column) const {
 }
 
 int Datacube::columnCount() const {
-  return d->col_counts.size() - std::count(d->col_counts.begin(), d->col_counts.end(), 0u);
+  const QVector<unsigned>& counts = d->shown_counts(Qt::Horizontal);
+  return counts.size() - std::count(counts.begin(), counts.end(), 0u);
 }
 
 int Datacube::rowCount() const {
-  return d->row_counts.size() - std::count(d->row_counts.begin(), d->row_counts.end(), 0u);
+  const QVector<unsigned>& counts = d->shown_counts(Qt::Vertical);
+  return counts.size() - std::count(counts.begin(), counts.end(), 0u);
 }
 
 QList< int > Datacube::elements(int row, int column) const {
@@ -348,7 +1010,8 @@ QList< int > Datacube::elements(int row, int column) const {
 QList< Datacube::HeaderDescription > Datacube::headers(Qt::Orientation orientation, int index) const {
   QList< HeaderDescription > rv;
   Aggregators& aggregators = (orientation == Qt::Horizontal) ? d->col_aggregators : d->row_aggregators;
-  const QVector<unsigned>& counts = (orientation == Qt::Horizontal) ? d->col_counts : d->row_counts;
+  const QVector<unsigned>& counts = d->section_counts(orientation);
+  const DatacubePrivate::HeaderOrder& header_order = (orientation == Qt::Horizontal) ? d->col_orders.at(index) : d->row_orders.at(index);
   AbstractAggregator::Ptr aggregator = aggregators.at(index);
   const int ncats = aggregator->categoryCount();
   int stride = 1;
@@ -363,7 +1026,8 @@ QList< Datacube::HeaderDescription > Datacube::headers(Qt::Orientation orientati
       }
     }
     if (count > 0 ) {
-      rv << HeaderDescription((c/stride)%ncats, count);
+      const int position = (c/stride)%ncats;
+      rv << HeaderDescription(header_order.sorted ? header_order.categories.at(position) : position, count);
     }
   }
   return rv;
@@ -385,23 +1049,35 @@ void DatacubePrivate::add(int index) {
   int columnBucket = computeColumnBucketForIndex(index);
   Q_ASSERT(columnBucket>=0); // Every container should be in both rows and columns, or neither place.
 
-  // Check if rows/columns are added, and notify listernes as neccessary
+  // Check if rows/columns are added, and notify listernes as neccessary. Elements in hidden sections are
+  // counted, but not shown
   int row_to_add = -1;
   int column_to_add = -1;
-    {
-        unsigned int& section_count = row_counts[rowBucket];
-        section_count += 1;
+  const bool shown = cell_shown(rowBucket, columnBucket);
+    row_counts[rowBucket] += 1;
+    if (shown) {
+        unsigned int& section_count = row_shown_counts.isEmpty() ? row_counts[rowBucket] : ++row_shown_counts[rowBucket];
+        if (!row_section_counts.isEmpty()) {
+          ++row_section_counts[bucket_position(Qt::Vertical, rowBucket)];
+        }
         if(section_count == 1) {
             row_to_add = bucket_to_row(rowBucket);;
-            emit q->rowsAboutToBeInserted(row_to_add,1);
+            if (!signals_blocked) {
+                emit q->rowsAboutToBeInserted(row_to_add,1);
+            }
         }
     }
-    {
-        unsigned int& section_count = col_counts[columnBucket];
-        section_count += 1;
+    col_counts[columnBucket] += 1;
+    if (shown) {
+        unsigned int& section_count = col_shown_counts.isEmpty() ? col_counts[columnBucket] : ++col_shown_counts[columnBucket];
+        if (!col_section_counts.isEmpty()) {
+          ++col_section_counts[bucket_position(Qt::Horizontal, columnBucket)];
+        }
         if(section_count == 1) {
             column_to_add = bucket_to_column(columnBucket);
-            emit q->columnsAboutToBeInserted(column_to_add,1);
+            if (!signals_blocked) {
+                emit q->columnsAboutToBeInserted(column_to_add,1);
+            }
         }
     }
 
@@ -409,19 +1085,33 @@ void DatacubePrivate::add(int index) {
   cellAppend(rowBucket, columnBucket,index);
   Q_ASSERT(!reverse_index.contains(index));
   reverse_index.insert(index, Cell(rowBucket, columnBucket));
+  bump_generation();
+  QDATACUBE_COUNT(this, AddCalls, 1);
 
   // Notify various listerners
   Q_FOREACH(DatacubeSelection* selection, selection_models) {
     selection->d->datacube_adds_element_to_bucket(rowBucket, columnBucket, index);
   }
+  update_header_filters(index, Cell(rowBucket, columnBucket), 1);
+  if (signals_blocked) {
+    update_header_orders(index, Cell(rowBucket, columnBucket), 1);
+    return;
+  }
   if(column_to_add>=0) {
     emit q->columnsInserted(column_to_add,1);
+    QDATACUBE_COUNT(this, SignalEmissions, 2); // with the about to signal
   }
   if(row_to_add>=0) {
     emit q->rowsInserted(row_to_add,1);
+    QDATACUBE_COUNT(this, SignalEmissions, 2); // with the about to signal
+  }
+  if(shown && row_to_add==-1 && column_to_add==-1) {
+    const int row = bucket_to_row(rowBucket);
+    const int column = bucket_to_column(columnBucket);
+    emit_data_changed(row, column, row, column);
   }
-  if(row_to_add==-1 && column_to_add==-1) {
-    emit q->dataChanged(bucket_to_row(rowBucket),bucket_to_column(columnBucket));
+  if (update_header_orders(index, Cell(rowBucket, columnBucket), 1)) {
+    header_reordered();
   }
 }
 
@@ -436,34 +1126,65 @@ void DatacubePrivate::remove(int index) {
   }
   int row_to_remove = -1;
   int column_to_remove = -1;
-  if(--row_counts[cell.row()]==0) {
+  // Elements in hidden sections are counted, but not shown
+  const bool shown = cell_shown(cell.row(), cell.column());
+  if (shown && !row_section_counts.isEmpty()) {
+    --row_section_counts[bucket_position(Qt::Vertical, cell.row())];
+  }
+  if (shown && !col_section_counts.isEmpty()) {
+    --col_section_counts[bucket_position(Qt::Horizontal, cell.column())];
+  }
+  --row_counts[cell.row()];
+  if(shown && (row_shown_counts.isEmpty() ? row_counts[cell.row()] : --row_shown_counts[cell.row()])==0) {
     row_to_remove = bucket_to_row(cell.row());
-    emit q->rowsAboutToBeRemoved(row_to_remove,1);
+    if (!signals_blocked) {
+      emit q->rowsAboutToBeRemoved(row_to_remove,1);
+    }
   }
-  if(--col_counts[cell.column()]==0) {
+  --col_counts[cell.column()];
+  if(shown && (col_shown_counts.isEmpty() ? col_counts[cell.column()] : --col_shown_counts[cell.column()])==0) {
     column_to_remove = bucket_to_column(cell.column());
-    emit q->columnsAboutToBeRemoved(column_to_remove,1);
+    if (!signals_blocked) {
+      emit q->columnsAboutToBeRemoved(column_to_remove,1);
+    }
   }
   Q_ASSERT(hasCell(cell.row(),cell.column()));
   const bool check = cellRemoveOne(cell.row(), cell.column(),index);
   Q_UNUSED(check)
   Q_ASSERT(check);
   reverse_index.remove(index);
+  bump_generation();
+  QDATACUBE_COUNT(this, RemoveCalls, 1);
+  update_header_filters(index, cell, -1);
+  if (signals_blocked) {
+    update_header_orders(index, cell, -1);
+    return;
+  }
   if(column_to_remove>=0) {
     emit q->columnsRemoved(column_to_remove,1);
+    QDATACUBE_COUNT(this, SignalEmissions, 2); // with the about to signal
   }
   if(row_to_remove>=0) {
     emit q->rowsRemoved(row_to_remove,1);
+    QDATACUBE_COUNT(this, SignalEmissions, 2); // with the about to signal
+  }
+  if(shown && row_to_remove==-1 && column_to_remove==-1) {
+    const int row = bucket_to_row(cell.row());
+    const int column = bucket_to_column(cell.column());
+    emit_data_changed(row, column, row, column);
   }
-  if(row_to_remove==-1 && column_to_remove==-1) {
-    emit q->dataChanged(bucket_to_row(cell.row()),bucket_to_column(cell.column()));
+  if (update_header_orders(index, cell, -1)) {
+    header_reordered();
   }
 }
 
 void DatacubePrivate::update_data(QModelIndex topleft, QModelIndex bottomRight) {
   const int toprow = topleft.row();
   const int buttomrow = bottomRight.row();
+  QDATACUBE_TRACE("update_data");
+  QDATACUBE_TRACE_ARG("rows", buttomrow - toprow + 1);
   for (int element = toprow; element <= buttomrow; ++element) {
+    forget_filter_results(element);
     const bool filtered_out = !filtered_in(element);
     int new_row_section = computeBucketForIndex(Qt::Vertical, element);
     int new_column_section = computeBucketForIndex(Qt::Horizontal, element);
@@ -475,25 +1196,53 @@ void DatacubePrivate::update_data(QModelIndex topleft, QModelIndex bottomRight)
       if (!filtered_out) {
         add(element);
       }
+    } else {
+      // Staying in its cell, the element can still change the measure of a header sorted or filtered by a sum
+      refresh_header_filter_values(element, old_cell, topleft.column(), bottomRight.column());
+      if (refresh_header_values(element, old_cell, topleft.column(), bottomRight.column())) {
+        header_reordered();
+      }
     }
   }
+  end_batch();
 #ifdef ANGE_QDATACUBE_CHECK_PRE_POST_CONDITIONS
   q->check();
 #endif
 }
 
 void DatacubePrivate::insert_data(QModelIndex parent, int start, int end) {
+  QDATACUBE_TRACE("insert_data");
+  QDATACUBE_TRACE_ARG("rows", end - start + 1);
   Q_ASSERT(!parent.isValid());
   Q_UNUSED(parent);
   Q_FOREACH(DatacubeSelection* selection, selection_models) {
     selection->d->datacube_inserts_elements(start, end);
   }
   renumber_cells(start, end-start+1);
+  for (int index = 0; index < filter_results.size(); ++index) {
+    filter_results[index].evaluated.insert(start, end-start+1);
+    filter_results[index].included.insert(start, end-start+1);
+  }
+  for (int horizontal = 0; horizontal < 2; ++horizontal) {
+    header_orders_t& orders = horizontal ? col_orders : row_orders;
+    for (int headerno = 0; headerno < orders.size(); ++headerno) {
+      if (orders.at(headerno).sorted && orders.at(headerno).section >= 0) {
+        orders[headerno].values.insert(start, end-start+1, 0.0);
+      }
+    }
+    header_filters_t& header_filters = horizontal ? col_header_filters : row_header_filters;
+    for (int headerno = 0; headerno < header_filters.size(); ++headerno) {
+      if (header_filters.at(headerno).active && header_filters.at(headerno).section >= 0) {
+        header_filters[headerno].values.insert(start, end-start+1, 0.0);
+      }
+    }
+  }
   for (int row = start; row <=end; ++row) {
     if(filtered_in(row)) {
       add(row);
     }
   }
+  end_batch();
 #ifdef ANGE_QDATACUBE_CHECK_PRE_POST_CONDITIONS
   q->check();
 #endif
@@ -504,6 +1253,8 @@ void DatacubePrivate::remove_data(QModelIndex parent, int start, int end) {
 #ifdef ANGE_QDATACUBE_CHECK_PRE_POST_CONDITIONS
   q->check();
 #endif
+  QDATACUBE_TRACE("remove_data");
+  QDATACUBE_TRACE_ARG("rows", end - start + 1);
   Q_ASSERT(!parent.isValid());
   Q_UNUSED(parent);
   for (int row = end; row>=start; --row) {
@@ -514,7 +1265,25 @@ void DatacubePrivate::remove_data(QModelIndex parent, int start, int end) {
   }
   // Now, all the remaining elements have to be renumbered
   renumber_cells(end+1, start-end-1);
-
+  for (int index = 0; index < filter_results.size(); ++index) {
+    filter_results[index].evaluated.remove(start, end-start+1);
+    filter_results[index].included.remove(start, end-start+1);
+  }
+  for (int horizontal = 0; horizontal < 2; ++horizontal) {
+    header_orders_t& orders = horizontal ? col_orders : row_orders;
+    for (int headerno = 0; headerno < orders.size(); ++headerno) {
+      if (orders.at(headerno).sorted && orders.at(headerno).section >= 0) {
+        orders[headerno].values.remove(start, end-start+1);
+      }
+    }
+    header_filters_t& header_filters = horizontal ? col_header_filters : row_header_filters;
+    for (int headerno = 0; headerno < header_filters.size(); ++headerno) {
+      if (header_filters.at(headerno).active && header_filters.at(headerno).section >= 0) {
+        header_filters[headerno].values.remove(start, end-start+1);
+      }
+    }
+  }
+  end_batch();
 }
 
 void DatacubePrivate::renumber_cells(int start, int adjustment) {
@@ -529,30 +1298,107 @@ void DatacubePrivate::renumber_cells(int start, int adjustment) {
     }
   }
   reverse_index = new_index;
+  bump_generation();
 
 }
 
-void DatacubePrivate::slot_columns_changed(int column, int count) {
-  for (int col = column; col<=column+count;++col) {
-    const int rowcount = q->rowCount();
-    for (int row = 0; row < rowcount; ++row) {
-      emit q->dataChanged(row,col);
+void DatacubePrivate::emit_data_changed(int top_row, int left_column, int bottom_row, int right_column) {
+  if (top_row > bottom_row || left_column > right_column) {
+    return;
+  }
+  emit q->dataChanged(top_row, left_column, bottom_row, right_column);
+  QDATACUBE_COUNT(this, SignalEmissions, 1);
+  if (q->receivers(SIGNAL(dataChanged(int,int))) > 0) {
+    QDATACUBE_COUNT(this, SignalEmissions, (bottom_row - top_row + 1) * (right_column - left_column + 1));
+    for (int row = top_row; row <= bottom_row; ++row) {
+      for (int column = left_column; column <= right_column; ++column) {
+        emit q->dataChanged(row, column);
+      }
     }
   }
+}
+
+void DatacubePrivate::slot_columns_changed(int column, int count) {
+  emit_data_changed(0, column, q->rowCount()-1, column+count-1);
   emit q->headersChanged(Qt::Horizontal, column, column+count-1);
 }
 
 void DatacubePrivate::slot_rows_changed(int row, int count) {
-  for (int r = row; r<=row+count;++r) {
-    const int columncount = q->columnCount();
-    for (int column = 0; column < columncount; ++column) {
-      emit q->dataChanged(r,column);
-    }
-  }
+  emit_data_changed(row, 0, row+count-1, q->columnCount()-1);
   emit q->headersChanged(Qt::Vertical, row, row+count-1);
 }
 
+void Datacube::sortHeader(Qt::Orientation orientation, int headerno, Qt::SortOrder order, int section, int role) {
+  QDATACUBE_TRACE("Datacube::sortHeader");
+  QDATACUBE_TRACE_ARG("elements", d->reverse_index.size());
+  DatacubePrivate::HeaderOrder& header_order = (orientation == Qt::Horizontal) ? d->col_orders[headerno] : d->row_orders[headerno];
+  emit aboutToBeReset();
+  header_order.sorted = true;
+  header_order.order = order;
+  header_order.section = section;
+  header_order.role = role;
+  d->sort_headers(orientation);
+  d->headers_changed();
+  emit reset();
+  QDATACUBE_COUNT(d, SignalEmissions, 2);
+}
+
+void Datacube::unsortHeader(Qt::Orientation orientation, int headerno) {
+  DatacubePrivate::HeaderOrder& header_order = (orientation == Qt::Horizontal) ? d->col_orders[headerno] : d->row_orders[headerno];
+  if (!header_order.sorted) {
+    return;
+  }
+  emit aboutToBeReset();
+  header_order = DatacubePrivate::HeaderOrder();
+  d->sort_headers(orientation);
+  d->headers_changed();
+  emit reset();
+  QDATACUBE_COUNT(d, SignalEmissions, 2);
+}
+
+bool Datacube::isHeaderSorted(Qt::Orientation orientation, int headerno) const {
+  return ((orientation == Qt::Horizontal) ? d->col_orders : d->row_orders).at(headerno).sorted;
+}
+
+void Datacube::filterHeader(Qt::Orientation orientation, int headerno, double minimum, double maximum, int top_count, Qt::SortOrder order, int section, int role) {
+  QDATACUBE_TRACE("Datacube::filterHeader");
+  QDATACUBE_TRACE_ARG("elements", d->reverse_index.size());
+  DatacubePrivate::HeaderFilter& header_filter = (orientation == Qt::Horizontal) ? d->col_header_filters[headerno] : d->row_header_filters[headerno];
+  emit aboutToBeReset();
+  header_filter.active = true;
+  header_filter.minimum = minimum;
+  header_filter.maximum = maximum;
+  header_filter.top_count = top_count;
+  header_filter.order = order;
+  header_filter.section = section;
+  header_filter.role = role;
+  d->measure_header_filters(orientation);
+  d->hide_sections(true);
+  d->headers_changed();
+  emit reset();
+  QDATACUBE_COUNT(d, SignalEmissions, 2);
+}
+
+void Datacube::unfilterHeader(Qt::Orientation orientation, int headerno) {
+  DatacubePrivate::HeaderFilter& header_filter = (orientation == Qt::Horizontal) ? d->col_header_filters[headerno] : d->row_header_filters[headerno];
+  if (!header_filter.active) {
+    return;
+  }
+  emit aboutToBeReset();
+  header_filter = DatacubePrivate::HeaderFilter();
+  d->measure_header_filters(orientation);
+  d->hide_sections(true);
+  d->headers_changed();
+  emit reset();
+  QDATACUBE_COUNT(d, SignalEmissions, 2);
+}
+
+bool Datacube::isHeaderFiltered(Qt::Orientation orientation, int headerno) const {
+  return ((orientation == Qt::Horizontal) ? d->col_header_filters : d->row_header_filters).at(headerno).active;
+}
+
 void Datacube::split(Qt::Orientation orientation, int headerno, AbstractAggregator::Ptr aggregator) {
+  QDATACUBE_TIME(d, Split);
   emit aboutToBeReset();
   if (orientation == Qt::Vertical) {
     d->split_row(headerno, aggregator);
@@ -561,11 +1407,15 @@ void Datacube::split(Qt::Orientation orientation, int headerno, AbstractAggregat
   }
   connect(aggregator.data(), SIGNAL(categoryAdded(int)), d.data(), SLOT(slot_aggregator_category_added(int)));
   connect(aggregator.data(), SIGNAL(categoryRemoved(int)), d.data(), SLOT(slot_aggregator_category_removed(int)));;
+  connect(aggregator.data(), SIGNAL(rowsRecategorized(qdatacube::Bitset)), d.data(), SLOT(slot_aggregator_rows_recategorized(qdatacube::Bitset)));
+  connect(aggregator.data(), SIGNAL(headerDataChanged(int,int)), d.data(), SLOT(slot_aggregator_header_data_changed()));
   emit reset();
+  QDATACUBE_COUNT(d, SignalEmissions, 2);
 }
 
 void DatacubePrivate::split_row(int headerno, AbstractAggregator::Ptr aggregator)
 {
+  QDATACUBE_TRACE("split_row");
 #ifdef ANGE_QDATACUBE_CHECK_PRE_POST_CONDITIONS
   q->check();
 #endif
@@ -604,7 +1454,19 @@ void DatacubePrivate::split_row(int headerno, AbstractAggregator::Ptr aggregator
         }
   }
   row_aggregators.insert(headerno, aggregator);
+  row_orders.insert(headerno, HeaderOrder());
+  row_header_filters.insert(headerno, HeaderFilter());
+  QDATACUBE_COUNT(this, CellsTouched, oldcells.size());
+  QDATACUBE_COUNT(this, ElementsTouched, reverse_index.size());
+  QDATACUBE_TRACE_ARG("cells_rebuilt", oldcells.size());
+  QDATACUBE_TRACE_ARG("elements", reverse_index.size());
+  QDATACUBE_TRACE_ARG("categories", ncats);
+  // The filtered headers after the new one are measured within its sections from now on
+  measure_header_filters(Qt::Vertical);
+  hide_sections(true);
+  headers_changed();
   emit q->reset();
+  QDATACUBE_COUNT(this, SignalEmissions, 2);
 #ifdef ANGE_QDATACUBE_CHECK_PRE_POST_CONDITIONS
   q->check();
 #endif
@@ -612,6 +1474,7 @@ void DatacubePrivate::split_row(int headerno, AbstractAggregator::Ptr aggregator
 }
 
 void DatacubePrivate::split_column(int headerno, AbstractAggregator::Ptr aggregator) {
+  QDATACUBE_TRACE("split_column");
 #ifdef ANGE_QDATACUBE_CHECK_PRE_POST_CONDITIONS
   q->check();
 #endif
@@ -651,7 +1514,18 @@ void DatacubePrivate::split_column(int headerno, AbstractAggregator::Ptr aggrega
         }
   }
   col_aggregators.insert(headerno, aggregator);
+  col_orders.insert(headerno, HeaderOrder());
+  col_header_filters.insert(headerno, HeaderFilter());
+  QDATACUBE_COUNT(this, CellsTouched, oldcells.size());
+  QDATACUBE_COUNT(this, ElementsTouched, reverse_index.size());
+  QDATACUBE_TRACE_ARG("cells_rebuilt", oldcells.size());
+  QDATACUBE_TRACE_ARG("elements", reverse_index.size());
+  QDATACUBE_TRACE_ARG("categories", ncats);
+  measure_header_filters(Qt::Horizontal);
+  hide_sections(true);
+  headers_changed();
   emit q->reset();
+  QDATACUBE_COUNT(this, SignalEmissions, 2);
 #ifdef ANGE_QDATACUBE_CHECK_PRE_POST_CONDITIONS
   q->check();
 #endif
@@ -659,6 +1533,8 @@ void DatacubePrivate::split_column(int headerno, AbstractAggregator::Ptr aggrega
 }
 
 void Datacube::collapse(Qt::Orientation orientation, int headerno) {
+  QDATACUBE_TIME(d, Collapse);
+  QDATACUBE_TRACE("Datacube::collapse");
 #ifdef ANGE_QDATACUBE_CHECK_PRE_POST_CONDITIONS
   check();
 #endif
@@ -669,7 +1545,11 @@ void Datacube::collapse(Qt::Orientation orientation, int headerno) {
   AbstractAggregator::Ptr aggregator = parallel_aggregators[headerno];
   disconnect(aggregator.data(), SIGNAL(categoryAdded(int)), d.data(), SLOT(slot_aggregator_category_added(int)));
   disconnect(aggregator.data(), SIGNAL(categoryRemoved(int)), d.data(), SLOT(slot_aggregator_category_removed(int)));;
+  disconnect(aggregator.data(), SIGNAL(rowsRecategorized(qdatacube::Bitset)), d.data(), SLOT(slot_aggregator_rows_recategorized(qdatacube::Bitset)));
+  disconnect(aggregator.data(), SIGNAL(headerDataChanged(int,int)), d.data(), SLOT(slot_aggregator_header_data_changed()));
   parallel_aggregators.removeAt(headerno);
+  (horizontal ? d->col_orders : d->row_orders).remove(headerno);
+  (horizontal ? d->col_header_filters : d->row_header_filters).remove(headerno);
   const int ncats = aggregator->categoryCount();
   d->cells = DatacubePrivate::cells_t();
   const int normal_count = horizontal ? d->row_counts.size() : d->col_counts.size();
@@ -701,7 +1581,15 @@ void Datacube::collapse(Qt::Orientation orientation, int headerno) {
       }
     }
   }
+  QDATACUBE_COUNT(d, CellsTouched, oldcells.size());
+  QDATACUBE_COUNT(d, ElementsTouched, d->reverse_index.size());
+  QDATACUBE_TRACE_ARG("cells_rebuilt", oldcells.size());
+  QDATACUBE_TRACE_ARG("elements", d->reverse_index.size());
+  d->measure_header_filters(orientation);
+  d->hide_sections(true);
+  d->headers_changed();
   emit reset();
+  QDATACUBE_COUNT(d, SignalEmissions, 2);
 #ifdef ANGE_QDATACUBE_CHECK_PRE_POST_CONDITIONS
   check();
 #endif
@@ -756,6 +1644,8 @@ void qdatacube::Datacube::dump(bool cells, bool rowcounts, bool col_counts) cons
 }
 
 void qdatacube::DatacubePrivate::slot_aggregator_category_added(int newCategoryIndex) {
+  // Drop the cached header data even if no header here uses the aggregator
+  headers_changed();
   if (AbstractAggregator* aggregator = qobject_cast<AbstractAggregator*>(sender())) {
     int headerno = 0;
     Q_FOREACH(AbstractAggregator::Ptr f, row_aggregators) {
@@ -775,6 +1665,7 @@ void qdatacube::DatacubePrivate::slot_aggregator_category_added(int newCategoryI
 }
 
 void qdatacube::DatacubePrivate::slot_aggregator_category_removed(int categoryIndex) {
+  headers_changed();
   if (AbstractAggregator* aggregator = qobject_cast<AbstractAggregator*>(sender())) {
     int headerno = 0;
     Q_FOREACH(AbstractAggregator::Ptr f, row_aggregators) {
@@ -794,6 +1685,46 @@ void qdatacube::DatacubePrivate::slot_aggregator_category_removed(int categoryIn
 
 }
 
+void qdatacube::DatacubePrivate::slot_aggregator_header_data_changed() {
+  // Only the labels changed; the sections and their elements stay
+  headers_changed();
+  if (AbstractAggregator* aggregator = qobject_cast<AbstractAggregator*>(sender())) {
+    Q_FOREACH(AbstractAggregator::Ptr f, row_aggregators) {
+      if (f == aggregator) {
+        emit q->headersChanged(Qt::Vertical, 0, q->rowCount()-1);
+        break;
+      }
+    }
+    Q_FOREACH(AbstractAggregator::Ptr f, col_aggregators) {
+      if (f == aggregator) {
+        emit q->headersChanged(Qt::Horizontal, 0, q->columnCount()-1);
+        break;
+      }
+    }
+  }
+}
+
+void qdatacube::DatacubePrivate::slot_aggregator_rows_recategorized(const qdatacube::Bitset& rows) {
+  QDATACUBE_TRACE("rows_recategorized");
+  QDATACUBE_TRACE_ARG("rows", rows.count());
+  // Filter results do not depend on the aggregators of the datacube, so only rows in it can move
+  const int nrows = model->rowCount();
+  Bitset moved(nrows);
+  for (int row = rows.nextSetBit(0); row >= 0 && row < nrows; row = rows.nextSetBit(row + 1)) {
+    const Cell cell = reverse_index.value(row);
+    if (cell.invalid()) {
+      continue;
+    }
+    if (cell.row() != computeRowBucketForIndex(row) || cell.column() != computeColumnBucketForIndex(row)) {
+      moved.set(row);
+    }
+  }
+  QDATACUBE_COUNT(this, ElementsTouched, moved.count());
+  apply_changes(moved, moved);
+#ifdef ANGE_QDATACUBE_CHECK_PRE_POST_CONDITIONS
+  q->check();
+#endif
+}
 
 void qdatacube::DatacubePrivate::aggregator_category_added(qdatacube::AbstractAggregator::Ptr aggregator, int headerno, int newCategoryIndex, Qt::Orientation orientation)
 {
@@ -803,6 +1734,10 @@ void qdatacube::DatacubePrivate::aggregator_category_added(qdatacube::AbstractAg
   const int normal_count = normal_counts.size();
   const QVector<unsigned> old_parallel_counts = new_parallel_counts;
   DatacubePrivate::cells_t old_cells = cells;
+  QDATACUBE_TIME(this, CategoryChange);
+  QDATACUBE_COUNT(this, CellsTouched, old_cells.size());
+  QDATACUBE_TRACE("category_added");
+  QDATACUBE_TRACE_ARG("cells_rebuilt", old_cells.size());
   int nsuper_categories = 1;
   for (int h=0; h<headerno; ++h) {
     nsuper_categories *= qMax(parallel_aggregators[h]->categoryCount(),1);
@@ -849,6 +1784,10 @@ void qdatacube::DatacubePrivate::aggregator_category_added(qdatacube::AbstractAg
     }
   }
   Q_ASSERT(debug_reverseIndexSize == reverse_index.size());
+  sort_headers(orientation);
+  measure_header_filters(orientation);
+  hide_sections(true);
+  headers_changed();
   emit q->reset(); // TODO: It is not impossible to emit the correct row/column changed instead
   // we can't do a check here because a element might be added to the model and about to be registered in the datacube
 }
@@ -861,6 +1800,10 @@ void qdatacube::DatacubePrivate::aggregator_category_removed(qdatacube::Abstract
   const QVector<unsigned>& normal_counts = orientation == Qt::Horizontal ? row_counts : col_counts;
   const QVector<unsigned> old_parallel_counts = new_parallel_counts;
   DatacubePrivate::cells_t old_cells = cells;
+  QDATACUBE_TIME(this, CategoryChange);
+  QDATACUBE_COUNT(this, CellsTouched, old_cells.size());
+  QDATACUBE_TRACE("category_removed");
+  QDATACUBE_TRACE_ARG("cells_rebuilt", old_cells.size());
   int nsuper_categories = 1;
   for (int h=0; h<headerno; ++h) {
     nsuper_categories *= qMax(parallel_aggregators[h]->categoryCount(),1);
@@ -897,6 +1840,10 @@ void qdatacube::DatacubePrivate::aggregator_category_removed(qdatacube::Abstract
       }
     }
   }
+  sort_headers(orientation);
+  measure_header_filters(orientation);
+  hide_sections(true);
+  headers_changed();
   emit q->reset(); // TODO: It is not impossible to emit the correct row/column changed instead
   // we can't do a check here because a element might be added to the model and about to be registered in the datacube
 }
@@ -938,15 +1885,106 @@ int qdatacube::Datacube::categoryIndex(Qt::Orientation orientation, int header_i
   return bucket % (naggregator_categories*sub_header_size)/sub_header_size;
 }
 
-bool qdatacube::DatacubePrivate::filtered_in(int element) const {
-  Q_FOREACH(Datacube::Filters::value_type filter, filters) {
-    if (!(*filter)(element)) {
+bool qdatacube::DatacubePrivate::filtered_in(int element) {
+  for (int index = 0, nfilters = filters.size(); index < nfilters; ++index) {
+    if (!filter_result(index, element)) {
       return false;
     }
   }
   return true;
 }
 
+bool qdatacube::DatacubePrivate::filter_result(int index, int row) {
+  FilterResults& results = filter_results[index];
+  if (!results.evaluated.test(row)) {
+    results.evaluated.set(row);
+    if ((*filters.at(index))(row)) {
+      results.included.set(row);
+    } else {
+      results.included.reset(row);
+    }
+  }
+  return results.included.test(row);
+}
+
+void qdatacube::DatacubePrivate::forget_filter_results(int row) {
+  for (int index = 0, nfilters = filter_results.size(); index < nfilters; ++index) {
+    filter_results[index].evaluated.reset(row);
+  }
+}
+
+qdatacube::Bitset qdatacube::DatacubePrivate::excluded_rows() const {
+  Bitset rv;
+  Q_FOREACH(const FilterResults& results, filter_results) {
+    Bitset excluded = results.evaluated;
+    excluded.subtract(results.included);
+    rv |= excluded;
+  }
+  return rv;
+}
+
+void qdatacube::DatacubePrivate::slot_filter_results_changed(const qdatacube::Bitset& rows) {
+  QDATACUBE_TRACE("filter_results_changed");
+  QDATACUBE_TRACE_ARG("rows", rows.count());
+  QList<int> indexes;
+  for (int index = 0, nfilters = filters.size(); index < nfilters; ++index) {
+    if (filters.at(index).data() == sender()) {
+      indexes << index;
+    }
+  }
+  if (indexes.isEmpty()) {
+    return;
+  }
+  // A row whose cached result was not known was excluded by another filter, and is still, so only
+  // rows changing between included and excluded by the filters as a whole need to move
+  const int nrows = model->rowCount();
+  Bitset removed(nrows);
+  Bitset added(nrows);
+  for (int row = rows.nextSetBit(0); row >= 0 && row < nrows; row = rows.nextSetBit(row + 1)) {
+    const bool was_included = filtered_in(row);
+    Q_FOREACH(int index, indexes) {
+      filter_results[index].evaluated.reset(row);
+    }
+    const bool included = filtered_in(row);
+    if (was_included && !included) {
+      removed.set(row);
+    } else if (!was_included && included) {
+      added.set(row);
+    }
+  }
+  QDATACUBE_COUNT(this, ElementsTouched, rows.count());
+  apply_changes(removed, added);
+  emit q->filterChanged();
+}
+
+void qdatacube::DatacubePrivate::apply_changes(const Bitset& removed, const Bitset& added) {
+  Bitset changed = removed;
+  changed |= added;
+  const int nchanged = changed.count();
+  QDATACUBE_TRACE("apply_changes");
+  QDATACUBE_TRACE_ARG("elements_changed", nchanged);
+  const bool as_reset = nchanged > filter_reset_threshold;
+  if (as_reset) {
+    emit q->aboutToBeReset();
+    signals_blocked = true;
+  }
+  for (int row = removed.nextSetBit(0); row >= 0; row = removed.nextSetBit(row + 1)) {
+    remove(row);
+  }
+  for (int row = added.nextSetBit(0); row >= 0; row = added.nextSetBit(row + 1)) {
+    add(row);
+  }
+  if (as_reset) {
+    if (header_filters_dirty) {
+      hide_sections(true);
+    }
+    signals_blocked = false;
+    emit q->reset();
+    QDATACUBE_COUNT(this, SignalEmissions, 2);
+  }
+  end_batch();
+}
+
 qdatacube::Datacube::Aggregators qdatacube::Datacube::columnAggregators() const
 {
   return d->col_aggregators;
@@ -960,7 +1998,7 @@ qdatacube::Datacube::Aggregators qdatacube::Datacube::rowAggregators() const
 int qdatacube::Datacube::elementCount(Qt::Orientation orientation, int headerno, int header_section) const
 {
   Aggregators& aggregators = (orientation == Qt::Horizontal) ? d->col_aggregators : d->row_aggregators;
-  const QVector<unsigned>& counts = (orientation == Qt::Horizontal) ? d->col_counts : d->row_counts;
+  const QVector<unsigned>& counts = d->section_counts(orientation);
   int count = 0;
   int stride = 1;
   for (int i=headerno+1; i<aggregators.size(); ++i) {
@@ -981,7 +2019,7 @@ int qdatacube::Datacube::elementCount(Qt::Orientation orientation, int headerno,
 QList<int> qdatacube::Datacube::elements(Qt::Orientation orientation, int headerno, int header_section) const
 {
   Aggregators& aggregators = (orientation == Qt::Horizontal) ? d->col_aggregators : d->row_aggregators;
-  const QVector<unsigned>& counts = (orientation == Qt::Horizontal) ? d->col_counts : d->row_counts;
+  const QVector<unsigned>& counts = d->section_counts(orientation);
   int stride = 1;
   for (int i=headerno+1; i<aggregators.size(); ++i) {
     stride *= aggregators.at(i)->categoryCount();
@@ -1004,11 +2042,16 @@ QList<int> qdatacube::Datacube::elements(Qt::Orientation orientation, int header
   // Accumulate answer
   QList<int> rv;
   const int normal_count = (orientation == Qt::Horizontal) ? d->row_counts.size() : d->col_counts.size();
+  const Qt::Orientation normal_orientation = (orientation == Qt::Horizontal) ? Qt::Vertical : Qt::Horizontal;
   for (; bucket<counts.size() && rv.isEmpty(); bucket+=stride) {
     for (int i=0;i<stride && (bucket+i)<counts.size(); ++i) {
       if (counts.at(bucket+i)>0) {
         for (int n=0; n<normal_count; ++n) {
-          rv << ((orientation == Qt::Horizontal) ? d->cell(n,bucket+i) : d->cell(bucket+i,n));
+          if (d->bucket_hidden(normal_orientation, n)) {
+            continue;
+          }
+          const int b = d->position_bucket(orientation, bucket+i);
+          rv << ((orientation == Qt::Horizontal) ? d->cell(n,b) : d->cell(b,n));
         }
       }
     }
@@ -1021,7 +2064,7 @@ int qdatacube::Datacube::toHeaderSection(const Qt::Orientation orientation, cons
 {
 //   qDebug() << __func__ << headerno << section << row_count() << column_count();
   Aggregators& aggregators = (orientation == Qt::Horizontal) ? d->col_aggregators : d->row_aggregators;
-  const QVector<unsigned>& counts = (orientation == Qt::Horizontal) ? d->col_counts : d->row_counts;
+  const QVector<unsigned>& counts = d->section_counts(orientation);
   int stride = 1;
   for (int i=headerno+1; i<aggregators.size(); ++i) {
     stride *= aggregators.at(i)->categoryCount();
@@ -1051,7 +2094,7 @@ int qdatacube::Datacube::toHeaderSection(const Qt::Orientation orientation, cons
 QPair< int, int > qdatacube::Datacube::toSection(Qt::Orientation orientation, const int headerno, const int header_section) const
 {
   Aggregators& aggregators = (orientation == Qt::Horizontal) ? d->col_aggregators : d->row_aggregators;
-  const QVector<unsigned>& counts = (orientation == Qt::Horizontal) ? d->col_counts : d->row_counts;
+  const QVector<unsigned>& counts = d->section_counts(orientation);
   int stride = 1;
   for (int i=headerno+1; i<aggregators.size(); ++i) {
     stride *= aggregators.at(i)->categoryCount();
@@ -1094,4 +2137,291 @@ QList< int > qdatacube::Datacube::elements() const
   return d->reverse_index.keys();
 }
 
+void qdatacube::DatacubePrivate::headers_changed() {
+  row_categories.clear();
+  col_categories.clear();
+  forget_section_counts(Qt::Vertical);
+  forget_section_counts(Qt::Horizontal);
+  bump_generation();
+}
+
+const qdatacube::DatacubePrivate::categories_t& qdatacube::DatacubePrivate::categories(Qt::Orientation orientation) const {
+  const Datacube::Aggregators& aggregators = orientation == Qt::Horizontal ? col_aggregators : row_aggregators;
+  categories_t& rv = orientation == Qt::Horizontal ? col_categories : row_categories;
+  if (rv.size() != aggregators.size()) {
+    rv.clear();
+    Q_FOREACH(AbstractAggregator::Ptr aggregator, aggregators) {
+      QVector<QVariant> header_data;
+      for (int category = 0, ncategories = aggregator->categoryCount(); category < ncategories; ++category) {
+        header_data << aggregator->categoryHeaderData(category);
+      }
+      rv << header_data;
+    }
+  }
+  return rv;
+}
+
+qdatacube::DatacubeSnapshot qdatacube::Datacube::snapshot() const
+{
+  DatacubeSnapshot rv;
+  rv.d->null = false;
+  rv.d->generation = d->generation;
+  rv.d->row_counts = d->shown_counts(Qt::Vertical);
+  rv.d->col_counts = d->shown_counts(Qt::Horizontal);
+  rv.d->row_section_counts = d->section_counts(Qt::Vertical);
+  rv.d->col_section_counts = d->section_counts(Qt::Horizontal);
+  rv.d->cells = d->cells;
+  rv.d->reverse_index = d->reverse_index;
+  if (d->sorted(Qt::Vertical)) {
+    Q_FOREACH(const DatacubePrivate::HeaderOrder& header_order, d->row_orders) {
+      rv.d->row_order << (header_order.sorted ? header_order.categories : QVector<int>());
+      rv.d->row_positions << (header_order.sorted ? header_order.positions : QVector<int>());
+    }
+  }
+  if (d->sorted(Qt::Horizontal)) {
+    Q_FOREACH(const DatacubePrivate::HeaderOrder& header_order, d->col_orders) {
+      rv.d->col_order << (header_order.sorted ? header_order.categories : QVector<int>());
+      rv.d->col_positions << (header_order.sorted ? header_order.positions : QVector<int>());
+    }
+  }
+  rv.d->row_categories = d->categories(Qt::Vertical);
+  rv.d->col_categories = d->categories(Qt::Horizontal);
+  return rv;
+}
+
+quint64 qdatacube::Datacube::generation() const
+{
+  return d->generation;
+}
+
+void qdatacube::Datacube::setStatisticsEnabled(bool enabled)
+{
+#ifndef QDATACUBE_NO_STATISTICS
+  if (enabled && !d->statistics) {
+    d->statistics.reset(new DatacubeStatistics);
+  } else if (!enabled) {
+    d->statistics.reset();
+  }
+#else
+  Q_UNUSED(enabled);
+#endif
+}
+
+qdatacube::DatacubeStatistics* qdatacube::Datacube::statistics() const
+{
+  return d->statistics.data();
+}
+
+qdatacube::MemoryUsage qdatacube::DatacubePrivate::memory_usage() const {
+  MemoryUsage rv;
+  // The elements of the cells are counted per cell, as each list grows on its own
+  qint64 cell_bytes = memory::hash_bytes(cells);
+  for (cells_t::const_iterator it = cells.constBegin(), end = cells.constEnd(); it != end; ++it) {
+    cell_bytes += memory::list_bytes(it->size());
+  }
+  rv.add("datacube cells", cell_bytes);
+  rv.add("datacube reverse index", memory::hash_bytes(reverse_index));
+  rv.add("datacube row counts", memory::vector_bytes(row_counts));
+  rv.add("datacube column counts", memory::vector_bytes(col_counts));
+  qint64 header_bytes = memory::vector_bytes(row_categories) + memory::vector_bytes(col_categories);
+  Q_FOREACH(const QVector<QVariant>& categories, row_categories + col_categories) {
+    header_bytes += memory::vector_bytes(categories);
+  }
+  rv.add("datacube header cache", header_bytes);
+  qint64 filter_bytes = memory::vector_bytes(filter_results);
+  Q_FOREACH(const FilterResults& results, filter_results) {
+    filter_bytes += memory::bitset_bytes(results.evaluated) + memory::bitset_bytes(results.included);
+  }
+  rv.add("datacube filter results", filter_bytes);
+  qint64 order_bytes = memory::vector_bytes(row_orders) + memory::vector_bytes(col_orders)
+                       + memory::vector_bytes(row_section_counts) + memory::vector_bytes(col_section_counts);
+  Q_FOREACH(const HeaderOrder& header_order, row_orders + col_orders) {
+    order_bytes += memory::vector_bytes(header_order.measures) + memory::vector_bytes(header_order.categories)
+                 + memory::vector_bytes(header_order.positions) + memory::vector_bytes(header_order.values);
+  }
+  if (order_bytes > 0) {
+    rv.add("datacube header orders", order_bytes);
+  }
+  qint64 header_filter_bytes = memory::vector_bytes(row_header_filters) + memory::vector_bytes(col_header_filters)
+                               + memory::vector_bytes(row_shown_counts) + memory::vector_bytes(col_shown_counts);
+  Q_FOREACH(const HeaderFilter& header_filter, row_header_filters + col_header_filters) {
+    header_filter_bytes += memory::vector_bytes(header_filter.measures) + memory::vector_bytes(header_filter.values)
+                         + memory::bitset_bytes(header_filter.hidden);
+  }
+  if (header_filter_bytes > 0) {
+    rv.add("datacube header filters", header_filter_bytes);
+  }
+  if (statistics) {
+    rv.add("datacube statistics", memory::heap_bytes(sizeof(DatacubeStatistics))
+                                  + DatacubeStatistics::NTimings * memory::heap_bytes(sizeof(QArrayData) + DatacubeStatistics::NHistogramBuckets * sizeof(int)));
+  }
+  return rv;
+}
+
+qdatacube::MemoryUsage qdatacube::Datacube::memoryUsage() const
+{
+  return d->memory_usage();
+}
+
+qdatacube::MemoryUsage qdatacube::Datacube::totalMemoryUsage()
+{
+  MemoryUsage rv;
+  QSet<AbstractAggregator*> aggregators;
+  QMutexLocker lock(&live_datacubes()->mutex);
+  Q_FOREACH(const DatacubePrivate* datacube, live_datacubes()->datacubes) {
+    rv += datacube->memory_usage();
+    Q_FOREACH(const DatacubeSelection* selection, datacube->selection_models) {
+      rv += selection->memoryUsage();
+    }
+    Q_FOREACH(AbstractAggregator::Ptr aggregator, datacube->row_aggregators + datacube->col_aggregators) {
+      aggregators << aggregator.data();
+    }
+  }
+  Q_FOREACH(const AbstractAggregator* aggregator, aggregators) {
+    rv += aggregator->memoryUsage();
+  }
+  return rv;
+}
+
+void qdatacube::DatacubePrivate::save(QDataStream& stream, const QByteArray& fingerprint) const {
+  stream.setVersion(QDataStream::Qt_5_2);
+  // Counts and cells are written in host byte order, so they can be read back in bulk
+  stream << save_magic << save_version << quint8(QSysInfo::ByteOrder) << fingerprint << qint32(model->rowCount());
+  stream << category_labels(row_aggregators) << category_labels(col_aggregators) << filter_names(filters);
+  write_counts(stream, row_counts);
+  write_counts(stream, col_counts);
+  stream << quint32(cells.size());
+  for (cells_t::const_iterator it = cells.constBegin(), iend = cells.constEnd(); it != iend; ++it) {
+    const QVector<int> elements = it.value().toVector();
+    stream << qint64(it.key()) << quint32(elements.size());
+    stream.writeRawData(reinterpret_cast<const char*>(elements.constData()), elements.size() * sizeof(int));
+  }
+}
+
+bool qdatacube::DatacubePrivate::restore(QDataStream& stream, const QByteArray& fingerprint) {
+  stream.setVersion(QDataStream::Qt_5_2);
+  quint32 magic;
+  quint32 version;
+  quint8 byte_order;
+  QByteArray saved_fingerprint;
+  qint32 nelements;
+  stream >> magic >> version >> byte_order >> saved_fingerprint >> nelements;
+  if (stream.status() != QDataStream::Ok || magic != save_magic || version != save_version || byte_order != quint8(QSysInfo::ByteOrder)) {
+    return false;
+  }
+  if (saved_fingerprint != fingerprint || nelements != model->rowCount()) {
+    return false;
+  }
+  QList<QStringList> saved_row_labels;
+  QList<QStringList> saved_column_labels;
+  QStringList saved_filter_names;
+  stream >> saved_row_labels >> saved_column_labels >> saved_filter_names;
+  if (saved_row_labels != category_labels(row_aggregators) || saved_column_labels != category_labels(col_aggregators) || saved_filter_names != filter_names(filters)) {
+    return false;
+  }
+  QVector<unsigned> new_row_counts;
+  QVector<unsigned> new_col_counts;
+  if (!read_counts(stream, bucket_count(row_aggregators), new_row_counts) || !read_counts(stream, bucket_count(col_aggregators), new_col_counts)) {
+    return false;
+  }
+  quint32 ncells;
+  stream >> ncells;
+  const long nrows = new_row_counts.size();
+  const long nbuckets = nrows * new_col_counts.size();
+  if (stream.status() != QDataStream::Ok || ncells > quint64(nbuckets)) {
+    return false;
+  }
+  cells_t new_cells;
+  new_cells.reserve(ncells);
+  reverse_index_t new_reverse_index;
+  new_reverse_index.reserve(nelements);
+  Bitset restored_elements(nelements);
+  // Recount from the cells, so a file whose counts and cells disagree is rejected
+  QVector<unsigned> cell_row_counts(new_row_counts.size(), 0);
+  QVector<unsigned> cell_col_counts(new_col_counts.size(), 0);
+  QVector<int> buffer;
+  for (quint32 i = 0; i < ncells; ++i) {
+    qint64 key;
+    quint32 count;
+    stream >> key >> count;
+    if (stream.status() != QDataStream::Ok || key < 0 || key >= nbuckets || count > quint32(nelements)) {
+      return false;
+    }
+    if (!fits_raw_read(count, sizeof(int)) || new_cells.contains(key)) {
+      return false;
+    }
+    buffer.resize(count);
+    const int nbytes = int(count * sizeof(int));
+    if (stream.readRawData(reinterpret_cast<char*>(buffer.data()), nbytes) != nbytes) {
+      return false;
+    }
+    QList<int>& cell = new_cells[key];
+    cell.reserve(count);
+    const Cell coordinates(key % nrows, key / nrows);
+    for (int j = 0; j < buffer.size(); ++j) {
+      const int element = buffer.at(j);
+      if (element < 0 || element >= nelements || restored_elements.test(element)) {
+        return false;
+      }
+      restored_elements.set(element);
+      cell << element;
+      new_reverse_index.insert(element, coordinates);
+    }
+    cell_row_counts[coordinates.row()] += count;
+    cell_col_counts[coordinates.column()] += count;
+  }
+  if (stream.status() != QDataStream::Ok || cell_row_counts != new_row_counts || cell_col_counts != new_col_counts) {
+    return false;
+  }
+  // A row left out must be filtered out, or the file is stale. This also caches which filters exclude the
+  // rows left out, so removing a filter can bring them back.
+  for (int element = 0; element < nelements; ++element) {
+    if (!restored_elements.test(element) && filtered_in(element)) {
+      return false;
+    }
+  }
+  row_counts = new_row_counts;
+  col_counts = new_col_counts;
+  forget_section_counts(Qt::Vertical);
+  forget_section_counts(Qt::Horizontal);
+  cells = new_cells;
+  reverse_index = new_reverse_index;
+  bump_generation();
+  return true;
+}
+
+bool qdatacube::Datacube::save(QIODevice* device, const QByteArray& fingerprint) const
+{
+  QDataStream stream(device);
+  d->save(stream, fingerprint);
+  return stream.status() == QDataStream::Ok;
+}
+
+qdatacube::Datacube* qdatacube::Datacube::load(QIODevice* device, const QByteArray& fingerprint,
+                                               const QAbstractItemModel* model,
+                                               const Aggregators& row_aggregators,
+                                               const Aggregators& column_aggregators,
+                                               const Filters& filters,
+                                               QObject* parent,
+                                               bool* restored)
+{
+  Datacube* rv = new Datacube(model, row_aggregators, column_aggregators, filters, parent);
+  bool ok = false;
+  if (device) {
+    QDataStream stream(device);
+    ok = rv->d->restore(stream, fingerprint);
+  }
+  if (!ok) {
+    for (int element = 0, nelements = model->rowCount(); element < nelements; ++element) {
+      if (rv->d->filtered_in(element)) {
+        rv->d->add(element);
+      }
+    }
+  }
+  if (restored) {
+    *restored = ok;
+  }
+  return rv;
+}
+
 #include "datacube.moc"
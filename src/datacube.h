@@ -4,14 +4,18 @@
 #include "qdatacube_export.h"
 #include "abstractaggregator.h"
 #include "abstractfilter.h"
+#include "memoryusage.h"
 
 #include <QObject>
 #include <QPair>
 
 class QAbstractItemModel;
+class QIODevice;
 namespace qdatacube {
 class Cell;
 class DatacubePrivate;
+class DatacubeSnapshot;
+class DatacubeStatistics;
 }
 
 namespace qdatacube {
@@ -143,6 +147,11 @@ class QDATACUBE_EXPORT Datacube : public QObject {
 
         /**
          * Add filter.
+         * The result of each filter is cached per row, so adding a filter only evaluates it for the rows
+         * currently included, and removing one only reconsiders the rows it excluded. A filter must
+         * therefore give the same result for a row until the row changes in the model.
+         * Changes affecting more than a hundred elements are signalled as aboutToBeReset()/reset()
+         * rather than per element.
          */
         void addFilter(AbstractFilter::Ptr filter);
 
@@ -173,6 +182,47 @@ class QDATACUBE_EXPORT Datacube : public QObject {
          */
         void collapse(Qt::Orientation orientation, int headerno);
 
+        /**
+         * Order the sections of header headerno by a measure of its categories rather than by the order of the
+         * aggregator: the number of elements in each category or, if section is not negative, the sum of the data
+         * for role in column section of the underlying model over them. Ties keep the aggregator's order.
+         * The order is kept up to date as elements are added and removed, without moving elements between cells,
+         * and reset() is emitted whenever it changes. Splitting and collapsing other headers keeps the order.
+         */
+        void sortHeader(Qt::Orientation orientation, int headerno, Qt::SortOrder order = Qt::DescendingOrder, int section = -1, int role = Qt::DisplayRole);
+
+        /**
+         * Restore the aggregator's order of the sections of header headerno
+         */
+        void unsortHeader(Qt::Orientation orientation, int headerno);
+
+        /**
+         * @return true if header headerno is sorted by sortHeader()
+         */
+        bool isHeaderSorted(Qt::Orientation orientation, int headerno) const;
+
+        /**
+         * Hide the sections of header headerno whose measure, as for sortHeader(), is outside minimum..maximum
+         * or, if top_count is positive, not among the top_count first in order within their section of the
+         * headers before headerno. Pass -qInf() and qInf() to leave the range open. The measures are taken
+         * over the elements in the datacube, so they follow its filters, and are kept up to date as elements
+         * are added and removed; reset() is emitted whenever the hidden sections change. Elements in hidden
+         * sections stay in the datacube and in elements(), but not in any cell or header, and sections of the
+         * other orientation left with only such elements are hidden too.
+         */
+        void filterHeader(Qt::Orientation orientation, int headerno, double minimum, double maximum, int top_count = 0,
+                          Qt::SortOrder order = Qt::DescendingOrder, int section = -1, int role = Qt::DisplayRole);
+
+        /**
+         * Show the sections of header headerno hidden by filterHeader()
+         */
+        void unfilterHeader(Qt::Orientation orientation, int headerno);
+
+        /**
+         * @return true if header headerno is filtered by filterHeader()
+         */
+        bool isHeaderFiltered(Qt::Orientation orientation, int headerno) const;
+
         /**
          * @returns the section (i.e, row for Qt::Vertical and column for Qt::Horizontal) for
          * @param orientation
@@ -221,6 +271,69 @@ class QDATACUBE_EXPORT Datacube : public QObject {
          */
         void check() const;
 
+        /**
+         * @return immutable copy of the current state, for reading from other threads. Taking a snapshot
+         * is cheap; see DatacubeSnapshot. Must be called from the thread the datacube lives in.
+         */
+        DatacubeSnapshot snapshot() const;
+
+        /**
+         * @return number that changes whenever the cells or headers change
+         */
+        quint64 generation() const;
+
+        /**
+         * Start or stop collecting statistics. Stopping discards the statistics collected.
+         * Does nothing if built with QDATACUBE_NO_STATISTICS.
+         */
+        void setStatisticsEnabled(bool enabled);
+
+        /**
+         * @return the statistics collected, or null if not enabled. Reset and dump them through the returned object.
+         */
+        DatacubeStatistics* statistics() const;
+
+        /**
+         * @return heap memory used by the cells, reverse index, counts and caches of this datacube. The
+         * selections and aggregators report their own, see DatacubeSelection::memoryUsage() and
+         * AbstractAggregator::memoryUsage().
+         */
+        MemoryUsage memoryUsage() const;
+
+        /**
+         * @return heap memory used by all existing datacubes, their selections and their aggregators, with
+         * aggregators shared between datacubes counted once. The datacubes must not be changed by other
+         * threads meanwhile.
+         */
+        static MemoryUsage totalMemoryUsage();
+
+        /**
+         * Save cells and headers to device, for a later load().
+         * @param fingerprint identifies the content of the underlying model, e.g. a checksum
+         *        or the modification time of its source. It is checked by load()
+         * @return false if writing failed
+         */
+        bool save(QIODevice* device, const QByteArray& fingerprint) const;
+
+        /**
+         * Construct datacube over model with the given aggregators and filters. The cells are read from device
+         * if it holds a save() with the same fingerprint, aggregator categories and filter names, and every
+         * row left out of its cells is filtered out; otherwise the datacube is built from the model like the
+         * constructors do.
+         * The aggregators and filters must be the ones the saved datacube used, or equivalent ones.
+         * Loading reads the elements of each cell in one block, and so skips categorizing the rows, but it
+         * still inserts every element in the in-memory cells and index: it is linear in the number of
+         * elements, not a memory map of the file. The filters are evaluated for the rows left out.
+         * @param restored if not null, set to true if the cells were read from device
+         */
+        static Datacube* load(QIODevice* device, const QByteArray& fingerprint,
+                const QAbstractItemModel* model,
+                const Aggregators& row_aggregators,
+                const Aggregators& column_aggregators,
+                const Filters& filters = Filters(),
+                QObject* parent = 0,
+                bool* restored = 0);
+
     Q_SIGNALS:
         /**
          * rows are about to be removed
@@ -268,8 +381,14 @@ class QDATACUBE_EXPORT Datacube : public QObject {
          */
         void headersChanged(Qt::Orientation, int first, int last);
 
+        /**
+         * The values in the cells from topRow, leftColumn to bottomRow, rightColumn (inclusive) have changed
+         */
+        void dataChanged(int topRow, int leftColumn, int bottomRow, int rightColumn);
+
         /**
          * The value in cell has changed
+         * Kept for compatibility; only emitted if connected to. Prefer the range form above.
          */
         void dataChanged(int row,int column);
 
@@ -289,9 +408,18 @@ class QDATACUBE_EXPORT Datacube : public QObject {
         void filterChanged();
 
     private:
+        /**
+         * Construct datacube with aggregators and filters, but no elements
+         */
+        Datacube(const QAbstractItemModel* model,
+                const Aggregators& row_aggregators,
+                const Aggregators& column_aggregators,
+                const Filters& filters,
+                QObject* parent);
         QScopedPointer<DatacubePrivate> d;
         friend class DatacubeSelection;
         friend class DatacubeSelectionPrivate;
+        friend class DatacubePrivate;
 
 };
 }
@@ -3,9 +3,15 @@
 
 #include <QObject>
 #include <QSharedPointer>
+#include <QDataStream>
+#include <QVector>
 
+#include "bitset.h"
 #include "cell.h"
 #include "datacube.h"
+#include "datacubestatistics.h"
+
+#include <QElapsedTimer>
 
 class QAbstractItemModel;
 namespace qdatacube {
@@ -14,6 +20,34 @@ class DatacubeSelection;
 
 namespace qdatacube {
 
+#ifndef QDATACUBE_NO_STATISTICS
+/**
+ * Add the time spent in the enclosing scope to statistics, if they are enabled
+ */
+class StatisticsTimer {
+    public:
+        StatisticsTimer(DatacubeStatistics* statistics, DatacubeStatistics::Timing timing) : m_statistics(statistics), m_timing(timing) {
+            if (m_statistics) {
+                m_timer.start();
+            }
+        }
+        ~StatisticsTimer() {
+            if (m_statistics) {
+                m_statistics->addTiming(m_timing, m_timer.nsecsElapsed());
+            }
+        }
+    private:
+        DatacubeStatistics* m_statistics;
+        DatacubeStatistics::Timing m_timing;
+        QElapsedTimer m_timer;
+};
+#define QDATACUBE_COUNT(d, counter, amount) do { if ((d)->statistics) { (d)->statistics->count(DatacubeStatistics::counter, amount); } } while (0)
+#define QDATACUBE_TIME(d, timing) StatisticsTimer statistics_timer((d)->statistics.data(), DatacubeStatistics::timing)
+#else
+#define QDATACUBE_COUNT(d, counter, amount) do {} while (0)
+#define QDATACUBE_TIME(d, timing) do {} while (0)
+#endif
+
 struct CellPoint {
     long row;
     long column;
@@ -27,6 +61,7 @@ class DatacubePrivate : public QObject {
                 AbstractAggregator::Ptr row_aggregator,
                 AbstractAggregator::Ptr column_aggregator);
         DatacubePrivate(Datacube* datacube, const QAbstractItemModel* model);
+        ~DatacubePrivate();
         Datacube* q;
         int computeRowBucketForIndex(int index) {
             return computeBucketForIndex(Qt::Vertical, index);
@@ -37,6 +72,10 @@ class DatacubePrivate : public QObject {
         int computeBucketForIndex(Qt::Orientation orientation, int index);
         const QList<int>& cell(long int bucket_row, long int bucket_column) const;
         int hasCell(long int bucket_row, long int bucket_column) const;
+        /**
+        * @return number of elements in bucket, without copying the cell
+        */
+        int cell_count(long int bucket_row, long int bucket_column) const;
         void setCell(long int bucket_row, long int bucket_column, const QList< int >& cell_content);
         void setCell(qdatacube::CellPoint point, const QList< int >& cell_content);
         void cellAppend(long int bucket_row, long int bucket_column, int to_add);
@@ -56,10 +95,251 @@ class DatacubePrivate : public QObject {
         QVector<unsigned> row_counts; // list counting number of items in each row indexed by bucket number
         QVector<unsigned> col_counts;
         Datacube::Filters filters;
+
+        /**
+        * Cached result of a filter for each row. A row's result is known if its bit in evaluated is set.
+        * Rows are evaluated lazily, but a row not evaluated by a filter is always excluded by another filter
+        * that was evaluated for it.
+        */
+        struct FilterResults {
+            explicit FilterResults(int nrows = 0) : evaluated(nrows), included(nrows) {}
+            Bitset evaluated;
+            Bitset included;
+        };
+        QVector<FilterResults> filter_results; // parallel to filters
+
+        /**
+        * Filter changes, or aggregator changes moving elements, touching more elements than this are applied
+        * as a reset, rather than signalled per element
+        */
+        static const int filter_reset_threshold = 100;
+        bool signals_blocked; // set while applying a filter change as a reset
+        bool reorder_pending; // set when a sorted header changed order during a batch, see header_reordered()
         typedef QHash<long, QList<int> > cells_t;
         cells_t cells; // maps from cell index (computed from bucket coordinates) to lists of indexes in underlying model
         typedef QHash<int, Cell> reverse_index_t;
         reverse_index_t reverse_index; // maps from underlying model index to coordinates in datacube (in buckets)
+        quint64 generation; // incremented on every change to cells, counts or headers
+        typedef QVector<QVector<QVariant> > categories_t;
+        mutable categories_t row_categories; // header data for each category of each aggregator, empty if stale
+        mutable categories_t col_categories;
+        QScopedPointer<DatacubeStatistics> statistics; // null unless enabled
+
+        /**
+        * Order of the categories of a header by a measure, see Datacube::sortHeader(). Sections are laid out
+        * by position, the bucket number computed from the positions of the categories rather than the
+        * categories themselves, so sorting never moves elements between buckets.
+        */
+        struct HeaderOrder {
+            HeaderOrder() : sorted(false), order(Qt::AscendingOrder), section(-1), role(Qt::DisplayRole) {}
+            /**
+            * @return true if category lhs goes before category rhs
+            */
+            bool before(int lhs, int rhs) const;
+            /**
+            * Move category to its place after its measure changed
+            * @return true if it moved
+            */
+            bool reposition(int category);
+            bool sorted;
+            Qt::SortOrder order;
+            int section; // column of the model summed, or -1 to count elements
+            int role;
+            QVector<double> measures; // per category
+            QVector<int> categories; // category at each position
+            QVector<int> positions; // position of each category
+            QVector<double> values; // value of each row of the model as added, when summing
+        };
+        typedef QVector<HeaderOrder> header_orders_t;
+        header_orders_t row_orders; // parallel to row_aggregators
+        header_orders_t col_orders;
+        mutable QVector<unsigned> row_section_counts; // row_counts by position while sorted, empty if stale
+        mutable QVector<unsigned> col_section_counts;
+
+        /**
+        * Sections of a header hidden by a measure, see Datacube::filterHeader(). The measures are kept per
+        * group: a category of the header within a section of the headers before it, numbered as the bucket
+        * divided by the number of buckets of the headers after it.
+        */
+        struct HeaderFilter {
+            HeaderFilter() : active(false), minimum(0.0), maximum(0.0), top_count(0), order(Qt::DescendingOrder), section(-1), role(Qt::DisplayRole) {}
+            /**
+            * @return true if group lhs goes before group rhs when picking the top_count groups
+            */
+            bool before(int lhs, int rhs) const;
+            bool active;
+            double minimum;
+            double maximum;
+            int top_count; // groups kept within each section of the headers before, or 0 to keep all
+            Qt::SortOrder order;
+            int section; // column of the model summed, or -1 to count elements
+            int role;
+            QVector<double> measures; // per group
+            QVector<double> values; // value of each row of the model as added, when summing
+            Bitset hidden; // per group
+        };
+        typedef QVector<HeaderFilter> header_filters_t;
+        header_filters_t row_header_filters; // parallel to row_aggregators
+        header_filters_t col_header_filters;
+        QVector<unsigned> row_shown_counts; // row_counts without elements in hidden sections, empty unless hiding
+        QVector<unsigned> col_shown_counts;
+        bool header_filters_dirty; // set when the measure of a filtered header changed since hide_sections()
+
+        /**
+        * @return true if any header in orientation is sorted
+        */
+        bool sorted(Qt::Orientation orientation) const;
+
+        /**
+        * @return true if any header in orientation is filtered
+        */
+        bool filtering(Qt::Orientation orientation) const;
+
+        /**
+        * @return true if any header is filtered, so some sections may be hidden
+        */
+        bool hiding() const {
+          return filtering(Qt::Vertical) || filtering(Qt::Horizontal);
+        }
+
+        /**
+        * @return true if bucket in orientation is in a section hidden by a filtered header
+        */
+        bool bucket_hidden(Qt::Orientation orientation, int bucket) const;
+
+        /**
+        * @return true if the elements of the cell at bucket_row, bucket_column are shown
+        */
+        bool cell_shown(int bucket_row, int bucket_column) const {
+          return !bucket_hidden(Qt::Vertical, bucket_row) && !bucket_hidden(Qt::Horizontal, bucket_column);
+        }
+
+        /**
+        * @return counts in orientation indexed by bucket, leaving out the elements in hidden sections
+        */
+        const QVector<unsigned>& shown_counts(Qt::Orientation orientation) const {
+          if (orientation == Qt::Horizontal) {
+            return col_shown_counts.isEmpty() ? col_counts : col_shown_counts;
+          }
+          return row_shown_counts.isEmpty() ? row_counts : row_shown_counts;
+        }
+
+        /**
+        * @return position of bucket in orientation, the bucket itself unless sorted
+        */
+        int bucket_position(Qt::Orientation orientation, int bucket) const;
+
+        /**
+        * @return bucket at position in orientation
+        */
+        int position_bucket(Qt::Orientation orientation, int position) const;
+
+        /**
+        * @return shown counts in orientation indexed by position: the counts themselves unless sorted,
+        * otherwise cached until forget_section_counts()
+        */
+        const QVector<unsigned>& section_counts(Qt::Orientation orientation) const;
+
+        /**
+        * Drop the cached counts by position in orientation, after the order of a sorted header changed
+        */
+        void forget_section_counts(Qt::Orientation orientation) {
+          (orientation == Qt::Horizontal ? col_section_counts : row_section_counts).clear();
+        }
+
+        /**
+        * Recompute the measures and the order of the sorted headers in orientation from the elements
+        */
+        void sort_headers(Qt::Orientation orientation);
+
+        /**
+        * Add sign times element, in cell, to the measures of the sorted headers
+        * @return true if the order of some header changed
+        */
+        bool update_header_orders(int element, const Cell& cell, int sign);
+
+        /**
+        * Re-read the value of element, staying in cell, for the sorted headers summing a column in
+        * first_column..last_column
+        * @return true if the order of some header changed
+        */
+        bool refresh_header_values(int element, const Cell& cell, int first_column, int last_column);
+
+        /**
+        * Recompute the measures of the filtered headers in orientation from the elements
+        */
+        void measure_header_filters(Qt::Orientation orientation);
+
+        /**
+        * Add sign times element, in bucket of orientation, to the measures of the filtered headers
+        */
+        void measure_element(Qt::Orientation orientation, int element, int bucket, int sign);
+
+        /**
+        * Add sign times element, in cell, to the measures of the filtered headers. The sections hidden are
+        * updated at the end of the batch
+        */
+        void update_header_filters(int element, const Cell& cell, int sign) {
+          measure_element(Qt::Vertical, element, cell.row(), sign);
+          measure_element(Qt::Horizontal, element, cell.column(), sign);
+        }
+
+        /**
+        * Re-read the value of element, staying in cell, for the filtered headers summing a column in
+        * first_column..last_column
+        */
+        void refresh_header_filter_values(int element, const Cell& cell, int first_column, int last_column);
+
+        /**
+        * @return the groups hidden by each filtered header in orientation, from their measures
+        */
+        QVector<Bitset> hidden_groups(Qt::Orientation orientation) const;
+
+        /**
+        * Hide the sections failing the filters of their headers, and recount the shown counts. Unless resetting,
+        * i.e. between aboutToBeReset() and reset(), a change to the hidden sections goes through
+        * header_reordered() like a change of order
+        */
+        void hide_sections(bool resetting);
+
+        /**
+        * Recount row_shown_counts and col_shown_counts from the cells
+        */
+        void count_shown();
+
+        /**
+        * Note that a sorted header changed order while changing elements. The first time in a batch, emits
+        * aboutToBeReset() and blocks the per element signals for the rest of the batch
+        */
+        void header_reordered();
+
+        /**
+        * End a batch of element changes, emitting reset() if a sorted header changed order or a filtered
+        * header hides other sections after it
+        */
+        void end_batch();
+
+        /**
+        * Note a change to cells or counts
+        */
+        void bump_generation() {
+            ++generation;
+        }
+
+        /**
+        * Note a change to the aggregators or their categories
+        */
+        void headers_changed();
+
+        /**
+        * @return header data for the categories of the aggregators in orientation, cached until headers_changed()
+        */
+        const categories_t& categories(Qt::Orientation orientation) const;
+
+        /**
+        * @return heap used by the structures of this datacube, see Datacube::memoryUsage()
+        */
+        MemoryUsage memory_usage() const;
 
         void remove(int index);
         void add(int index);
@@ -113,9 +393,48 @@ class DatacubePrivate : public QObject {
         void add_selection_model(DatacubeSelection* selection);
 
         /**
-        * @returns true if included by the current set of filters
+        * @returns true if included by the current set of filters, evaluating the filters not cached for element
+        */
+        bool filtered_in(int element);
+
+        /**
+        * @return result of filter number index for row, evaluated if not cached
+        */
+        bool filter_result(int index, int row);
+
+        /**
+        * Drop the cached filter results for row, e.g. because its data changed
+        */
+        void forget_filter_results(int row);
+
+        /**
+        * @return the rows excluded by some filter
+        */
+        Bitset excluded_rows() const;
+
+        /**
+        * Remove the removed rows, then add the added rows, after a filter change or rows changing category;
+        * a row in both moves. Signals per element or, for changes to more than filter_reset_threshold
+        * elements, by a reset
+        */
+        void apply_changes(const Bitset& removed, const Bitset& added);
+
+        /**
+        * Emit dataChanged for the rectangle, and for each cell in it if anyone listens to the per-cell signal
+        */
+        void emit_data_changed(int top_row, int left_column, int bottom_row, int right_column);
+
+        /**
+        * Write cells and headers to stream, see Datacube::save()
+        */
+        void save(QDataStream& stream, const QByteArray& fingerprint) const;
+
+        /**
+        * Read cells from stream if it matches fingerprint and the current aggregators and filters, and every
+        * row left out of the cells is filtered out.
+        * @return false, leaving the datacube unchanged, if it did not match or could not be read
         */
-        bool filtered_in(int element) const;
+        bool restore(QDataStream& stream, const QByteArray& fingerprint);
     public Q_SLOTS:
         void update_data(QModelIndex topleft, QModelIndex bottomRight);
         void remove_data(QModelIndex parent, int start, int end);
@@ -124,7 +443,10 @@ class DatacubePrivate : public QObject {
         void slot_rows_changed(int row, int count);
         void slot_aggregator_category_added(int index);
         void slot_aggregator_category_removed(int);
+        void slot_aggregator_rows_recategorized(const qdatacube::Bitset& rows);
+        void slot_aggregator_header_data_changed();
         void remove_selection_model(QObject* selection_model);
+        void slot_filter_results_changed(const qdatacube::Bitset& rows);
 };
 
 }
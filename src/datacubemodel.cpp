@@ -0,0 +1,504 @@
+#include "datacubemodel.h"
+#include "datacube.h"
+#include "abstractaggregator.h"
+#include "abstractformatter.h"
+
+#include <QCache>
+#include <QRect>
+#include <QStringList>
+#include <QTimer>
+
+namespace qdatacube {
+
+class DatacubeModelPrivate : public QObject {
+    Q_OBJECT
+    public:
+        /**
+         * A row or column insert or remove, as reported by the datacube
+         */
+        struct StructuralChange {
+            enum Type {
+                None,
+                Insert,
+                Remove
+            };
+            StructuralChange() : type(None), orientation(Qt::Vertical), first(0), count(0), done(false), mapped(false) {}
+            StructuralChange(Type type, Qt::Orientation orientation, int first, int count)
+              : type(type), orientation(orientation), first(first), count(count), done(false), mapped(false) {}
+            bool matches(const StructuralChange& other) const {
+                return type == other.type && orientation == other.orientation && first == other.first && count == other.count;
+            }
+            Type type;
+            Qt::Orientation orientation;
+            int first;
+            int count;
+            bool done; // The datacube has made the change
+            bool mapped; // The datacube has made the change, but the model has not announced it yet
+        };
+
+        DatacubeModelPrivate(DatacubeModel* q);
+        DatacubeModel* q;
+        Datacube* datacube;
+        QList<AbstractFormatter*> formatters;
+        // Size as announced to the views, which lags behind the datacube's while changes are forwarded
+        int nrows;
+        int ncolumns;
+        // Datacube announces a row and a column change interleaved when an element creates or empties
+        // both; the model announces the second after the first has ended.
+        StructuralChange active;
+        StructuralChange queued;
+        bool resetting;
+        QRect changed_cells; // x is column, y is row
+        QTimer* flush_timer;
+        mutable QCache<quint64, QStringList> cell_cache;
+        static const int cell_cache_size = 64 * 1024;
+
+        /**
+         * @return datacube section for model section, or -1 if the section is already removed from the datacube
+         */
+        int to_cube_section(Qt::Orientation orientation, int section) const;
+
+        /**
+         * @return formatted values for model cell row, column, which is cube_row, cube_column in the datacube
+         */
+        QStringList formatted_values(int row, int column, int cube_row, int cube_column) const;
+
+        void about_to_change(const StructuralChange& change);
+        void changed(const StructuralChange& change);
+        void begin_change(const StructuralChange& change);
+        void end_change(const StructuralChange& change);
+
+        /**
+         * Record cells as changed, to be reported at next flush
+         */
+        void mark_changed(int top_row, int left_column, int bottom_row, int right_column);
+        void connect_datacube();
+    public Q_SLOTS:
+        void rows_about_to_be_inserted(int index, int count);
+        void rows_inserted(int index, int count);
+        void rows_about_to_be_removed(int index, int count);
+        void rows_removed(int index, int count);
+        void columns_about_to_be_inserted(int index, int count);
+        void columns_inserted(int index, int count);
+        void columns_about_to_be_removed(int index, int count);
+        void columns_removed(int index, int count);
+        void about_to_be_reset();
+        void reset();
+        void cells_changed(int top_row, int left_column, int bottom_row, int right_column);
+        void headers_changed(Qt::Orientation orientation, int first, int last);
+        void elements_changed(const QModelIndex& top_left, const QModelIndex& bottom_right);
+        void formatter_changed();
+        void datacube_deleted();
+        void flush_changed_cells();
+};
+
+DatacubeModelPrivate::DatacubeModelPrivate(DatacubeModel* q)
+  : QObject(),
+    q(q),
+    datacube(0),
+    nrows(0),
+    ncolumns(0),
+    resetting(false),
+    flush_timer(new QTimer(this)),
+    cell_cache(cell_cache_size)
+{
+  flush_timer->setSingleShot(true);
+  flush_timer->setInterval(0);
+  connect(flush_timer, SIGNAL(timeout()), SLOT(flush_changed_cells()));
+}
+
+int DatacubeModelPrivate::to_cube_section(Qt::Orientation orientation, int section) const {
+  const StructuralChange* pending[] = { &active, &queued };
+  for (int i = 0; i < 2; ++i) {
+    const StructuralChange& change = *pending[i];
+    if (!change.mapped || change.orientation != orientation || section < change.first) {
+      continue;
+    }
+    if (change.type == StructuralChange::Insert) {
+      section += change.count;
+    } else if (change.type == StructuralChange::Remove) {
+      if (section < change.first + change.count) {
+        return -1;
+      }
+      section -= change.count;
+    }
+  }
+  return section;
+}
+
+QStringList DatacubeModelPrivate::formatted_values(int row, int column, int cube_row, int cube_column) const {
+  const quint64 key = (quint64(row) << 32) | quint32(column);
+  if (const QStringList* values = cell_cache.object(key)) {
+    return *values;
+  }
+  QStringList* values = new QStringList();
+  const QList<int> elements = datacube->elements(cube_row, cube_column);
+  if (!elements.isEmpty()) {
+    Q_FOREACH(const AbstractFormatter* formatter, formatters) {
+      *values << formatter->format(elements);
+    }
+  }
+  const QStringList rv = *values;
+  cell_cache.insert(key, values);
+  return rv;
+}
+
+void DatacubeModelPrivate::begin_change(const StructuralChange& change) {
+  cell_cache.clear();
+  if (change.orientation == Qt::Vertical) {
+    if (change.type == StructuralChange::Insert) {
+      q->beginInsertRows(QModelIndex(), change.first, change.first + change.count - 1);
+    } else {
+      q->beginRemoveRows(QModelIndex(), change.first, change.first + change.count - 1);
+    }
+  } else {
+    if (change.type == StructuralChange::Insert) {
+      q->beginInsertColumns(QModelIndex(), change.first, change.first + change.count - 1);
+    } else {
+      q->beginRemoveColumns(QModelIndex(), change.first, change.first + change.count - 1);
+    }
+  }
+}
+
+void DatacubeModelPrivate::end_change(const StructuralChange& change) {
+  cell_cache.clear();
+  const int delta = change.type == StructuralChange::Insert ? change.count : -change.count;
+  if (change.orientation == Qt::Vertical) {
+    nrows += delta;
+    if (change.type == StructuralChange::Insert) {
+      q->endInsertRows();
+    } else {
+      q->endRemoveRows();
+    }
+  } else {
+    ncolumns += delta;
+    if (change.type == StructuralChange::Insert) {
+      q->endInsertColumns();
+    } else {
+      q->endRemoveColumns();
+    }
+  }
+}
+
+void DatacubeModelPrivate::about_to_change(const StructuralChange& change) {
+  if (resetting) {
+    return;
+  }
+  flush_changed_cells();
+  if (active.type == StructuralChange::None) {
+    active = change;
+    begin_change(active);
+  } else if (queued.type == StructuralChange::None) {
+    queued = change;
+    queued.mapped = true;
+  } else {
+    qWarning("DatacubeModel: Unexpected overlapping changes in datacube");
+  }
+}
+
+void DatacubeModelPrivate::changed(const StructuralChange& change) {
+  if (resetting) {
+    return;
+  }
+  if (queued.matches(change)) {
+    queued.done = true;
+    return;
+  }
+  if (!active.matches(change)) {
+    // Not announced by datacube, so we do not know what the views have seen. Start over.
+    reset();
+    return;
+  }
+  active.mapped = false;
+  end_change(active);
+  active = queued;
+  queued = StructuralChange();
+  if (active.type != StructuralChange::None) {
+    // The datacube has already made this change, so the model keeps mapping sections until it is announced
+    begin_change(active);
+    if (active.done) {
+      active.mapped = false;
+      end_change(active);
+      active = StructuralChange();
+    }
+  }
+}
+
+void DatacubeModelPrivate::rows_about_to_be_inserted(int index, int count) {
+  about_to_change(StructuralChange(StructuralChange::Insert, Qt::Vertical, index, count));
+}
+
+void DatacubeModelPrivate::rows_inserted(int index, int count) {
+  changed(StructuralChange(StructuralChange::Insert, Qt::Vertical, index, count));
+}
+
+void DatacubeModelPrivate::rows_about_to_be_removed(int index, int count) {
+  about_to_change(StructuralChange(StructuralChange::Remove, Qt::Vertical, index, count));
+}
+
+void DatacubeModelPrivate::rows_removed(int index, int count) {
+  changed(StructuralChange(StructuralChange::Remove, Qt::Vertical, index, count));
+}
+
+void DatacubeModelPrivate::columns_about_to_be_inserted(int index, int count) {
+  about_to_change(StructuralChange(StructuralChange::Insert, Qt::Horizontal, index, count));
+}
+
+void DatacubeModelPrivate::columns_inserted(int index, int count) {
+  changed(StructuralChange(StructuralChange::Insert, Qt::Horizontal, index, count));
+}
+
+void DatacubeModelPrivate::columns_about_to_be_removed(int index, int count) {
+  about_to_change(StructuralChange(StructuralChange::Remove, Qt::Horizontal, index, count));
+}
+
+void DatacubeModelPrivate::columns_removed(int index, int count) {
+  changed(StructuralChange(StructuralChange::Remove, Qt::Horizontal, index, count));
+}
+
+void DatacubeModelPrivate::about_to_be_reset() {
+  if (!resetting) {
+    resetting = true;
+    q->beginResetModel();
+  }
+}
+
+void DatacubeModelPrivate::reset() {
+  // Datacube emits reset() without aboutToBeReset() when categories are added or removed
+  if (!resetting) {
+    q->beginResetModel();
+  }
+  resetting = false;
+  active = StructuralChange();
+  queued = StructuralChange();
+  changed_cells = QRect();
+  cell_cache.clear();
+  nrows = datacube ? datacube->rowCount() : 0;
+  ncolumns = datacube ? datacube->columnCount() : 0;
+  q->endResetModel();
+}
+
+void DatacubeModelPrivate::mark_changed(int top_row, int left_column, int bottom_row, int right_column) {
+  changed_cells |= QRect(left_column, top_row, right_column - left_column + 1, bottom_row - top_row + 1);
+  flush_timer->start();
+}
+
+void DatacubeModelPrivate::cells_changed(int top_row, int left_column, int bottom_row, int right_column) {
+  if (resetting || active.type != StructuralChange::None) {
+    // The structural change will be announced
+    return;
+  }
+  if ((bottom_row - top_row + 1) * (right_column - left_column + 1) > cell_cache.count()) {
+    cell_cache.clear();
+  } else {
+    for (int row = top_row; row <= bottom_row; ++row) {
+      for (int column = left_column; column <= right_column; ++column) {
+        cell_cache.remove((quint64(row) << 32) | quint32(column));
+      }
+    }
+  }
+  mark_changed(top_row, left_column, bottom_row, right_column);
+}
+
+void DatacubeModelPrivate::headers_changed(Qt::Orientation orientation, int first, int last) {
+  if (resetting || active.type != StructuralChange::None) {
+    return;
+  }
+  emit q->headerDataChanged(orientation, first, last);
+}
+
+void DatacubeModelPrivate::elements_changed(const QModelIndex& top_left, const QModelIndex& bottom_right) {
+  // Formatters typically show data from columns the datacube does not aggregate on, so the cube itself
+  // will not report these changes.
+  if (!datacube || formatters.isEmpty() || top_left.parent().isValid() || nrows == 0 || ncolumns == 0) {
+    return;
+  }
+  if (bottom_right.row() - top_left.row() >= 64) {
+    formatter_changed();
+    return;
+  }
+  for (int element = top_left.row(); element <= bottom_right.row(); ++element) {
+    const int row = datacube->sectionForElement(element, Qt::Vertical);
+    const int column = datacube->sectionForElement(element, Qt::Horizontal);
+    if (row >= 0 && column >= 0) {
+      cells_changed(row, column, row, column);
+    }
+  }
+}
+
+void DatacubeModelPrivate::formatter_changed() {
+  cell_cache.clear();
+  if (nrows > 0 && ncolumns > 0) {
+    mark_changed(0, 0, nrows - 1, ncolumns - 1);
+  }
+}
+
+void DatacubeModelPrivate::flush_changed_cells() {
+  flush_timer->stop();
+  const QRect cells = changed_cells & QRect(0, 0, ncolumns, nrows);
+  changed_cells = QRect();
+  if (!cells.isEmpty()) {
+    emit q->dataChanged(q->index(cells.top(), cells.left()), q->index(cells.bottom(), cells.right()));
+  }
+}
+
+void DatacubeModelPrivate::datacube_deleted() {
+  q->beginResetModel();
+  datacube = 0;
+  resetting = false;
+  active = StructuralChange();
+  queued = StructuralChange();
+  changed_cells = QRect();
+  cell_cache.clear();
+  nrows = 0;
+  ncolumns = 0;
+  q->endResetModel();
+}
+
+void DatacubeModelPrivate::connect_datacube() {
+  connect(datacube, SIGNAL(destroyed(QObject*)), SLOT(datacube_deleted()));
+  connect(datacube, SIGNAL(rowsAboutToBeInserted(int,int)), SLOT(rows_about_to_be_inserted(int,int)));
+  connect(datacube, SIGNAL(rowsInserted(int,int)), SLOT(rows_inserted(int,int)));
+  connect(datacube, SIGNAL(rowsAboutToBeRemoved(int,int)), SLOT(rows_about_to_be_removed(int,int)));
+  connect(datacube, SIGNAL(rowsRemoved(int,int)), SLOT(rows_removed(int,int)));
+  connect(datacube, SIGNAL(columnsAboutToBeInserted(int,int)), SLOT(columns_about_to_be_inserted(int,int)));
+  connect(datacube, SIGNAL(columnsInserted(int,int)), SLOT(columns_inserted(int,int)));
+  connect(datacube, SIGNAL(columnsAboutToBeRemoved(int,int)), SLOT(columns_about_to_be_removed(int,int)));
+  connect(datacube, SIGNAL(columnsRemoved(int,int)), SLOT(columns_removed(int,int)));
+  connect(datacube, SIGNAL(aboutToBeReset()), SLOT(about_to_be_reset()));
+  connect(datacube, SIGNAL(reset()), SLOT(reset()));
+  connect(datacube, SIGNAL(dataChanged(int,int,int,int)), SLOT(cells_changed(int,int,int,int)));
+  connect(datacube, SIGNAL(headersChanged(Qt::Orientation,int,int)), SLOT(headers_changed(Qt::Orientation,int,int)));
+  connect(datacube->underlyingModel(), SIGNAL(dataChanged(QModelIndex,QModelIndex)), SLOT(elements_changed(QModelIndex,QModelIndex)));
+}
+
+DatacubeModel::DatacubeModel(Datacube* datacube, QObject* parent)
+  : QAbstractTableModel(parent),
+    d(new DatacubeModelPrivate(this))
+{
+  setDatacube(datacube);
+}
+
+DatacubeModel::~DatacubeModel() {
+  // Need to declare here so DatacubeModelPrivate's destructor is visible
+}
+
+void DatacubeModel::setDatacube(Datacube* datacube) {
+  beginResetModel();
+  if (d->datacube) {
+    d->datacube->disconnect(d.data());
+    d->datacube->underlyingModel()->disconnect(d.data());
+  }
+  d->datacube = datacube;
+  d->resetting = false;
+  d->active = DatacubeModelPrivate::StructuralChange();
+  d->queued = DatacubeModelPrivate::StructuralChange();
+  d->changed_cells = QRect();
+  d->cell_cache.clear();
+  d->nrows = datacube ? datacube->rowCount() : 0;
+  d->ncolumns = datacube ? datacube->columnCount() : 0;
+  if (datacube) {
+    d->connect_datacube();
+  }
+  endResetModel();
+}
+
+Datacube* DatacubeModel::datacube() const {
+  return d->datacube;
+}
+
+void DatacubeModel::addFormatter(AbstractFormatter* formatter) {
+  beginResetModel();
+  d->formatters << formatter;
+  formatter->setParent(this);
+  connect(formatter, SIGNAL(formatterChanged()), d.data(), SLOT(formatter_changed()));
+  d->cell_cache.clear();
+  endResetModel();
+}
+
+AbstractFormatter* DatacubeModel::takeFormatter(int index) {
+  beginResetModel();
+  AbstractFormatter* formatter = d->formatters.takeAt(index);
+  disconnect(formatter, SIGNAL(formatterChanged()), d.data(), SLOT(formatter_changed()));
+  formatter->setParent(0);
+  d->cell_cache.clear();
+  endResetModel();
+  return formatter;
+}
+
+QList< AbstractFormatter* > DatacubeModel::formatters() const {
+  return d->formatters;
+}
+
+int DatacubeModel::rowCount(const QModelIndex& parent) const {
+  return parent.isValid() ? 0 : d->nrows;
+}
+
+int DatacubeModel::columnCount(const QModelIndex& parent) const {
+  return parent.isValid() ? 0 : d->ncolumns;
+}
+
+QVariant DatacubeModel::data(const QModelIndex& index, int role) const {
+  if (!d->datacube || !index.isValid() || index.row() >= d->nrows || index.column() >= d->ncolumns) {
+    return QVariant();
+  }
+  const int row = d->to_cube_section(Qt::Vertical, index.row());
+  const int column = d->to_cube_section(Qt::Horizontal, index.column());
+  if (row < 0 || column < 0) {
+    return QVariant();
+  }
+  switch (role) {
+    case Qt::DisplayRole: {
+      const QStringList values = d->formatted_values(index.row(), index.column(), row, column);
+      return values.isEmpty() ? QVariant() : values.join("\n");
+    }
+    case Qt::TextAlignmentRole:
+      return int(Qt::AlignCenter);
+    case ElementCountRole:
+      return d->datacube->elementCount(row, column);
+  }
+  if (role >= FormatterRole && role < FormatterRole + d->formatters.size()) {
+    const QStringList values = d->formatted_values(index.row(), index.column(), row, column);
+    return values.isEmpty() ? QVariant() : values.at(role - FormatterRole);
+  }
+  return QVariant();
+}
+
+QVariant DatacubeModel::headerData(int section, Qt::Orientation orientation, int role) const {
+  if (!d->datacube || section < 0 || section >= (orientation == Qt::Vertical ? d->nrows : d->ncolumns)) {
+    return QVariant();
+  }
+  const int cube_section = d->to_cube_section(orientation, section);
+  const int nheaders = d->datacube->headerCount(orientation);
+  if (cube_section < 0 || nheaders == 0) {
+    return QVariant();
+  }
+  const Datacube::Aggregators aggregators = orientation == Qt::Vertical ? d->datacube->rowAggregators() : d->datacube->columnAggregators();
+  if (role == HeaderCategoriesRole || role == Qt::ToolTipRole) {
+    QStringList categories;
+    for (int header = 0; header < nheaders; ++header) {
+      const int category = d->datacube->categoryIndex(orientation, header, cube_section);
+      categories << aggregators.at(header)->categoryHeaderData(category).toString();
+    }
+    return role == HeaderCategoriesRole ? QVariant(categories) : QVariant(categories.join(" / "));
+  }
+  if (role == Qt::TextAlignmentRole) {
+    return int(Qt::AlignCenter);
+  }
+  const int category = d->datacube->categoryIndex(orientation, nheaders - 1, cube_section);
+  return aggregators.last()->categoryHeaderData(category, role);
+}
+
+QHash< int, QByteArray > DatacubeModel::roleNames() const {
+  QHash<int, QByteArray> names = QAbstractTableModel::roleNames();
+  names.insert(ElementCountRole, "elementCount");
+  names.insert(HeaderCategoriesRole, "headerCategories");
+  for (int i = 0; i < d->formatters.size(); ++i) {
+    names.insert(FormatterRole + i, QString("formatter%1").arg(i).toLatin1());
+  }
+  return names;
+}
+
+}
+
+#include "datacubemodel.moc"
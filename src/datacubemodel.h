@@ -0,0 +1,90 @@
+#ifndef QDATACUBE_DATACUBEMODEL_H
+#define QDATACUBE_DATACUBEMODEL_H
+
+#include "qdatacube_export.h"
+
+#include <QAbstractTableModel>
+
+namespace qdatacube {
+class AbstractFormatter;
+class Datacube;
+class DatacubeModelPrivate;
+}
+
+namespace qdatacube {
+
+/**
+ * Table model presenting the cells of a datacube, for QTableView, QML and other item views
+ * where DatacubeView does not fit.
+ *
+ * The rows and columns of the model are the rows and columns of the datacube. A cell shows the
+ * values of the installed formatters, one per line in Qt::DisplayRole, and each in its own role
+ * from FormatterRole. Header data is taken from the innermost header's aggregator; all header levels
+ * are available through HeaderCategoriesRole.
+ *
+ * Rows and columns added or removed in the datacube are forwarded as inserts and removes. Changed
+ * cells are collected and reported as a single dataChanged() when control returns to the event loop.
+ * Formatted values are cached per cell.
+ */
+class QDATACUBE_EXPORT DatacubeModel : public QAbstractTableModel {
+    Q_OBJECT
+    public:
+        enum Roles {
+            /**
+             * Number of elements in cell (int)
+             */
+            ElementCountRole = Qt::UserRole,
+            /**
+             * Header data: the categories of all header levels for a section, outermost first (QStringList)
+             */
+            HeaderCategoriesRole,
+            /**
+             * Value from the first formatter (QString). Value from formatter n is in role FormatterRole+n
+             */
+            FormatterRole = Qt::UserRole + 16
+        };
+
+        /**
+         * @param datacube the datacube to present. Can be null, and set later with setDatacube()
+         */
+        explicit DatacubeModel(Datacube* datacube = 0, QObject* parent = 0);
+        virtual ~DatacubeModel();
+
+        /**
+         * Set datacube to present. The model is reset.
+         */
+        void setDatacube(Datacube* datacube);
+
+        /**
+         * @return the datacube presented
+         */
+        Datacube* datacube() const;
+
+        /**
+         * Add formatter. The model takes ownership of the formatter, and is reset as the roles change.
+         */
+        void addFormatter(AbstractFormatter* formatter);
+
+        /**
+         * Remove formatter at index, and transfer ownership to caller
+         */
+        AbstractFormatter* takeFormatter(int index);
+
+        /**
+         * @return the formatters, in role order
+         */
+        QList<AbstractFormatter*> formatters() const;
+
+        virtual int rowCount(const QModelIndex& parent = QModelIndex()) const;
+        virtual int columnCount(const QModelIndex& parent = QModelIndex()) const;
+        virtual QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const;
+        virtual QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const;
+        virtual QHash<int, QByteArray> roleNames() const;
+    private:
+        friend class DatacubeModelPrivate;
+        QScopedPointer<DatacubeModelPrivate> d;
+};
+
+}
+
+#endif // QDATACUBE_DATACUBEMODEL_H
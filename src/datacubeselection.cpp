@@ -10,15 +10,125 @@
 #include "cell.h"
 #include "datacube_p.h"
 #include "datacubeselection_p.h"
+#include "memoryusage_p.h"
 #include <QAbstractProxyModel>
+#include <QPointer>
+#include <QSortFilterProxyModel>
 #include <QDate>
 #include <QItemSelectionModel>
+#include <QRect>
 
 namespace qdatacube {
 
 
+bool DatacubeSelectionPrivate::ensure_mapping() {
+  if (mapping_valid) {
+    return true;
+  }
+  if (!synchronized_selection_model) {
+    return false;
+  }
+  // Only use tables for the chain of sort/filter proxies we watch, as they announce all changes to their mapping
+  const QAbstractItemModel* model = synchronized_selection_model->model();
+  const QAbstractItemModel* underlying_model = datacube->underlyingModel();
+  QList<const QSortFilterProxyModel*> proxies;
+  for (const QAbstractItemModel* m = model; m != underlying_model; ) {
+    const QSortFilterProxyModel* proxy = qobject_cast<const QSortFilterProxyModel*>(m);
+    if (!proxy || !watched_proxies.contains(proxy)) {
+      return false;
+    }
+    proxies << proxy;
+    m = proxy->sourceModel();
+  }
+  if (proxies.isEmpty()) {
+    // Rows are elements
+    return false;
+  }
+  const int nrows = model->rowCount();
+  proxy_to_source = QVector<int>(nrows, -1);
+  source_to_proxy = QVector<int>(underlying_model->rowCount(), -1);
+  for (int row = 0; row < nrows; ++row) {
+    QModelIndex index = model->index(row, 0);
+    Q_FOREACH(const QSortFilterProxyModel* proxy, proxies) {
+      index = proxy->mapToSource(index);
+    }
+    if (index.isValid()) {
+      proxy_to_source[row] = index.row();
+      source_to_proxy[index.row()] = row;
+    }
+  }
+  mapping_valid = true;
+  return true;
+}
+
+void DatacubeSelectionPrivate::invalidate_mapping() {
+  mapping_valid = false;
+  proxy_to_source.clear();
+  source_to_proxy.clear();
+}
+
+void DatacubeSelectionPrivate::proxy_destroyed(QObject* proxy) {
+  watched_proxies.removeAll(static_cast<const QSortFilterProxyModel*>(proxy));
+  invalidate_mapping();
+}
+
+void DatacubeSelectionPrivate::watch_proxies() {
+  Q_FOREACH(const QSortFilterProxyModel* proxy, watched_proxies) {
+    proxy->disconnect(this);
+  }
+  watched_proxies.clear();
+  Q_FOREACH(const QPointer<const QAbstractItemModel>& source, watched_sources) {
+    if (source) {
+      source->disconnect(this);
+    }
+  }
+  watched_sources.clear();
+  invalidate_mapping();
+  if (!synchronized_selection_model) {
+    return;
+  }
+  const QAbstractItemModel* underlying_model = datacube->underlyingModel();
+  for (const QAbstractItemModel* model = synchronized_selection_model->model(); model && model != underlying_model; ) {
+    const QSortFilterProxyModel* proxy = qobject_cast<const QSortFilterProxyModel*>(model);
+    if (!proxy) {
+      break;
+    }
+    watched_proxies << proxy;
+    connect(proxy, SIGNAL(layoutChanged()), SLOT(invalidate_mapping()));
+    connect(proxy, SIGNAL(modelReset()), SLOT(invalidate_mapping()));
+    connect(proxy, SIGNAL(rowsInserted(QModelIndex,int,int)), SLOT(invalidate_mapping()));
+    connect(proxy, SIGNAL(rowsRemoved(QModelIndex,int,int)), SLOT(invalidate_mapping()));
+    connect(proxy, SIGNAL(rowsMoved(QModelIndex,int,int,QModelIndex,int)), SLOT(invalidate_mapping()));
+    connect(proxy, SIGNAL(sourceModelChanged()), SLOT(watch_proxies()));
+    connect(proxy, SIGNAL(destroyed(QObject*)), SLOT(proxy_destroyed(QObject*)));
+    model = proxy->sourceModel();
+    if (!model) {
+      break;
+    }
+    // A proxy says nothing when rows it hides are inserted or removed, yet the rows after them are renumbered
+    // in its source. Watch the source too.
+    watched_sources << model;
+    connect(model, SIGNAL(layoutChanged()), SLOT(invalidate_mapping()));
+    connect(model, SIGNAL(modelReset()), SLOT(invalidate_mapping()));
+    connect(model, SIGNAL(rowsInserted(QModelIndex,int,int)), SLOT(invalidate_mapping()));
+    connect(model, SIGNAL(rowsRemoved(QModelIndex,int,int)), SLOT(invalidate_mapping()));
+    connect(model, SIGNAL(rowsMoved(QModelIndex,int,int,QModelIndex,int)), SLOT(invalidate_mapping()));
+  }
+}
+
 QList< int > DatacubeSelectionPrivate::elements_from_selection(QItemSelection selection) {
   QList<int> rv;
+  if (synchronized_selection_model && ensure_mapping()) {
+    Q_FOREACH(QItemSelectionRange range, selection) {
+      for (int row=range.top(); row<=range.bottom(); ++row) {
+        const int element = proxy_to_source.value(row, -1);
+        if (element >= 0) {
+          rv << element;
+        }
+      }
+    }
+    return rv;
+  }
   if (synchronized_selection_model) {
     // Create list of rows (that is, indexes of the first column)
     QList<QModelIndex> indexes;
@@ -53,51 +163,72 @@ QList< int > DatacubeSelectionPrivate::elements_from_selection(QItemSelection se
 
 }
 
-QItemSelection DatacubeSelectionPrivate::map_to_synchronized(QList< int > elements) {
-  QItemSelection selection;
-  if (synchronized_selection_model) {
-    // Get the reversed list of proxies to source model
-    const QAbstractItemModel* model = synchronized_selection_model->model();
-    const QAbstractItemModel* underlying_model = datacube->underlyingModel();
-    QList<const QAbstractProxyModel*> proxies;
-    while (model != underlying_model) {
-      if (const QAbstractProxyModel* proxy = qobject_cast<const QAbstractProxyModel*>(model)) {
-        proxies << proxy;
-        model = proxy->sourceModel();
-      } else {
-        qWarning("Unable to select on synchronized model");
-        return QItemSelection();
+QList< int > DatacubeSelectionPrivate::synchronized_rows(QList< int > elements) {
+  if (ensure_mapping()) {
+    QList<int> rows;
+    Q_FOREACH(int element, elements) {
+      const int row = source_to_proxy.value(element, -1);
+      if (row >= 0) {
+        rows << row;
       }
     }
-    std::reverse(proxies.begin(), proxies.end());
-
-    QList<int> rows = elements;
-
-    // Map from source to whatever proxy model the synchronized model
-    const QAbstractItemModel* last_model = model;
-    QList<int> proxy_rows;
-    Q_FOREACH(const QAbstractProxyModel* proxy, proxies) {
-      proxy_rows.clear();
-      Q_FOREACH(int row, rows) {
-        proxy_rows << proxy->mapFromSource(last_model->index(row,0)).row();
+    return rows;
+  }
+  // Get the reversed list of proxies to source model
+  const QAbstractItemModel* model = synchronized_selection_model->model();
+  const QAbstractItemModel* underlying_model = datacube->underlyingModel();
+  QList<const QAbstractProxyModel*> proxies;
+  while (model != underlying_model) {
+    if (const QAbstractProxyModel* proxy = qobject_cast<const QAbstractProxyModel*>(model)) {
+      proxies << proxy;
+      model = proxy->sourceModel();
+    } else {
+      qWarning("Unable to select on synchronized model");
+      return QList<int>();
+    }
+  }
+  std::reverse(proxies.begin(), proxies.end());
+
+  QList<int> rows = elements;
+
+  // Map from source to whatever proxy model the synchronized model
+  const QAbstractItemModel* last_model = model;
+  QList<int> proxy_rows;
+  Q_FOREACH(const QAbstractProxyModel* proxy, proxies) {
+    proxy_rows.clear();
+    Q_FOREACH(int row, rows) {
+      const int proxy_row = proxy->mapFromSource(last_model->index(row,0)).row();
+      if (proxy_row >= 0) {
+        proxy_rows << proxy_row;
       }
-      rows = proxy_rows;
-      last_model = proxy;
     }
+    rows = proxy_rows;
+    last_model = proxy;
+  }
+  return rows;
+}
+
+QItemSelection DatacubeSelectionPrivate::map_to_synchronized(QList< int > elements) {
+  QItemSelection selection;
+  if (synchronized_selection_model) {
+    QList<int> rows = synchronized_rows(elements);
     qSort(rows);
+    const QAbstractItemModel* model = synchronized_selection_model->model();
     const int last_column = model->columnCount()-1;
-    model = synchronized_selection_model->model();
+    // Coalesce into ranges of consecutive rows
     if (rows.size()>0) {
       int lastrow = rows.front();
       int start = lastrow;
       for (int i=1, iend=rows.size(); i<iend; ++i) {
-        ++lastrow;
         const int row = rows.at(i);
-        if ( row != lastrow) {
-          selection << QItemSelectionRange(model->index(start,0), model->index(lastrow-1, last_column));
+        if (row == lastrow) {
+          continue;
+        }
+        if (row != lastrow+1) {
+          selection << QItemSelectionRange(model->index(start,0), model->index(lastrow, last_column));
           start = row;
-          lastrow = row;
         }
+        lastrow = row;
       }
       selection << QItemSelectionRange(model->index(start,0), model->index(lastrow, last_column));
     }
@@ -110,10 +241,9 @@ void DatacubeSelectionPrivate::select_on_synchronized(QList<int> elements) {
     return;
   }
   if (synchronized_selection_model && !ignore_synchronized) {
-    // Select on sync. model
-    QItemSelection selection(map_to_synchronized(selected_elements.toList()));
+    // Select only what was added on sync. model
     ignore_synchronized = true;
-    synchronized_selection_model->select(selection, QItemSelectionModel::ClearAndSelect);
+    synchronized_selection_model->select(map_to_synchronized(elements), QItemSelectionModel::Select | QItemSelectionModel::Rows);
     ignore_synchronized = false;
   }
 
@@ -142,7 +272,8 @@ DatacubeSelectionPrivate::DatacubeSelectionPrivate(DatacubeSelection* datacubese
     synchronized_selection_model(0L),
     ignore_synchronized(false),
     nrows(0),
-    ncolumns(0)
+    ncolumns(0),
+    mapping_valid(false)
 {
 
 }
@@ -158,46 +289,89 @@ void DatacubeSelectionPrivate::dump() {
 }
 
 
-void DatacubeSelection::addElements(QList< int > elements) {
-  QList<int> actually_selected_elements;
+void DatacubeSelectionPrivate::update_cells(const Bitset& elements, int delta) {
+  // Count per bucket first, so each cell is checked and notified once
+  QHash<int, int> old_counts;
   Cell cell;
-  Q_FOREACH(int element, elements) {
-    if (!d->selected_elements.contains(element)) {
-      d->datacube->d->bucket_for_element(element, cell);
-      d->selected_elements << element;
-      actually_selected_elements << element;
-      if (!cell.invalid()) {
-        int newvalue = d->increaseCell(cell.row(), cell.column(),1);
-        if (newvalue == 1 || newvalue == d->datacube->d->elements_in_bucket(cell.row(), cell.column()).size()) {
-          const int row_section = d->datacube->d->section_for_bucket_row(cell.row());
-          const int column_section = d->datacube->d->section_for_bucket_column(cell.column());
-          emit selectionStatusChanged(row_section,column_section);
-        }
+  for (int element = elements.nextSetBit(0); element >= 0; element = elements.nextSetBit(element+1)) {
+    datacube->d->bucket_for_element(element, cell);
+    if (!cell.invalid()) {
+      const int index = cell.row() + cell.column()*nrows;
+      if (!old_counts.contains(index)) {
+        old_counts.insert(index, cells.at(index));
       }
+      cells[index] += delta;
+      Q_ASSERT(cells.at(index) >= 0);
     }
   }
-  d->select_on_synchronized(actually_selected_elements);
+  QVector<QPoint> changed_cells;
+  const QVector<int> row_sections = bucket_sections(Qt::Vertical);
+  const QVector<int> column_sections = bucket_sections(Qt::Horizontal);
+  for (QHash<int, int>::const_iterator it = old_counts.constBegin(), iend = old_counts.constEnd(); it != iend; ++it) {
+    const int bucket_row = it.key() % nrows;
+    const int bucket_column = it.key() / nrows;
+    const int count = datacube->d->cell_count(bucket_row, bucket_column);
+    if (status(it.value(), count) != status(cells.at(it.key()), count)) {
+      changed_cells << QPoint(column_sections.at(bucket_column), row_sections.at(bucket_row));
+    }
+  }
+  emit_status_changed(changed_cells);
 }
 
-void DatacubeSelection::removeElements(QList< int > elements) {
-  QList<int> actually_deselected_elements;
-  Cell cell;
-  Q_FOREACH(int element, elements) {
-    if (d->selected_elements.remove(element)) {
-      d->datacube->d->bucket_for_element(element, cell);
-      actually_deselected_elements << element;
-      if (!cell.invalid()) {
-        int newvalue = d->decreaseCell(cell.row(), cell.column());
-        Q_ASSERT(newvalue>=0);
-        if (newvalue == 0 || newvalue == d->datacube->d->elements_in_bucket(cell.row(), cell.column()).size()-1) {
-          const int row_section = d->datacube->d->section_for_bucket_row(cell.row());
-          const int column_section = d->datacube->d->section_for_bucket_column(cell.column());
-          emit selectionStatusChanged(row_section,column_section);
-        }
-      }
+QVector< int > DatacubeSelectionPrivate::bucket_sections(Qt::Orientation orientation) const {
+  // Sections follow the positions of the buckets, which differ from the buckets if headers are sorted
+  const QVector<unsigned> counts = datacube->d->section_counts(orientation);
+  QVector<int> rv(counts.size(), -1);
+  int section = 0;
+  for (int position = 0, npositions = counts.size(); position < npositions; ++position) {
+    if (counts.at(position) > 0) {
+      rv[datacube->d->position_bucket(orientation, position)] = section++;
+    }
+  }
+  return rv;
+}
+
+void DatacubeSelectionPrivate::emit_status_changed(const QVector<QPoint>& changed_cells) {
+  // Cells in sections hidden by Datacube::filterHeader() have no row or column
+  QVector<QPoint> shown_cells;
+  Q_FOREACH(const QPoint& cell, changed_cells) {
+    if (cell.x() >= 0 && cell.y() >= 0) {
+      shown_cells << cell;
+    }
+  }
+  if (shown_cells.isEmpty()) {
+    return;
+  }
+  QRect bounds(shown_cells.first(), QSize(1, 1));
+  Q_FOREACH(const QPoint& cell, shown_cells) {
+    bounds |= QRect(cell, QSize(1, 1));
+  }
+  emit q->selectionStatusChanged(bounds.top(), bounds.left(), bounds.bottom(), bounds.right());
+  if (q->receivers(SIGNAL(selectionStatusChanged(int,int))) > 0) {
+    Q_FOREACH(const QPoint& cell, shown_cells) {
+      emit q->selectionStatusChanged(cell.y(), cell.x());
     }
   }
-  d->deselect_on_synchronized(actually_deselected_elements);
+}
+
+void DatacubeSelection::addElements(QList< int > elements) {
+  Bitset added = Bitset::fromList(elements);
+  added.subtract(d->selected_elements);
+  if (added.any()) {
+    d->selected_elements |= added;
+    d->update_cells(added, 1);
+    d->select_on_synchronized(added.toList());
+  }
+}
+
+void DatacubeSelection::removeElements(QList< int > elements) {
+  Bitset removed = Bitset::fromList(elements);
+  removed &= d->selected_elements;
+  if (removed.any()) {
+    d->selected_elements.subtract(removed);
+    d->update_cells(removed, -1);
+    d->deselect_on_synchronized(removed.toList());
+  }
 
 }
 
@@ -214,41 +388,40 @@ DatacubeSelection::DatacubeSelection (qdatacube::Datacube* datacube, qdatacube::
 void DatacubeSelectionPrivate::reset() {
     nrows = datacube->d->number_of_buckets(Qt::Vertical);
     ncolumns = datacube->d->number_of_buckets(Qt::Horizontal);
-    QList<int> old_selected_elements = selected_elements.toList();
-    cells.clear();
-    selected_elements.clear();
-    q->addElements(old_selected_elements);
+    const Bitset old_selected_elements = selected_elements;
+    cells = QVector<int>(nrows*ncolumns);
+    selected_elements = old_selected_elements;
+    selected_elements.resize(qMax(selected_elements.size(), datacube->underlyingModel()->rowCount()));
+    update_cells(old_selected_elements, 1);
+    select_on_synchronized(old_selected_elements.toList());
 }
 
 void DatacubeSelection::addCell(int row, int column) {
   int bucket_row = d->datacube->d->bucket_for_row(row);
   int bucket_column = d->datacube->d->bucket_for_column(column);
-  QList<int> raw_elements = d->datacube->d->elements_in_bucket(bucket_row, bucket_column);
-  QList<int> elements;
-  Q_FOREACH(int raw_element, raw_elements) {
-    if (!d->selected_elements.contains(raw_element)) {
-      elements << raw_element;
+  QList<int> added;
+  Q_FOREACH(int element, d->datacube->d->cell(bucket_row, bucket_column)) {
+    if (!d->selected_elements.test(element)) {
+      d->selected_elements.set(element);
+      added << element;
     }
   }
-  if (!elements.isEmpty()) {
-      d->increaseCell(bucket_row, bucket_column, elements.size());
-    Q_FOREACH(int element, elements) {
-      d->selected_elements << element;
-    }
-    emit selectionStatusChanged(row, column);
-    d->select_on_synchronized(elements);
+  if (!added.isEmpty()) {
+    d->increaseCell(bucket_row, bucket_column, added.size());
+    d->emit_status_changed(QVector<QPoint>() << QPoint(column, row));
+    d->select_on_synchronized(added);
   }
 }
 
 void DatacubeSelectionPrivate::datacube_adds_element_to_bucket(int row, int column, int element) {
-  if (selected_elements.contains(element)) {
+  if (selected_elements.test(element)) {
     int c = increaseCell(row, column);
-    Q_ASSERT(c <= datacube->d->elements_in_bucket(row, column).size()); Q_UNUSED(c);
+    Q_ASSERT(c <= datacube->d->cell_count(row, column)); Q_UNUSED(c);
   }
 }
 
 void DatacubeSelectionPrivate::datacube_removes_element_from_bucket(int row, int column, int element) {
-  if (selected_elements.contains(element)) {
+  if (selected_elements.test(element)) {
     int c = decreaseCell(row, column);
     Q_ASSERT(c >= 0); Q_UNUSED(c);
   }
@@ -257,23 +430,22 @@ void DatacubeSelectionPrivate::datacube_removes_element_from_bucket(int row, int
 DatacubeSelection::SelectionStatus DatacubeSelection::selectionStatus(int row, int column) const {
   const int bucket_row = d->datacube->d->bucket_for_row(row);
   const int bucket_column = d->datacube->d->bucket_for_column(column);
-  const int selected_count = d->cellValue(bucket_row, bucket_column);
-  if (selected_count > 0) {
-    const int count = d->datacube->d->elements_in_bucket(bucket_row, bucket_column).size();
-    if (selected_count == count) {
-      return SELECTED;
-    } else {
-      return PARTIALLY_SELECTED;
-    }
-  } else {
-    return UNSELECTED;
-  }
+  return DatacubeSelectionPrivate::status(d->cellValue(bucket_row, bucket_column), d->datacube->d->cell_count(bucket_row, bucket_column));
 
 }
 
 void DatacubeSelection::clear() {
+  QVector<QPoint> changed_cells;
+  const QVector<int> row_sections = d->bucket_sections(Qt::Vertical);
+  const QVector<int> column_sections = d->bucket_sections(Qt::Horizontal);
+  for (int i = 0, ncells = d->cells.size(); i < ncells; ++i) {
+    if (d->cells.at(i) > 0) {
+      changed_cells << QPoint(column_sections.at(i / d->nrows), row_sections.at(i % d->nrows));
+    }
+  }
   d->selected_elements.clear();
-  std::fill(d->cells.begin(), d->cells.end(), 0);
+  d->cells.fill(0);
+  d->emit_status_changed(changed_cells);
   d->clear_synchronized();
 }
 
@@ -288,13 +460,22 @@ DatacubeSelection::~DatacubeSelection() {
   // declared to have secret_t in scope
 }
 
+MemoryUsage DatacubeSelection::memoryUsage() const {
+  MemoryUsage rv;
+  rv.add("selection cells", memory::vector_bytes(d->cells));
+  rv.add("selection elements", memory::bitset_bytes(d->selected_elements));
+  rv.add("selection proxy mapping", memory::vector_bytes(d->proxy_to_source) + memory::vector_bytes(d->source_to_proxy));
+  return rv;
+}
+
 void DatacubeSelection::synchronizeWith(QItemSelectionModel* synchronized_selection_model) {
   if (d->synchronized_selection_model) {
     d->synchronized_selection_model->disconnect(SIGNAL(selectionChanged(QItemSelection,QItemSelection)), this, SLOT(updateSelection(QItemSelection,QItemSelection)));
     d->synchronized_selection_model = 0L;
   }
+  d->synchronized_selection_model = synchronized_selection_model;
+  d->watch_proxies();
   if (synchronized_selection_model) {
-    d->synchronized_selection_model = synchronized_selection_model;
     connect(synchronized_selection_model,
           SIGNAL(selectionChanged(QItemSelection,QItemSelection)),
           SLOT(updateSelection(QItemSelection,QItemSelection)));
@@ -305,23 +486,12 @@ void DatacubeSelection::synchronizeWith(QItemSelectionModel* synchronized_select
 
 void DatacubeSelectionPrivate::datacube_deletes_elements(int start, int end)
 {
-  const int adjust = (end-start)+1;
-  QSet<int> new_selected_elements;
-  Q_FOREACH(int e, selected_elements) {
-    Q_ASSERT(e<start || e>end);
-    new_selected_elements << (e>start? e-adjust:e);
-  }
-  selected_elements = new_selected_elements;
+  selected_elements.remove(start, (end-start)+1);
 
 }
 
 void DatacubeSelectionPrivate::datacube_inserts_elements(int start, int end) {
-  const int adjust = (end-start)+1;
-  QSet<int> new_selected_elements;
-  Q_FOREACH(int e, selected_elements) {
-    new_selected_elements << (e>=start? e+adjust:e);
-  }
-  selected_elements = new_selected_elements;
+  selected_elements.insert(start, (end-start)+1);
 
 }
 
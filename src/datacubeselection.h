@@ -2,6 +2,7 @@
 #define DATACUBE_SELECTION_H
 
 #include "qdatacube_export.h"
+#include "memoryusage.h"
 
 #include <QItemSelection>
 #include <QObject>
@@ -67,9 +68,21 @@ class QDATACUBE_EXPORT DatacubeSelection : public QObject {
          **/
         void synchronizeWith(QItemSelectionModel* synchronized_selection_model);
 
+        /**
+         * @return heap memory used by the selected elements, cell counts and proxy mapping
+         */
+        MemoryUsage memoryUsage() const;
+
     Q_SIGNALS:
+        /**
+         * Selection status may have changed for the cells from topRow, leftColumn to bottomRow, rightColumn (inclusive)
+         * Emitted once for each change to the selection.
+         **/
+        void selectionStatusChanged(int topRow, int leftColumn, int bottomRow, int rightColumn);
+
         /**
          * Selection status has changed for cell
+         * Kept for compatibility; only emitted if connected to. Prefer the range form above.
          **/
         void selectionStatusChanged(int row, int column);
 
@@ -82,6 +95,7 @@ class QDATACUBE_EXPORT DatacubeSelection : public QObject {
     private:
         friend class Datacube;
         friend class DatacubePrivate;
+        friend class DatacubeSelectionPrivate;
         QScopedPointer<DatacubeSelectionPrivate> d;
 };
 
@@ -2,14 +2,17 @@
 #define QDATACUBE_DATACUBESELECTION_P
 
 #include <QObject>
-#include <QHash>
+#include <QPoint>
+#include <QPointer>
+#include <QVector>
 #include <QItemSelectionModel>
+#include "bitset.h"
+#include "datacubeselection.h"
 
 class QItemSelectionModel;
+class QSortFilterProxyModel;
 namespace qdatacube {
 
-class DatacubeSelection;
-
 class Datacube;
 
 class DatacubeSelectionPrivate : public QObject {
@@ -18,18 +21,26 @@ class DatacubeSelectionPrivate : public QObject {
         DatacubeSelectionPrivate(DatacubeSelection* datacubeselection);
         DatacubeSelection* q;
         Datacube* datacube;
-        QHash<long, int> cells; // maps from bucket index to number of selected items
-        QSet<int> selected_elements; // set of the selected rows in the underlying model from the datacube
+        QVector<int> cells; // number of selected items, indexed by bucket index
+        Bitset selected_elements; // set of the selected rows in the underlying model from the datacube
         QItemSelectionModel* synchronized_selection_model;
         bool ignore_synchronized;
         int nrows; // bucket size of datacube
         int ncolumns; // bucket size of datacube
+        // Row mapping between the synchronized model and the underlying model, when they are connected
+        // through sort/filter proxies only
+        QList<const QSortFilterProxyModel*> watched_proxies;
+        QList<QPointer<const QAbstractItemModel> > watched_sources; // source model of each watched proxy
+        QVector<int> proxy_to_source;
+        QVector<int> source_to_proxy;
+        bool mapping_valid;
 
         /**
          * \return the value in cell \param row, \param value
          */
         int cellValue(int row, int column) const {
-            return cells.value(row+column*nrows,0);
+            const int index = row+column*nrows;
+            return index < cells.size() ? cells.at(index) : 0;
         }
         /**
          * \param row row to decrease
@@ -38,18 +49,10 @@ class DatacubeSelectionPrivate : public QObject {
          * \return the new value
          */
         int decreaseCell(int row, int column, int value = 1) {
-            QHash<long,int>::iterator it = cells.find(row+column*nrows);
-            if(it == cells.end()) {
-                Q_ASSERT(false);
-                return 0;
-            } else {
-                *it-=value;
-                if(*it == 0) {
-                    cells.erase(it);
-                    return 0;
-                }
-                return *it;
-            }
+            int& count = cells[row+column*nrows];
+            Q_ASSERT(count >= value);
+            count -= value;
+            return count;
         }
         /**
          * \param row row to increase
@@ -58,22 +61,52 @@ class DatacubeSelectionPrivate : public QObject {
          * \return the new value in \param row
          */
         int increaseCell(int row, int column, int value = 1) {
-            QHash<long,int>::iterator it = cells.find(row+column*nrows);
-            if(it == cells.end()) {
-                cells.insert(row+column*nrows,value);
-                return value;
-            } else {
-                *it+=value;
-                return *it;
+            int& count = cells[row+column*nrows];
+            count += value;
+            return count;
+        }
+
+        /**
+         * \return the selection status of a bucket with \param selected selected items out of \param count
+         */
+        static DatacubeSelection::SelectionStatus status(int selected, int count) {
+            if (selected == 0) {
+                return DatacubeSelection::UNSELECTED;
             }
+            return selected == count ? DatacubeSelection::SELECTED : DatacubeSelection::PARTIALLY_SELECTED;
         }
 
+        /**
+         * Add delta to the bucket counts for each element in \param elements, and notify
+         * about the cells that changed status
+         */
+        void update_cells(const Bitset& elements, int delta);
+
+        /**
+         * \return the section for each bucket in \param orientation, -1 for empty buckets
+         */
+        QVector<int> bucket_sections(Qt::Orientation orientation) const;
+
+        /**
+         * Notify that the status of cells, given as (column, row) points, has changed
+         */
+        void emit_status_changed(const QVector<QPoint>& changed_cells);
+
         void dump();
 
         void select_on_synchronized(QList<int> elements);
         void deselect_on_synchronized(QList<int> elements);
         void clear_synchronized();
         QItemSelection map_to_synchronized(QList<int> elements);
+        /**
+         * \return the rows in the synchronized model for the elements that are visible there
+         */
+        QList<int> synchronized_rows(QList<int> elements);
+        /**
+         * Build the row mapping tables if possible.
+         * \return true if the tables are valid
+         */
+        bool ensure_mapping();
         QList<int> elements_from_selection(QItemSelection selection);
         void datacube_adds_element_to_bucket(int row, int column, int element);
         void datacube_removes_element_from_bucket(int row, int column, int element);
@@ -81,6 +114,13 @@ class DatacubeSelectionPrivate : public QObject {
         void datacube_inserts_elements(int start, int end);
     public Q_SLOTS:
         void reset();
+        /**
+         * Watch the sort/filter proxies between the synchronized model and the underlying model, and their source
+         * models, for mapping changes
+         */
+        void watch_proxies();
+        void invalidate_mapping();
+        void proxy_destroyed(QObject* proxy);
 
 
 };
@@ -0,0 +1,181 @@
+#include "datacubesnapshot.h"
+#include "datacubesnapshot_p.h"
+
+#include <algorithm>
+
+namespace qdatacube {
+
+namespace {
+
+/**
+ * @return the position for section, counting only non-empty positions in counts by position
+ */
+int position_for_section(const QVector<unsigned>& counts, int section) {
+  for (int position = 0, npositions = counts.size(); position < npositions; ++position) {
+    if (counts.at(position) > 0) {
+      if (section-- == 0) {
+        return position;
+      }
+    }
+  }
+  return -1;
+}
+
+/**
+ * @return the section for position, given counts by position
+ */
+int section_for_position(const QVector<unsigned>& counts, int position) {
+  return position - std::count(counts.constBegin(), counts.constBegin() + position, 0u);
+}
+
+/**
+ * @return the number of buckets spanned by one category of header headerno
+ */
+int stride_for_header(const DatacubePrivate::categories_t& categories, int headerno) {
+  int stride = 1;
+  for (int i = headerno + 1; i < categories.size(); ++i) {
+    stride *= categories.at(i).size();
+  }
+  return stride;
+}
+
+/**
+ * @return the category at position of header headerno
+ */
+int category_at(const QVector<QVector<int> >& order, int headerno, int position) {
+  return headerno < order.size() && !order.at(headerno).isEmpty() ? order.at(headerno).at(position) : position;
+}
+
+/**
+ * @return number, a bucket or a position, with the digit of each header mapped through table,
+ * as DatacubePrivate::bucket_position() and position_bucket() do
+ */
+int permute(const DatacubePrivate::categories_t& categories, const QVector<QVector<int> >& table, int number) {
+  if (table.isEmpty()) {
+    return number;
+  }
+  int rv = 0;
+  int stride = 1;
+  for (int headerno = categories.size() - 1; headerno >= 0; --headerno) {
+    const int ncats = categories.at(headerno).size();
+    const int digit = number % ncats;
+    number /= ncats;
+    rv += stride * category_at(table, headerno, digit);
+    stride *= ncats;
+  }
+  return rv;
+}
+
+}
+
+DatacubeSnapshot::DatacubeSnapshot() : d(new DatacubeSnapshotData) {
+}
+
+DatacubeSnapshot::DatacubeSnapshot(const DatacubeSnapshot& other) : d(other.d) {
+}
+
+DatacubeSnapshot& DatacubeSnapshot::operator=(const DatacubeSnapshot& other) {
+  d = other.d;
+  return *this;
+}
+
+DatacubeSnapshot::~DatacubeSnapshot() {
+  // Need to declare here so DatacubeSnapshotData's destructor is visible
+}
+
+bool DatacubeSnapshot::isNull() const {
+  return d->null;
+}
+
+quint64 DatacubeSnapshot::generation() const {
+  return d->generation;
+}
+
+int DatacubeSnapshot::headerCount(Qt::Orientation orientation) const {
+  return orientation == Qt::Horizontal ? d->col_categories.size() : d->row_categories.size();
+}
+
+int DatacubeSnapshot::rowCount() const {
+  return d->row_counts.size() - std::count(d->row_counts.constBegin(), d->row_counts.constEnd(), 0u);
+}
+
+int DatacubeSnapshot::columnCount() const {
+  return d->col_counts.size() - std::count(d->col_counts.constBegin(), d->col_counts.constEnd(), 0u);
+}
+
+int DatacubeSnapshot::categoryCount(Qt::Orientation orientation, int headerno) const {
+  const DatacubePrivate::categories_t& categories = orientation == Qt::Horizontal ? d->col_categories : d->row_categories;
+  return categories.at(headerno).size();
+}
+
+QVariant DatacubeSnapshot::categoryHeaderData(Qt::Orientation orientation, int headerno, int category) const {
+  const DatacubePrivate::categories_t& categories = orientation == Qt::Horizontal ? d->col_categories : d->row_categories;
+  return categories.at(headerno).value(category);
+}
+
+QList< Datacube::HeaderDescription > DatacubeSnapshot::headers(Qt::Orientation orientation, int index) const {
+  QList<Datacube::HeaderDescription> rv;
+  const DatacubePrivate::categories_t& categories = orientation == Qt::Horizontal ? d->col_categories : d->row_categories;
+  const QVector<unsigned>& counts = orientation == Qt::Horizontal ? d->col_section_counts : d->row_section_counts;
+  const QVector<QVector<int> >& order = orientation == Qt::Horizontal ? d->col_order : d->row_order;
+  const int ncats = categories.at(index).size();
+  const int stride = stride_for_header(categories, index);
+  for (int c = 0; c < counts.size(); c += stride) {
+    int count = 0;
+    for (int i = 0; i < stride; ++i) {
+      if (counts.at(c+i) > 0) {
+        ++count;
+      }
+    }
+    if (count > 0) {
+      rv << Datacube::HeaderDescription(category_at(order, index, (c/stride)%ncats), count);
+    }
+  }
+  return rv;
+}
+
+int DatacubeSnapshot::categoryIndex(Qt::Orientation orientation, int header_index, int section) const {
+  const DatacubePrivate::categories_t& categories = orientation == Qt::Horizontal ? d->col_categories : d->row_categories;
+  const int position = position_for_section(orientation == Qt::Horizontal ? d->col_section_counts : d->row_section_counts, section);
+  const int sub_header_size = stride_for_header(categories, header_index);
+  const int naggregator_categories = categories.at(header_index).size();
+  const QVector<QVector<int> >& order = orientation == Qt::Horizontal ? d->col_order : d->row_order;
+  return category_at(order, header_index, position % (naggregator_categories*sub_header_size)/sub_header_size);
+}
+
+int DatacubeSnapshot::elementCount(int row, int column) const {
+  return elements(row, column).size();
+}
+
+QList< int > DatacubeSnapshot::elements(int row, int column) const {
+  const int row_position = position_for_section(d->row_section_counts, row);
+  const int column_position = position_for_section(d->col_section_counts, column);
+  if (row_position < 0 || column_position < 0) {
+    return QList<int>();
+  }
+  const int bucket_row = permute(d->row_categories, d->row_order, row_position);
+  const int bucket_column = permute(d->col_categories, d->col_order, column_position);
+  return d->cells.value(bucket_row + long(bucket_column) * d->row_counts.size());
+}
+
+int DatacubeSnapshot::elementCount() const {
+  return d->reverse_index.size();
+}
+
+QList< int > DatacubeSnapshot::elements() const {
+  return d->reverse_index.keys();
+}
+
+int DatacubeSnapshot::internalSection(int element, Qt::Orientation orientation) const {
+  const Cell cell = d->reverse_index.value(element);
+  if (cell.invalid()) {
+    return -1;
+  }
+  if (orientation == Qt::Horizontal) {
+    return section_for_position(d->col_section_counts, permute(d->col_categories, d->col_positions, cell.column()));
+  } else {
+    return section_for_position(d->row_section_counts, permute(d->row_categories, d->row_positions, cell.row()));
+  }
+}
+
+} // end of namespace
@@ -0,0 +1,116 @@
+#ifndef QDATACUBE_DATACUBESNAPSHOT_H
+#define QDATACUBE_DATACUBESNAPSHOT_H
+
+#include "qdatacube_export.h"
+#include "datacube.h"
+
+#include <QSharedDataPointer>
+#include <QVariant>
+
+namespace qdatacube {
+class DatacubeSnapshotData;
+}
+
+namespace qdatacube {
+
+/**
+ * Immutable view of a datacube at one point in time, see Datacube::snapshot().
+ *
+ * A snapshot holds its own reference to the cells, counts and header layout of the datacube, so it
+ * is unaffected by later changes to the datacube, and can be read from any thread while the datacube
+ * keeps changing on its own. The query functions mirror those of Datacube.
+ *
+ * Snapshots share their data with the datacube until the datacube changes: taking one is cheap, but
+ * the first change afterwards copies all the cells and the element to cell index of the datacube,
+ * O(elements), while a snapshot is still alive. Later changes are not slowed. Release snapshots that
+ * are no longer needed before changing the datacube. Copying a snapshot is cheap.
+ *
+ * Aggregators are not part of a snapshot; their categories' Qt::DisplayRole header data is.
+ */
+class QDATACUBE_EXPORT DatacubeSnapshot {
+    public:
+        /**
+         * Construct null snapshot, with no rows or columns
+         */
+        DatacubeSnapshot();
+        DatacubeSnapshot(const DatacubeSnapshot& other);
+        DatacubeSnapshot& operator=(const DatacubeSnapshot& other);
+        ~DatacubeSnapshot();
+
+        /**
+         * @return true if this snapshot was not taken from a datacube
+         */
+        bool isNull() const;
+
+        /**
+         * @return the generation of the datacube when the snapshot was taken, see Datacube::generation()
+         */
+        quint64 generation() const;
+
+        /**
+         * @return number of headers in orientation
+         */
+        int headerCount(Qt::Orientation orientation) const;
+
+        /**
+         * @return number of (non-empty) rows
+         */
+        int rowCount() const;
+
+        /**
+         * @return number of (non-empty) columns
+         */
+        int columnCount() const;
+
+        /**
+         * @return number of categories of the aggregator for header headerno
+         */
+        int categoryCount(Qt::Orientation orientation, int headerno) const;
+
+        /**
+         * @return Qt::DisplayRole header data for category of the aggregator for header headerno
+         */
+        QVariant categoryHeaderData(Qt::Orientation orientation, int headerno, int category) const;
+
+        /**
+         * @return the header layout for header index, as Datacube::headers()
+         */
+        QList<Datacube::HeaderDescription> headers(Qt::Orientation orientation, int index) const;
+
+        /**
+         * @return the category index for the section in header header_index, as Datacube::categoryIndex()
+         */
+        int categoryIndex(Qt::Orientation orientation, int header_index, int section) const;
+
+        /**
+         * @return number of elements in cell at row, column
+         */
+        int elementCount(int row, int column) const;
+
+        /**
+         * @return elements in cell at row, column
+         */
+        QList<int> elements(int row, int column) const;
+
+        /**
+         * @return total number of (unfiltered) elements
+         */
+        int elementCount() const;
+
+        /**
+         * @return all (unfiltered) elements
+         */
+        QList<int> elements() const;
+
+        /**
+         * @return the section element is in, or -1 if element is not in the datacube
+         */
+        int internalSection(int element, Qt::Orientation orientation) const;
+    private:
+        friend class Datacube;
+        QSharedDataPointer<DatacubeSnapshotData> d;
+};
+
+}
+
+#endif // QDATACUBE_DATACUBESNAPSHOT_H
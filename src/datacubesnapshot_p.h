@@ -0,0 +1,37 @@
+#ifndef QDATACUBE_DATACUBESNAPSHOT_P_H
+#define QDATACUBE_DATACUBESNAPSHOT_P_H
+
+#include "datacube_p.h"
+
+#include <QSharedData>
+
+namespace qdatacube {
+
+/**
+ * The state captured by a snapshot. All members are implicitly shared with the datacube, and
+ * never changed after construction. Buckets are numbered as in the datacube; if it has sorted
+ * headers, the order of their categories is kept to map between buckets and positions, see
+ * DatacubePrivate::HeaderOrder.
+ */
+class DatacubeSnapshotData : public QSharedData {
+    public:
+        DatacubeSnapshotData() : null(true), generation(0) {}
+        bool null;
+        quint64 generation;
+        QVector<unsigned> row_counts; // by bucket
+        QVector<unsigned> col_counts;
+        QVector<unsigned> row_section_counts; // by position
+        QVector<unsigned> col_section_counts;
+        DatacubePrivate::cells_t cells;
+        DatacubePrivate::reverse_index_t reverse_index;
+        DatacubePrivate::categories_t row_categories;
+        DatacubePrivate::categories_t col_categories;
+        QVector<QVector<int> > row_order; // category at each position for each header, empty unless sorted
+        QVector<QVector<int> > col_order;
+        QVector<QVector<int> > row_positions; // position of each category for each header, empty unless sorted
+        QVector<QVector<int> > col_positions;
+};
+
+}
+
+#endif // QDATACUBE_DATACUBESNAPSHOT_P_H
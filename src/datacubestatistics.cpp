@@ -0,0 +1,114 @@
+#include "datacubestatistics.h"
+
+#include <QStringList>
+
+namespace qdatacube {
+
+DatacubeStatistics::DatacubeStatistics() {
+  reset();
+}
+
+void DatacubeStatistics::addTiming(Timing timing, qint64 nsecs) {
+  TimingData& data = m_timings[timing];
+  ++data.count;
+  data.total += nsecs;
+  data.max = qMax(data.max, nsecs);
+  int bucket = 0;
+  for (qint64 usecs = nsecs / 1000; usecs > 1 && bucket < NHistogramBuckets - 1; usecs >>= 1) {
+    ++bucket;
+  }
+  ++data.histogram[bucket];
+}
+
+int DatacubeStatistics::timingCount(Timing timing) const {
+  return m_timings[timing].count;
+}
+
+qint64 DatacubeStatistics::totalTime(Timing timing) const {
+  return m_timings[timing].total;
+}
+
+qint64 DatacubeStatistics::maxTime(Timing timing) const {
+  return m_timings[timing].max;
+}
+
+QVector< int > DatacubeStatistics::histogram(Timing timing) const {
+  return m_timings[timing].histogram;
+}
+
+void DatacubeStatistics::reset() {
+  for (int counter = 0; counter < NCounters; ++counter) {
+    m_counters[counter] = 0;
+  }
+  for (int timing = 0; timing < NTimings; ++timing) {
+    m_timings[timing] = TimingData();
+  }
+}
+
+QString DatacubeStatistics::dump() const {
+  QStringList lines;
+  for (int counter = 0; counter < NCounters; ++counter) {
+    lines << QString("%1: %2").arg(counterName(Counter(counter))).arg(m_counters[counter]);
+  }
+  for (int timing = 0; timing < NTimings; ++timing) {
+    const TimingData& data = m_timings[timing];
+    if (data.count == 0) {
+      lines << QString("%1: never").arg(timingName(Timing(timing)));
+      continue;
+    }
+    QStringList histogram;
+    for (int bucket = 0; bucket < NHistogramBuckets; ++bucket) {
+      if (data.histogram.at(bucket) > 0) {
+        histogram << QString("<%1us:%2").arg(qint64(2) << bucket).arg(data.histogram.at(bucket));
+      }
+    }
+    lines << QString("%1: %2 times, %3ms total, %4ms max [%5]").arg(timingName(Timing(timing))).arg(data.count)
+                                                               .arg(data.total / 1e6).arg(data.max / 1e6)
+                                                               .arg(histogram.join(" "));
+  }
+  return lines.join("\n");
+}
+
+QString DatacubeStatistics::counterName(Counter counter) {
+  switch (counter) {
+    case AddCalls:
+      return "add calls";
+    case RemoveCalls:
+      return "remove calls";
+    case AggregatorEvaluations:
+      return "aggregator evaluations";
+    case BucketMappings:
+      return "bucket mappings";
+    case SignalEmissions:
+      return "signal emissions";
+    case CellsTouched:
+      return "cells touched";
+    case ElementsTouched:
+      return "elements touched";
+    case NCounters:
+      break;
+  }
+  return QString();
+}
+
+QString DatacubeStatistics::timingName(Timing timing) {
+  switch (timing) {
+    case Split:
+      return "split";
+    case Collapse:
+      return "collapse";
+    case AddFilter:
+      return "add filter";
+    case RemoveFilter:
+      return "remove filter";
+    case ResetFilter:
+      return "reset filter";
+    case CategoryChange:
+      return "category change";
+    case NTimings:
+      break;
+  }
+  return QString();
+}
+
+}
@@ -0,0 +1,106 @@
+#ifndef QDATACUBE_DATACUBESTATISTICS_H
+#define QDATACUBE_DATACUBESTATISTICS_H
+
+#include "qdatacube_export.h"
+
+#include <QString>
+#include <QVector>
+
+namespace qdatacube {
+
+/**
+ * Counters and timings of the internal operations of a datacube, for finding out why a datacube is slow.
+ *
+ * Collected while enabled with Datacube::setStatisticsEnabled(). When disabled, the cost to the datacube is a
+ * null pointer check per operation. Building with QDATACUBE_NO_STATISTICS defined removes collection entirely.
+ *
+ * Timings are in nanoseconds. Each timing keeps a histogram of its durations, where bucket n counts
+ * durations of at least 2^n and less than 2^(n+1) microseconds; bucket 0 also counts shorter durations.
+ */
+class QDATACUBE_EXPORT DatacubeStatistics {
+    public:
+        enum Counter {
+            AddCalls, // elements added to the cells
+            RemoveCalls, // elements removed from the cells
+            AggregatorEvaluations, // calls to an aggregator to categorize an element
+            BucketMappings, // conversions between buckets and rows or columns
+            SignalEmissions, // signals emitted by the datacube
+            CellsTouched, // cells rebuilt by split, collapse and category changes
+            ElementsTouched, // elements moved by split, collapse and category changes, and filtered
+            NCounters
+        };
+        enum Timing {
+            Split,
+            Collapse,
+            AddFilter,
+            RemoveFilter,
+            ResetFilter,
+            CategoryChange, // rebuild after an aggregator added or removed a category
+            NTimings
+        };
+        enum {
+            NHistogramBuckets = 24
+        };
+
+        DatacubeStatistics();
+
+        void count(Counter counter, qint64 amount = 1) {
+            m_counters[counter] += amount;
+        }
+
+        /**
+         * Record that timing took nsecs nanoseconds
+         */
+        void addTiming(Timing timing, qint64 nsecs);
+
+        qint64 counter(Counter counter) const {
+            return m_counters[counter];
+        }
+
+        /**
+         * @return number of times timing was recorded
+         */
+        int timingCount(Timing timing) const;
+
+        /**
+         * @return cumulative nanoseconds spent in timing
+         */
+        qint64 totalTime(Timing timing) const;
+
+        /**
+         * @return longest time spent in timing
+         */
+        qint64 maxTime(Timing timing) const;
+
+        /**
+         * @return histogram of durations for timing, see class documentation
+         */
+        QVector<int> histogram(Timing timing) const;
+
+        /**
+         * Zero all counters and timings
+         */
+        void reset();
+
+        /**
+         * @return counters and timings as text, one per line
+         */
+        QString dump() const;
+
+        static QString counterName(Counter counter);
+        static QString timingName(Timing timing);
+    private:
+        struct TimingData {
+            TimingData() : count(0), total(0), max(0), histogram(NHistogramBuckets) {}
+            int count;
+            qint64 total;
+            qint64 max;
+            QVector<int> histogram;
+        };
+        qint64 m_counters[NCounters];
+        TimingData m_timings[NTimings];
+};
+
+}
+
+#endif // QDATACUBE_DATACUBESTATISTICS_H
@@ -14,9 +14,18 @@
 #include "cell.h"
 #include <QScrollBar>
 #include <QToolTip>
+#include <QAbstractItemModel>
+#include <QCoreApplication>
+#include <QRunnable>
+#include <QTimer>
+#include <QMenu>
+#include <QAction>
+#include <QDebug>
 #include "abstractaggregator.h"
 #include "abstractfilter.h"
 #include "abstractformatter.h"
+#include "datacubestatistics.h"
+#include "tracer_p.h"
 
 #include "datacubeview_p.h"
 
@@ -40,6 +49,44 @@ struct PainterSaver {
 
 namespace qdatacube {
 
+static const QEvent::Type format_done_event_type = static_cast<QEvent::Type>(QEvent::registerEventType());
+
+/**
+ * Result of a FormatJob, posted to the view
+ */
+class FormatDoneEvent : public QEvent {
+    public:
+        FormatDoneEvent(const FormatCacheKey& key, const QString& text, int job)
+          : QEvent(format_done_event_type), key(key), text(text), job(job) {}
+        const FormatCacheKey key;
+        const QString text;
+        const int job;
+};
+
+/**
+ * Formats a copy of the elements of a cell or total in a worker thread
+ */
+class FormatJob : public QRunnable {
+    public:
+        FormatJob(QObject* receiver, const FormatCacheKey& key, const QList<int>& elements, int job, QSharedPointer<QAtomicInt> cancelled)
+          : m_receiver(receiver), m_key(key), m_elements(elements), m_job(job), m_cancelled(cancelled) {}
+        virtual void run() {
+          if (m_cancelled->loadAcquire()) {
+            return;
+          }
+          QDATACUBE_TRACE(m_key.formatter->metaObject()->className());
+          QDATACUBE_TRACE_ARG("elements", m_elements.size());
+          const QString text = m_key.formatter->format(m_elements);
+          QCoreApplication::postEvent(m_receiver, new FormatDoneEvent(m_key, text, m_job));
+        }
+    private:
+        QObject* m_receiver;
+        const FormatCacheKey m_key;
+        const QList<int> m_elements;
+        const int m_job;
+        QSharedPointer<QAtomicInt> m_cancelled;
+};
+
 DatacubeViewPrivate::DatacubeViewPrivate(DatacubeView* datacubeview)
     : q(datacubeview),
     datacube(0L),
@@ -48,9 +95,296 @@ DatacubeViewPrivate::DatacubeViewPrivate(DatacubeView* datacubeview)
     vertical_header_width(-1),
     cell_size(),
     datacube_size(),
-    show_totals(true)
+    show_totals(true),
+    statistics_menu(0L),
+    collect_statistics_action(0L),
+    format_cache(format_cache_size),
+    asynchronous_formatting(false),
+    format_cancelled(new QAtomicInt(0)),
+    format_generation(0),
+    last_format_job(0)
 {
+  // Coalesce repaints to about one per frame
+  repaint_timer = new QTimer(this);
+  repaint_timer->setSingleShot(true);
+  repaint_timer->setInterval(16);
+  connect(repaint_timer, SIGNAL(timeout()), SLOT(flush_dirty_region()));
+  connect(q->verticalScrollBar(), SIGNAL(valueChanged(int)), SLOT(cancel_pending_formats()));
+  connect(q->horizontalScrollBar(), SIGNAL(valueChanged(int)), SLOT(cancel_pending_formats()));
+}
+
+QVector<FormattedValue> DatacubeViewPrivate::formatted_values(FormatCacheKey::Kind kind, int a, int b) const {
+  QVector<FormattedValue> rv;
+  rv.reserve(formatters.size());
+  QList<int> elements;
+  bool have_elements = false;
+  Q_FOREACH(AbstractFormatter* formatter, formatters) {
+    const FormatCacheKey key(formatter, kind, a, b);
+    if (const FormattedValue* cached = format_cache.object(key)) {
+      rv << *cached;
+      continue;
+    }
+    if (formatter->mergesCells()) {
+      QDATACUBE_TRACE(formatter->metaObject()->className());
+      rv << insert_formatted_value(key, format_cells(formatter, kind, a, b));
+      continue;
+    }
+    if (!have_elements) {
+      switch (kind) {
+        case FormatCacheKey::CellValue:
+          elements = datacube->elements(a, b);
+          break;
+        case FormatCacheKey::HorizontalTotal:
+          elements = datacube->elements(Qt::Horizontal, a, b);
+          break;
+        case FormatCacheKey::VerticalTotal:
+          elements = datacube->elements(Qt::Vertical, a, b);
+          break;
+        case FormatCacheKey::GrandTotal:
+          elements = datacube->elements();
+          break;
+      }
+      have_elements = true;
+    }
+    // Empty cells are shown empty, without asking the formatter
+    if (kind == FormatCacheKey::CellValue && elements.isEmpty()) {
+      rv << insert_formatted_value(key, QString());
+    } else if (asynchronous_formatting && formatter->isThreadSafe()) {
+      if (!pending_formats.contains(key)) {
+        const int job = ++last_format_job;
+        pending_formats.insert(key, job);
+        format_pool.start(new FormatJob(const_cast<DatacubeViewPrivate*>(this), key, elements, job, format_cancelled));
+      }
+      const QString placeholder(QChar(0x2026)); // ellipsis
+      rv << FormattedValue(placeholder, q->fontMetrics().width(placeholder));
+    } else {
+      QDATACUBE_TRACE(formatter->metaObject()->className());
+      QDATACUBE_TRACE_ARG("elements", elements.size());
+      rv << insert_formatted_value(key, formatter->format(elements));
+    }
+  }
+  return rv;
+}
+
+QString DatacubeViewPrivate::format_cells(const AbstractFormatter* formatter, FormatCacheKey::Kind kind, int a, int b) const {
+  const int last_row = datacube->rowCount() - 1;
+  const int last_column = datacube->columnCount() - 1;
+  switch (kind) {
+    case FormatCacheKey::CellValue:
+      // Empty cells are shown empty, without asking the formatter
+      return datacube->elementCount(a, b) ? formatter->formatCells(datacube, a, b, a, b) : QString();
+    case FormatCacheKey::HorizontalTotal: {
+      const QPair<int,int> columns = datacube->toSection(Qt::Horizontal, a, b);
+      return formatter->formatCells(datacube, 0, columns.first, last_row, columns.second);
+    }
+    case FormatCacheKey::VerticalTotal: {
+      const QPair<int,int> rows = datacube->toSection(Qt::Vertical, a, b);
+      return formatter->formatCells(datacube, rows.first, 0, rows.second, last_column);
+    }
+    case FormatCacheKey::GrandTotal:
+      return formatter->formatCells(datacube, 0, 0, last_row, last_column);
+  }
+  return QString();
+}
+
+FormattedValue DatacubeViewPrivate::insert_formatted_value(const FormatCacheKey& key, const QString& text) const {
+  FormattedValue* value = new FormattedValue(text, text.isEmpty() ? 0 : q->fontMetrics().width(text));
+  const FormattedValue rv = *value;
+  format_cache.insert(key, value, int(sizeof(FormattedValue) + sizeof(FormatCacheKey)) + text.size()*int(sizeof(QChar)));
+  return rv;
+}
+
+void DatacubeViewPrivate::cancel_pending_formats() {
+  if (!pending_formats.isEmpty()) {
+    format_cancelled->storeRelease(1);
+    format_cancelled = QSharedPointer<QAtomicInt>(new QAtomicInt(0));
+    format_pool.clear();
+    pending_formats.clear();
+  }
+}
+
+void DatacubeViewPrivate::invalidate_pending_formats() {
+  format_generation = last_format_job;
+  format_invalidated.clear();
+  cancel_pending_formats();
+}
+
+void DatacubeViewPrivate::invalidate_pending_format(const FormatCacheKey& key) {
+  if (pending_formats.remove(key)) {
+    format_invalidated.insert(key, last_format_job);
+  }
+}
+
+bool DatacubeViewPrivate::event(QEvent* event) {
+  if (event->type() == format_done_event_type) {
+    FormatDoneEvent* done = static_cast<FormatDoneEvent*>(event);
+    QHash<FormatCacheKey, int>::iterator pending = pending_formats.find(done->key);
+    if (pending != pending_formats.end() && pending.value() == done->job) {
+      pending_formats.erase(pending);
+    }
+    if (done->job > qMax(format_generation, format_invalidated.value(done->key, 0))) {
+      insert_formatted_value(done->key, done->text);
+      mark_dirty(value_rect(done->key.kind, done->key.a, done->key.b));
+    }
+    return true;
+  }
+  return QObject::event(event);
+}
+
+QRect DatacubeViewPrivate::grid_rect(int row, int column, int nrows, int ncolumns) const {
+  return QRect(q->viewport()->rect().left() + vertical_header_width + (column - q->horizontalScrollBar()->value()) * cell_size.width(),
+               q->viewport()->rect().top() + horizontal_header_height + (row - q->verticalScrollBar()->value()) * cell_size.height(),
+               ncolumns * cell_size.width(), nrows * cell_size.height());
+}
+
+QRect DatacubeViewPrivate::value_rect(FormatCacheKey::Kind kind, int a, int b) const {
+  const int ndatarows = datacube->rowCount();
+  const int ndatacolumns = datacube->columnCount();
+  switch (kind) {
+    case FormatCacheKey::CellValue:
+      return grid_rect(a, b);
+    case FormatCacheKey::HorizontalTotal: {
+      // The totals for the innermost header are next to the cells
+      const QPair<int,int> columns = datacube->toSection(Qt::Horizontal, a, b);
+      return grid_rect(ndatarows + datacube->headerCount(Qt::Horizontal) - 1 - a, columns.first, 1, columns.second - columns.first + 1);
+    }
+    case FormatCacheKey::VerticalTotal: {
+      const QPair<int,int> rows = datacube->toSection(Qt::Vertical, a, b);
+      return grid_rect(rows.first, ndatacolumns + datacube->headerCount(Qt::Vertical) - 1 - a, rows.second - rows.first + 1, 1);
+    }
+    case FormatCacheKey::GrandTotal:
+      return grid_rect(ndatarows, ndatacolumns, qMax(1, datacube->headerCount(Qt::Horizontal)), qMax(1, datacube->headerCount(Qt::Vertical)));
+  }
+  return QRect();
+}
+
+void DatacubeViewPrivate::mark_dirty(const QRect& rect) {
+  const QRect visible = rect.intersected(q->viewport()->rect());
+  if (visible.isEmpty()) {
+    return;
+  }
+  dirty_region += visible;
+  if (!repaint_timer->isActive()) {
+    repaint_timer->start();
+  }
+}
+
+void DatacubeViewPrivate::flush_dirty_region() {
+  if (!dirty_region.isEmpty()) {
+    q->viewport()->update(dirty_region);
+    dirty_region = QRegion();
+  }
+}
+
+void DatacubeViewPrivate::update_cells(int top_row, int left_column, int bottom_row, int right_column) {
+  if (!datacube || top_row < 0 || left_column < 0 || bottom_row >= datacube->rowCount() || right_column >= datacube->columnCount()) {
+    return;
+  }
+  mark_dirty(grid_rect(top_row, left_column, bottom_row - top_row + 1, right_column - left_column + 1));
+}
+
+void DatacubeViewPrivate::update_cells_and_totals(int top_row, int left_column, int bottom_row, int right_column) {
+  if (!datacube || top_row < 0 || left_column < 0 || bottom_row >= datacube->rowCount() || right_column >= datacube->columnCount()
+      || top_row > bottom_row || left_column > right_column) {
+    // Structural change under way; that will repaint everything
+    return;
+  }
+  mark_dirty(grid_rect(top_row, left_column, bottom_row - top_row + 1, right_column - left_column + 1));
+  if (show_totals) {
+    for (int hh = 0, nhh = datacube->headerCount(Qt::Horizontal); hh < nhh; ++hh) {
+      const int last = datacube->toHeaderSection(Qt::Horizontal, hh, right_column);
+      for (int section = datacube->toHeaderSection(Qt::Horizontal, hh, left_column); section <= last; ++section) {
+        mark_dirty(value_rect(FormatCacheKey::HorizontalTotal, hh, section));
+      }
+    }
+    for (int vh = 0, nvh = datacube->headerCount(Qt::Vertical); vh < nvh; ++vh) {
+      const int last = datacube->toHeaderSection(Qt::Vertical, vh, bottom_row);
+      for (int section = datacube->toHeaderSection(Qt::Vertical, vh, top_row); section <= last; ++section) {
+        mark_dirty(value_rect(FormatCacheKey::VerticalTotal, vh, section));
+      }
+    }
+    mark_dirty(value_rect(FormatCacheKey::GrandTotal, 0, 0));
+  }
+}
 
+void DatacubeViewPrivate::invalidate_formatted_values() {
+  invalidate_pending_formats();
+  format_cache.clear();
+}
+
+void DatacubeViewPrivate::invalidate_formatter() {
+  remove_formatted_values(qobject_cast<AbstractFormatter*>(sender()));
+}
+
+void DatacubeViewPrivate::remove_formatted_values(const AbstractFormatter* formatter) {
+  invalidate_pending_formats();
+  Q_FOREACH(const FormatCacheKey& key, format_cache.keys()) {
+    if (key.formatter == formatter) {
+      format_cache.remove(key);
+    }
+  }
+}
+
+void DatacubeViewPrivate::invalidate_cells(int top_row, int left_column, int bottom_row, int right_column) {
+  if (!datacube || top_row < 0 || left_column < 0 || bottom_row >= datacube->rowCount() || right_column >= datacube->columnCount()) {
+    invalidate_formatted_values();
+    return;
+  }
+  if ((bottom_row - top_row + 1) * (right_column - left_column + 1) > format_cache.count()) {
+    // Cheaper to start over than to look up every cell
+    invalidate_formatted_values();
+    return;
+  }
+  const int horizontal_header_count = datacube->headerCount(Qt::Horizontal);
+  const int vertical_header_count = datacube->headerCount(Qt::Vertical);
+  Q_FOREACH(AbstractFormatter* formatter, formatters) {
+    for (int row = top_row; row <= bottom_row; ++row) {
+      for (int column = left_column; column <= right_column; ++column) {
+        invalidate_formatted_value(FormatCacheKey(formatter, FormatCacheKey::CellValue, row, column));
+      }
+    }
+    for (int hh = 0; hh < horizontal_header_count; ++hh) {
+      const int last = datacube->toHeaderSection(Qt::Horizontal, hh, right_column);
+      for (int section = datacube->toHeaderSection(Qt::Horizontal, hh, left_column); section <= last; ++section) {
+        invalidate_formatted_value(FormatCacheKey(formatter, FormatCacheKey::HorizontalTotal, hh, section));
+      }
+    }
+    for (int vh = 0; vh < vertical_header_count; ++vh) {
+      const int last = datacube->toHeaderSection(Qt::Vertical, vh, bottom_row);
+      for (int section = datacube->toHeaderSection(Qt::Vertical, vh, top_row); section <= last; ++section) {
+        invalidate_formatted_value(FormatCacheKey(formatter, FormatCacheKey::VerticalTotal, vh, section));
+      }
+    }
+    invalidate_formatted_value(FormatCacheKey(formatter, FormatCacheKey::GrandTotal, 0, 0));
+  }
+}
+
+void DatacubeViewPrivate::invalidate_formatted_value(const FormatCacheKey& key) {
+  format_cache.remove(key);
+  invalidate_pending_format(key);
+}
+
+void DatacubeViewPrivate::invalidate_elements(const QModelIndex& top_left, const QModelIndex& bottom_right) {
+  // Formatters typically show data from columns the datacube does not aggregate on, so the cube itself
+  // will not report these changes.
+  if (!datacube || top_left.parent().isValid()) {
+    return;
+  }
+  if (bottom_right.row() - top_left.row() >= 64) {
+    invalidate_formatted_values();
+    q->viewport()->update();
+  } else {
+    for (int element = top_left.row(); element <= bottom_right.row(); ++element) {
+      const int row = datacube->sectionForElement(element, Qt::Vertical);
+      const int column = datacube->sectionForElement(element, Qt::Horizontal);
+      if (row < 0 || column < 0) {
+        // Filtered out, so not shown in any cell or total
+        continue;
+      }
+      invalidate_cells(row, column, row, column);
+      update_cells_and_totals(row, column, row, column);
+    }
+  }
 }
 
 Cell DatacubeViewPrivate::cell_for_position(QPoint pos, int vertical_scrollbar_value, int horizontal_scrollbar_value) const {
@@ -88,19 +422,35 @@ void DatacubeView::setDatacube(Datacube* datacube) {
   if (d->datacube) {
     d->datacube->disconnect(this);
     d->datacube->disconnect(d.data());
+    d->datacube->underlyingModel()->disconnect(d.data());
     if (datacube && datacube->underlyingModel() != d->datacube->underlyingModel()) {
+      d->invalidate_pending_formats();
+      d->format_pool.waitForDone();
       qDeleteAll(d->formatters);
       d->formatters.clear();
     }
   }
   d->datacube = datacube;
+  d->invalidate_formatted_values();
   delete d->selection;
   d->selection = new DatacubeSelection(datacube, this);
   viewport()->update();
-  connect(d->selection, SIGNAL(selectionStatusChanged(int, int)), viewport(), SLOT(update()));
+  connect(d->selection, SIGNAL(selectionStatusChanged(int,int,int,int)), d.data(), SLOT(update_cells(int,int,int,int)));
   connect(datacube, SIGNAL(destroyed(QObject*)), d.data(), SLOT(datacube_deleted()));
+  // The cache must be invalidated before the relayout and repaint
+  connect(datacube, SIGNAL(reset()), d.data(), SLOT(invalidate_formatted_values()));
+  connect(datacube, SIGNAL(dataChanged(int,int,int,int)), d.data(), SLOT(invalidate_cells(int,int,int,int)));
+  connect(datacube, SIGNAL(columnsInserted(int, int)), d.data(), SLOT(invalidate_formatted_values()));
+  connect(datacube, SIGNAL(rowsInserted(int, int)), d.data(), SLOT(invalidate_formatted_values()));
+  connect(datacube, SIGNAL(columnsRemoved(int, int)), d.data(), SLOT(invalidate_formatted_values()));
+  connect(datacube, SIGNAL(rowsRemoved(int, int)), d.data(), SLOT(invalidate_formatted_values()));
+  connect(datacube, SIGNAL(filterChanged()), d.data(), SLOT(invalidate_formatted_values()));
+  connect(datacube, SIGNAL(headersChanged(Qt::Orientation,int,int)), d.data(), SLOT(invalidate_formatted_values()));
+  if (datacube) {
+    connect(datacube->underlyingModel(), SIGNAL(dataChanged(QModelIndex,QModelIndex)), d.data(), SLOT(invalidate_elements(QModelIndex,QModelIndex)));
+  }
   connect(datacube, SIGNAL(reset()), d.data(), SLOT(relayout()));
-  connect(datacube, SIGNAL(dataChanged(int, int)), viewport(), SLOT(update()));
+  connect(datacube, SIGNAL(dataChanged(int,int,int,int)), d.data(), SLOT(update_cells_and_totals(int,int,int,int)));
   connect(datacube, SIGNAL(columnsInserted(int, int)), d.data(), SLOT(relayout()));
   connect(datacube, SIGNAL(rowsInserted(int, int)), d.data(), SLOT(relayout()));
   connect(datacube, SIGNAL(columnsRemoved(int, int)), d.data(), SLOT(relayout()));
@@ -113,7 +463,7 @@ void DatacubeViewPrivate::relayout() {
   if (!datacube) {
     return; // defer layout to datacube is set
   }
-  datacube_size = QSize(datacube->columnCount(), datacube->rowCount());
+  const QSize new_datacube_size(datacube->columnCount(), datacube->rowCount());
   QSize new_cell_size(q->fontMetrics().width("9999"), 0);
   Q_FOREACH(AbstractFormatter* formatter, formatters) {
     QSize formatter_cell_size = formatter->cellSize();
@@ -123,10 +473,21 @@ void DatacubeViewPrivate::relayout() {
   if (new_cell_size.height() == 0) {
     new_cell_size.setHeight(10);
   }
-  cell_size = new_cell_size;
-  vertical_header_width = qMax(1, datacube->headerCount(Qt::Vertical)) * cell_size.width();
-  horizontal_header_height = qMax(1, datacube->headerCount(Qt::Horizontal)) * cell_size.height();
+  const int new_vertical_header_width = qMax(1, datacube->headerCount(Qt::Vertical)) * new_cell_size.width();
+  const int new_horizontal_header_height = qMax(1, datacube->headerCount(Qt::Horizontal)) * new_cell_size.height();
   QSize visible_size = q->viewport()->size();
+  // The whole view must be repainted in any case, as this is also called when all values changed
+  dirty_region = QRegion();
+  q->viewport()->update();
+  if (new_datacube_size == datacube_size && new_cell_size == cell_size && visible_size == layout_viewport_size
+      && new_vertical_header_width == vertical_header_width && new_horizontal_header_height == horizontal_header_height) {
+    return; // Geometry unchanged
+  }
+  datacube_size = new_datacube_size;
+  cell_size = new_cell_size;
+  vertical_header_width = new_vertical_header_width;
+  horizontal_header_height = new_horizontal_header_height;
+  layout_viewport_size = visible_size;
   // Calculate the number of rows and columns at least partly visible
   const int rows_visible = (visible_size.height() - horizontal_header_height + 1) / (cell_size.height());
   const int columns_visible = (visible_size.width() - vertical_header_width + 1) / (cell_size.width());
@@ -138,7 +499,6 @@ void DatacubeViewPrivate::relayout() {
   q->verticalScrollBar()->setPageStep(rows_visible);
   q->horizontalScrollBar()->setRange(0, qMax(0, ncolumns - columns_visible));
   q->horizontalScrollBar()->setPageStep(columns_visible);
-  q->viewport()->update();
 }
 
 void DatacubeView::resizeEvent(QResizeEvent* event)
@@ -163,6 +523,9 @@ void DatacubeViewPrivate::paint_datacube(QPaintEvent* event) const {
   if(!datacube) {
     return;
   }
+  QDATACUBE_TRACE("DatacubeView::paint_datacube");
+  QDATACUBE_TRACE_ARG("rows", visible_cells.height());
+  QDATACUBE_TRACE_ARG("columns", visible_cells.width());
   QPainter painter(q->viewport());
   QStyleOption options;
   options.initFrom(q->viewport());
@@ -238,12 +601,16 @@ void DatacubeViewPrivate::paint_datacube(QPaintEvent* event) const {
       header_rect.translate(header_rect.width(), 0);
       if (show_totals && bottommost_row >= hh + ndatarows) {
         summary_rect.setSize(header_rect.size());
+        if (!event->region().intersects(summary_rect)) {
+          summary_rect.translate(summary_rect.width(), 0);
+          continue;
+        }
         painter.drawRect(summary_rect);
         QRect text_rect(summary_rect);
-        QList<int> elements = datacube->elements(Qt::Horizontal, hh, header_index);
-        Q_FOREACH(AbstractFormatter* formatter, formatters) {
-          text_rect.setHeight(formatter->cellSize().height());
-          const QString value = formatter->format(elements);
+        const QVector<FormattedValue> values = formatted_values(FormatCacheKey::HorizontalTotal, hh, header_index);
+        for (int i = 0; i < formatters.size(); ++i) {
+          text_rect.setHeight(formatters.at(i)->cellSize().height());
+          const QString& value = values.at(i).text;
             painter.save();
             QVariant maybeforeground = aggregator->categoryHeaderData(header.categoryIndex, Qt::ForegroundRole);
             if(maybeforeground.canConvert<QColor>()) {
@@ -323,13 +690,17 @@ void DatacubeViewPrivate::paint_datacube(QPaintEvent* event) const {
       header_rect.translate(0, header_rect.height());
       if (show_totals && rightmost_column >= vh + ndatacolumns) {
         summary_rect.setSize(header_rect.size());
+        if (!event->region().intersects(summary_rect)) {
+          summary_rect.translate(0, summary_rect.height());
+          continue;
+        }
         painter.drawRect(summary_rect);
         QRect text_rect(summary_rect);
         text_rect.translate(0, (summary_rect.height()-cell_size.height())/2); // Center vertically
-        QList<int> elements = datacube->elements(Qt::Vertical, vh, header_index);
-        Q_FOREACH(AbstractFormatter* formatter, formatters) {
-          text_rect.setHeight(formatter->cellSize().height());
-          const QString value = formatter->format(elements);
+        const QVector<FormattedValue> values = formatted_values(FormatCacheKey::VerticalTotal, vh, header_index);
+        for (int i = 0; i < formatters.size(); ++i) {
+          text_rect.setHeight(formatters.at(i)->cellSize().height());
+          const QString& value = values.at(i).text;
             painter.save();
             QVariant maybeforeground = aggregator->categoryHeaderData(header.categoryIndex, Qt::ForegroundRole);
             if(maybeforeground.canConvert<QColor>()) {
@@ -360,7 +731,7 @@ void DatacubeViewPrivate::paint_datacube(QPaintEvent* event) const {
   }
 
   // Draw grand total cell, if appropriate
-  if (show_totals && bottommost_row >= ndatarows  && rightmost_column >= ndatacolumns ) {
+  if (show_totals && bottommost_row >= ndatarows  && rightmost_column >= ndatacolumns && event->region().intersects(grid_rect(ndatarows, ndatacolumns, qMax(1, horizontal_header_count), qMax(1, vertical_header_count)))) {
       int adaptedVerticalHeaderCount = qMax(vertical_header_count,1);
       int adaptedHorizontalHeaderCount = qMax(horizontal_header_count,1);
     const int leftmost_summary = ndatacolumns-leftmost_column+adaptedVerticalHeaderCount;
@@ -370,10 +741,10 @@ void DatacubeViewPrivate::paint_datacube(QPaintEvent* event) const {
     painter.drawRect(summary_rect);
     QRect text_rect(summary_rect);
     text_rect.translate(0, (summary_rect.height()-cell_size.height())/2); // Center vertically
-    QList<int> elements = datacube->elements();
-    Q_FOREACH(AbstractFormatter* formatter, formatters) {
-      text_rect.setHeight(formatter->cellSize().height());
-      const QString value = formatter->format(elements);
+    const QVector<FormattedValue> values = formatted_values(FormatCacheKey::GrandTotal, 0, 0);
+    for (int i = 0; i < formatters.size(); ++i) {
+      text_rect.setHeight(formatters.at(i)->cellSize().height());
+      const QString& value = values.at(i).text;
       painter.drawText(text_rect.adjusted(0,0,0,2), Qt::AlignCenter, value);
       text_rect.translate(0, text_rect.height());
     }
@@ -393,6 +764,10 @@ void DatacubeViewPrivate::paint_datacube(QPaintEvent* event) const {
   for (int r = q->verticalScrollBar()->value(), nr = qMin(datacube->rowCount(), bottommost_row+1); r < nr; ++r) {
     options.rect.moveLeft(q->viewport()->rect().left() + vertical_header_width);
     for (int c = q->horizontalScrollBar()->value(), nc = qMin(datacube->columnCount(), rightmost_column+1       ); c < nc; ++c) {
+      if (!event->region().intersects(options.rect)) {
+        options.rect.translate(cell_size.width(), 0);
+        continue;
+      }
       DatacubeSelection::SelectionStatus selection_status = selection->selectionStatus(r, c);
       bool highlighted = false;
       switch (selection_status) {
@@ -420,15 +795,15 @@ void DatacubeViewPrivate::paint_datacube(QPaintEvent* event) const {
           }
           break;
       }
-      QList<int> elements = datacube->elements(r,c);
-      if (elements.size() > 0) {
-        QRect textrect(options.rect);
-        Q_FOREACH(AbstractFormatter* formatter, formatters) {
-          textrect.setHeight(formatter->cellSize().height());
-          const QString value = formatter->format(elements);
-          q->style()->drawItemText(&painter, textrect.adjusted(0,0,0,2), Qt::AlignCenter, q->palette(), true, value, highlighted ? QPalette::HighlightedText : QPalette::Text);
-          textrect.translate(0,textrect.height());
+      const QVector<FormattedValue> values = formatted_values(FormatCacheKey::CellValue, r, c);
+      QRect textrect(options.rect);
+      for (int i = 0; i < formatters.size(); ++i) {
+        textrect.setHeight(formatters.at(i)->cellSize().height());
+        const FormattedValue& value = values.at(i);
+        if (value.width > 0) {
+          q->style()->drawItemText(&painter, textrect.adjusted(0,0,0,2), Qt::AlignCenter, q->palette(), true, value.text, highlighted ? QPalette::HighlightedText : QPalette::Text);
         }
+        textrect.translate(0,textrect.height());
       }
       painter.drawRect(options.rect);
       options.rect.translate(cell_size.width(), 0);
@@ -511,6 +886,51 @@ Datacube* DatacubeView::datacube() const {
   return d->datacube;
 }
 
+QMenu* DatacubeView::statisticsMenu() const {
+  if (!d->statistics_menu) {
+    d->statistics_menu = new QMenu(tr("Statistics"), const_cast<DatacubeView*>(this));
+    d->collect_statistics_action = d->statistics_menu->addAction(tr("Collect statistics"));
+    d->collect_statistics_action->setCheckable(true);
+    d->connect(d->collect_statistics_action, SIGNAL(toggled(bool)), SLOT(set_statistics_enabled(bool)));
+    d->connect(d->statistics_menu->addAction(tr("Dump statistics")), SIGNAL(triggered()), SLOT(dump_statistics()));
+    d->connect(d->statistics_menu->addAction(tr("Reset statistics")), SIGNAL(triggered()), SLOT(reset_statistics()));
+    d->connect(d->statistics_menu, SIGNAL(aboutToShow()), SLOT(update_statistics_menu()));
+    d->update_statistics_menu();
+  }
+  return d->statistics_menu;
+}
+
+void DatacubeViewPrivate::update_statistics_menu() {
+  const bool enabled = datacube && datacube->statistics();
+  collect_statistics_action->blockSignals(true);
+  collect_statistics_action->setChecked(enabled);
+  collect_statistics_action->blockSignals(false);
+  collect_statistics_action->setEnabled(datacube != 0);
+  Q_FOREACH(QAction* action, statistics_menu->actions()) {
+    if (action != collect_statistics_action) {
+      action->setEnabled(enabled);
+    }
+  }
+}
+
+void DatacubeViewPrivate::set_statistics_enabled(bool enabled) {
+  if (datacube) {
+    datacube->setStatisticsEnabled(enabled);
+  }
+}
+
+void DatacubeViewPrivate::dump_statistics() {
+  if (datacube && datacube->statistics()) {
+    qDebug("%s", qPrintable(datacube->statistics()->dump()));
+  }
+}
+
+void DatacubeViewPrivate::reset_statistics() {
+  if (datacube && datacube->statistics()) {
+    datacube->statistics()->reset();
+  }
+}
+
 void DatacubeView::mousePressEvent(QMouseEvent* event) {
   QAbstractScrollArea::mousePressEvent(event);
   if (event->button() != Qt::LeftButton || !d->datacube) {
@@ -676,6 +1096,7 @@ void DatacubeView::addFormatter(AbstractFormatter* formatter)
 {
   d->formatters << formatter;
   connect(formatter,SIGNAL(cellSizeChanged(QSize)), d.data(), SLOT(relayout()));
+  connect(formatter,SIGNAL(formatterChanged()), d.data(), SLOT(invalidate_formatter()));
   connect(formatter,SIGNAL(formatterChanged()), d.data(), SLOT(relayout()));
   formatter->setParent(this);
   d->relayout();
@@ -691,16 +1112,35 @@ AbstractFormatter* DatacubeView::takeFormatter(int index)
   AbstractFormatter* formatter = d->formatters.takeAt(index);
   disconnect(formatter,SIGNAL(cellSizeChanged(QSize)), d.data(),SLOT(relayout()));
   disconnect(formatter,SIGNAL(formatterChanged()), d.data(), SLOT(relayout()));
+  disconnect(formatter,SIGNAL(formatterChanged()), d.data(), SLOT(invalidate_formatter()));
+  d->remove_formatted_values(formatter);
+  d->format_pool.waitForDone(); // the caller now owns the formatter
   d->relayout();
   return formatter;
 }
 
+void DatacubeView::setAsynchronousFormatting(bool asynchronous) {
+  if (asynchronous != d->asynchronous_formatting) {
+    d->asynchronous_formatting = asynchronous;
+    d->invalidate_pending_formats();
+    viewport()->update();
+  }
+}
+
+bool DatacubeView::asynchronousFormatting() const {
+  return d->asynchronous_formatting;
+}
+
 void DatacubeViewPrivate::datacube_deleted() {
     selection->deleteLater();
     q->d.reset(new DatacubeViewPrivate(q));
 }
 
 bool DatacubeView::event(QEvent* event) {
+    if(event->type() == QEvent::FontChange) {
+        // Cached text widths are in the old font
+        d->format_cache.clear();
+    }
     if(event->type() == QEvent::ToolTip) {
         do {
             QHelpEvent* helpEvent = static_cast<QHelpEvent*>(event);
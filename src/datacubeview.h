@@ -11,6 +11,8 @@
 #include <QAbstractScrollArea>
 #include "qdatacube_export.h"
 
+class QMenu;
+
 namespace qdatacube {
 
 class AbstractFormatter;
@@ -56,6 +58,25 @@ class QDATACUBE_EXPORT DatacubeView : public QAbstractScrollArea  {
          * @return all the formatters in current use
          */
         QList<AbstractFormatter*> formatters() const;
+
+        /**
+         * Format values in a thread pool rather than while painting. Only used with formatters
+         * that are thread safe (see AbstractFormatter::isThreadSafe()), other formatters are still
+         * called while painting. Until the value arrives, a placeholder is shown.
+         * Default is false.
+         */
+        void setAsynchronousFormatting(bool asynchronous);
+
+        /**
+         * @return true if formatting asynchronously
+         */
+        bool asynchronousFormatting() const;
+
+        /**
+         * @return menu for collecting, dumping and resetting the statistics of the datacube (see
+         * Datacube::statistics()), for adding to the menus shown on the context menu signals. Owned by the view.
+         */
+        QMenu* statisticsMenu() const;
     protected:
         virtual void mousePressEvent(QMouseEvent* event);
         virtual void mouseReleaseEvent(QMouseEvent* event );
@@ -4,9 +4,21 @@
 #include <QSize>
 #include <QPoint>
 #include <QRect>
+#include <QRegion>
+#include <QCache>
+#include <QHash>
+#include <QVector>
+#include <QSharedPointer>
+#include <QAtomicInt>
+#include <QThreadPool>
 #include "cell.h"
 
+class QMenu;
+class QAction;
+
 class QPaintEvent;
+class QModelIndex;
+class QTimer;
 namespace qdatacube {
 
 class DatacubeSelection;
@@ -14,6 +26,41 @@ class AbstractFormatter;
 class Datacube;
 class DatacubeView;
 
+/**
+ * Identifies a formatted value shown in the view: A cell, a header total or the grand total
+ */
+struct FormatCacheKey {
+    enum Kind {
+        CellValue, // a: row, b: column
+        HorizontalTotal, // a: headerno, b: header section
+        VerticalTotal, // a: headerno, b: header section
+        GrandTotal
+    };
+    FormatCacheKey(const AbstractFormatter* formatter, Kind kind, int a, int b)
+      : formatter(formatter), kind(kind), a(a), b(b) {}
+    bool operator==(const FormatCacheKey& rhs) const {
+        return formatter == rhs.formatter && kind == rhs.kind && a == rhs.a && b == rhs.b;
+    }
+    const AbstractFormatter* formatter;
+    Kind kind;
+    int a;
+    int b;
+};
+
+inline uint qHash(const FormatCacheKey& key) {
+    return qHash(key.formatter) ^ (uint(key.kind) << 30) ^ uint(key.a * 92821) ^ uint(key.b);
+}
+
+/**
+ * A formatted value with its width in the view font
+ */
+struct FormattedValue {
+    FormattedValue() : width(0) {}
+    FormattedValue(const QString& text, int width) : text(text), width(width) {}
+    QString text;
+    int width;
+};
+
 class DatacubeViewPrivate : public QObject {
     Q_OBJECT
     public:
@@ -34,6 +81,95 @@ class DatacubeViewPrivate : public QObject {
         QRect selection_area;
         QRect header_selection_area;
         bool show_totals;
+        QSize layout_viewport_size;
+
+        /**
+         * Created on first use by DatacubeView::statisticsMenu()
+         */
+        QMenu* statistics_menu;
+        QAction* collect_statistics_action;
+
+        /**
+         * Area of the viewport to be repainted. Changes are accumulated here and flushed by repaint_timer, so
+         * a burst of changes gives one repaint of the changed area.
+         */
+        QRegion dirty_region;
+        QTimer* repaint_timer;
+
+        /**
+         * @return rectangle in viewport coordinates for the rows and columns, where rows and columns
+         * past the end of the datacube are the totals
+         */
+        QRect grid_rect(int row, int column, int nrows = 1, int ncolumns = 1) const;
+
+        /**
+         * @return rectangle in viewport coordinates for the value given by kind, a and b (see FormatCacheKey)
+         */
+        QRect value_rect(FormatCacheKey::Kind kind, int a, int b) const;
+
+        /**
+         * Schedule rect for repaint
+         */
+        void mark_dirty(const QRect& rect);
+
+        /**
+         * Formatted values by formatter and cell or total, so repaints do not call AbstractFormatter::format()
+         * for values that did not change. Cost is in bytes.
+         */
+        mutable QCache<FormatCacheKey, FormattedValue> format_cache;
+        static const int format_cache_size = 4*1024*1024;
+
+        /**
+         * @return the formatted value for each formatter for the cell or total given by kind, a and b. The elements
+         * are only fetched from the datacube if some value is not in the cache.
+         */
+        QVector<FormattedValue> formatted_values(FormatCacheKey::Kind kind, int a, int b) const;
+
+        /**
+         * @return the value from formatter for the cell or total given by kind, a and b, formatted by
+         * AbstractFormatter::formatCells()
+         */
+        QString format_cells(const AbstractFormatter* formatter, FormatCacheKey::Kind kind, int a, int b) const;
+
+        /**
+         * Insert text in the cache
+         * @return the cached value
+         */
+        FormattedValue insert_formatted_value(const FormatCacheKey& key, const QString& text) const;
+
+        /**
+         * Remove all cached values from formatter
+         */
+        void remove_formatted_values(const AbstractFormatter* formatter);
+
+        /**
+         * Asynchronous formatting: Values from thread safe formatters are computed by jobs on format_pool
+         * while a placeholder is shown. Jobs are numbered, and results arrive as events. A result is dropped
+         * if its value was invalidated after the job started: by a change to all values (jobs up to
+         * format_generation), or by a change to its own cell or total (jobs up to its entry in format_invalidated).
+         */
+        bool asynchronous_formatting;
+        mutable QHash<FormatCacheKey, int> pending_formats; // value to number of the job computing it
+        mutable QSharedPointer<QAtomicInt> format_cancelled;
+        int format_generation;
+        mutable int last_format_job;
+        QHash<FormatCacheKey, int> format_invalidated;
+
+        /**
+         * Cancel the pending jobs, and drop the results of those already running
+         */
+        void invalidate_pending_formats();
+
+        /**
+         * Drop the result of the job computing key, if any
+         */
+        void invalidate_pending_format(const FormatCacheKey& key);
+
+        /**
+         * Remove key from the cache, and drop the result of the job computing it, if any
+         */
+        void invalidate_formatted_value(const FormatCacheKey& key);
+        virtual bool event(QEvent* event);
 
         /**
          *  Return cell corresponding to position. Note that position is zero-based, and if no cells at position an
@@ -44,6 +180,36 @@ class DatacubeViewPrivate : public QObject {
     public Q_SLOTS:
         void relayout();
         void datacube_deleted();
+        void invalidate_formatted_values();
+        void invalidate_formatter();
+        /**
+         * Remove cached values for the cells in the rectangle and the totals that include them
+         */
+        void invalidate_cells(int top_row, int left_column, int bottom_row, int right_column);
+        void invalidate_elements(const QModelIndex& top_left, const QModelIndex& bottom_right);
+
+        /**
+         * Cancel jobs that have not started yet, e.g. because the view scrolled
+         */
+        void cancel_pending_formats();
+
+        /**
+         * Repaint the cells in the rectangle
+         */
+        void update_cells(int top_row, int left_column, int bottom_row, int right_column);
+
+        /**
+         * Repaint the cells in the rectangle and the totals that include them
+         */
+        void update_cells_and_totals(int top_row, int left_column, int bottom_row, int right_column);
+        void flush_dirty_region();
+        void update_statistics_menu();
+        void set_statistics_enabled(bool enabled);
+        void dump_statistics();
+        void reset_statistics();
+    public:
+        // Declared last, so it is destroyed (waiting for running jobs) first
+        mutable QThreadPool format_pool;
 };
 
 }
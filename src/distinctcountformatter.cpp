@@ -0,0 +1,166 @@
+#include "distinctcountformatter.h"
+#include <QAbstractItemModel>
+#include <QVector>
+#include <stdexcept>
+#include "datacubeview.h"
+#include "hyperloglog.h"
+#include "cellsketches_p.h"
+
+namespace qdatacube {
+
+class DistinctCountFormatterPrivate : public CellSketches<HyperLogLog> {
+    public:
+        DistinctCountFormatterPrivate(const QAbstractItemModel* model, int column, int precision)
+          : m_model(model), m_column(column), m_precision(clamp(precision)), m_valid(false) {
+        }
+        /**
+         * @return precision as HyperLogLog will use it
+         */
+        static int clamp(int precision) {
+          return qBound(int(HyperLogLog::MIN_PRECISION), precision, int(HyperLogLog::MAX_PRECISION));
+        }
+        const QAbstractItemModel* m_model;
+        const int m_column;
+        int m_precision;
+        // Hash of the column value for each row in the underlying model
+        mutable QVector<quint64> m_hashes;
+        mutable bool m_valid;
+        void rebuild() const;
+        void add(HyperLogLog& sketch, const QList<int>& rows) const;
+    protected:
+        virtual HyperLogLog* build(const QList<int>& elements) const;
+        virtual int cost(const HyperLogLog& sketch) const;
+};
+
+void DistinctCountFormatterPrivate::rebuild() const {
+  const int nrows = m_model->rowCount();
+  m_hashes.resize(nrows);
+  for (int row = 0; row < nrows; ++row) {
+    m_hashes[row] = HyperLogLog::hash(m_model->index(row, m_column).data().toString());
+  }
+  m_valid = true;
+}
+
+void DistinctCountFormatterPrivate::add(HyperLogLog& sketch, const QList<int>& rows) const {
+  if (!m_valid) {
+    rebuild();
+  }
+  const quint64* hashes = m_hashes.constData();
+  Q_FOREACH(int element, rows) {
+    sketch.add(hashes[element]);
+  }
+}
+
+HyperLogLog* DistinctCountFormatterPrivate::build(const QList<int>& elements) const {
+  HyperLogLog* rv = new HyperLogLog(m_precision);
+  add(*rv, elements);
+  return rv;
+}
+
+int DistinctCountFormatterPrivate::cost(const HyperLogLog& sketch) const {
+  return int(sizeof(HyperLogLog)) + (1 << sketch.precision());
+}
+
+/**
+ * @return estimate rounded for display. Only an empty sketch estimates less than 1.
+ */
+static QString format_estimate(double estimate) {
+  return QString::number(estimate > 0.0 ? qMax(qint64(1), qRound64(estimate)) : qint64(0));
+}
+
+DistinctCountFormatter::DistinctCountFormatter(QAbstractItemModel* underlying_model, qdatacube::DatacubeView* view, int column, int precision)
+ : AbstractFormatter(underlying_model, view), d(new DistinctCountFormatterPrivate(underlying_model, column, precision))
+{
+  if (column >= underlying_model->columnCount()|| column<0) {
+    throw std::runtime_error(QString("Column %1 must be in the underlying model, ie., be between 0 and %2").arg(column).arg(underlying_model->columnCount()).toStdString());
+  }
+  connect(underlying_model, SIGNAL(dataChanged(QModelIndex,QModelIndex)), SLOT(refresh_rows(QModelIndex,QModelIndex)));
+  connect(underlying_model, SIGNAL(rowsInserted(QModelIndex,int,int)), SLOT(invalidate()));
+  connect(underlying_model, SIGNAL(rowsRemoved(QModelIndex,int,int)), SLOT(invalidate()));
+  connect(underlying_model, SIGNAL(modelReset()), SLOT(invalidate()));
+  update(qdatacube::AbstractFormatter::CellSize);
+  setShortName("DST");
+  setName(QString("Distinct %1").arg(underlyingModel()->headerData(d->m_column, Qt::Horizontal).toString()));
+}
+
+double DistinctCountFormatter::estimate(const QList<int>& rows) const {
+  HyperLogLog sketch(d->m_precision);
+  d->add(sketch, rows);
+  return sketch.estimate();
+}
+
+double DistinctCountFormatter::estimate(const Datacube* datacube, int top_row, int left_column, int bottom_row, int right_column) const {
+  HyperLogLog sketch(d->m_precision);
+  d->merge(datacube, top_row, left_column, bottom_row, right_column, sketch);
+  return sketch.estimate();
+}
+
+QString DistinctCountFormatter::format(QList< int > rows) const {
+  return format_estimate(estimate(rows));
+}
+
+bool DistinctCountFormatter::mergesCells() const {
+  return true;
+}
+
+QString DistinctCountFormatter::formatCells(const Datacube* datacube, int top_row, int left_column, int bottom_row, int right_column) const {
+  return format_estimate(estimate(datacube, top_row, left_column, bottom_row, right_column));
+}
+
+int DistinctCountFormatter::precision() const {
+  return d->m_precision;
+}
+
+void DistinctCountFormatter::setPrecision(int precision) {
+  precision = DistinctCountFormatterPrivate::clamp(precision);
+  if (precision != d->m_precision) {
+    d->m_precision = precision;
+    d->clear();
+    emit formatterChanged();
+  }
+}
+
+void DistinctCountFormatter::refresh_rows(const QModelIndex& top_left, const QModelIndex& bottom_right) {
+  if (top_left.parent().isValid()) {
+    return;
+  }
+  if (top_left.column() > d->m_column || bottom_right.column() < d->m_column) {
+    return;
+  }
+  if (bottom_right.row() - top_left.row() >= 64) {
+    d->clear();
+  } else {
+    for (int row = top_left.row(); row <= bottom_right.row(); ++row) {
+      d->forgetElement(row);
+    }
+  }
+  if (!d->m_valid) {
+    return;
+  }
+  for (int row = top_left.row(); row <= bottom_right.row(); ++row) {
+    d->m_hashes[row] = HyperLogLog::hash(underlyingModel()->index(row, d->m_column).data().toString());
+  }
+}
+
+void DistinctCountFormatter::invalidate() {
+  d->m_valid = false;
+  d->m_hashes.clear();
+}
+
+void DistinctCountFormatter::update(AbstractFormatter::UpdateType element) {
+  if (element == qdatacube::AbstractFormatter::CellSize) {
+    if (datacubeView()) {
+      QString big_cell_contents = QString::number(underlyingModel()->rowCount());
+      setCellSize(QSize(datacubeView()->fontMetrics().width(big_cell_contents),
+                        datacubeView()->fontMetrics().lineSpacing()));
+    }
+  }
+}
+
+DistinctCountFormatter::~DistinctCountFormatter() {
+
+}
+
+} // end of namespace
+
+#include "distinctcountformatter.moc"
@@ -0,0 +1,69 @@
+#ifndef QDATACUBE_DISTINCT_COUNT_FORMATTER_H
+#define QDATACUBE_DISTINCT_COUNT_FORMATTER_H
+
+#include "abstractformatter.h"
+#include "qdatacube_export.h"
+
+class QModelIndex;
+
+namespace qdatacube {
+
+/**
+ * Approximate number of distinct values in a column, e.g. "unique customers" per cell.
+ *
+ * Uses a HyperLogLog sketch over hashes of the column values. The hashes are computed once per
+ * row and kept up to date with the underlying model, so formatting a cell does no model lookups.
+ * The precision sets the accuracy/memory tradeoff: the relative standard error is about
+ * 1.04/sqrt(2^precision) using 2^precision bytes per sketch.
+ *
+ * In a DatacubeView, a sketch is kept per cell and the sketches are merged for the totals, so
+ * a total is not a pass over all its elements. Sketches are dropped as their cells change.
+ */
+class DistinctCountFormatterPrivate;
+class QDATACUBE_EXPORT DistinctCountFormatter : public AbstractFormatter {
+    Q_OBJECT
+    public:
+        /**
+         * @param underlying_model the underlying model
+         * @param view the datacube view (optional, used to indicate cell size)
+         * @param column the column of the underlying model whose distinct values are counted
+         * @param precision number of HyperLogLog index bits, between 4 and 18
+         */
+        DistinctCountFormatter(QAbstractItemModel* underlying_model, qdatacube::DatacubeView* view, int column, int precision = 12);
+        virtual QString format(QList< int > rows) const;
+
+        /**
+         * @return estimated number of distinct values in column for rows
+         */
+        double estimate(const QList<int>& rows) const;
+
+        /**
+         * @return estimated number of distinct values in column for the cells of datacube from top_row,
+         * left_column to bottom_row, right_column, merging the sketches kept for each cell
+         */
+        double estimate(const Datacube* datacube, int top_row, int left_column, int bottom_row, int right_column) const;
+
+        virtual bool mergesCells() const;
+        virtual QString formatCells(const Datacube* datacube, int top_row, int left_column, int bottom_row, int right_column) const;
+
+        /**
+         * @return the precision
+         */
+        int precision() const;
+
+        /**
+         * Change the precision, clamped to between 4 and 18. Emits formatterChanged() if it changed
+         */
+        void setPrecision(int precision);
+        virtual ~DistinctCountFormatter();
+    protected:
+        virtual void update(UpdateType element);
+    private Q_SLOTS:
+        void refresh_rows(const QModelIndex& top_left, const QModelIndex& bottom_right);
+        void invalidate();
+    private:
+        QScopedPointer<DistinctCountFormatterPrivate> d;
+};
+
+} // end of namespace
+#endif // QDATACUBE_DISTINCT_COUNT_FORMATTER_H
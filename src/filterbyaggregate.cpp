@@ -1,6 +1,7 @@
 #include "filterbyaggregate.h"
 
 #include "abstractaggregator.h"
+#include "bitset.h"
 
 #include <QSharedPointer>
 
@@ -23,6 +24,7 @@ FilterByAggregatePrivate::FilterByAggregatePrivate(FilterByAggregate* q, Abstrac
     Q_ASSERT(categoryIndex < aggregator->categoryCount());
     QObject::connect(aggregator.data(), &AbstractAggregator::categoryAdded, q, &FilterByAggregate::slot_aggregator_category_inserted);
     QObject::connect(aggregator.data(), &AbstractAggregator::categoryRemoved, q, &FilterByAggregate::slot_aggregator_category_removed);
+    QObject::connect(aggregator.data(), &AbstractAggregator::rowsRecategorized, q, &AbstractFilter::resultsChanged);
     q->setShortName(m_category);
     q->setName(m_aggregator->name() + "=" + m_category);
 }
@@ -61,6 +63,17 @@ bool FilterByAggregate::operator()(int row) const {
     return d->m_aggregator->operator()(row) == d->m_categoryIndex;
 }
 
+void FilterByAggregate::evaluate(int start, int count, Bitset& result) const {
+    const int category = d->m_categoryIndex;
+    if (category < 0) {
+        result = Bitset(count);
+        return;
+    }
+    Bitset categories(category + 1);
+    categories.set(category);
+    d->m_aggregator->matchCategories(start, count, categories, false, result);
+}
+
 void FilterByAggregate::slot_aggregator_category_inserted(int index) {
     if (d->m_categoryIndex == -1) {
         d->m_categoryIndex = categoryToIndex(d->m_aggregator, d->m_category);
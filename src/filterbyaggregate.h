@@ -36,6 +36,11 @@ public:
     // Inherited:
     virtual bool operator()(int row) const;
 
+    /**
+     * Compares the categories of the rows, as given by AbstractAggregator::categorize(), with categoryIndex()
+     */
+    virtual void evaluate(int start, int count, Bitset& result) const;
+
     // Getters:
     AbstractAggregator::Ptr aggregator() const;
     int categoryIndex() const;
@@ -0,0 +1,204 @@
+#include "filtercombination_p.h"
+
+#include "bitset.h"
+
+#include <QElapsedTimer>
+#include <QVarLengthArray>
+
+#include <algorithm>
+
+namespace qdatacube {
+
+FilterCombination::FilterCombination(Operator op)
+  : m_operator(op), m_adaptive(1), m_calls(0), m_version(0), m_samples(0)
+{
+}
+
+void FilterCombination::append(AbstractFilter::Ptr filter) {
+    QMutexLocker lock(&m_mutex);
+    m_order << m_filters.size();
+    m_filters << filter;
+    m_statistics << Statistics();
+    m_published << QAtomicInt(0);
+    publish();
+}
+
+void FilterCombination::publish() const {
+    m_version.fetchAndAddOrdered(1);
+    for (int i = 0; i < m_order.size(); ++i) {
+        m_published[i].storeRelease(m_order.at(i));
+    }
+    m_version.fetchAndAddOrdered(1);
+}
+
+void FilterCombination::read_published(int* order) const {
+    for (;;) {
+        const int version = m_version.loadAcquire();
+        if (version & 1) {
+            continue; // Being published
+        }
+        for (int i = 0, nfilters = m_published.size(); i < nfilters; ++i) {
+            order[i] = m_published.at(i).loadAcquire();
+        }
+        if (m_version.loadAcquire() == version) {
+            return;
+        }
+    }
+}
+
+FilterCombination::Filters FilterCombination::evaluationOrder() const {
+    QMutexLocker lock(&m_mutex);
+    Filters rv;
+    Q_FOREACH(int filter, m_order) {
+        rv << m_filters.at(filter);
+    }
+    return rv;
+}
+
+void FilterCombination::setAdaptive(bool adaptive) {
+    QMutexLocker lock(&m_mutex);
+    m_adaptive.storeRelease(adaptive);
+    if (!adaptive) {
+        for (int filter = 0; filter < m_order.size(); ++filter) {
+            m_order[filter] = filter;
+        }
+        publish();
+        m_statistics.fill(Statistics());
+        m_calls.storeRelease(0);
+        m_samples = 0;
+    }
+}
+
+bool FilterCombination::test(int row) const {
+    const int nfilters = m_filters.size();
+    QVarLengthArray<int, 16> order(nfilters);
+    read_published(order.data());
+    if (m_adaptive.loadAcquire() && ((m_calls.fetchAndAddRelaxed(1) + 1) & (sample_interval - 1)) == 0) {
+        return test_sampled(row, order.constData());
+    }
+    // AND stops at the first filter rejecting the row, OR at the first accepting it
+    const bool stop = m_operator == Or;
+    for (int i = 0; i < nfilters; ++i) {
+        if ((*m_filters.at(order[i]))(row) == stop) {
+            return stop;
+        }
+    }
+    return !stop;
+}
+
+bool FilterCombination::test_sampled(int row, const int* order) const {
+    bool rv = m_operator == And;
+    QVector<Statistics> observations(m_filters.size());
+    QElapsedTimer timer;
+    for (int i = 0, nfilters = m_filters.size(); i < nfilters; ++i) {
+        const int filter = order[i];
+        timer.start();
+        const bool passed = (*m_filters.at(filter))(row);
+        Statistics& statistics = observations[filter];
+        statistics.nsecs += timer.nsecsElapsed();
+        ++statistics.evaluations;
+        statistics.passes += passed;
+        rv = m_operator == And ? rv && passed : rv || passed;
+    }
+    QMutexLocker lock(&m_mutex);
+    if (!m_adaptive.loadAcquire()) {
+        return rv;
+    }
+    record(observations);
+    if (++m_samples == reorder_interval) {
+        m_samples = 0;
+        reorder();
+    }
+    return rv;
+}
+
+void FilterCombination::evaluate(int start, int count, Bitset& result) const {
+    QVector<int> order;
+    bool adaptive;
+    {
+        QMutexLocker lock(&m_mutex);
+        order = m_order;
+        adaptive = m_adaptive.loadAcquire();
+    }
+    result = Bitset(count);
+    if (m_operator == And) {
+        result.setAll();
+    }
+    Bitset filter_result;
+    QVector<Statistics> observations(m_filters.size());
+    QElapsedTimer timer;
+    for (int i = 0, nfilters = order.size(); i < nfilters; ++i) {
+        // Stop when nothing is left to reject or to accept
+        if (m_operator == And ? !result.any() : result.count() == count) {
+            break;
+        }
+        const int filter = order.at(i);
+        timer.start();
+        m_filters.at(filter)->evaluate(start, count, filter_result);
+        Statistics& statistics = observations[filter];
+        statistics.nsecs += timer.nsecsElapsed();
+        statistics.evaluations += count;
+        statistics.passes += filter_result.count();
+        if (m_operator == And) {
+            result &= filter_result;
+        } else {
+            result |= filter_result;
+        }
+    }
+    if (adaptive) {
+        QMutexLocker lock(&m_mutex);
+        if (m_adaptive.loadAcquire()) {
+            record(observations);
+            reorder();
+        }
+    }
+}
+
+void FilterCombination::record(const QVector<Statistics>& observations) const {
+    for (int filter = 0; filter < observations.size(); ++filter) {
+        Statistics& statistics = m_statistics[filter];
+        statistics.evaluations += observations.at(filter).evaluations;
+        statistics.passes += observations.at(filter).passes;
+        statistics.nsecs += observations.at(filter).nsecs;
+    }
+}
+
+double FilterCombination::rank(int filter) const {
+    const Statistics& statistics = m_statistics.at(filter);
+    if (statistics.evaluations == 0) {
+        return 0.0; // Try unknown filters first, to get to know them
+    }
+    const double cost = double(statistics.nsecs) / statistics.evaluations;
+    const double pass_rate = (statistics.passes + 1.0) / (statistics.evaluations + 2.0);
+    return cost / (m_operator == And ? 1.0 - pass_rate : pass_rate);
+}
+
+namespace {
+struct ByRank {
+    ByRank(const QVector<double>& ranks) : ranks(ranks) {}
+    bool operator()(int lhs, int rhs) const {
+        return ranks.at(lhs) < ranks.at(rhs) || (ranks.at(lhs) == ranks.at(rhs) && lhs < rhs);
+    }
+    const QVector<double>& ranks;
+};
+}
+
+void FilterCombination::reorder() const {
+    QVector<double> ranks(m_filters.size());
+    for (int filter = 0; filter < ranks.size(); ++filter) {
+        ranks[filter] = rank(filter);
+    }
+    std::sort(m_order.begin(), m_order.end(), ByRank(ranks));
+    publish();
+    // Let old observations fade, so the order follows the rows as they change
+    for (int filter = 0; filter < m_statistics.size(); ++filter) {
+        Statistics& statistics = m_statistics[filter];
+        if (statistics.evaluations > max_evaluations) {
+            statistics.evaluations /= 2;
+            statistics.passes /= 2;
+            statistics.nsecs /= 2;
+        }
+    }
+}
+
+}
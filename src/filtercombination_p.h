@@ -0,0 +1,102 @@
+#ifndef QDATACUBE_FILTERCOMBINATION_P_H
+#define QDATACUBE_FILTERCOMBINATION_P_H
+
+#include "abstractfilter.h"
+
+#include <QAtomicInt>
+#include <QList>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QVector>
+
+namespace qdatacube {
+
+/**
+ * Evaluation of the filters combined by an AndFilter or an OrFilter, in an order adapted to the filters.
+ *
+ * Every sample_interval'th row is evaluated by all filters, timing each, to learn each filter's cost and
+ * pass rate. Every reorder_interval samples, the filters are ordered by cost per row decided: for AND,
+ * cost / (1 - pass rate), so cheap filters rejecting most rows go first; for OR, cost / pass rate.
+ * Batch evaluation learns from every call, and reorders after it. Observations are halved now and then,
+ * so the order follows changes in the rows.
+ *
+ * The filters are pure, so the order never changes the result, only the cost. Ties are broken by the order
+ * the filters were added in.
+ *
+ * test() and evaluate() are const, as the filters' operator() and evaluate() are, and may be called from several
+ * threads. test() takes no lock unless it samples the row: calls are counted atomically, and the order is read
+ * from a copy published with a sequence number, read again if it changed meanwhile. The rest of the sampling
+ * state is mutable and guarded by a mutex, held to record observations and reorder, not while the filters run.
+ */
+class FilterCombination {
+    public:
+        enum Operator {
+            And,
+            Or
+        };
+        typedef QList<AbstractFilter::Ptr> Filters;
+        static const int sample_interval = 64; // power of 2
+        static const int reorder_interval = 256;
+        static const qint64 max_evaluations = 1 << 20; // observations are halved beyond this
+
+        explicit FilterCombination(Operator op);
+
+        void append(AbstractFilter::Ptr filter);
+
+        const Filters& filters() const {
+            return m_filters;
+        }
+
+        /**
+         * @return the filters in the order they are evaluated
+         */
+        Filters evaluationOrder() const;
+
+        /**
+         * Turn adapting the order on or off. When off, the filters are evaluated in the order they were added.
+         */
+        void setAdaptive(bool adaptive);
+
+        bool isAdaptive() const {
+            return m_adaptive.loadAcquire();
+        }
+
+        bool test(int row) const;
+        void evaluate(int start, int count, Bitset& result) const;
+    private:
+        struct Statistics {
+            Statistics() : evaluations(0), passes(0), nsecs(0) {}
+            qint64 evaluations;
+            qint64 passes;
+            qint64 nsecs;
+        };
+        bool test_sampled(int row, const int* order) const;
+        /**
+         * Add observations, indexed like m_filters, to the statistics. Must hold m_mutex.
+         */
+        void record(const QVector<Statistics>& observations) const;
+        void reorder() const;
+        double rank(int filter) const;
+        /**
+         * Copy m_order to m_published for test(). Must hold m_mutex.
+         */
+        void publish() const;
+        /**
+         * Read the published order into order, which has room for all filters, without locking
+         */
+        void read_published(int* order) const;
+        Operator m_operator;
+        Filters m_filters; // in the order added
+        QAtomicInt m_adaptive;
+        mutable QAtomicInt m_calls;
+        mutable QVector<QAtomicInt> m_published; // m_order as last published, read without locking
+        mutable QAtomicInt m_version; // odd while m_published is being written
+        mutable QMutex m_mutex; // guards the members below
+        mutable QVector<int> m_order; // indexes into m_filters in evaluation order
+        mutable QVector<Statistics> m_statistics; // indexed like m_filters
+        mutable int m_samples;
+};
+
+}
+
+#endif // QDATACUBE_FILTERCOMBINATION_P_H
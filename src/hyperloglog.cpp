@@ -0,0 +1,90 @@
+#include "hyperloglog.h"
+
+#include <QtAlgorithms>
+#include <cmath>
+
+namespace qdatacube {
+
+HyperLogLog::HyperLogLog(int precision)
+  : m_precision(qBound(int(MIN_PRECISION), precision, int(MAX_PRECISION))),
+    m_registers(1 << m_precision, 0)
+{
+}
+
+void HyperLogLog::add(quint64 hash) {
+  const int index = int(hash >> (64 - m_precision));
+  const quint64 remainder = hash << m_precision;
+  const quint8 rank = quint8(qMin(int(qCountLeadingZeroBits(remainder)), 64 - m_precision) + 1);
+  quint8& reg = m_registers[index];
+  if (rank > reg) {
+    reg = rank;
+  }
+}
+
+void HyperLogLog::merge(const HyperLogLog& other) {
+  Q_ASSERT(other.m_precision == m_precision);
+  if (other.m_precision != m_precision) {
+    return;
+  }
+  quint8* registers = m_registers.data();
+  const quint8* other_registers = other.m_registers.constData();
+  for (int i=0, iend = m_registers.size(); i<iend; ++i) {
+    registers[i] = qMax(registers[i], other_registers[i]);
+  }
+}
+
+double HyperLogLog::estimate() const {
+  const int m = m_registers.size();
+  double alpha;
+  switch (m) {
+    case 16:
+      alpha = 0.673;
+      break;
+    case 32:
+      alpha = 0.697;
+      break;
+    case 64:
+      alpha = 0.709;
+      break;
+    default:
+      alpha = 0.7213/(1.0 + 1.079/m);
+  }
+  double sum = 0.0;
+  int zeros = 0;
+  Q_FOREACH(quint8 reg, m_registers) {
+    sum += std::ldexp(1.0, -int(reg));
+    if (reg == 0) {
+      ++zeros;
+    }
+  }
+  const double raw = alpha * m * m / sum;
+  if (raw <= 2.5 * m && zeros > 0) {
+    // Small range correction: linear counting is more precise here
+    return m * std::log(double(m) / zeros);
+  }
+  return raw;
+}
+
+double HyperLogLog::relativeError(int precision) {
+  precision = qBound(int(MIN_PRECISION), precision, int(MAX_PRECISION));
+  return 1.04 / std::sqrt(double(1 << precision));
+}
+
+quint64 HyperLogLog::hash(const QString& string) {
+  // FNV-1a over the UTF-16 code units, followed by the splitmix64 finalizer to
+  // spread the entropy into the high bits used for register selection.
+  quint64 h = Q_UINT64_C(14695981039346656037);
+  const ushort* data = string.utf16();
+  for (int i=0, iend = string.size(); i<iend; ++i) {
+    h ^= data[i];
+    h *= Q_UINT64_C(1099511628211);
+  }
+  h ^= h >> 30;
+  h *= Q_UINT64_C(0xbf58476d1ce4e5b9);
+  h ^= h >> 27;
+  h *= Q_UINT64_C(0x94d049bb133111eb);
+  h ^= h >> 31;
+  return h;
+}
+
+} // end of namespace
@@ -0,0 +1,64 @@
+#ifndef QDATACUBE_HYPERLOGLOG_H
+#define QDATACUBE_HYPERLOGLOG_H
+
+#include <QVector>
+#include <QString>
+#include "qdatacube_export.h"
+
+namespace qdatacube {
+
+/**
+ * HyperLogLog sketch estimating the number of distinct values added.
+ *
+ * The sketch uses 2^precision one-byte registers, giving a relative standard
+ * error of about 1.04/sqrt(2^precision): precision 10 is ~3% in 1KiB,
+ * precision 14 is ~0.8% in 16KiB.
+ * Two sketches of equal precision can be merged, the result being the sketch
+ * of the union of their inputs.
+ */
+class QDATACUBE_EXPORT HyperLogLog {
+    public:
+        static const int MIN_PRECISION = 4;
+        static const int MAX_PRECISION = 18;
+
+        /**
+         * @param precision number of index bits, clamped to [MIN_PRECISION, MAX_PRECISION]
+         */
+        explicit HyperLogLog(int precision = 12);
+
+        /**
+         * Add a (well mixed) 64 bit hash of a value
+         */
+        void add(quint64 hash);
+
+        /**
+         * Merge other into this. Both sketches must have the same precision.
+         */
+        void merge(const HyperLogLog& other);
+
+        /**
+         * @return the estimated number of distinct hashes added
+         */
+        double estimate() const;
+
+        int precision() const {
+            return m_precision;
+        }
+
+        /**
+         * @return the expected relative standard error for a given precision
+         */
+        static double relativeError(int precision);
+
+        /**
+         * @return a 64 bit hash of string suitable for add()
+         */
+        static quint64 hash(const QString& string);
+    private:
+        int m_precision;
+        QVector<quint8> m_registers;
+};
+
+} // end of namespace
+
+#endif // QDATACUBE_HYPERLOGLOG_H
@@ -0,0 +1,41 @@
+#include "memoryusage.h"
+
+namespace qdatacube {
+
+void MemoryUsage::add(const QString& structure, qint64 bytes) {
+  m_bytes[structure] += bytes;
+}
+
+MemoryUsage& MemoryUsage::operator+=(const MemoryUsage& other) {
+  for (QMap<QString, qint64>::const_iterator it = other.m_bytes.constBegin(), end = other.m_bytes.constEnd(); it != end; ++it) {
+    m_bytes[it.key()] += it.value();
+  }
+  return *this;
+}
+
+qint64 MemoryUsage::bytes(const QString& structure) const {
+  return m_bytes.value(structure);
+}
+
+qint64 MemoryUsage::total() const {
+  qint64 rv = 0;
+  Q_FOREACH(qint64 bytes, m_bytes) {
+    rv += bytes;
+  }
+  return rv;
+}
+
+QStringList MemoryUsage::structures() const {
+  return m_bytes.keys();
+}
+
+QString MemoryUsage::dump() const {
+  QStringList lines;
+  for (QMap<QString, qint64>::const_iterator it = m_bytes.constBegin(), end = m_bytes.constEnd(); it != end; ++it) {
+    lines << QString("%1: %2 KiB").arg(it.key()).arg(it.value() / 1024.0, 0, 'f', 1);
+  }
+  lines << QString("total: %1 KiB").arg(total() / 1024.0, 0, 'f', 1);
+  return lines.join("\n");
+}
+
+}
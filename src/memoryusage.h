@@ -0,0 +1,56 @@
+#ifndef QDATACUBE_MEMORYUSAGE_H
+#define QDATACUBE_MEMORYUSAGE_H
+
+#include "qdatacube_export.h"
+
+#include <QMap>
+#include <QString>
+#include <QStringList>
+
+namespace qdatacube {
+
+/**
+ * Heap memory used by an object, in bytes, broken down by structure.
+ *
+ * The numbers are estimated from the sizes and capacities of the containers, including the
+ * bookkeeping of the allocator, without visiting every element. Implicitly shared data, e.g.
+ * with a DatacubeSnapshot, is counted for each object sharing it.
+ */
+class QDATACUBE_EXPORT MemoryUsage {
+    public:
+        /**
+         * Add bytes to structure
+         */
+        void add(const QString& structure, qint64 bytes);
+
+        /**
+         * Add the bytes of each structure in other
+         */
+        MemoryUsage& operator+=(const MemoryUsage& other);
+
+        /**
+         * @return bytes used by structure
+         */
+        qint64 bytes(const QString& structure) const;
+
+        /**
+         * @return bytes used by all structures
+         */
+        qint64 total() const;
+
+        /**
+         * @return the structures, sorted by name
+         */
+        QStringList structures() const;
+
+        /**
+         * @return structures and bytes as text, one per line
+         */
+        QString dump() const;
+    private:
+        QMap<QString, qint64> m_bytes;
+};
+
+}
+
+#endif // QDATACUBE_MEMORYUSAGE_H
@@ -0,0 +1,70 @@
+#ifndef QDATACUBE_MEMORYUSAGE_P_H
+#define QDATACUBE_MEMORYUSAGE_P_H
+
+#include <QHash>
+#include <QString>
+#include <QVector>
+
+#include "bitset.h"
+
+/*
+ * Estimates of the heap memory used by Qt containers, for MemoryUsage. They follow the layout of the
+ * Qt 5 containers, and a glibc-like allocator: blocks carry a pointer-sized header, are rounded up to
+ * two pointers and are at least four pointers; large blocks are mapped as whole pages.
+ */
+namespace qdatacube {
+namespace memory {
+
+/**
+ * @return heap used by an allocation of size bytes
+ */
+inline qint64 heap_bytes(qint64 size) {
+  const qint64 word = sizeof(void*);
+  if (size >= 128 * 1024) {
+    return (size + 2 * word + 4095) & ~qint64(4095);
+  }
+  return qMax(4 * word, (size + word + 2 * word - 1) & ~(2 * word - 1));
+}
+
+template<typename T>
+qint64 vector_bytes(const QVector<T>& vector) {
+  return vector.capacity() == 0 ? 0 : heap_bytes(sizeof(QArrayData) + qint64(vector.capacity()) * sizeof(T));
+}
+
+/**
+ * @return heap used by a QList of count pointer-sized elements built by appending, which grows its
+ * block to powers of two
+ */
+inline qint64 list_bytes(int count) {
+  if (count == 0) {
+    return 0;
+  }
+  const qint64 needed = 4 * sizeof(int) + qint64(count) * sizeof(void*);
+  qint64 block = 32;
+  while (block < needed) {
+    block *= 2;
+  }
+  return heap_bytes(block);
+}
+
+template<typename Key, typename T>
+qint64 hash_bytes(const QHash<Key, T>& hash) {
+  if (hash.capacity() == 0 && hash.isEmpty()) {
+    return 0;
+  }
+  return heap_bytes(sizeof(QHashData)) + heap_bytes(qint64(hash.capacity()) * sizeof(void*))
+       + hash.size() * heap_bytes(sizeof(QHashNode<Key, T>));
+}
+
+inline qint64 string_bytes(const QString& string) {
+  return string.isEmpty() ? 0 : heap_bytes(sizeof(QArrayData) + qint64(string.capacity() + 1) * sizeof(QChar));
+}
+
+inline qint64 bitset_bytes(const Bitset& bitset) {
+  return bitset.capacity() == 0 ? 0 : heap_bytes(sizeof(QArrayData) + qint64(bitset.capacity()) * sizeof(quint64));
+}
+
+}
+}
+
+#endif // QDATACUBE_MEMORYUSAGE_P_H
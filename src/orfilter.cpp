@@ -1,27 +1,42 @@
 #include "orfilter.h"
+#include "bitset.h"
+#include "filtercombination_p.h"
+
 #include <QSharedPointer>
 
 namespace qdatacube {
 class OrFilterPrivate {
 public:
-    OrFilterPrivate() {};
-    QList<AbstractFilter::Ptr> m_filterComponents;
+    OrFilterPrivate() : m_combination(FilterCombination::Or) {};
+    FilterCombination m_combination;
 };
 
 OrFilter::OrFilter(QAbstractItemModel* underlyingModel): AbstractFilter(underlyingModel), d(new OrFilterPrivate()) {}
 
 void OrFilter::addFilter(AbstractFilter::Ptr filter) {
     Q_ASSERT(filter->underlyingModel() == underlyingModel());
-    d->m_filterComponents.append(filter);
+    d->m_combination.append(filter);
+    connect(filter.data(), SIGNAL(resultsChanged(qdatacube::Bitset)), SIGNAL(resultsChanged(qdatacube::Bitset)));
 }
 
 bool OrFilter::operator()(int row) const {
-    Q_FOREACH(AbstractFilter::Ptr filter, d->m_filterComponents) {
-       if((*filter)(row))  {
-           return true;
-       }
-    }
-    return false;
+    return d->m_combination.test(row);
+}
+
+void OrFilter::evaluate(int start, int count, Bitset& result) const {
+    d->m_combination.evaluate(start, count, result);
+}
+
+void OrFilter::setAdaptiveOrdering(bool adaptive) {
+    d->m_combination.setAdaptive(adaptive);
+}
+
+bool OrFilter::adaptiveOrdering() const {
+    return d->m_combination.isAdaptive();
+}
+
+QList<AbstractFilter::Ptr> OrFilter::evaluationOrder() const {
+    return d->m_combination.evaluationOrder();
 }
 
 OrFilter::~OrFilter() {}
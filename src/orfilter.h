@@ -22,12 +22,35 @@ class QDATACUBE_EXPORT OrFilter : public AbstractFilter {
          */
         virtual bool operator()(int row) const;
 
+        /**
+         * Evaluate the filters in turn, combining their results a word at a time
+         */
+        virtual void evaluate(int start, int count, Bitset& result) const;
+
         /**
          * adds a filter
          * Note: all filters need to share the same underlyingModel
          */
         void addFilter(AbstractFilter::Ptr filter);
 
+        /**
+         * Turn adaptive ordering on (the default) or off. When on, the filters are evaluated in the order
+         * expected to be cheapest, learned by sampling their cost and how often they include a row:
+         * cheap filters including most rows first. When off, they are evaluated in the order added.
+         * The order never changes the result.
+         */
+        void setAdaptiveOrdering(bool adaptive);
+
+        /**
+         * @return true if the filters are evaluated in an adaptive order, see setAdaptiveOrdering()
+         */
+        bool adaptiveOrdering() const;
+
+        /**
+         * @return the filters, in the order they are currently evaluated
+         */
+        QList<AbstractFilter::Ptr> evaluationOrder() const;
+
         /**
          * dtor
          */
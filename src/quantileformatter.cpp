@@ -0,0 +1,184 @@
+#include "quantileformatter.h"
+#include <QAbstractItemModel>
+#include <QVector>
+#include <stdexcept>
+#include "datacubeview.h"
+#include "tdigest.h"
+#include "cellsketches_p.h"
+
+namespace qdatacube {
+
+class QuantileFormatterPrivate : public CellSketches<TDigest> {
+    public:
+        QuantileFormatterPrivate(const QAbstractItemModel* model, int column, double quantile, int precision, QString suffix, double compression)
+          : m_model(model), m_column(column), m_quantile(quantile), m_precision(precision), m_suffix(suffix), m_compression(compression), m_valid(false) {
+        }
+        const QAbstractItemModel* m_model;
+        const int m_column;
+        double m_quantile;
+        const int m_precision;
+        QString m_suffix;
+        double m_compression;
+        // The column value for each row in the underlying model
+        mutable QVector<double> m_values;
+        mutable bool m_valid;
+        void rebuild() const;
+        void add(TDigest& digest, const QList<int>& rows) const;
+        QString format(const TDigest& digest) const;
+    protected:
+        virtual TDigest* build(const QList<int>& elements) const;
+        virtual int cost(const TDigest& digest) const;
+};
+
+void QuantileFormatterPrivate::rebuild() const {
+  const int nrows = m_model->rowCount();
+  m_values.resize(nrows);
+  for (int row = 0; row < nrows; ++row) {
+    m_values[row] = m_model->index(row, m_column).data().toDouble();
+  }
+  m_valid = true;
+}
+
+void QuantileFormatterPrivate::add(TDigest& digest, const QList<int>& rows) const {
+  if (!m_valid) {
+    rebuild();
+  }
+  const double* values = m_values.constData();
+  Q_FOREACH(int element, rows) {
+    digest.add(values[element]);
+  }
+}
+
+QString QuantileFormatterPrivate::format(const TDigest& digest) const {
+  if (digest.count() == 0.0) {
+    return QString();
+  }
+  return QString::number(digest.quantile(m_quantile),'f',m_precision) + m_suffix;
+}
+
+TDigest* QuantileFormatterPrivate::build(const QList<int>& elements) const {
+  TDigest* rv = new TDigest(m_compression);
+  add(*rv, elements);
+  return rv;
+}
+
+int QuantileFormatterPrivate::cost(const TDigest& digest) const {
+  return int(sizeof(TDigest)) + digest.centroidCount() * 2 * int(sizeof(double));
+}
+
+QuantileFormatter::QuantileFormatter(QAbstractItemModel* underlying_model, qdatacube::DatacubeView* view, int column, double quantile,
+                                     int precision, QString suffix, double compression)
+ : AbstractFormatter(underlying_model, view), d(new QuantileFormatterPrivate(underlying_model, column, qBound(0.0, quantile, 1.0), precision, suffix, compression))
+{
+  if (column >= underlying_model->columnCount()|| column<0) {
+    throw std::runtime_error(QString("Column %1 must be in the underlying model, ie., be between 0 and %2").arg(column).arg(underlying_model->columnCount()).toStdString());
+  }
+  connect(underlying_model, SIGNAL(dataChanged(QModelIndex,QModelIndex)), SLOT(refresh_rows(QModelIndex,QModelIndex)));
+  connect(underlying_model, SIGNAL(rowsInserted(QModelIndex,int,int)), SLOT(invalidate()));
+  connect(underlying_model, SIGNAL(rowsRemoved(QModelIndex,int,int)), SLOT(invalidate()));
+  connect(underlying_model, SIGNAL(modelReset()), SLOT(invalidate()));
+  update(qdatacube::AbstractFormatter::CellSize);
+  setShortName(d->m_quantile == 0.5 ? QStringLiteral("MED") : QString("P%1").arg(qRound(d->m_quantile*100)));
+  setName(QString("%1% quantile of %2").arg(d->m_quantile*100).arg(underlyingModel()->headerData(d->m_column, Qt::Horizontal).toString()));
+}
+
+double QuantileFormatter::estimate(const QList<int>& rows) const {
+  TDigest digest(d->m_compression);
+  d->add(digest, rows);
+  return digest.quantile(d->m_quantile);
+}
+
+double QuantileFormatter::estimate(const Datacube* datacube, int top_row, int left_column, int bottom_row, int right_column) const {
+  TDigest digest(d->m_compression);
+  d->merge(datacube, top_row, left_column, bottom_row, right_column, digest);
+  return digest.quantile(d->m_quantile);
+}
+
+QString QuantileFormatter::format(QList< int > rows) const {
+  TDigest digest(d->m_compression);
+  d->add(digest, rows);
+  return d->format(digest);
+}
+
+bool QuantileFormatter::mergesCells() const {
+  return true;
+}
+
+QString QuantileFormatter::formatCells(const Datacube* datacube, int top_row, int left_column, int bottom_row, int right_column) const {
+  TDigest digest(d->m_compression);
+  d->merge(datacube, top_row, left_column, bottom_row, right_column, digest);
+  return d->format(digest);
+}
+
+double QuantileFormatter::quantile() const {
+  return d->m_quantile;
+}
+
+void QuantileFormatter::setQuantile(double quantile) {
+  quantile = qBound(0.0, quantile, 1.0);
+  if (quantile != d->m_quantile) {
+    d->m_quantile = quantile;
+    emit formatterChanged();
+  }
+}
+
+double QuantileFormatter::compression() const {
+  return d->m_compression;
+}
+
+void QuantileFormatter::setCompression(double compression) {
+  if (compression != d->m_compression) {
+    d->m_compression = compression;
+    d->clear();
+    emit formatterChanged();
+  }
+}
+
+void QuantileFormatter::refresh_rows(const QModelIndex& top_left, const QModelIndex& bottom_right) {
+  if (top_left.parent().isValid()) {
+    return;
+  }
+  if (top_left.column() > d->m_column || bottom_right.column() < d->m_column) {
+    return;
+  }
+  if (bottom_right.row() - top_left.row() >= 64) {
+    d->clear();
+  } else {
+    for (int row = top_left.row(); row <= bottom_right.row(); ++row) {
+      d->forgetElement(row);
+    }
+  }
+  if (!d->m_valid) {
+    return;
+  }
+  for (int row = top_left.row(); row <= bottom_right.row(); ++row) {
+    d->m_values[row] = underlyingModel()->index(row, d->m_column).data().toDouble();
+  }
+}
+
+void QuantileFormatter::invalidate() {
+  d->m_valid = false;
+  d->m_values.clear();
+}
+
+void QuantileFormatter::update(AbstractFormatter::UpdateType element) {
+  if (element == qdatacube::AbstractFormatter::CellSize) {
+    if (datacubeView()) {
+      // The quantile is bounded by the largest value in the column
+      double largest = 0.0;
+      for (int row = 0, nrows = underlyingModel()->rowCount(); row < nrows; ++row) {
+        largest = qMax(largest, qAbs(underlyingModel()->index(row, d->m_column).data().toDouble()));
+      }
+      QString big_cell_contents = QString::number(-largest, 'f', d->m_precision) + d->m_suffix;
+      setCellSize(QSize(datacubeView()->fontMetrics().width(big_cell_contents), datacubeView()->fontMetrics().lineSpacing()));
+    }
+  }
+}
+
+QuantileFormatter::~QuantileFormatter() {
+
+}
+
+} // end of namespace
+
+#include "quantileformatter.moc"
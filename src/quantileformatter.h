@@ -0,0 +1,81 @@
+#ifndef QDATACUBE_QUANTILE_FORMATTER_H
+#define QDATACUBE_QUANTILE_FORMATTER_H
+
+#include "abstractformatter.h"
+#include "qdatacube_export.h"
+
+class QModelIndex;
+
+namespace qdatacube {
+
+/**
+ * Approximate quantile (e.g. the median or the 95th percentile) of a numeric column.
+ *
+ * Uses a t-digest over the column values, which are converted to double once per row and
+ * kept up to date with the underlying model. The compression sets the accuracy/memory tradeoff:
+ * a digest holds at most about 2*compression centroids.
+ *
+ * In a DatacubeView, a digest is kept per cell and the digests are merged for the totals.
+ */
+class QuantileFormatterPrivate;
+class QDATACUBE_EXPORT QuantileFormatter : public AbstractFormatter {
+    Q_OBJECT
+    public:
+        /**
+         * @param underlying_model the underlying model
+         * @param view the datacube view (optional, used to indicate cell size)
+         * @param column the column of the underlying model. Should provide data convertible to double
+         * @param quantile the quantile to show, between 0 and 1. 0.5 is the median
+         * @param precision precision of the output
+         * @param suffix a (small) string that is appended to the format, e.g. "ms"
+         * @param compression t-digest compression, at least 10.
+         */
+        QuantileFormatter(QAbstractItemModel* underlying_model, qdatacube::DatacubeView* view, int column, double quantile,
+                          int precision, QString suffix, double compression = 100.0);
+        virtual QString format(QList< int > rows) const;
+
+        /**
+         * @return estimated quantile of column for rows, NaN if rows is empty
+         */
+        double estimate(const QList<int>& rows) const;
+
+        /**
+         * @return estimated quantile of column for the cells of datacube from top_row, left_column to
+         * bottom_row, right_column, merging the digests kept for each cell. NaN if the cells are empty.
+         */
+        double estimate(const Datacube* datacube, int top_row, int left_column, int bottom_row, int right_column) const;
+
+        virtual bool mergesCells() const;
+        virtual QString formatCells(const Datacube* datacube, int top_row, int left_column, int bottom_row, int right_column) const;
+
+        /**
+         * @return the quantile shown
+         */
+        double quantile() const;
+
+        /**
+         * Change the quantile shown. Emits formatterChanged()
+         */
+        void setQuantile(double quantile);
+
+        /**
+         * @return the compression
+         */
+        double compression() const;
+
+        /**
+         * Change the compression. Emits formatterChanged()
+         */
+        void setCompression(double compression);
+        virtual ~QuantileFormatter();
+    protected:
+        virtual void update(UpdateType element);
+    private Q_SLOTS:
+        void refresh_rows(const QModelIndex& top_left, const QModelIndex& bottom_right);
+        void invalidate();
+    private:
+        QScopedPointer<QuantileFormatterPrivate> d;
+};
+
+} // end of namespace
+#endif // QDATACUBE_QUANTILE_FORMATTER_H
@@ -0,0 +1,279 @@
+#include "rangefilter.h"
+
+#include "bitset.h"
+
+#include <QAbstractItemModel>
+#include <QDateTime>
+#include <QPair>
+#include <QtNumeric>
+#include <QVector>
+
+#include <algorithm>
+#include <limits>
+
+namespace qdatacube {
+
+class RangeFilterPrivate {
+public:
+    RangeFilterPrivate(int section, double minimum, double maximum, int role)
+      : m_section(section), m_minimum(minimum), m_maximum(maximum), m_role(role) {}
+    typedef QPair<double, int> entry_t; // value and row
+    typedef QVector<entry_t> index_t;
+    static const int batch_threshold = 16; // changes to more rows than this rebuild the index in one pass
+    bool in_range(double value) const {
+        return m_minimum <= value && value <= m_maximum; // false for NaN
+    }
+    /**
+     * @return the positions in the index of the first entry not below minimum and the first entry above maximum
+     */
+    QPair<int, int> positions(double minimum, double maximum) const;
+    /**
+     * Set the bits for the rows in the index between positions from and to
+     */
+    void set_rows(Bitset& rows, int from, int to) const;
+    double read(const QAbstractItemModel* model, int row) const;
+    void index_insert(int row);
+    void index_remove(int row);
+    /**
+     * Remove the entries of the rows start..end from the index in one pass
+     */
+    void index_remove(int start, int end);
+    /**
+     * Read the values of the rows start..end, which have no entries in the index, and merge them into the index
+     */
+    void index_merge(const QAbstractItemModel* model, int start, int end);
+    int m_section;
+    double m_minimum;
+    double m_maximum;
+    int m_role;
+    QVector<double> m_values; // value of each row, NaN if not a number
+    index_t m_index; // rows with a number as value, sorted by value and row
+};
+
+QPair<int, int> RangeFilterPrivate::positions(double minimum, double maximum) const {
+    const int from = std::lower_bound(m_index.constBegin(), m_index.constEnd(), entry_t(minimum, std::numeric_limits<int>::min())) - m_index.constBegin();
+    const int to = std::upper_bound(m_index.constBegin(), m_index.constEnd(), entry_t(maximum, std::numeric_limits<int>::max())) - m_index.constBegin();
+    return qMakePair(from, qMax(from, to));
+}
+
+void RangeFilterPrivate::set_rows(Bitset& rows, int from, int to) const {
+    for (int position = from; position < to; ++position) {
+        rows.set(m_index.at(position).second);
+    }
+}
+
+double RangeFilterPrivate::read(const QAbstractItemModel* model, int row) const {
+    const QVariant data = model->data(model->index(row, m_section), m_role);
+    if (data.type() == QVariant::DateTime || data.type() == QVariant::Date) {
+        return double(data.toDateTime().toMSecsSinceEpoch());
+    }
+    bool ok = false;
+    const double rv = data.toDouble(&ok);
+    return ok ? rv : std::numeric_limits<double>::quiet_NaN();
+}
+
+void RangeFilterPrivate::index_insert(int row) {
+    const entry_t entry(m_values.at(row), row);
+    if (!qIsNaN(entry.first)) {
+        m_index.insert(std::lower_bound(m_index.begin(), m_index.end(), entry), entry);
+    }
+}
+
+void RangeFilterPrivate::index_remove(int row) {
+    const entry_t entry(m_values.at(row), row);
+    if (!qIsNaN(entry.first)) {
+        index_t::iterator it = std::lower_bound(m_index.begin(), m_index.end(), entry);
+        Q_ASSERT(it != m_index.end() && *it == entry);
+        m_index.erase(it);
+    }
+}
+
+void RangeFilterPrivate::index_remove(int start, int end) {
+    index_t::iterator out = m_index.begin();
+    for (index_t::const_iterator it = m_index.constBegin(), iend = m_index.constEnd(); it != iend; ++it) {
+        if (it->second < start || it->second > end) {
+            *out++ = *it;
+        }
+    }
+    m_index.erase(out, m_index.end());
+}
+
+void RangeFilterPrivate::index_merge(const QAbstractItemModel* model, int start, int end) {
+    index_t added;
+    added.reserve(end - start + 1);
+    for (int row = start; row <= end; ++row) {
+        const double value = read(model, row);
+        m_values[row] = value;
+        if (!qIsNaN(value)) {
+            added << entry_t(value, row);
+        }
+    }
+    std::sort(added.begin(), added.end());
+    index_t merged(m_index.size() + added.size());
+    std::merge(m_index.constBegin(), m_index.constEnd(), added.constBegin(), added.constEnd(), merged.begin());
+    m_index.swap(merged);
+}
+
+RangeFilter::RangeFilter(const QAbstractItemModel* model, int section, double minimum, double maximum, int role)
+  : AbstractFilter(model),
+    d(new RangeFilterPrivate(section, minimum, maximum, role))
+{
+    setName(QString("%1 in [%2, %3]").arg(model->headerData(section, Qt::Horizontal).toString()).arg(minimum).arg(maximum));
+    setShortName("[]");
+    connect(model, SIGNAL(dataChanged(QModelIndex,QModelIndex)), SLOT(refresh_rows(QModelIndex,QModelIndex)));
+    connect(model, SIGNAL(rowsInserted(QModelIndex,int,int)), SLOT(insert_rows(QModelIndex,int,int)));
+    connect(model, SIGNAL(rowsRemoved(QModelIndex,int,int)), SLOT(remove_rows(QModelIndex,int,int)));
+    connect(model, SIGNAL(modelReset()), SLOT(refresh_all()));
+    refresh_all();
+}
+
+RangeFilter::~RangeFilter() {
+    // Empty
+}
+
+bool RangeFilter::operator()(int row) const {
+    Q_ASSERT_X(d->m_values.size() == underlyingModel()->rowCount(), "RangeFilter", "must be created before the datacubes using it");
+    return d->in_range(d->m_values.at(row));
+}
+
+void RangeFilter::evaluate(int start, int count, Bitset& result) const {
+    Q_ASSERT_X(d->m_values.size() == underlyingModel()->rowCount(), "RangeFilter", "must be created before the datacubes using it");
+    result = Bitset(count);
+    const double* values = d->m_values.constData() + start;
+    const double minimum = d->m_minimum;
+    const double maximum = d->m_maximum;
+    for (int i = 0; i < count; i += 64) {
+        quint64 word = 0;
+        for (int bit = 0, nbits = qMin(64, count - i); bit < nbits; ++bit) {
+            const double value = values[i + bit];
+            word |= quint64(minimum <= value && value <= maximum) << bit;
+        }
+        result.setWord(i >> 6, word);
+    }
+}
+
+void RangeFilter::setRange(double minimum, double maximum) {
+    if (minimum == d->m_minimum && maximum == d->m_maximum) {
+        return;
+    }
+    // The rows in exactly one of the old and the new range are between the two lower ends or between the two upper ends,
+    // unless the ranges do not overlap at all
+    const QPair<int, int> old_positions = d->positions(d->m_minimum, d->m_maximum);
+    const QPair<int, int> new_positions = d->positions(minimum, maximum);
+    Bitset changed(d->m_values.size());
+    if (old_positions.second <= new_positions.first || new_positions.second <= old_positions.first) {
+        d->set_rows(changed, old_positions.first, old_positions.second);
+        d->set_rows(changed, new_positions.first, new_positions.second);
+    } else {
+        d->set_rows(changed, qMin(old_positions.first, new_positions.first), qMax(old_positions.first, new_positions.first));
+        d->set_rows(changed, qMin(old_positions.second, new_positions.second), qMax(old_positions.second, new_positions.second));
+    }
+    d->m_minimum = minimum;
+    d->m_maximum = maximum;
+    setName(QString("%1 in [%2, %3]").arg(underlyingModel()->headerData(d->m_section, Qt::Horizontal).toString()).arg(minimum).arg(maximum));
+    if (changed.any()) {
+        emit resultsChanged(changed);
+    }
+}
+
+int RangeFilter::section() const {
+    return d->m_section;
+}
+
+double RangeFilter::minimum() const {
+    return d->m_minimum;
+}
+
+double RangeFilter::maximum() const {
+    return d->m_maximum;
+}
+
+double RangeFilter::value(int row) const {
+    return d->m_values.at(row);
+}
+
+void RangeFilter::refresh_rows(const QModelIndex& top_left, const QModelIndex& bottom_right) {
+    if (top_left.parent().isValid() || top_left.column() > d->m_section || bottom_right.column() < d->m_section) {
+        return;
+    }
+    const int start = top_left.row();
+    const int end = bottom_right.row();
+    Bitset changed(d->m_values.size());
+    for (int row = start; row <= end; ++row) {
+        if (d->in_range(d->m_values.at(row))) {
+            changed.set(row);
+        }
+    }
+    if (end - start + 1 <= RangeFilterPrivate::batch_threshold) {
+        for (int row = start; row <= end; ++row) {
+            d->index_remove(row);
+            d->m_values[row] = d->read(underlyingModel(), row);
+            d->index_insert(row);
+        }
+    } else {
+        d->index_remove(start, end);
+        d->index_merge(underlyingModel(), start, end);
+    }
+    // A datacube hearing about the change before this filter has used the old values, so report the rows
+    // entering or leaving the range
+    for (int row = start; row <= end; ++row) {
+        if (changed.test(row) == d->in_range(d->m_values.at(row))) {
+            changed.reset(row);
+        } else {
+            changed.set(row);
+        }
+    }
+    if (changed.any()) {
+        emit resultsChanged(changed);
+    }
+}
+
+void RangeFilter::insert_rows(const QModelIndex& parent, int start, int end) {
+    if (parent.isValid()) {
+        return;
+    }
+    const int count = end - start + 1;
+    for (RangeFilterPrivate::index_t::iterator it = d->m_index.begin(), iend = d->m_index.end(); it != iend; ++it) {
+        if (it->second >= start) {
+            it->second += count;
+        }
+    }
+    d->m_values.insert(start, count, 0.0);
+    d->index_merge(underlyingModel(), start, end);
+}
+
+void RangeFilter::remove_rows(const QModelIndex& parent, int start, int end) {
+    if (parent.isValid()) {
+        return;
+    }
+    const int count = end - start + 1;
+    RangeFilterPrivate::index_t::iterator out = d->m_index.begin();
+    for (RangeFilterPrivate::index_t::const_iterator it = d->m_index.constBegin(), iend = d->m_index.constEnd(); it != iend; ++it) {
+        if (it->second > end) {
+            *out++ = RangeFilterPrivate::entry_t(it->first, it->second - count);
+        } else if (it->second < start) {
+            *out++ = *it;
+        }
+    }
+    d->m_index.erase(out, d->m_index.end());
+    d->m_values.remove(start, count);
+}
+
+void RangeFilter::refresh_all() {
+    const int nrows = underlyingModel()->rowCount();
+    d->m_values.resize(nrows);
+    d->m_index.clear();
+    d->m_index.reserve(nrows);
+    for (int row = 0; row < nrows; ++row) {
+        const double value = d->read(underlyingModel(), row);
+        d->m_values[row] = value;
+        if (!qIsNaN(value)) {
+            d->m_index << RangeFilterPrivate::entry_t(value, row);
+        }
+    }
+    std::sort(d->m_index.begin(), d->m_index.end());
+}
+
+} // namespace qdatacube
+
+#include "rangefilter.moc"
@@ -0,0 +1,75 @@
+#ifndef QDATACUBE_RANGE_FILTER_H
+#define QDATACUBE_RANGE_FILTER_H
+
+#include "abstractfilter.h"
+#include "qdatacube_export.h"
+
+class QModelIndex;
+
+namespace qdatacube {
+class RangeFilterPrivate;
+}
+
+namespace qdatacube {
+
+/**
+ * Filter in the rows whose value in a numeric column is within [minimum, maximum].
+ *
+ * The values are converted from the model once and kept, together with an index of the rows sorted
+ * by value. Changing the range with setRange() finds the rows entering or leaving the range in the index,
+ * and emits resultsChanged() for just those, so a datacube using the filter only moves those rows;
+ * dragging a range slider stays interactive on large models.
+ *
+ * Values are read with toDouble(); dates and times count as milliseconds since the epoch. Values that
+ * are not numbers are never in range.
+ *
+ * The filter keeps its values up to date as the model changes, and reports rows whose change of value
+ * moves them in or out of the range with resultsChanged(). As with AggregatorRegistry, the filter must be
+ * created before the datacubes using it, so it has its values for inserted rows when they are asked about;
+ * debug builds assert this.
+ */
+class QDATACUBE_EXPORT RangeFilter : public AbstractFilter {
+
+    Q_OBJECT
+
+public:
+
+    /**
+     * Creates a filter of the rows with the data for role in section within [minimum, maximum]
+     */
+    RangeFilter(const QAbstractItemModel* model, int section, double minimum, double maximum, int role = Qt::DisplayRole);
+
+    virtual ~RangeFilter();
+
+    // Inherited:
+    virtual bool operator()(int row) const;
+    virtual void evaluate(int start, int count, Bitset& result) const;
+
+    /**
+     * Change the range, emitting resultsChanged() for the rows entering or leaving it
+     */
+    void setRange(double minimum, double maximum);
+
+    // Getters:
+    int section() const;
+    double minimum() const;
+    double maximum() const;
+
+    /**
+     * @return the value of row, as compared to the range
+     */
+    double value(int row) const;
+
+private Q_SLOTS:
+    void refresh_rows(const QModelIndex& top_left, const QModelIndex& bottom_right);
+    void insert_rows(const QModelIndex& parent, int start, int end);
+    void remove_rows(const QModelIndex& parent, int start, int end);
+    void refresh_all();
+
+private:
+    QScopedPointer<RangeFilterPrivate> d;
+};
+
+} // namespace qdatacube
+
+#endif // QDATACUBE_RANGE_FILTER_H
@@ -0,0 +1,116 @@
+#include "tdigest.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace qdatacube {
+
+TDigest::TDigest(double compression)
+  : m_compression(qMax(compression, 10.0)),
+    m_buffer_capacity(int(m_compression) * 5),
+    m_total_weight(0.0),
+    m_min(std::numeric_limits<double>::infinity()),
+    m_max(-std::numeric_limits<double>::infinity())
+{
+}
+
+void TDigest::add(double value, double weight) {
+  if (weight <= 0.0 || value != value) {
+    return; // Ignore NaN and weightless values
+  }
+  m_buffer.append(Centroid(value, weight));
+  m_total_weight += weight;
+  m_min = qMin(m_min, value);
+  m_max = qMax(m_max, value);
+  if (m_buffer.size() >= m_buffer_capacity) {
+    flush();
+  }
+}
+
+void TDigest::merge(const TDigest& other) {
+  other.flush();
+  Q_FOREACH(const Centroid& centroid, other.m_centroids) {
+    m_buffer.append(centroid);
+    if (m_buffer.size() >= m_buffer_capacity) {
+      flush();
+    }
+  }
+  m_total_weight += other.m_total_weight;
+  m_min = qMin(m_min, other.m_min);
+  m_max = qMax(m_max, other.m_max);
+}
+
+void TDigest::flush() const {
+  if (m_buffer.isEmpty()) {
+    return;
+  }
+  QVector<Centroid> all = m_centroids;
+  all += m_buffer;
+  m_buffer.clear();
+  std::sort(all.begin(), all.end());
+  double total = 0.0;
+  Q_FOREACH(const Centroid& c, all) {
+    total += c.weight;
+  }
+  QVector<Centroid> merged;
+  merged.reserve(int(2*m_compression));
+  Centroid current = all.front();
+  double weight_so_far = 0.0;
+  for (int i=1, iend = all.size(); i<iend; ++i) {
+    const Centroid& next = all.at(i);
+    const double proposed = current.weight + next.weight;
+    // Size bound from the k0 scale function: centroids may grow to 4*n*q*(1-q)/compression
+    const double q = (weight_so_far + proposed/2.0) / total;
+    const double limit = qMax(1.0, 4.0 * total * q * (1.0 - q) / m_compression);
+    if (proposed <= limit) {
+      current.mean += (next.mean - current.mean) * next.weight / proposed;
+      current.weight = proposed;
+    } else {
+      weight_so_far += current.weight;
+      merged.append(current);
+      current = next;
+    }
+  }
+  merged.append(current);
+  m_centroids = merged;
+}
+
+double TDigest::quantile(double q) const {
+  flush();
+  if (m_centroids.isEmpty()) {
+    return std::numeric_limits<double>::quiet_NaN();
+  }
+  q = qBound(0.0, q, 1.0);
+  if (m_centroids.size() == 1) {
+    return m_centroids.front().mean;
+  }
+  const double index = q * m_total_weight;
+  const Centroid& first = m_centroids.front();
+  if (index < first.weight/2.0) {
+    return m_min + (first.mean - m_min) * index / (first.weight/2.0);
+  }
+  double center = first.weight/2.0;
+  for (int i=0, iend = m_centroids.size()-1; i<iend; ++i) {
+    const Centroid& left = m_centroids.at(i);
+    const Centroid& right = m_centroids.at(i+1);
+    const double next_center = center + (left.weight + right.weight)/2.0;
+    if (index <= next_center) {
+      const double fraction = (index - center) / (next_center - center);
+      return left.mean + (right.mean - left.mean) * fraction;
+    }
+    center = next_center;
+  }
+  const Centroid& last = m_centroids.back();
+  const double tail = m_total_weight - center;
+  if (tail <= 0.0) {
+    return last.mean;
+  }
+  return last.mean + (m_max - last.mean) * qMin(1.0, (index - center) / tail);
+}
+
+int TDigest::centroidCount() const {
+  flush();
+  return m_centroids.size();
+}
+
+} // end of namespace
@@ -0,0 +1,76 @@
+#ifndef QDATACUBE_TDIGEST_H
+#define QDATACUBE_TDIGEST_H
+
+#include <QVector>
+#include "qdatacube_export.h"
+
+namespace qdatacube {
+
+/**
+ * Merging t-digest (Dunning & Ertl) for estimating quantiles of a stream of values.
+ *
+ * The digest keeps at most about 2*compression centroids. Centroids near the
+ * tails are kept small, so extreme quantiles are more accurate than the median.
+ * Higher compression gives better accuracy at the cost of memory and time;
+ * 100 gives errors well below 1% of the quantile rank for most distributions.
+ * Digests can be merged, the result approximating the digest of the union
+ * of the inputs.
+ */
+class QDATACUBE_EXPORT TDigest {
+    public:
+        explicit TDigest(double compression = 100.0);
+
+        /**
+         * Add value with weight
+         */
+        void add(double value, double weight = 1.0);
+
+        /**
+         * Merge other into this digest
+         */
+        void merge(const TDigest& other);
+
+        /**
+         * @return estimated value at quantile q, 0 <= q <= 1. NaN if the digest is empty.
+         */
+        double quantile(double q) const;
+
+        /**
+         * @return total weight added
+         */
+        double count() const {
+            return m_total_weight;
+        }
+
+        double compression() const {
+            return m_compression;
+        }
+
+        /**
+         * @return number of centroids after compressing the buffer
+         */
+        int centroidCount() const;
+    private:
+        struct Centroid {
+            Centroid() : mean(0.0), weight(0.0) {}
+            Centroid(double mean, double weight) : mean(mean), weight(weight) {}
+            bool operator<(const Centroid& rhs) const {
+                return mean < rhs.mean;
+            }
+            double mean;
+            double weight;
+        };
+        void flush() const;
+        double m_compression;
+        int m_buffer_capacity;
+        double m_total_weight;
+        double m_min;
+        double m_max;
+        // Adding is buffered; the buffer is merged into the centroids on demand
+        mutable QVector<Centroid> m_centroids;
+        mutable QVector<Centroid> m_buffer;
+};
+
+} // end of namespace
+
+#endif // QDATACUBE_TDIGEST_H
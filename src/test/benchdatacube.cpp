@@ -0,0 +1,198 @@
+/*
+ * Benchmarks of Datacube operations on a SyntheticModel, at several scales.
+ *
+ * The largest scale run can be limited with the QDATACUBE_BENCH_MAX_ROWS environment variable.
+ * Use the QTest output options for results that can be tracked over time, e.g.
+ *   benchdatacube -o benchdatacube.xml,xml
+ * The bench target of the build does that for this and the other benchmarks.
+ */
+#include "syntheticmodel.h"
+#include "datacube.h"
+#include "datacubeselection.h"
+#include "columnaggregator.h"
+#include "columnsumformatter.h"
+#include "countformatter.h"
+#include "filterbyaggregate.h"
+
+#include <QSharedPointer>
+#include <QTest>
+
+using namespace qdatacube;
+
+class BenchDatacube : public QObject {
+    Q_OBJECT
+    private Q_SLOTS:
+        void construct_data();
+        void construct();
+        void split_data();
+        void split();
+        void collapse_data();
+        void collapse();
+        void addRemoveFilter_data();
+        void addRemoveFilter();
+        void dataChangedBurst_data();
+        void dataChangedBurst();
+        void insertRemoveRows_data();
+        void insertRemoveRows();
+        void selectRow_data();
+        void selectRow();
+        void formatCells_data();
+        void formatCells();
+    private:
+        void scales();
+};
+
+/**
+ * Model and datacube of sex by kommune over the model
+ */
+class Fixture {
+    public:
+        Fixture(int rows, double skew) {
+            SyntheticModel::Config config(rows);
+            config.skew = skew;
+            model.reset(new SyntheticModel(config));
+            sex.reset(new ColumnAggregator(model.data(), SyntheticModel::SEX));
+            kommune.reset(new ColumnAggregator(model.data(), SyntheticModel::KOMMUNE));
+            age.reset(new ColumnAggregator(model.data(), SyntheticModel::AGE));
+            datacube.reset(new Datacube(model.data(), sex, kommune));
+        }
+        QScopedPointer<SyntheticModel> model;
+        AbstractAggregator::Ptr sex;
+        AbstractAggregator::Ptr kommune;
+        AbstractAggregator::Ptr age;
+        QScopedPointer<Datacube> datacube;
+};
+
+void BenchDatacube::scales() {
+    QTest::addColumn<int>("rows");
+    QTest::addColumn<double>("skew");
+    const int max_rows = qEnvironmentVariableIsSet("QDATACUBE_BENCH_MAX_ROWS") ? qgetenv("QDATACUBE_BENCH_MAX_ROWS").toInt() : 1000000;
+    for (int rows = 10000; rows <= max_rows; rows *= 10) {
+        QTest::newRow(QString("%1 uniform").arg(rows).toLatin1().constData()) << rows << 0.0;
+        QTest::newRow(QString("%1 skewed").arg(rows).toLatin1().constData()) << rows << 1.0;
+    }
+}
+
+void BenchDatacube::construct_data() {
+    scales();
+}
+
+void BenchDatacube::construct() {
+    QFETCH(int, rows);
+    QFETCH(double, skew);
+    Fixture fixture(rows, skew);
+    QBENCHMARK {
+        Datacube datacube(fixture.model.data(), fixture.sex, fixture.kommune);
+    }
+}
+
+void BenchDatacube::split_data() {
+    scales();
+}
+
+void BenchDatacube::split() {
+    QFETCH(int, rows);
+    QFETCH(double, skew);
+    Fixture fixture(rows, skew);
+    QBENCHMARK_ONCE {
+        fixture.datacube->split(Qt::Horizontal, 1, fixture.age);
+    }
+}
+
+void BenchDatacube::collapse_data() {
+    scales();
+}
+
+void BenchDatacube::collapse() {
+    QFETCH(int, rows);
+    QFETCH(double, skew);
+    Fixture fixture(rows, skew);
+    fixture.datacube->split(Qt::Horizontal, 1, fixture.age);
+    QBENCHMARK_ONCE {
+        fixture.datacube->collapse(Qt::Horizontal, 1);
+    }
+}
+
+void BenchDatacube::addRemoveFilter_data() {
+    scales();
+}
+
+void BenchDatacube::addRemoveFilter() {
+    QFETCH(int, rows);
+    QFETCH(double, skew);
+    Fixture fixture(rows, skew);
+    AbstractFilter::Ptr filter(new FilterByAggregate(fixture.age, 0));
+    QBENCHMARK {
+        fixture.datacube->addFilter(filter);
+        fixture.datacube->removeFilter(filter);
+    }
+}
+
+void BenchDatacube::dataChangedBurst_data() {
+    scales();
+}
+
+void BenchDatacube::dataChangedBurst() {
+    QFETCH(int, rows);
+    QFETCH(double, skew);
+    Fixture fixture(rows, skew);
+    QBENCHMARK {
+        fixture.model->regenerate(0, 999, SyntheticModel::KOMMUNE);
+    }
+}
+
+void BenchDatacube::insertRemoveRows_data() {
+    scales();
+}
+
+void BenchDatacube::insertRemoveRows() {
+    QFETCH(int, rows);
+    QFETCH(double, skew);
+    Fixture fixture(rows, skew);
+    QBENCHMARK {
+        fixture.model->insertRows(rows / 2, 1000);
+        fixture.model->removeRows(rows / 2, 1000);
+    }
+}
+
+void BenchDatacube::selectRow_data() {
+    scales();
+}
+
+void BenchDatacube::selectRow() {
+    QFETCH(int, rows);
+    QFETCH(double, skew);
+    Fixture fixture(rows, skew);
+    DatacubeSelection selection(fixture.datacube.data(), 0);
+    QBENCHMARK {
+        selection.clear();
+        for (int column = 0; column < fixture.datacube->columnCount(); ++column) {
+            selection.addCell(0, column);
+        }
+    }
+}
+
+void BenchDatacube::formatCells_data() {
+    scales();
+}
+
+void BenchDatacube::formatCells() {
+    QFETCH(int, rows);
+    QFETCH(double, skew);
+    Fixture fixture(rows, skew);
+    CountFormatter count(fixture.model.data());
+    ColumnSumFormatter weight(fixture.model.data(), 0, SyntheticModel::WEIGHT, 0, "kg");
+    QBENCHMARK {
+        for (int row = 0; row < fixture.datacube->rowCount(); ++row) {
+            for (int column = 0; column < fixture.datacube->columnCount(); ++column) {
+                const QList<int> elements = fixture.datacube->elements(row, column);
+                count.format(elements);
+                weight.format(elements);
+            }
+        }
+    }
+}
+
+QTEST_GUILESS_MAIN(BenchDatacube)
+
+#include "benchdatacube.moc"
@@ -0,0 +1,287 @@
+/*
+ * Headless paint benchmark of DatacubeView.
+ *
+ * Renders the view into an image using the offscreen platform, so it runs without a display.
+ * fullRepaint, scrollRepaint and selectionRepaint run over cube shapes, header depths, formatter
+ * counts and scroll positions:
+ *  - fullRepaint repaints the unchanged view
+ *  - scrollRepaint repaints after scrolling a single row
+ *  - selectionRepaint repaints after selecting or deselecting the top left visible cell
+ * scrollRepaintElements repaints after scrolling a single row for growing numbers of elements; with
+ * formatted values cached in the view this cost should not depend on the number of elements in the cells.
+ *
+ * Except for fullRepaint, only the region the view schedules for repainting after the change is
+ * rendered, as the window system would. The region is captured once for each direction of the change.
+ */
+#include "syntheticmodel.h"
+#include "datacube.h"
+#include "datacubeselection.h"
+#include "datacubeview.h"
+#include "columnaggregator.h"
+#include "countformatter.h"
+#include "columnsumformatter.h"
+
+#include <QApplication>
+#include <QImage>
+#include <QPaintEvent>
+#include <QScrollBar>
+#include <QSharedPointer>
+#include <QTest>
+
+using namespace qdatacube;
+
+/**
+ * Column of SyntheticModel with 3 categories, for the second horizontal header
+ */
+static const int EXTRA = SyntheticModel::N_COLUMNS;
+
+/**
+ * Records the region of the paint events of a widget, and drops them, so only the benchmark paints
+ */
+class PaintRecorder : public QObject {
+    public:
+        QRegion region;
+    protected:
+        virtual bool eventFilter(QObject* watched, QEvent* event) {
+            if (event->type() == QEvent::Paint) {
+                region += static_cast<QPaintEvent*>(event)->region();
+                return true;
+            }
+            return QObject::eventFilter(watched, event);
+        }
+};
+
+/**
+ * View of a datacube of FIRST_NAME by LAST_NAME over a SyntheticModel, rendering into image
+ */
+class ViewFixture {
+    public:
+        ViewFixture(int rows, int row_categories, int column_categories, int depth, int formatters) {
+            SyntheticModel::Config config(rows);
+            config.skew = 0.0;
+            config.cardinalities[SyntheticModel::FIRST_NAME] = row_categories;
+            config.cardinalities[SyntheticModel::LAST_NAME] = column_categories;
+            config.cardinalities << 3;
+            model.reset(new SyntheticModel(config));
+            AbstractAggregator::Ptr row_aggregator(new ColumnAggregator(model.data(), SyntheticModel::FIRST_NAME));
+            AbstractAggregator::Ptr column_aggregator(new ColumnAggregator(model.data(), SyntheticModel::LAST_NAME));
+            datacube.reset(new Datacube(model.data(), row_aggregator, column_aggregator));
+            if (depth > 1) {
+                datacube->split(Qt::Vertical, 1, AbstractAggregator::Ptr(new ColumnAggregator(model.data(), SyntheticModel::SEX)));
+                datacube->split(Qt::Horizontal, 1, AbstractAggregator::Ptr(new ColumnAggregator(model.data(), EXTRA)));
+            }
+            view.reset(new DatacubeView);
+            view->resize(800, 600);
+            view->setDatacube(datacube.data());
+            view->addFormatter(new CountFormatter(model.data(), view.data()));
+            if (formatters > 1) {
+                view->addFormatter(new ColumnSumFormatter(model.data(), view.data(), SyntheticModel::WEIGHT, 0, "kg"));
+            }
+            if (formatters > 2) {
+                view->addFormatter(new ColumnSumFormatter(model.data(), view.data(), SyntheticModel::AGE, 0, "y"));
+            }
+            image = QImage(view->viewport()->size(), QImage::Format_ARGB32_Premultiplied);
+            view->viewport()->installEventFilter(&recorder);
+            view->show();
+            QTest::qWaitForWindowExposed(view.data());
+        }
+
+        /**
+         * Scroll both ways to position, a fraction of the scroll range
+         */
+        void scrollTo(double position) {
+            view->verticalScrollBar()->setValue(qRound(position * view->verticalScrollBar()->maximum()));
+            view->horizontalScrollBar()->setValue(qRound(position * view->horizontalScrollBar()->maximum()));
+        }
+
+        void render() {
+            view->viewport()->render(&image);
+        }
+
+        /**
+         * Render only region of the view, in place. An empty region renders nothing, rather than the whole view.
+         */
+        void render(const QRegion& region) {
+            if (!region.isEmpty()) {
+                view->viewport()->render(&image, region.boundingRect().topLeft(), region);
+            }
+        }
+
+        /**
+         * @return the region the view scheduled for repainting since the last call, once the view's
+         * delayed updates are through
+         */
+        QRegion scheduledRegion() {
+            QTest::qWait(50);
+            const QRegion rv = recorder.region;
+            recorder.region = QRegion();
+            return rv;
+        }
+
+        // Destroyed in reverse order, so the view and the datacube go before the model they refer to
+        QScopedPointer<SyntheticModel> model;
+        QScopedPointer<Datacube> datacube;
+        QScopedPointer<DatacubeView> view;
+        QImage image;
+        PaintRecorder recorder;
+};
+
+class BenchDatacubeView : public QObject {
+    Q_OBJECT
+    private Q_SLOTS:
+        void fullRepaint_data();
+        void fullRepaint();
+        void scrollRepaint_data();
+        void scrollRepaint();
+        void selectionRepaint_data();
+        void selectionRepaint();
+        void scrollRepaintElements_data();
+        void scrollRepaintElements();
+    private:
+        void layouts();
+};
+
+void BenchDatacubeView::layouts() {
+    QTest::addColumn<int>("row_categories");
+    QTest::addColumn<int>("column_categories");
+    QTest::addColumn<int>("depth");
+    QTest::addColumn<int>("formatters");
+    QTest::addColumn<double>("position");
+    const QList<QPair<int, int> > shapes = QList<QPair<int, int> >() << qMakePair(10, 10) << qMakePair(40, 40) << qMakePair(400, 20);
+    const QList<double> positions = QList<double>() << 0.0 << 0.5 << 1.0;
+    for (int shape = 0; shape < shapes.size(); ++shape) {
+        for (int depth = 1; depth <= 2; ++depth) {
+            for (int formatters = 1; formatters <= 3; formatters += 2) {
+                Q_FOREACH(double position, positions) {
+                    const int row_categories = shapes.at(shape).first;
+                    const int column_categories = shapes.at(shape).second;
+                    const QString name = QString("%1x%2 depth %3 %4 formatters at %5").arg(row_categories).arg(column_categories)
+                                                                                      .arg(depth).arg(formatters).arg(position);
+                    QTest::newRow(name.toLatin1().constData()) << row_categories << column_categories << depth << formatters << position;
+                }
+            }
+        }
+    }
+}
+
+void BenchDatacubeView::fullRepaint_data() {
+    layouts();
+}
+
+void BenchDatacubeView::fullRepaint() {
+    QFETCH(int, row_categories);
+    QFETCH(int, column_categories);
+    QFETCH(int, depth);
+    QFETCH(int, formatters);
+    QFETCH(double, position);
+    ViewFixture fixture(100000, row_categories, column_categories, depth, formatters);
+    fixture.scrollTo(position);
+    fixture.render();
+    QBENCHMARK {
+        fixture.render();
+    }
+}
+
+void BenchDatacubeView::scrollRepaint_data() {
+    layouts();
+}
+
+void BenchDatacubeView::scrollRepaint() {
+    QFETCH(int, row_categories);
+    QFETCH(int, column_categories);
+    QFETCH(int, depth);
+    QFETCH(int, formatters);
+    QFETCH(double, position);
+    ViewFixture fixture(100000, row_categories, column_categories, depth, formatters);
+    fixture.scrollTo(position);
+    QScrollBar* scrollbar = fixture.view->verticalScrollBar();
+    const int from = scrollbar->value();
+    // Scroll up from the bottom, down otherwise
+    const int to = from == scrollbar->maximum() ? qMax(from - 1, 0) : from + 1;
+    fixture.render();
+    fixture.scheduledRegion();
+    scrollbar->setValue(to);
+    const QRegion scrolled_region = fixture.scheduledRegion();
+    fixture.render(scrolled_region);
+    scrollbar->setValue(from);
+    const QRegion back_region = fixture.scheduledRegion();
+    fixture.render(back_region);
+    bool scrolled = false;
+    QBENCHMARK {
+        scrolled = !scrolled;
+        scrollbar->setValue(scrolled ? to : from);
+        fixture.render(scrolled ? scrolled_region : back_region);
+    }
+}
+
+void BenchDatacubeView::selectionRepaint_data() {
+    layouts();
+}
+
+void BenchDatacubeView::selectionRepaint() {
+    QFETCH(int, row_categories);
+    QFETCH(int, column_categories);
+    QFETCH(int, depth);
+    QFETCH(int, formatters);
+    QFETCH(double, position);
+    ViewFixture fixture(100000, row_categories, column_categories, depth, formatters);
+    fixture.scrollTo(position);
+    DatacubeSelection* selection = fixture.view->datacubeSelection();
+    const int row = fixture.view->verticalScrollBar()->value();
+    const int column = fixture.view->horizontalScrollBar()->value();
+    fixture.render();
+    fixture.scheduledRegion();
+    selection->addCell(row, column);
+    const QRegion selected_region = fixture.scheduledRegion();
+    fixture.render(selected_region);
+    selection->clear();
+    const QRegion cleared_region = fixture.scheduledRegion();
+    fixture.render(cleared_region);
+    bool selected = false;
+    QBENCHMARK {
+        selected = !selected;
+        if (selected) {
+            selection->addCell(row, column);
+        } else {
+            selection->clear();
+        }
+        fixture.render(selected ? selected_region : cleared_region);
+    }
+}
+
+void BenchDatacubeView::scrollRepaintElements_data() {
+    QTest::addColumn<int>("rows");
+    QTest::newRow("10k") << 10000;
+    QTest::newRow("100k") << 100000;
+    QTest::newRow("1M") << 1000000;
+}
+
+void BenchDatacubeView::scrollRepaintElements() {
+    QFETCH(int, rows);
+    ViewFixture fixture(rows, 40, 40, 1, 2);
+    fixture.render();
+    fixture.scheduledRegion();
+    fixture.view->verticalScrollBar()->setValue(1);
+    const QRegion scrolled_region = fixture.scheduledRegion();
+    fixture.render(scrolled_region);
+    fixture.view->verticalScrollBar()->setValue(0);
+    const QRegion back_region = fixture.scheduledRegion();
+    fixture.render(back_region);
+    int scroll = 0;
+    QBENCHMARK {
+        scroll = 1 - scroll;
+        fixture.view->verticalScrollBar()->setValue(scroll);
+        fixture.render(scroll ? scrolled_region : back_region);
+    }
+}
+
+int main(int argc, char** argv) {
+    if (qgetenv("QT_QPA_PLATFORM").isEmpty()) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    QApplication app(argc, argv);
+    BenchDatacubeView bench;
+    return QTest::qExec(&bench, argc, argv);
+}
+
+#include "benchdatacubeview.moc"
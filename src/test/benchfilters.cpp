@@ -0,0 +1,229 @@
+/*
+ * Benchmark of evaluating nested AndFilter/OrFilter trees over FilterByAggregate leaves, row by row
+ * through operator() and in one go through AbstractFilter::evaluate().
+ *
+ * The model has 10M rows by default; set QDATACUBE_BENCH_MAX_ROWS for a smaller run. The aggregators
+ * are shared through an AggregatorRegistry, so the leaves read stored category codes as they would
+ * in an application with several datacubes over the model.
+ *
+ * badOrdering puts an expensive filter that decides nothing first in an AND or an OR, with and without
+ * adaptive ordering of the filters.
+ */
+#include "syntheticmodel.h"
+#include "abstractaggregator.h"
+#include "aggregatorregistry.h"
+#include "andfilter.h"
+#include "bitset.h"
+#include "filterbyaggregate.h"
+#include "orfilter.h"
+
+#include <QSharedPointer>
+#include <QTest>
+
+using namespace qdatacube;
+
+/**
+ * Aggregator reading the category codes of a SyntheticModel column directly, to set up 10M rows quickly
+ */
+class CodeAggregator : public AbstractAggregator {
+    public:
+        CodeAggregator(const SyntheticModel* model, int column, int categories)
+          : AbstractAggregator(model), m_model(model), m_column(column), m_categories(categories) {}
+        virtual int operator()(int row) const {
+            return m_model->category(row, m_column);
+        }
+        virtual int categoryCount() const {
+            return m_categories;
+        }
+        virtual QVariant categoryHeaderData(int category, int role = Qt::DisplayRole) const {
+            return role == Qt::DisplayRole ? QVariant(QString::number(category)) : QVariant();
+        }
+    private:
+        const SyntheticModel* m_model;
+        int m_column;
+        int m_categories;
+};
+
+/**
+ * Filter reading the model's data for each row, including every row or none
+ */
+class ModelDataFilter : public AbstractFilter {
+    public:
+        ModelDataFilter(const QAbstractItemModel* model, bool include) : AbstractFilter(model), m_include(include) {}
+        virtual bool operator()(int row) const {
+            const QAbstractItemModel* model = underlyingModel();
+            return (model->data(model->index(row, SyntheticModel::WEIGHT)).toInt() >= 0) == m_include;
+        }
+    private:
+        bool m_include;
+};
+
+class BenchFilters : public QObject {
+    Q_OBJECT
+    private Q_SLOTS:
+        void initTestCase();
+        void cleanupTestCase();
+        void scalar_data();
+        void scalar();
+        void batch_data();
+        void batch();
+        void badOrdering_data();
+        void badOrdering();
+    private:
+        void trees();
+        AbstractFilter::Ptr leaf(AbstractAggregator::Ptr aggregator, int category);
+        AbstractFilter::Ptr both(AbstractFilter::Ptr a, AbstractFilter::Ptr b);
+        AbstractFilter::Ptr either(AbstractFilter::Ptr a, AbstractFilter::Ptr b);
+        AbstractFilter::Ptr tree(const QString& name);
+        QScopedPointer<SyntheticModel> m_model;
+        QScopedPointer<AggregatorRegistry> m_registry;
+        AbstractAggregator::Ptr m_sex;
+        AbstractAggregator::Ptr m_age;
+        AbstractAggregator::Ptr m_kommune;
+};
+
+void BenchFilters::initTestCase() {
+    const int rows = qEnvironmentVariableIsSet("QDATACUBE_BENCH_MAX_ROWS") ? qgetenv("QDATACUBE_BENCH_MAX_ROWS").toInt() : 10000000;
+    SyntheticModel::Config config(rows);
+    m_model.reset(new SyntheticModel(config));
+    m_registry.reset(new AggregatorRegistry(m_model.data()));
+    m_sex = m_registry->aggregator("sex", AbstractAggregator::Ptr(new CodeAggregator(m_model.data(), SyntheticModel::SEX, config.cardinalities.at(SyntheticModel::SEX))));
+    m_age = m_registry->aggregator("age", AbstractAggregator::Ptr(new CodeAggregator(m_model.data(), SyntheticModel::AGE, config.cardinalities.at(SyntheticModel::AGE))));
+    m_kommune = m_registry->aggregator("kommune", AbstractAggregator::Ptr(new CodeAggregator(m_model.data(), SyntheticModel::KOMMUNE, config.cardinalities.at(SyntheticModel::KOMMUNE))));
+}
+
+void BenchFilters::cleanupTestCase() {
+    m_sex.clear();
+    m_age.clear();
+    m_kommune.clear();
+    m_registry.reset();
+    m_model.reset();
+}
+
+AbstractFilter::Ptr BenchFilters::leaf(AbstractAggregator::Ptr aggregator, int category) {
+    return AbstractFilter::Ptr(new FilterByAggregate(aggregator, category));
+}
+
+AbstractFilter::Ptr BenchFilters::both(AbstractFilter::Ptr a, AbstractFilter::Ptr b) {
+    QSharedPointer<AndFilter> rv(new AndFilter(m_model.data()));
+    rv->addFilter(a);
+    rv->addFilter(b);
+    return rv;
+}
+
+AbstractFilter::Ptr BenchFilters::either(AbstractFilter::Ptr a, AbstractFilter::Ptr b) {
+    QSharedPointer<OrFilter> rv(new OrFilter(m_model.data()));
+    rv->addFilter(a);
+    rv->addFilter(b);
+    return rv;
+}
+
+/**
+ * @return the filter tree called name, see trees()
+ */
+AbstractFilter::Ptr BenchFilters::tree(const QString& name) {
+    if (name == "leaf") {
+        return leaf(m_kommune, 0);
+    }
+    if (name == "and") {
+        return both(leaf(m_sex, 0), leaf(m_kommune, 0));
+    }
+    if (name == "or") {
+        return either(leaf(m_age, 1), leaf(m_kommune, 0));
+    }
+    if (name == "and of ors") {
+        return both(either(leaf(m_age, 0), leaf(m_age, 1)), either(leaf(m_kommune, 0), leaf(m_kommune, 2)));
+    }
+    if (name == "or of ands") {
+        return either(both(leaf(m_sex, 0), leaf(m_age, 0)), both(leaf(m_sex, 1), leaf(m_kommune, 1)));
+    }
+    Q_ASSERT(name == "depth 4");
+    return both(either(both(leaf(m_sex, 0), either(leaf(m_age, 0), leaf(m_age, 3))), leaf(m_kommune, 0)),
+                either(leaf(m_age, 2), both(leaf(m_sex, 1), leaf(m_kommune, 4))));
+}
+
+void BenchFilters::trees() {
+    QTest::addColumn<QString>("tree");
+    QTest::newRow("leaf") << "leaf";
+    QTest::newRow("and") << "and";
+    QTest::newRow("or") << "or";
+    QTest::newRow("and of ors") << "and of ors";
+    QTest::newRow("or of ands") << "or of ands";
+    QTest::newRow("depth 4") << "depth 4";
+}
+
+void BenchFilters::scalar_data() {
+    trees();
+}
+
+void BenchFilters::scalar() {
+    QFETCH(QString, tree);
+    AbstractFilter::Ptr filter = this->tree(tree);
+    const AbstractFilter& f = *filter;
+    int included = 0;
+    QBENCHMARK {
+        included = 0;
+        for (int row = 0, nrows = m_model->rowCount(); row < nrows; ++row) {
+            included += f(row);
+        }
+    }
+    QVERIFY(included >= 0);
+}
+
+void BenchFilters::batch_data() {
+    trees();
+}
+
+void BenchFilters::batch() {
+    QFETCH(QString, tree);
+    AbstractFilter::Ptr filter = this->tree(tree);
+    Bitset result;
+    QBENCHMARK {
+        filter->evaluate(0, m_model->rowCount(), result);
+    }
+    QCOMPARE(result.size(), m_model->rowCount());
+}
+
+void BenchFilters::badOrdering_data() {
+    QTest::addColumn<bool>("conjunction");
+    QTest::addColumn<bool>("adaptive");
+    QTest::newRow("and fixed") << true << false;
+    QTest::newRow("and adaptive") << true << true;
+    QTest::newRow("or fixed") << false << false;
+    QTest::newRow("or adaptive") << false << true;
+}
+
+void BenchFilters::badOrdering() {
+    QFETCH(bool, conjunction);
+    QFETCH(bool, adaptive);
+    // Reading the model for every row is slow, so stick to 1M rows
+    const int nrows = qMin(m_model->rowCount(), 1000000);
+    AbstractFilter::Ptr expensive(new ModelDataFilter(m_model.data(), conjunction));
+    AbstractFilter::Ptr filter;
+    if (conjunction) {
+        QSharedPointer<AndFilter> and_filter(new AndFilter(m_model.data()));
+        and_filter->setAdaptiveOrdering(adaptive);
+        and_filter->addFilter(expensive);
+        and_filter->addFilter(leaf(m_kommune, 0));
+        filter = and_filter;
+    } else {
+        QSharedPointer<OrFilter> or_filter(new OrFilter(m_model.data()));
+        or_filter->setAdaptiveOrdering(adaptive);
+        or_filter->addFilter(expensive);
+        or_filter->addFilter(leaf(m_kommune, 0));
+        filter = or_filter;
+    }
+    const AbstractFilter& f = *filter;
+    int included = 0;
+    QBENCHMARK {
+        included = 0;
+        for (int row = 0; row < nrows; ++row) {
+            included += f(row);
+        }
+    }
+    QVERIFY(included >= 0);
+}
+
+QTEST_GUILESS_MAIN(BenchFilters)
+
+#include "benchfilters.moc"
@@ -0,0 +1,279 @@
+/*
+ * Benchmark of the sketch based formatters against the exact methods.
+ *
+ * For each cell size, reports the cost of formatting one cell (i.e. the per-paint
+ * cost of a cell without caching) and the relative error of the sketch.
+ * For the totals, reports the cost of formatCells() over a header row and over the
+ * grand total, exact (pass over all elements) against sketch (merge of cell sketches).
+ */
+#include "columnaggregator.h"
+#include "datacube.h"
+#include "distinctcountformatter.h"
+#include "quantileformatter.h"
+
+#include <QObject>
+#include <QScopedPointer>
+#include <QSet>
+#include <QStandardItemModel>
+#include <QTest>
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+using namespace qdatacube;
+
+class BenchFormatters : public QObject {
+    Q_OBJECT
+private:
+    enum columns_t {
+        CUSTOMER,
+        LATENCY,
+        REGION,
+        CHANNEL,
+        N_COLUMNS
+    };
+    QStandardItemModel* m_model;
+    Datacube* m_datacube;
+    QList<int> rows(int count) const;
+    int exactDistinct(const QList<int>& rows) const;
+    double exactQuantile(const QList<int>& rows, double q) const;
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+    void distinctCountExact_data();
+    void distinctCountExact();
+    void distinctCountSketch_data();
+    void distinctCountSketch();
+    void quantileExact_data();
+    void quantileExact();
+    void quantileSketch_data();
+    void quantileSketch();
+    void formatCellsExact_data();
+    void formatCellsExact();
+    void formatCellsSketch_data();
+    void formatCellsSketch();
+    void reportError_data();
+    void reportError();
+};
+
+static const int N_ROWS = 200000;
+
+void BenchFormatters::initTestCase() {
+    m_model = new QStandardItemModel(0, N_COLUMNS, this);
+    std::mt19937 generator(42);
+    // Skewed customers: a few frequent ones and a long tail
+    std::lognormal_distribution<double> customer(0.0, 2.0);
+    std::lognormal_distribution<double> latency(3.0, 0.8);
+    for (int row = 0; row < N_ROWS; ++row) {
+        QList<QStandardItem*> items;
+        items << new QStandardItem(QString("customer%1").arg(qint64(customer(generator) * 1000) % 50000));
+        items << new QStandardItem(QString::number(latency(generator), 'f', 3));
+        items << new QStandardItem(QString("region%1").arg(row % 20));
+        items << new QStandardItem(QString("channel%1").arg((row / 20) % 8));
+        m_model->appendRow(items);
+    }
+    AbstractAggregator::Ptr region(new ColumnAggregator(m_model, REGION));
+    AbstractAggregator::Ptr channel(new ColumnAggregator(m_model, CHANNEL));
+    m_datacube = new Datacube(m_model, region, channel, this);
+}
+
+void BenchFormatters::cleanupTestCase() {
+    delete m_datacube;
+    delete m_model;
+}
+
+QList<int> BenchFormatters::rows(int count) const {
+    QList<int> rv;
+    rv.reserve(count);
+    // Spread over the model like a real cell
+    const int step = qMax(1, N_ROWS / count);
+    for (int i = 0; i < count; ++i) {
+        rv << (i * step) % N_ROWS;
+    }
+    return rv;
+}
+
+int BenchFormatters::exactDistinct(const QList<int>& rows) const {
+    QSet<QString> values;
+    Q_FOREACH(int row, rows) {
+        values << m_model->index(row, CUSTOMER).data().toString();
+    }
+    return values.size();
+}
+
+double BenchFormatters::exactQuantile(const QList<int>& rows, double q) const {
+    std::vector<double> values;
+    values.reserve(rows.size());
+    Q_FOREACH(int row, rows) {
+        values.push_back(m_model->index(row, LATENCY).data().toDouble());
+    }
+    std::vector<double>::iterator nth = values.begin() + qMin<int>(values.size() - 1, int(q * values.size()));
+    std::nth_element(values.begin(), nth, values.end());
+    return *nth;
+}
+
+static void addCellSizes() {
+    QTest::addColumn<int>("cellsize");
+    QTest::newRow("1k") << 1000;
+    QTest::newRow("10k") << 10000;
+    QTest::newRow("100k") << 100000;
+}
+
+void BenchFormatters::distinctCountExact_data() {
+    addCellSizes();
+}
+
+void BenchFormatters::distinctCountExact() {
+    QFETCH(int, cellsize);
+    const QList<int> cell = rows(cellsize);
+    int result = 0;
+    QBENCHMARK {
+        result = exactDistinct(cell);
+    }
+    QVERIFY(result > 0);
+}
+
+void BenchFormatters::distinctCountSketch_data() {
+    addCellSizes();
+}
+
+void BenchFormatters::distinctCountSketch() {
+    QFETCH(int, cellsize);
+    const QList<int> cell = rows(cellsize);
+    DistinctCountFormatter formatter(m_model, 0L, CUSTOMER);
+    formatter.format(cell); // Warm up per-row hashes
+    QString result;
+    QBENCHMARK {
+        result = formatter.format(cell);
+    }
+    QVERIFY(!result.isEmpty());
+}
+
+void BenchFormatters::quantileExact_data() {
+    addCellSizes();
+}
+
+void BenchFormatters::quantileExact() {
+    QFETCH(int, cellsize);
+    const QList<int> cell = rows(cellsize);
+    double result = 0.0;
+    QBENCHMARK {
+        result = exactQuantile(cell, 0.5);
+    }
+    QVERIFY(result > 0.0);
+}
+
+void BenchFormatters::quantileSketch_data() {
+    addCellSizes();
+}
+
+void BenchFormatters::quantileSketch() {
+    QFETCH(int, cellsize);
+    const QList<int> cell = rows(cellsize);
+    QuantileFormatter formatter(m_model, 0L, LATENCY, 0.5, 3, QString());
+    formatter.format(cell); // Warm up per-row values
+    QString result;
+    QBENCHMARK {
+        result = formatter.format(cell);
+    }
+    QVERIFY(!result.isEmpty());
+}
+
+static void addTotals() {
+    QTest::addColumn<QString>("formatter");
+    QTest::addColumn<bool>("grandtotal");
+    QTest::newRow("distinct header row") << "distinct" << false;
+    QTest::newRow("distinct grand total") << "distinct" << true;
+    QTest::newRow("quantile header row") << "quantile" << false;
+    QTest::newRow("quantile grand total") << "quantile" << true;
+}
+
+void BenchFormatters::formatCellsExact_data() {
+    addTotals();
+}
+
+void BenchFormatters::formatCellsExact() {
+    QFETCH(QString, formatter);
+    QFETCH(bool, grandtotal);
+    const int bottom_row = grandtotal ? m_datacube->rowCount() - 1 : 0;
+    const int right_column = m_datacube->columnCount() - 1;
+    double result = 0.0;
+    QBENCHMARK {
+        // What formatCells() does for a formatter that does not merge cells
+        QList<int> elements;
+        for (int row = 0; row <= bottom_row; ++row) {
+            for (int column = 0; column <= right_column; ++column) {
+                elements << m_datacube->elements(row, column);
+            }
+        }
+        result = formatter == "distinct" ? exactDistinct(elements) : exactQuantile(elements, 0.5);
+    }
+    QVERIFY(result > 0.0);
+}
+
+void BenchFormatters::formatCellsSketch_data() {
+    addTotals();
+}
+
+void BenchFormatters::formatCellsSketch() {
+    QFETCH(QString, formatter);
+    QFETCH(bool, grandtotal);
+    const int bottom_row = grandtotal ? m_datacube->rowCount() - 1 : 0;
+    const int right_column = m_datacube->columnCount() - 1;
+    QScopedPointer<AbstractFormatter> sketch;
+    if (formatter == "distinct") {
+        sketch.reset(new DistinctCountFormatter(m_model, 0L, CUSTOMER));
+    } else {
+        sketch.reset(new QuantileFormatter(m_model, 0L, LATENCY, 0.5, 3, QString()));
+    }
+    QVERIFY(sketch->mergesCells());
+    sketch->formatCells(m_datacube, 0, 0, bottom_row, right_column); // Warm up the cell sketches
+    QString result;
+    QBENCHMARK {
+        result = sketch->formatCells(m_datacube, 0, 0, bottom_row, right_column);
+    }
+    QVERIFY(!result.isEmpty());
+}
+
+void BenchFormatters::reportError_data() {
+    QTest::addColumn<int>("cellsize");
+    QTest::addColumn<int>("precision");
+    QTest::addColumn<double>("compression");
+    QTest::newRow("10k low") << 10000 << 10 << 50.0;
+    QTest::newRow("10k default") << 10000 << 12 << 100.0;
+    QTest::newRow("100k low") << 100000 << 10 << 50.0;
+    QTest::newRow("100k default") << 100000 << 12 << 100.0;
+    QTest::newRow("100k high") << 100000 << 14 << 200.0;
+}
+
+void BenchFormatters::reportError() {
+    QFETCH(int, cellsize);
+    QFETCH(int, precision);
+    QFETCH(double, compression);
+    const QList<int> cell = rows(cellsize);
+
+    DistinctCountFormatter distinct(m_model, 0L, CUSTOMER, precision);
+    const int exact_distinct = exactDistinct(cell);
+    const double distinct_error = std::abs(distinct.estimate(cell) - exact_distinct) / exact_distinct;
+
+    QuantileFormatter quantile(m_model, 0L, LATENCY, 0.5, 3, QString(), compression);
+    QList<double> quantile_errors;
+    Q_FOREACH(double q, QList<double>() << 0.5 << 0.9 << 0.99) {
+        quantile.setQuantile(q);
+        const double exact = exactQuantile(cell, q);
+        quantile_errors << std::abs(quantile.estimate(cell) - exact) / exact;
+    }
+    qDebug("cellsize %d: distinct %d (p=%d) relative error %.4f; quantile (compression %.0f) relative error p50 %.4f p90 %.4f p99 %.4f",
+           cellsize, exact_distinct, precision, distinct_error, compression,
+           quantile_errors.at(0), quantile_errors.at(1), quantile_errors.at(2));
+    // Generous bounds: 5 standard errors for HyperLogLog, and a few percent for the t-digest
+    QVERIFY(distinct_error < 5 * 1.04 / std::sqrt(double(1 << precision)));
+    Q_FOREACH(double error, quantile_errors) {
+        QVERIFY(error < 0.05);
+    }
+}
+
+QTEST_GUILESS_MAIN(BenchFormatters)
+
+#include "benchformatters.moc"
@@ -0,0 +1,91 @@
+/*
+ * Benchmark of building a datacube from its model versus loading it with Datacube::load().
+ *
+ * The number of rows defaults to 10M, and can be set with the QDATACUBE_BENCH_ROWS environment variable.
+ * Both cases construct the aggregators, which scan the model for categories; the difference is the
+ * cost of bucketing every element.
+ */
+#include "datacube.h"
+#include "columnaggregator.h"
+
+#include <QAbstractTableModel>
+#include <QBuffer>
+#include <QCoreApplication>
+#include <QSharedPointer>
+#include <QTest>
+
+using namespace qdatacube;
+
+/**
+ * Read only model with computed content: Two category columns with 40 and 200 categories
+ */
+class GeneratedModel : public QAbstractTableModel {
+    public:
+        GeneratedModel(int rows, QObject* parent = 0) : QAbstractTableModel(parent), m_rows(rows) {}
+        virtual int rowCount(const QModelIndex& parent = QModelIndex()) const {
+            return parent.isValid() ? 0 : m_rows;
+        }
+        virtual int columnCount(const QModelIndex& parent = QModelIndex()) const {
+            return parent.isValid() ? 0 : 2;
+        }
+        virtual QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const {
+            if (role != Qt::DisplayRole) {
+                return QVariant();
+            }
+            const int row = index.row();
+            if (index.column() == 0) {
+                return QString("a%1").arg(row % 40, 2, 10, QChar('0'));
+            }
+            return QString("b%1").arg((row * 7919) % 200, 3, 10, QChar('0'));
+        }
+    private:
+        int m_rows;
+};
+
+class BenchSaveLoad : public QObject {
+    Q_OBJECT
+    private Q_SLOTS:
+        void initTestCase();
+        void coldBuild();
+        void load();
+    private:
+        QScopedPointer<GeneratedModel> m_model;
+        QBuffer m_saved;
+};
+
+void BenchSaveLoad::initTestCase() {
+    const int rows = qEnvironmentVariableIsSet("QDATACUBE_BENCH_ROWS") ? qgetenv("QDATACUBE_BENCH_ROWS").toInt() : 10000000;
+    m_model.reset(new GeneratedModel(rows));
+    AbstractAggregator::Ptr row_aggregator(new ColumnAggregator(m_model.data(), 0));
+    AbstractAggregator::Ptr column_aggregator(new ColumnAggregator(m_model.data(), 1));
+    Datacube datacube(m_model.data(), row_aggregator, column_aggregator);
+    m_saved.open(QIODevice::ReadWrite);
+    QVERIFY(datacube.save(&m_saved, "bench"));
+}
+
+void BenchSaveLoad::coldBuild() {
+    QBENCHMARK_ONCE {
+        AbstractAggregator::Ptr row_aggregator(new ColumnAggregator(m_model.data(), 0));
+        AbstractAggregator::Ptr column_aggregator(new ColumnAggregator(m_model.data(), 1));
+        Datacube datacube(m_model.data(), row_aggregator, column_aggregator);
+        QCOMPARE(datacube.elementCount(), m_model->rowCount());
+    }
+}
+
+void BenchSaveLoad::load() {
+    QBENCHMARK_ONCE {
+        Datacube::Aggregators row_aggregators;
+        row_aggregators << AbstractAggregator::Ptr(new ColumnAggregator(m_model.data(), 0));
+        Datacube::Aggregators column_aggregators;
+        column_aggregators << AbstractAggregator::Ptr(new ColumnAggregator(m_model.data(), 1));
+        m_saved.seek(0);
+        bool restored = false;
+        QScopedPointer<Datacube> datacube(Datacube::load(&m_saved, "bench", m_model.data(), row_aggregators, column_aggregators, Datacube::Filters(), 0, &restored));
+        QVERIFY(restored);
+        QCOMPARE(datacube->elementCount(), m_model->rowCount());
+    }
+}
+
+QTEST_GUILESS_MAIN(BenchSaveLoad)
+
+#include "benchsaveload.moc"
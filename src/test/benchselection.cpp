@@ -0,0 +1,108 @@
+/*
+ * Benchmark of selecting in a large cube shown in a DatacubeView.
+ *
+ * The cube has 500x500 cells with 2 elements each. Selecting cell by cell exercises the per-mutation
+ * notifications and the view's repaint coalescing; selecting everything at once exercises the bulk path.
+ */
+#include "datacube.h"
+#include "datacubeselection.h"
+#include "datacubeview.h"
+#include "columnaggregator.h"
+
+#include <QAbstractTableModel>
+#include <QApplication>
+#include <QTest>
+
+using namespace qdatacube;
+
+/**
+ * Read only model with 2 computed category columns with 500 categories each, covering every combination
+ */
+class GridModel : public QAbstractTableModel {
+    public:
+        GridModel(int side, int per_cell, QObject* parent = 0) : QAbstractTableModel(parent), m_side(side), m_per_cell(per_cell) {}
+        virtual int rowCount(const QModelIndex& parent = QModelIndex()) const {
+            return parent.isValid() ? 0 : m_side * m_side * m_per_cell;
+        }
+        virtual int columnCount(const QModelIndex& parent = QModelIndex()) const {
+            return parent.isValid() ? 0 : 2;
+        }
+        virtual QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const {
+            if (role != Qt::DisplayRole) {
+                return QVariant();
+            }
+            const int cell = index.row() / m_per_cell;
+            const int category = index.column() == 0 ? cell % m_side : cell / m_side;
+            return QString("c%1").arg(category, 3, 10, QChar('0'));
+        }
+    private:
+        int m_side;
+        int m_per_cell;
+};
+
+class BenchSelection : public QObject {
+    Q_OBJECT
+    private Q_SLOTS:
+        void initTestCase();
+        void cleanupTestCase();
+        void addCellEveryCell();
+        void addElementsEverything();
+    private:
+        GridModel* m_model;
+        Datacube* m_datacube;
+        DatacubeView* m_view;
+};
+
+void BenchSelection::initTestCase() {
+    m_model = new GridModel(500, 2, this);
+    AbstractAggregator::Ptr row_aggregator(new ColumnAggregator(m_model, 0));
+    AbstractAggregator::Ptr column_aggregator(new ColumnAggregator(m_model, 1));
+    m_datacube = new Datacube(m_model, row_aggregator, column_aggregator, this);
+    QCOMPARE(m_datacube->rowCount(), 500);
+    QCOMPARE(m_datacube->columnCount(), 500);
+    m_view = new DatacubeView();
+    m_view->resize(800, 600);
+    m_view->setDatacube(m_datacube);
+}
+
+void BenchSelection::cleanupTestCase() {
+    delete m_view;
+}
+
+void BenchSelection::addCellEveryCell() {
+    DatacubeSelection* selection = m_view->datacubeSelection();
+    const int nrows = m_datacube->rowCount();
+    const int ncolumns = m_datacube->columnCount();
+    QBENCHMARK {
+        selection->clear();
+        for (int row = 0; row < nrows; ++row) {
+            for (int column = 0; column < ncolumns; ++column) {
+                selection->addCell(row, column);
+            }
+        }
+        QCoreApplication::processEvents();
+    }
+    QCOMPARE(selection->selectionStatus(nrows-1, ncolumns-1), DatacubeSelection::SELECTED);
+}
+
+void BenchSelection::addElementsEverything() {
+    DatacubeSelection* selection = m_view->datacubeSelection();
+    const QList<int> elements = m_datacube->elements();
+    QBENCHMARK {
+        selection->clear();
+        selection->addElements(elements);
+        QCoreApplication::processEvents();
+    }
+    QCOMPARE(selection->selectionStatus(0, 0), DatacubeSelection::SELECTED);
+}
+
+int main(int argc, char** argv) {
+    if (qgetenv("QT_QPA_PLATFORM").isEmpty()) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    QApplication app(argc, argv);
+    BenchSelection bench;
+    return QTest::qExec(&bench, argc, argv);
+}
+
+#include "benchselection.moc"
@@ -0,0 +1,122 @@
+#include "syntheticmodel.h"
+
+#include <cmath>
+#include <algorithm>
+
+SyntheticModel::Config::Config(int rows) : rows(rows), skew(1.0), seed(1) {
+  // first names, last names, sexes, ages, weights, kommuner
+  cardinalities << 1000 << 500 << 2 << 100 << 150 << 98;
+}
+
+SyntheticModel::SyntheticModel(const Config& config, QObject* parent)
+  : QAbstractTableModel(parent),
+    m_config(config),
+    m_state(config.seed)
+{
+  const int ncolumns = config.cardinalities.size();
+  m_cumulative.resize(ncolumns);
+  m_codes.resize(ncolumns);
+  for (int column = 0; column < ncolumns; ++column) {
+    const int ncategories = qMax(config.cardinalities.at(column), 1);
+    QVector<double>& cumulative = m_cumulative[column];
+    cumulative.resize(ncategories);
+    double sum = 0.0;
+    for (int category = 0; category < ncategories; ++category) {
+      sum += 1.0 / std::pow(category + 1.0, config.skew);
+      cumulative[category] = sum;
+    }
+    for (int category = 0; category < ncategories; ++category) {
+      cumulative[category] /= sum;
+    }
+    QVector<int>& codes = m_codes[column];
+    codes.resize(config.rows);
+    for (int row = 0; row < config.rows; ++row) {
+      codes[row] = draw(column);
+    }
+  }
+}
+
+int SyntheticModel::draw(int column) {
+  // Numerical Recipes' linear congruential generator; good enough and the same everywhere
+  m_state = m_state * 1664525u + 1013904223u;
+  const double uniform = m_state / 4294967296.0;
+  const QVector<double>& cumulative = m_cumulative.at(column);
+  const int category = std::lower_bound(cumulative.constBegin(), cumulative.constEnd(), uniform) - cumulative.constBegin();
+  return qMin(category, cumulative.size() - 1);
+}
+
+int SyntheticModel::rowCount(const QModelIndex& parent) const {
+  return parent.isValid() || m_codes.isEmpty() ? 0 : m_codes.first().size();
+}
+
+int SyntheticModel::columnCount(const QModelIndex& parent) const {
+  return parent.isValid() ? 0 : m_codes.size();
+}
+
+QVariant SyntheticModel::data(const QModelIndex& index, int role) const {
+  if (role != Qt::DisplayRole || !index.isValid()) {
+    return QVariant();
+  }
+  const int code = m_codes.at(index.column()).at(index.row());
+  switch (index.column()) {
+    case FIRST_NAME:
+      return QString("first%1").arg(code, 4, 10, QChar('0'));
+    case LAST_NAME:
+      return QString("last%1").arg(code, 4, 10, QChar('0'));
+    case SEX:
+      return code == 0 ? QString("female") : code == 1 ? QString("male") : QString("sex%1").arg(code);
+    case AGE:
+      return code;
+    case WEIGHT:
+      return 40 + code;
+    case KOMMUNE:
+      return QString("kommune%1").arg(code, 3, 10, QChar('0'));
+  }
+  return QString("c%1_%2").arg(index.column()).arg(code);
+}
+
+QVariant SyntheticModel::headerData(int section, Qt::Orientation orientation, int role) const {
+  if (orientation != Qt::Horizontal || role != Qt::DisplayRole) {
+    return QAbstractTableModel::headerData(section, orientation, role);
+  }
+  static const char* names[] = { "firstname", "lastname", "sex", "age", "weight", "kommune" };
+  return section < N_COLUMNS ? QString(names[section]) : QString("c%1").arg(section);
+}
+
+bool SyntheticModel::insertRows(int row, int count, const QModelIndex& parent) {
+  if (parent.isValid() || row < 0 || row > rowCount() || count <= 0) {
+    return false;
+  }
+  beginInsertRows(parent, row, row + count - 1);
+  for (int column = 0; column < m_codes.size(); ++column) {
+    QVector<int>& codes = m_codes[column];
+    codes.insert(row, count, 0);
+    for (int i = row; i < row + count; ++i) {
+      codes[i] = draw(column);
+    }
+  }
+  endInsertRows();
+  return true;
+}
+
+bool SyntheticModel::removeRows(int row, int count, const QModelIndex& parent) {
+  if (parent.isValid() || row < 0 || count <= 0 || row + count > rowCount()) {
+    return false;
+  }
+  beginRemoveRows(parent, row, row + count - 1);
+  for (int column = 0; column < m_codes.size(); ++column) {
+    m_codes[column].remove(row, count);
+  }
+  endRemoveRows();
+  return true;
+}
+
+void SyntheticModel::regenerate(int first, int last, int column) {
+  QVector<int>& codes = m_codes[column];
+  for (int row = first; row <= last; ++row) {
+    codes[row] = draw(column);
+  }
+  emit dataChanged(index(first, column), index(last, column));
+}
+
+#include "syntheticmodel.moc"
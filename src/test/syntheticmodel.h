@@ -0,0 +1,76 @@
+#ifndef SYNTHETICMODEL_H
+#define SYNTHETICMODEL_H
+
+#include <QAbstractTableModel>
+#include <QVector>
+
+/**
+ * Generated table model for benchmarks, with the columns of danishnamecube_t but any number of rows.
+ *
+ * Each column holds a category code per row, drawn from a Zipf distribution over the column's
+ * categories. The display text is derived from the code, e.g. "kommune017"; AGE and WEIGHT are numbers.
+ * Generation is deterministic for a given configuration.
+ */
+class SyntheticModel : public QAbstractTableModel {
+    Q_OBJECT
+    public:
+        enum columns_t {
+          FIRST_NAME,
+          LAST_NAME,
+          SEX,
+          AGE,
+          WEIGHT,
+          KOMMUNE,
+          N_COLUMNS
+        };
+
+        struct Config {
+            Config(int rows = 10000);
+            /**
+             * Number of rows
+             */
+            int rows;
+            /**
+             * Number of categories for each column. Columns beyond N_COLUMNS are named c6, c7, ...
+             */
+            QVector<int> cardinalities;
+            /**
+             * Zipf exponent: 0 gives uniformly distributed categories, 1 a typical long tail
+             */
+            double skew;
+            quint32 seed;
+        };
+
+        explicit SyntheticModel(const Config& config = Config(), QObject* parent = 0);
+
+        virtual int rowCount(const QModelIndex& parent = QModelIndex()) const;
+        virtual int columnCount(const QModelIndex& parent = QModelIndex()) const;
+        virtual QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const;
+        virtual QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const;
+
+        /**
+         * Insert count generated rows at row
+         */
+        virtual bool insertRows(int row, int count, const QModelIndex& parent = QModelIndex());
+        virtual bool removeRows(int row, int count, const QModelIndex& parent = QModelIndex());
+
+        /**
+         * Draw new categories for column in rows first to last, and emit a single dataChanged()
+         */
+        void regenerate(int first, int last, int column);
+
+        /**
+         * @return category code of row in column
+         */
+        int category(int row, int column) const {
+            return m_codes.at(column).at(row);
+        }
+    private:
+        int draw(int column);
+        Config m_config;
+        quint32 m_state;
+        QVector<QVector<double> > m_cumulative; // Zipf distribution function for each column
+        QVector<QVector<int> > m_codes; // category code for each column and row
+};
+
+#endif // SYNTHETICMODEL_H
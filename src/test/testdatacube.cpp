@@ -1,19 +1,205 @@
+#include "aggregatorregistry.h"
+#include "andfilter.h"
+#include "bitset.h"
+#include "categorysetfilter.h"
+#include "columnaggregator.h"
 #include "danishnamecube.h"
 #include "datacube.h"
+#include "datacubeselection.h"
+#include "datacubesnapshot.h"
+#include "datacubestatistics.h"
+#include "distinctcountformatter.h"
 #include "filterbyaggregate.h"
+#include "hyperloglog.h"
+#include "orfilter.h"
+#include "quantileformatter.h"
+#include "rangefilter.h"
+#include "syntheticmodel.h"
+#include "tdigest.h"
+#include "topcategoriesaggregator.h"
+#include "tracer.h"
 
+#include <QBuffer>
+#include <QCoreApplication>
+#include <QItemSelectionModel>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
 #include <QObject>
+#include <QSet>
 #include <QSharedPointer>
+#include <QSignalSpy>
+#include <QSortFilterProxyModel>
 #include <QStandardItemModel>
 #include <QTest>
+#include <QThread>
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 
 using namespace qdatacube;
 
+/**
+ * @return bytes allocated from the heap, or -1 if not known
+ */
+static qint64 heap_in_use() {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    const struct mallinfo2 info = mallinfo2();
+    return qint64(info.uordblks) + qint64(info.hblkhd);
+#else
+    return -1;
+#endif
+}
+
+/**
+ * Sums the cells of a snapshot over and over in another thread
+ */
+class SnapshotReader : public QThread {
+    public:
+        SnapshotReader(const DatacubeSnapshot& snapshot) : m_snapshot(snapshot), m_mismatches(0) {}
+        virtual void run() {
+            for (int pass = 0; pass < 100; ++pass) {
+                int total = 0;
+                for (int row = 0; row < m_snapshot.rowCount(); ++row) {
+                    for (int column = 0; column < m_snapshot.columnCount(); ++column) {
+                        total += m_snapshot.elementCount(row, column);
+                    }
+                }
+                if (total != m_snapshot.elementCount()) {
+                    ++m_mismatches;
+                }
+            }
+        }
+        int mismatches() const {
+            return m_mismatches;
+        }
+    private:
+        DatacubeSnapshot m_snapshot;
+        int m_mismatches;
+};
+
+/**
+ * Includes the rows of a SyntheticModel whose category code in column is a multiple of modulus,
+ * counting how often it is asked
+ */
+class CountingFilter : public AbstractFilter {
+    public:
+        CountingFilter(const SyntheticModel* model, int column, int modulus)
+          : AbstractFilter(model), m_model(model), m_column(column), m_modulus(modulus), m_evaluations(0) {}
+        virtual bool operator()(int row) const {
+            ++m_evaluations;
+            return m_model->category(row, m_column) % m_modulus == 0;
+        }
+        int evaluations() const {
+            return m_evaluations;
+        }
+    private:
+        const SyntheticModel* m_model;
+        int m_column;
+        int m_modulus;
+        mutable int m_evaluations;
+};
+
+/**
+ * Includes all rows or none, slowly
+ */
+class SlowFilter : public AbstractFilter {
+    public:
+        SlowFilter(const QAbstractItemModel* model, bool include) : AbstractFilter(model), m_include(include) {}
+        virtual bool operator()(int row) const {
+            volatile int work = row;
+            for (int i = 0; i < 2000; ++i) {
+                work = work + i;
+            }
+            return m_include;
+        }
+    private:
+        bool m_include;
+};
+
+/**
+ * @return the elements of model included by all filters, evaluating them directly
+ */
+static QList<int> filtered_elements(const SyntheticModel& model, const QList<CountingFilter*>& filters) {
+    QList<int> rv;
+    for (int row = 0; row < model.rowCount(); ++row) {
+        bool included = true;
+        Q_FOREACH(CountingFilter* filter, filters) {
+            included = included && (*filter)(row);
+        }
+        if (included) {
+            rv << row;
+        }
+    }
+    return rv;
+}
+
+/**
+ * @return elements of datacube, sorted
+ */
+static QList<int> sorted_elements(const Datacube& datacube) {
+    QList<int> rv = datacube.elements();
+    qSort(rv);
+    return rv;
+}
+
+/**
+ * Aggregator by the sex codes of a SyntheticModel, with labels that can be changed
+ */
+class RenamableAggregator : public AbstractAggregator {
+    public:
+        RenamableAggregator(const SyntheticModel* model) : AbstractAggregator(model), m_model(model) {
+            m_labels << "female" << "male";
+        }
+        virtual int operator()(int row) const {
+            return m_model->category(row, SyntheticModel::SEX);
+        }
+        virtual int categoryCount() const {
+            return m_labels.size();
+        }
+        virtual QVariant categoryHeaderData(int category, int role = Qt::DisplayRole) const {
+            return role == Qt::DisplayRole ? QVariant(m_labels.at(category)) : QVariant();
+        }
+        void rename(int category, const QString& label) {
+            m_labels[category] = label;
+            emit headerDataChanged(category, category);
+        }
+    private:
+        const SyntheticModel* m_model;
+        QStringList m_labels;
+};
+
 class TestDatacube : public QObject {
     Q_OBJECT
 private Q_SLOTS:
 
     void testFilterByAggregate();
+    void testCategorySetFilter();
+    void testDataChangedRange();
+    void testSelection();
+    void testSynchronizedSelection();
+    void testSnapshot();
+    void testRenamedCategories();
+    void testAggregatorRegistry();
+    void testSaveLoad();
+    void testStatistics();
+    void testTracing();
+    void testMemoryUsage();
+    void testIncrementalFilters();
+    void testBatchFilterEvaluation();
+    void testRangeFilter();
+    void testAdaptiveFilterOrdering();
+    void testFilterHeader();
+    void testTopCategoriesAggregator();
+    void testSortHeader();
+    void testHyperLogLog();
+    void testTDigest();
+    void testCellSketches();
 };
 QTEST_GUILESS_MAIN(TestDatacube)
 
@@ -56,4 +242,1274 @@ void TestDatacube::testFilterByAggregate() {
     QCOMPARE(otherFilter->categoryIndex(), -1);
 }
 
+void TestDatacube::testCategorySetFilter() {
+    danishnamecube_t danishModelHolder;
+    danishModelHolder.load_model_data(QFINDTESTDATA("data/plaincubedata.txt"));
+    Datacube datacube(danishModelHolder.m_underlying_model);
+    AbstractAggregator::Ptr kommune = danishModelHolder.kommune_aggregator;
+
+    // Same as OR'ing a filter per category
+    int expected = 0;
+    QList<int> kommuner;
+    kommuner << 0 << 2 << 3;
+    Q_FOREACH(int category, kommuner) {
+        Datacube single(danishModelHolder.m_underlying_model);
+        single.addFilter(AbstractFilter::Ptr(new FilterByAggregate(kommune, category)));
+        expected += single.elementCount();
+    }
+    AbstractFilter::Ptr in(new CategorySetFilter(kommune, kommuner));
+    datacube.addFilter(in);
+    QCOMPARE(datacube.elementCount(), expected);
+    datacube.resetFilter();
+    QSharedPointer<CategorySetFilter> notIn(new CategorySetFilter(kommune, kommuner, true));
+    QVERIFY(notIn->isNegated());
+    datacube.addFilter(notIn);
+    QCOMPARE(datacube.elementCount(), 100 - expected);
+
+    Bitset result;
+    notIn->evaluate(3, 90, result);
+    for (int row = 3; row < 93; ++row) {
+        QCOMPARE(result.test(row - 3), (*notIn)(row));
+    }
+
+    // Categories are followed as they come and go
+    datacube.resetFilter();
+    QSharedPointer<CategorySetFilter> sexFilter(new CategorySetFilter(danishModelHolder.sex_aggregator, QStringList() << "other" << "female"));
+    datacube.addFilter(sexFilter);
+    QCOMPARE(datacube.elementCount(), 42);
+    QCOMPARE(sexFilter->categoryIndexes().size(), 1);
+
+    QList<QStandardItem*> otherRow;
+    otherRow << new QStandardItem() << new QStandardItem() << new QStandardItem("other"); // 3 columns ignored
+    danishModelHolder.m_underlying_model->appendRow(otherRow);
+    QCOMPARE(datacube.elementCount(), 43);
+    QCOMPARE(sexFilter->categoryIndexes(), QList<int>() << 0 << 2);
+
+    danishModelHolder.m_underlying_model->removeRow(100);
+    danishModelHolder.sex_aggregator->resetCategories();
+    QCOMPARE(datacube.elementCount(), 42);
+    QCOMPARE(sexFilter->categoryIndexes(), QList<int>() << 0);
+}
+
+void TestDatacube::testDataChangedRange() {
+    danishnamecube_t danishModelHolder;
+    danishModelHolder.load_model_data(QFINDTESTDATA("data/plaincubedata.txt"));
+    QStandardItemModel* model = danishModelHolder.m_underlying_model;
+    Datacube datacube(model, danishModelHolder.sex_aggregator, danishModelHolder.kommune_aggregator);
+    QSignalSpy rangeSpy(&datacube, SIGNAL(dataChanged(int,int,int,int)));
+    QSignalSpy cellSpy(&datacube, SIGNAL(dataChanged(int,int)));
+
+    // A copy of the first element goes to an existing cell
+    const int row = datacube.sectionForElement(0, Qt::Vertical);
+    const int column = datacube.sectionForElement(0, Qt::Horizontal);
+    QList<QStandardItem*> copy;
+    for (int c = 0; c < model->columnCount(); ++c) {
+        copy << model->item(0, c)->clone();
+    }
+    model->appendRow(copy);
+
+    QCOMPARE(rangeSpy.count(), 1);
+    QCOMPARE(rangeSpy.first(), QVariantList() << row << column << row << column);
+    QCOMPARE(cellSpy.count(), 1);
+    QCOMPARE(cellSpy.first(), QVariantList() << row << column);
+}
+
+void TestDatacube::testSelection() {
+    danishnamecube_t danishModelHolder;
+    danishModelHolder.load_model_data(QFINDTESTDATA("data/plaincubedata.txt"));
+    QStandardItemModel* model = danishModelHolder.m_underlying_model;
+    Datacube datacube(model, danishModelHolder.sex_aggregator, danishModelHolder.kommune_aggregator);
+    DatacubeSelection selection(&datacube, 0);
+    QSignalSpy spy(&selection, SIGNAL(selectionStatusChanged(int,int)));
+
+    // Select a cell through its elements
+    const QList<int> elements = datacube.elements(0, 0);
+    QVERIFY(elements.size() > 1);
+    selection.addElements(elements);
+    QCOMPARE(selection.selectionStatus(0, 0), DatacubeSelection::SELECTED);
+    QCOMPARE(spy.count(), 1);
+    QCOMPARE(selection.selectionStatus(1, 0), DatacubeSelection::UNSELECTED);
+
+    selection.removeElements(QList<int>() << elements.first());
+    QCOMPARE(selection.selectionStatus(0, 0), DatacubeSelection::PARTIALLY_SELECTED);
+    QCOMPARE(spy.count(), 2);
+
+    // Removing the deselected element leaves the rest of the cell selected, with the elements renumbered
+    model->removeRow(elements.first());
+    QCOMPARE(selection.selectionStatus(0, 0), DatacubeSelection::SELECTED);
+
+    selection.clear();
+    QCOMPARE(selection.selectionStatus(0, 0), DatacubeSelection::UNSELECTED);
+    selection.addCell(0, 0);
+    QCOMPARE(selection.selectionStatus(0, 0), DatacubeSelection::SELECTED);
+}
+
+void TestDatacube::testSynchronizedSelection() {
+    danishnamecube_t danishModelHolder;
+    danishModelHolder.load_model_data(QFINDTESTDATA("data/plaincubedata.txt"));
+    QStandardItemModel* model = danishModelHolder.m_underlying_model;
+    Datacube datacube(model, danishModelHolder.sex_aggregator, danishModelHolder.kommune_aggregator);
+    DatacubeSelection selection(&datacube, 0);
+    QSortFilterProxyModel proxy;
+    proxy.setSourceModel(model);
+    proxy.sort(danishnamecube_t::AGE, Qt::DescendingOrder);
+    QItemSelectionModel synchronized(&proxy);
+    selection.synchronizeWith(&synchronized);
+
+    const QList<int> elements = datacube.elements(0, 0);
+    selection.addElements(elements);
+    QModelIndexList rows = synchronized.selectedRows();
+    QCOMPARE(rows.size(), elements.size());
+    Q_FOREACH(const QModelIndex& row, rows) {
+        QVERIFY(elements.contains(proxy.mapToSource(row).row()));
+    }
+
+    // Resorting changes the mapping
+    proxy.sort(danishnamecube_t::FIRST_NAME);
+    const QList<int> more_elements = datacube.elements(0, 1);
+    selection.addElements(more_elements);
+    rows = synchronized.selectedRows();
+    QCOMPARE(rows.size(), elements.size() + more_elements.size());
+    Q_FOREACH(const QModelIndex& row, rows) {
+        const int element = proxy.mapToSource(row).row();
+        QVERIFY(elements.contains(element) || more_elements.contains(element));
+    }
+
+    // Selecting in the synchronized model selects in the cube
+    synchronized.clearSelection();
+    selection.clear();
+    const int element = 0;
+    const int row = datacube.sectionForElement(element, Qt::Vertical);
+    const int column = datacube.sectionForElement(element, Qt::Horizontal);
+    synchronized.select(proxy.mapFromSource(model->index(element, 0)), QItemSelectionModel::Select | QItemSelectionModel::Rows);
+    const DatacubeSelection::SelectionStatus expected = datacube.elementCount(row, column) == 1 ? DatacubeSelection::SELECTED : DatacubeSelection::PARTIALLY_SELECTED;
+    QCOMPARE(selection.selectionStatus(row, column), expected);
+
+    // Inserting or removing a row the proxy hides renumbers the rows after it, though the proxy says nothing
+    proxy.setFilterKeyColumn(danishnamecube_t::SEX);
+    proxy.setFilterRegExp("^male$");
+    for (int change = 0; change < 2; ++change) {
+        int female = 0;
+        while (model->item(female, danishnamecube_t::SEX)->text() != "female") {
+            ++female;
+        }
+        // Use the mapping before the change
+        selection.clear();
+        selection.addElements(QList<int>() << female);
+        QVERIFY(synchronized.selectedRows().isEmpty());
+        selection.clear();
+        if (change == 0) {
+            QList<QStandardItem*> hidden;
+            for (int c = 0; c < model->columnCount(); ++c) {
+                hidden << model->item(female, c)->clone();
+            }
+            model->insertRow(0, hidden);
+        } else {
+            model->removeRow(0);
+        }
+        int male = 0;
+        while (model->item(male, danishnamecube_t::SEX)->text() != "male") {
+            ++male;
+        }
+        selection.addElements(QList<int>() << male);
+        rows = synchronized.selectedRows();
+        QCOMPARE(rows.size(), 1);
+        QCOMPARE(proxy.mapToSource(rows.first()).row(), male);
+        selection.clear();
+        const int male_row = datacube.sectionForElement(male, Qt::Vertical);
+        const int male_column = datacube.sectionForElement(male, Qt::Horizontal);
+        synchronized.select(proxy.mapFromSource(model->index(male, 0)), QItemSelectionModel::Select | QItemSelectionModel::Rows);
+        const DatacubeSelection::SelectionStatus male_status = datacube.elementCount(male_row, male_column) == 1 ? DatacubeSelection::SELECTED : DatacubeSelection::PARTIALLY_SELECTED;
+        QCOMPARE(selection.selectionStatus(male_row, male_column), male_status);
+        synchronized.clearSelection();
+    }
+}
+
+void TestDatacube::testSnapshot() {
+    danishnamecube_t danishModelHolder;
+    danishModelHolder.load_model_data(QFINDTESTDATA("data/plaincubedata.txt"));
+    QStandardItemModel* model = danishModelHolder.m_underlying_model;
+    Datacube datacube(model, danishModelHolder.sex_aggregator, danishModelHolder.kommune_aggregator);
+    const DatacubeSnapshot snapshot = datacube.snapshot();
+    QVERIFY(!snapshot.isNull());
+    QCOMPARE(snapshot.generation(), datacube.generation());
+    QCOMPARE(snapshot.rowCount(), datacube.rowCount());
+    QCOMPARE(snapshot.columnCount(), datacube.columnCount());
+    QCOMPARE(snapshot.elements(0, 0), datacube.elements(0, 0));
+    QCOMPARE(snapshot.categoryIndex(Qt::Horizontal, 0, 1), datacube.categoryIndex(Qt::Horizontal, 0, 1));
+    QCOMPARE(snapshot.categoryHeaderData(Qt::Vertical, 0, 0), danishModelHolder.sex_aggregator->categoryHeaderData(0));
+    const QList<int> elements = datacube.elements(0, 0);
+
+    // Read the snapshot in another thread while the datacube changes
+    SnapshotReader reader(snapshot);
+    reader.start();
+    model->removeRows(0, 50);
+    datacube.split(Qt::Vertical, 1, danishModelHolder.age_aggregator);
+    QVERIFY(reader.wait());
+    QCOMPARE(reader.mismatches(), 0);
+
+    QVERIFY(snapshot.generation() != datacube.generation());
+    QCOMPARE(snapshot.elementCount(), 100);
+    QCOMPARE(datacube.elementCount(), 50);
+    QCOMPARE(snapshot.headerCount(Qt::Vertical), 1);
+    QCOMPARE(datacube.headerCount(Qt::Vertical), 2);
+    QCOMPARE(snapshot.elements(0, 0), elements);
+}
+
+void TestDatacube::testRenamedCategories() {
+    SyntheticModel model(SyntheticModel::Config(1000));
+    QSharedPointer<RenamableAggregator> sex(new RenamableAggregator(&model));
+    AbstractAggregator::Ptr kommune(new ColumnAggregator(&model, SyntheticModel::KOMMUNE));
+    Datacube datacube(&model, sex, kommune);
+    QCOMPARE(datacube.snapshot().categoryHeaderData(Qt::Vertical, 0, 1), QVariant("male"));
+    QSignalSpy headers_spy(&datacube, SIGNAL(headersChanged(Qt::Orientation,int,int)));
+    const quint64 generation = datacube.generation();
+    sex->rename(1, "men");
+    QCOMPARE(headers_spy.count(), 1);
+    QCOMPARE(headers_spy.first().at(0).value<Qt::Orientation>(), Qt::Vertical);
+    QVERIFY(datacube.generation() != generation);
+    QCOMPARE(datacube.snapshot().categoryHeaderData(Qt::Vertical, 0, 1), QVariant("men"));
+    QCOMPARE(datacube.snapshot().categoryHeaderData(Qt::Vertical, 0, 0), QVariant("female"));
+
+    // Through a shared aggregator too
+    AggregatorRegistry registry(&model);
+    AbstractAggregator::Ptr shared = registry.aggregator("sex", sex);
+    Datacube shared_datacube(&model, kommune, shared);
+    QCOMPARE(shared_datacube.snapshot().categoryHeaderData(Qt::Horizontal, 0, 0), QVariant("female"));
+    sex->rename(0, "women");
+    QCOMPARE(shared_datacube.snapshot().categoryHeaderData(Qt::Horizontal, 0, 0), QVariant("women"));
+}
+
+void TestDatacube::testAggregatorRegistry() {
+    danishnamecube_t danishModelHolder;
+    danishModelHolder.load_model_data(QFINDTESTDATA("data/plaincubedata.txt"));
+    QStandardItemModel* model = danishModelHolder.m_underlying_model;
+    AggregatorRegistry registry(model);
+    AbstractAggregator::Ptr sex = registry.columnAggregator(danishnamecube_t::SEX);
+    QCOMPARE(registry.columnAggregator(danishnamecube_t::SEX), sex);
+    AbstractAggregator::Ptr kommune = registry.columnAggregator(danishnamecube_t::KOMMUNE);
+    AbstractFilter::Ptr female = registry.categoryFilter(danishnamecube_t::SEX, "female");
+    QCOMPARE(registry.categoryFilter(danishnamecube_t::SEX, "female"), female);
+    QCOMPARE(registry.count(), 3);
+
+    Datacube shared(model, sex, kommune);
+    Datacube transposed(model, kommune, sex);
+    shared.addFilter(female);
+    transposed.addFilter(female);
+    Datacube plain(model, danishModelHolder.sex_aggregator, danishModelHolder.kommune_aggregator);
+    plain.addFilter(AbstractFilter::Ptr(new FilterByAggregate(danishModelHolder.sex_aggregator, "female")));
+
+    // Add a row with a new category, and change a row so it is filtered out
+    QList<QStandardItem*> row;
+    for (int c = 0; c < model->columnCount(); ++c) {
+        row << model->item(0, c)->clone();
+    }
+    row[danishnamecube_t::SEX]->setText("female");
+    row[danishnamecube_t::KOMMUNE]->setText("Aaaby");
+    model->appendRow(row);
+    model->item(plain.elements(0, 0).first(), danishnamecube_t::SEX)->setText("male");
+    model->removeRows(0, 3);
+
+    QCOMPARE(shared.elementCount(), plain.elementCount());
+    QCOMPARE(transposed.elementCount(), plain.elementCount());
+    QCOMPARE(shared.columnCount(), plain.columnCount());
+    for (int column = 0; column < plain.columnCount(); ++column) {
+        QCOMPARE(shared.elements(0, column), plain.elements(0, column));
+        QCOMPARE(transposed.elements(column, 0), plain.elements(0, column));
+    }
+}
+
+void TestDatacube::testSaveLoad() {
+    danishnamecube_t danishModelHolder;
+    danishModelHolder.load_model_data(QFINDTESTDATA("data/plaincubedata.txt"));
+    QStandardItemModel* model = danishModelHolder.m_underlying_model;
+    Datacube datacube(model, danishModelHolder.sex_aggregator, danishModelHolder.kommune_aggregator);
+    datacube.split(Qt::Horizontal, 1, danishModelHolder.age_aggregator);
+    AbstractFilter::Ptr femaleFilter(new FilterByAggregate(danishModelHolder.sex_aggregator, "female"));
+    datacube.addFilter(femaleFilter);
+    QBuffer buffer;
+    buffer.open(QIODevice::ReadWrite);
+    QVERIFY(datacube.save(&buffer, "v1"));
+
+    bool restored = false;
+    buffer.seek(0);
+    QScopedPointer<Datacube> loaded(Datacube::load(&buffer, "v1", model, datacube.rowAggregators(), datacube.columnAggregators(), datacube.filters(), 0, &restored));
+    QVERIFY(restored);
+    QCOMPARE(loaded->rowCount(), datacube.rowCount());
+    QCOMPARE(loaded->columnCount(), datacube.columnCount());
+    QCOMPARE(loaded->elementCount(), datacube.elementCount());
+    for (int row = 0; row < datacube.rowCount(); ++row) {
+        for (int column = 0; column < datacube.columnCount(); ++column) {
+            QCOMPARE(loaded->elements(row, column), datacube.elements(row, column));
+        }
+    }
+    const int element = datacube.elements(0, 0).first();
+    QCOMPARE(loaded->internalSection(element, Qt::Horizontal), datacube.internalSection(element, Qt::Horizontal));
+
+    // A different fingerprint or different aggregators rebuild from the model
+    buffer.seek(0);
+    QScopedPointer<Datacube> rebuilt(Datacube::load(&buffer, "v2", model, datacube.rowAggregators(), datacube.columnAggregators(), datacube.filters(), 0, &restored));
+    QVERIFY(!restored);
+    QCOMPARE(rebuilt->elementCount(), datacube.elementCount());
+    buffer.seek(0);
+    rebuilt.reset(Datacube::load(&buffer, "v1", model, datacube.columnAggregators(), datacube.rowAggregators(), datacube.filters(), 0, &restored));
+    QVERIFY(!restored);
+    QCOMPARE(rebuilt->rowCount(), datacube.columnCount());
+
+    // A file whose cells hold an invalid or a repeated element is rejected. The file ends with an element of the last cell
+    const QByteArray saved = buffer.data();
+    int last_element;
+    memcpy(&last_element, saved.constData() + saved.size() - sizeof(int), sizeof(int));
+    int other_element = -1;
+    for (int row = 0; row < datacube.rowCount() && other_element < 0; ++row) {
+        for (int column = 0; column < datacube.columnCount() && other_element < 0; ++column) {
+            Q_FOREACH(int candidate, datacube.elements(row, column)) {
+                if (candidate != last_element) {
+                    other_element = candidate;
+                    break;
+                }
+            }
+        }
+    }
+    QVERIFY(other_element >= 0);
+    const int invalid_elements[] = { model->rowCount(), -1, other_element };
+    for (unsigned i = 0; i < sizeof(invalid_elements) / sizeof(int); ++i) {
+        QByteArray corrupted = saved;
+        memcpy(corrupted.data() + corrupted.size() - sizeof(int), &invalid_elements[i], sizeof(int));
+        QBuffer corrupted_buffer(&corrupted);
+        corrupted_buffer.open(QIODevice::ReadOnly);
+        rebuilt.reset(Datacube::load(&corrupted_buffer, "v1", model, datacube.rowAggregators(), datacube.columnAggregators(), datacube.filters(), 0, &restored));
+        QVERIFY(!restored);
+        QCOMPARE(rebuilt->elementCount(), datacube.elementCount());
+    }
+
+    // A file that leaves out a row the filters now let through is stale, and rebuilt from the model
+    int male = 0;
+    while (model->item(male, danishnamecube_t::SEX)->text() != "male") {
+        ++male;
+    }
+    model->item(male, danishnamecube_t::SEX)->setText("female");
+    buffer.seek(0);
+    rebuilt.reset(Datacube::load(&buffer, "v1", model, datacube.rowAggregators(), datacube.columnAggregators(), datacube.filters(), 0, &restored));
+    QVERIFY(!restored);
+    QCOMPARE(rebuilt->elementCount(), datacube.elementCount());
+    QVERIFY(rebuilt->sectionForElement(male, Qt::Vertical) >= 0);
+
+    // The loaded datacube follows the model
+    model->removeRow(element);
+    QCOMPARE(loaded->elementCount(), datacube.elementCount());
+    QCOMPARE(loaded->elements(0, 0), datacube.elements(0, 0));
+}
+
+void TestDatacube::testStatistics() {
+    danishnamecube_t danishModelHolder;
+    danishModelHolder.load_model_data(QFINDTESTDATA("data/plaincubedata.txt"));
+    QStandardItemModel* model = danishModelHolder.m_underlying_model;
+    Datacube datacube(model, danishModelHolder.sex_aggregator, danishModelHolder.kommune_aggregator);
+    QVERIFY(!datacube.statistics());
+    datacube.setStatisticsEnabled(true);
+    if (!datacube.statistics()) {
+        QSKIP("Built without statistics");
+    }
+    DatacubeStatistics* statistics = datacube.statistics();
+    datacube.split(Qt::Horizontal, 1, danishModelHolder.age_aggregator);
+    QCOMPARE(statistics->timingCount(DatacubeStatistics::Split), 1);
+    QCOMPARE(statistics->counter(DatacubeStatistics::ElementsTouched), qint64(datacube.elementCount()));
+    QVERIFY(statistics->counter(DatacubeStatistics::CellsTouched) > 0);
+    QVERIFY(statistics->counter(DatacubeStatistics::SignalEmissions) > 0);
+    int histogram_total = 0;
+    Q_FOREACH(int count, statistics->histogram(DatacubeStatistics::Split)) {
+        histogram_total += count;
+    }
+    QCOMPARE(histogram_total, 1);
+    const qint64 split_emissions = statistics->counter(DatacubeStatistics::SignalEmissions);
+    datacube.collapse(Qt::Horizontal, 1);
+    QCOMPARE(statistics->timingCount(DatacubeStatistics::Collapse), 1);
+    QCOMPARE(statistics->counter(DatacubeStatistics::SignalEmissions), split_emissions + 2);
+
+    model->removeRow(0);
+    QCOMPARE(statistics->counter(DatacubeStatistics::RemoveCalls), qint64(1));
+    QVERIFY(statistics->dump().contains("remove calls: 1"));
+
+    statistics->reset();
+    QCOMPARE(statistics->timingCount(DatacubeStatistics::Split), 0);
+    QCOMPARE(statistics->counter(DatacubeStatistics::RemoveCalls), qint64(0));
+    datacube.setStatisticsEnabled(false);
+    QVERIFY(!datacube.statistics());
+}
+
+void TestDatacube::testTracing() {
+    danishnamecube_t danishModelHolder;
+    danishModelHolder.load_model_data(QFINDTESTDATA("data/plaincubedata.txt"));
+    QStandardItemModel* model = danishModelHolder.m_underlying_model;
+    Tracer::clear();
+    Tracer::setEnabled(true);
+    if (!Tracer::isEnabled()) {
+        QSKIP("Built without tracing");
+    }
+    Datacube datacube(model, danishModelHolder.sex_aggregator, danishModelHolder.kommune_aggregator);
+    datacube.split(Qt::Horizontal, 1, danishModelHolder.age_aggregator);
+    AbstractFilter::Ptr femaleFilter(new FilterByAggregate(danishModelHolder.sex_aggregator, "female"));
+    datacube.addFilter(femaleFilter);
+    Tracer::setEnabled(false);
+    datacube.removeFilter(femaleFilter); // not recorded
+
+    QBuffer buffer;
+    buffer.open(QIODevice::ReadWrite);
+    QVERIFY(Tracer::writeChromeTrace(&buffer));
+    QJsonParseError error;
+    const QJsonDocument trace = QJsonDocument::fromJson(buffer.data(), &error);
+    QCOMPARE(error.error, QJsonParseError::NoError);
+    QStringList names;
+    Q_FOREACH(const QJsonValue& value, trace.object().value("traceEvents").toArray()) {
+        const QJsonObject event = value.toObject();
+        if (event.value("ph").toString() == "M") {
+            QCOMPARE(event.value("name").toString(), QString("thread_name"));
+            continue;
+        }
+        QCOMPARE(event.value("ph").toString(), QString("X"));
+        QVERIFY(event.value("dur").toDouble() >= 0.0);
+        const QString name = event.value("name").toString();
+        if (name == "split_column") {
+            const QJsonObject args = event.value("args").toObject();
+            QCOMPARE(args.value("elements").toInt(), model->rowCount());
+            QCOMPARE(args.value("categories").toInt(), danishModelHolder.age_aggregator->categoryCount());
+        }
+        names << name;
+    }
+    QVERIFY(names.contains("Datacube::Datacube"));
+    QVERIFY(names.contains("split_column"));
+    QVERIFY(names.contains("Datacube::addFilter"));
+    QVERIFY(!names.contains("Datacube::removeFilter"));
+
+    Tracer::clear();
+    buffer.buffer().clear();
+    buffer.seek(0);
+    QVERIFY(Tracer::writeChromeTrace(&buffer));
+    QVERIFY(!buffer.data().contains("split_column"));
+}
+
+void TestDatacube::testMemoryUsage() {
+    SyntheticModel model(SyntheticModel::Config(100000));
+    AbstractAggregator::Ptr sex(new ColumnAggregator(&model, SyntheticModel::SEX));
+    AbstractAggregator::Ptr kommune(new ColumnAggregator(&model, SyntheticModel::KOMMUNE));
+    const qint64 before = heap_in_use();
+    QScopedPointer<Datacube> datacube(new Datacube(&model, sex, kommune));
+    const qint64 allocated = heap_in_use() - before;
+    const MemoryUsage usage = datacube->memoryUsage();
+    QVERIFY(usage.bytes("datacube cells") > 0);
+    QVERIFY(usage.bytes("datacube reverse index") > 0);
+    QVERIFY(usage.bytes("datacube column counts") > 0);
+    if (before < 0) {
+        qDebug("Heap usage not known, not comparing with the reported memory usage");
+    } else {
+        // The reported usage leaves out the QObjects and such, which are small compared to 100000 elements
+        QVERIFY2(qAbs(usage.total() - allocated) < allocated / 5,
+                 qPrintable(QString("reported %1 bytes, allocated %2 bytes\n%3").arg(usage.total()).arg(allocated).arg(usage.dump())));
+    }
+
+    DatacubeSelection selection(datacube.data(), 0);
+    for (int column = 0; column < datacube->columnCount(); ++column) {
+        selection.addCell(0, column);
+    }
+    QVERIFY(selection.memoryUsage().bytes("selection elements") >= model.rowCount() / 8);
+    QVERIFY(selection.memoryUsage().bytes("selection cells") > 0);
+
+    QVERIFY(sex->memoryUsage().bytes("aggregator categories") > 0);
+    const MemoryUsage total = Datacube::totalMemoryUsage();
+    QVERIFY(total.bytes("datacube reverse index") >= usage.bytes("datacube reverse index"));
+    QVERIFY(total.bytes("selection elements") >= selection.memoryUsage().bytes("selection elements"));
+    QVERIFY(total.bytes("aggregator categories") >= sex->memoryUsage().total() + kommune->memoryUsage().total());
+
+    // A second datacube over the same aggregators counts them once
+    Datacube other(&model, kommune, sex);
+    const MemoryUsage both = Datacube::totalMemoryUsage();
+    QCOMPARE(both.bytes("aggregator categories"), total.bytes("aggregator categories"));
+    QCOMPARE(both.bytes("datacube reverse index"), total.bytes("datacube reverse index") + other.memoryUsage().bytes("datacube reverse index"));
+}
+
+void TestDatacube::testIncrementalFilters() {
+    SyntheticModel model(SyntheticModel::Config(2000));
+    AbstractAggregator::Ptr sex(new ColumnAggregator(&model, SyntheticModel::SEX));
+    AbstractAggregator::Ptr kommune(new ColumnAggregator(&model, SyntheticModel::KOMMUNE));
+    Datacube datacube(&model, sex, kommune);
+    QSignalSpy resetSpy(&datacube, SIGNAL(reset()));
+    QSignalSpy rowsRemovedSpy(&datacube, SIGNAL(rowsRemoved(int,int)));
+    QSignalSpy columnsRemovedSpy(&datacube, SIGNAL(columnsRemoved(int,int)));
+
+    CountingFilter* kommune_filter = new CountingFilter(&model, SyntheticModel::KOMMUNE, 2);
+    CountingFilter* age_filter = new CountingFilter(&model, SyntheticModel::AGE, 3);
+    AbstractFilter::Ptr kommune_ptr(kommune_filter);
+    AbstractFilter::Ptr age_ptr(age_filter);
+    QList<CountingFilter*> both;
+    both << kommune_filter << age_filter;
+    QList<CountingFilter*> only_age;
+    only_age << age_filter;
+
+    // Removing a lot of elements is signalled as a reset
+    datacube.addFilter(kommune_ptr);
+    QCOMPARE(kommune_filter->evaluations(), model.rowCount());
+    QCOMPARE(resetSpy.count(), 1);
+    QCOMPARE(columnsRemovedSpy.count() + rowsRemovedSpy.count(), 0);
+
+    // The second filter is only asked about the elements still included
+    const int included = datacube.elementCount();
+    datacube.addFilter(age_ptr);
+    QCOMPARE(age_filter->evaluations(), included);
+    QCOMPARE(sorted_elements(datacube), filtered_elements(model, both));
+
+    // Removing a filter only reconsiders the elements it excluded
+    const int age_evaluations = age_filter->evaluations();
+    const int kommune_evaluations = kommune_filter->evaluations();
+    datacube.removeFilter(kommune_ptr);
+    QCOMPARE(kommune_filter->evaluations(), kommune_evaluations);
+    QCOMPARE(age_filter->evaluations() - age_evaluations, model.rowCount() - included);
+    QCOMPARE(sorted_elements(datacube), filtered_elements(model, only_age));
+
+    // Changes to the model are filtered as before
+    datacube.addFilter(kommune_ptr);
+    resetSpy.clear();
+    model.regenerate(10, 19, SyntheticModel::KOMMUNE);
+    QCOMPARE(sorted_elements(datacube), filtered_elements(model, both));
+    model.insertRows(5, 20);
+    QCOMPARE(sorted_elements(datacube), filtered_elements(model, both));
+    model.removeRows(0, 30);
+    QCOMPARE(sorted_elements(datacube), filtered_elements(model, both));
+    QCOMPARE(resetSpy.count(), 0);
+
+    datacube.resetFilter();
+    QCOMPARE(datacube.elementCount(), model.rowCount());
+    QCOMPARE(resetSpy.count(), 1);
+
+    // Small changes are signalled per element
+    SyntheticModel small_model(SyntheticModel::Config(50));
+    AbstractAggregator::Ptr small_sex(new ColumnAggregator(&small_model, SyntheticModel::SEX));
+    AbstractAggregator::Ptr small_kommune(new ColumnAggregator(&small_model, SyntheticModel::KOMMUNE));
+    Datacube small(&small_model, small_sex, small_kommune);
+    QSignalSpy smallResetSpy(&small, SIGNAL(reset()));
+    QSignalSpy smallChangedSpy(&small, SIGNAL(dataChanged(int,int,int,int)));
+    QSignalSpy smallRowsSpy(&small, SIGNAL(rowsRemoved(int,int)));
+    QSignalSpy smallColumnsSpy(&small, SIGNAL(columnsRemoved(int,int)));
+    AbstractFilter::Ptr small_filter(new CountingFilter(&small_model, SyntheticModel::KOMMUNE, 2));
+    small.addFilter(small_filter);
+    QVERIFY(small.elementCount() < small_model.rowCount());
+    QCOMPARE(smallResetSpy.count(), 0);
+    QVERIFY(smallChangedSpy.count() + smallRowsSpy.count() + smallColumnsSpy.count() > 0);
+}
+
+void TestDatacube::testBatchFilterEvaluation() {
+    SyntheticModel model(SyntheticModel::Config(5000));
+    AggregatorRegistry registry(&model);
+    AbstractAggregator::Ptr kommune(new ColumnAggregator(&model, SyntheticModel::KOMMUNE));
+    AbstractAggregator::Ptr shared_age = registry.columnAggregator(SyntheticModel::AGE);
+    AbstractAggregator::Ptr shared_sex = registry.columnAggregator(SyntheticModel::SEX);
+
+    // (kommune=0 OR age=1) AND sex=0 AND (empty AND), mixing plain and shared aggregators and filters
+    QSharedPointer<OrFilter> either(new OrFilter(&model));
+    either->addFilter(AbstractFilter::Ptr(new FilterByAggregate(kommune, 0)));
+    either->addFilter(AbstractFilter::Ptr(new FilterByAggregate(shared_age, 1)));
+    QSharedPointer<AndFilter> all(new AndFilter(&model));
+    all->addFilter(either);
+    all->addFilter(registry.categoryFilter(SyntheticModel::SEX, shared_sex->categoryHeaderData(0).toString()));
+    all->addFilter(AbstractFilter::Ptr(new AndFilter(&model)));
+
+    Q_FOREACH(AbstractFilter::Ptr filter, QList<AbstractFilter::Ptr>() << either << all) {
+        // Ranges starting and ending off word boundaries
+        Q_FOREACH(int start, QList<int>() << 0 << 37 << 64 << 4000) {
+            const int count = model.rowCount() - start - 13;
+            Bitset result;
+            filter->evaluate(start, count, result);
+            QCOMPARE(result.size(), count);
+            int included = 0;
+            for (int i = 0; i < count; ++i) {
+                const bool expected = (*filter)(start + i);
+                QCOMPARE(result.test(i), expected);
+                included += expected;
+            }
+            QCOMPARE(result.count(), included);
+        }
+    }
+
+    // Categorizing a range in one go agrees with categorizing row by row
+    QVector<int> codes(model.rowCount() - 37);
+    kommune->categorize(37, codes.size(), codes.data());
+    for (int i = 0; i < codes.size(); ++i) {
+        QCOMPARE(codes.at(i), (*kommune)(37 + i));
+    }
+
+    // A filter on a category not present includes nothing
+    FilterByAggregate missing(kommune, "no such kommune");
+    Bitset result;
+    missing.evaluate(0, model.rowCount(), result);
+    QVERIFY(!result.any());
+
+    // Adding a filter to a datacube without other filters evaluates it in one go
+    Datacube datacube(&model, shared_sex, kommune);
+    datacube.addFilter(all);
+    Bitset expected;
+    all->evaluate(0, model.rowCount(), expected);
+    QList<int> elements = datacube.elements();
+    qSort(elements);
+    QCOMPARE(elements, expected.toList());
+}
+
+/**
+ * @return the rows of model with a weight within [minimum, maximum]
+ */
+static QList<int> rows_by_weight(const SyntheticModel& model, int minimum, int maximum) {
+    QList<int> rv;
+    for (int row = 0; row < model.rowCount(); ++row) {
+        const int weight = model.data(model.index(row, SyntheticModel::WEIGHT)).toInt();
+        if (minimum <= weight && weight <= maximum) {
+            rv << row;
+        }
+    }
+    return rv;
+}
+
+void TestDatacube::testRangeFilter() {
+    SyntheticModel model(SyntheticModel::Config(3000));
+    QSharedPointer<RangeFilter> weight(new RangeFilter(&model, SyntheticModel::WEIGHT, 42, 60));
+    AbstractAggregator::Ptr sex(new ColumnAggregator(&model, SyntheticModel::SEX));
+    AbstractAggregator::Ptr kommune(new ColumnAggregator(&model, SyntheticModel::KOMMUNE));
+    Datacube datacube(&model, sex, kommune);
+    datacube.addFilter(weight);
+    QCOMPARE(sorted_elements(datacube), rows_by_weight(model, 42, 60));
+    Bitset batch;
+    weight->evaluate(0, model.rowCount(), batch);
+    QCOMPARE(batch.toList(), rows_by_weight(model, 42, 60));
+
+    // Only the rows entering or leaving the range are reported, for overlapping and disjoint ranges
+    int changed = -1;
+    connect(weight.data(), &AbstractFilter::resultsChanged, [&changed](const Bitset& rows) { changed = rows.count(); });
+    QSignalSpy filterChangedSpy(&datacube, SIGNAL(filterChanged()));
+    weight->setRange(45, 70);
+    QCOMPARE(changed, rows_by_weight(model, 42, 44).size() + rows_by_weight(model, 61, 70).size());
+    QCOMPARE(sorted_elements(datacube), rows_by_weight(model, 45, 70));
+    QCOMPARE(filterChangedSpy.count(), 1);
+    weight->setRange(100, 120);
+    QCOMPARE(changed, rows_by_weight(model, 45, 70).size() + rows_by_weight(model, 100, 120).size());
+    QCOMPARE(sorted_elements(datacube), rows_by_weight(model, 100, 120));
+    weight->setRange(40, 39);
+    QCOMPARE(datacube.elementCount(), 0);
+    weight->setRange(40, 60);
+    QCOMPARE(sorted_elements(datacube), rows_by_weight(model, 40, 60));
+
+    // The values follow the model
+    model.regenerate(100, 199, SyntheticModel::WEIGHT);
+    QCOMPARE(sorted_elements(datacube), rows_by_weight(model, 40, 60));
+    model.insertRows(50, 25);
+    QCOMPARE(sorted_elements(datacube), rows_by_weight(model, 40, 60));
+    model.removeRows(10, 100);
+    QCOMPARE(sorted_elements(datacube), rows_by_weight(model, 40, 60));
+    weight->setRange(50, 80);
+    QCOMPARE(sorted_elements(datacube), rows_by_weight(model, 50, 80));
+
+    // Edits to a few rows and to many rows at once, also reaching a datacube that hears about them first
+    Datacube early(&model, sex, kommune);
+    QSharedPointer<RangeFilter> late_weight(new RangeFilter(&model, SyntheticModel::WEIGHT, 40, 60));
+    early.addFilter(late_weight);
+    model.regenerate(0, 9, SyntheticModel::WEIGHT);
+    model.regenerate(200, 499, SyntheticModel::WEIGHT);
+    QCOMPARE(sorted_elements(datacube), rows_by_weight(model, 50, 80));
+    QCOMPARE(sorted_elements(early), rows_by_weight(model, 40, 60));
+    Bitset late_batch;
+    late_weight->evaluate(0, model.rowCount(), late_batch);
+    QCOMPARE(late_batch.toList(), rows_by_weight(model, 40, 60));
+    late_weight->setRange(50, 80);
+    QCOMPARE(sorted_elements(early), rows_by_weight(model, 50, 80));
+
+    // Inside a composite filter
+    datacube.resetFilter();
+    QSharedPointer<AndFilter> both(new AndFilter(&model));
+    both->addFilter(weight);
+    both->addFilter(AbstractFilter::Ptr(new FilterByAggregate(sex, 0)));
+    datacube.addFilter(both);
+    weight->setRange(40, 45);
+    QList<int> expected;
+    Q_FOREACH(int row, rows_by_weight(model, 40, 45)) {
+        if ((*sex)(row) == 0) {
+            expected << row;
+        }
+    }
+    QCOMPARE(sorted_elements(datacube), expected);
+}
+
+void TestDatacube::testAdaptiveFilterOrdering() {
+    SyntheticModel model(SyntheticModel::Config(20000));
+    AbstractFilter::Ptr cheap(new CountingFilter(&model, SyntheticModel::KOMMUNE, 7));
+
+    // Badly ordered: the slow filter excluding nothing first in the AND, the slow filter including nothing first in the OR
+    QSharedPointer<AndFilter> both(new AndFilter(&model));
+    both->addFilter(AbstractFilter::Ptr(new SlowFilter(&model, true)));
+    both->addFilter(cheap);
+    QSharedPointer<OrFilter> either(new OrFilter(&model));
+    either->addFilter(AbstractFilter::Ptr(new SlowFilter(&model, false)));
+    either->addFilter(cheap);
+    QSharedPointer<AndFilter> fixed(new AndFilter(&model));
+    fixed->setAdaptiveOrdering(false);
+    fixed->addFilter(both->evaluationOrder().first());
+    fixed->addFilter(cheap);
+    QVERIFY(both->adaptiveOrdering());
+    QVERIFY(!fixed->adaptiveOrdering());
+
+    for (int pass = 0; pass < 2; ++pass) {
+        for (int row = 0; row < model.rowCount(); ++row) {
+            const bool expected = (*cheap)(row);
+            QCOMPARE((*both)(row), expected);
+            QCOMPARE((*either)(row), expected);
+            QCOMPARE((*fixed)(row), expected);
+        }
+    }
+    QCOMPARE(both->evaluationOrder().first(), cheap);
+    QCOMPARE(either->evaluationOrder().first(), cheap);
+    QVERIFY(fixed->evaluationOrder().first() != cheap);
+
+    // Batch evaluation learns and gives the same result
+    QSharedPointer<AndFilter> batch(new AndFilter(&model));
+    batch->addFilter(AbstractFilter::Ptr(new SlowFilter(&model, true)));
+    batch->addFilter(cheap);
+    Bitset first;
+    Bitset second;
+    batch->evaluate(0, model.rowCount(), first);
+    batch->evaluate(0, model.rowCount(), second);
+    QCOMPARE(batch->evaluationOrder().first(), cheap);
+    QCOMPARE(first, second);
+    Bitset expected;
+    cheap->evaluate(0, model.rowCount(), expected);
+    QCOMPARE(first, expected);
+
+    // Turning adaptive ordering off restores the order added
+    both->setAdaptiveOrdering(false);
+    QVERIFY(both->evaluationOrder().first() != cheap);
+}
+
+/**
+ * @return the rows in the top categories of aggregator by row count among those with at least minimum of
+ * rows, counting directly. top is 0 for no limit.
+ */
+static QList<int> rows_in_top_categories(AbstractAggregator::Ptr aggregator, const QList<int>& rows, int minimum, int top) {
+    QVector<int> counts(aggregator->categoryCount());
+    Q_FOREACH(int row, rows) {
+        ++counts[(*aggregator)(row)];
+    }
+    QList<int> categories;
+    for (int category = 0; category < counts.size(); ++category) {
+        if (counts.at(category) > 0 && counts.at(category) >= minimum) {
+            categories << category;
+        }
+    }
+    if (top > 0) {
+        std::stable_sort(categories.begin(), categories.end(), [&counts](int lhs, int rhs) { return counts.at(lhs) > counts.at(rhs); });
+        categories = categories.mid(0, top);
+    }
+    QList<int> rv;
+    Q_FOREACH(int row, rows) {
+        if (categories.contains((*aggregator)(row))) {
+            rv << row;
+        }
+    }
+    return rv;
+}
+
+/**
+ * @return elements in the cells of datacube, sorted
+ */
+static QList<int> shown_elements(const Datacube& datacube) {
+    QList<int> rv;
+    for (int row = 0; row < datacube.rowCount(); ++row) {
+        for (int column = 0; column < datacube.columnCount(); ++column) {
+            rv << datacube.elements(row, column);
+        }
+    }
+    qSort(rv);
+    return rv;
+}
+
+void TestDatacube::testFilterHeader() {
+    const double inf = std::numeric_limits<double>::infinity();
+    SyntheticModel model(SyntheticModel::Config(3000));
+    AbstractAggregator::Ptr sex(new ColumnAggregator(&model, SyntheticModel::SEX));
+    AbstractAggregator::Ptr kommune(new ColumnAggregator(&model, SyntheticModel::KOMMUNE));
+    Datacube datacube(&model, sex, kommune);
+    QSignalSpy resetSpy(&datacube, SIGNAL(reset()));
+    QSignalSpy aboutToBeResetSpy(&datacube, SIGNAL(aboutToBeReset()));
+
+    // Count threshold: the columns of small categories are hidden, their elements stay in the datacube
+    datacube.filterHeader(Qt::Horizontal, 0, 40, inf);
+    QVERIFY(datacube.isHeaderFiltered(Qt::Horizontal, 0));
+    QVERIFY(!datacube.isHeaderFiltered(Qt::Vertical, 0));
+    QCOMPARE(resetSpy.count(), 1);
+    QCOMPARE(shown_elements(datacube), rows_in_top_categories(kommune, sorted_elements(datacube), 40, 0));
+    QCOMPARE(datacube.elementCount(), model.rowCount());
+    for (int column = 0; column < datacube.columnCount(); ++column) {
+        QVERIFY(datacube.elementCount(Qt::Horizontal, 0, column) >= 40);
+    }
+
+    // Top N, ties going to the first category
+    datacube.filterHeader(Qt::Horizontal, 0, -inf, inf, 5);
+    QCOMPARE(shown_elements(datacube), rows_in_top_categories(kommune, sorted_elements(datacube), 0, 5));
+    QCOMPARE(datacube.columnCount(), 5);
+
+    // The measures are over the elements in the datacube, so the top follows its filters
+    datacube.addFilter(AbstractFilter::Ptr(new FilterByAggregate(sex, 0)));
+    QCOMPARE(shown_elements(datacube), rows_in_top_categories(kommune, sorted_elements(datacube), 0, 5));
+    QCOMPARE(datacube.rowCount(), 1);
+    datacube.resetFilter();
+
+    // ... and the model, with at most one reset per change
+    int resets = resetSpy.count();
+    model.regenerate(100, 999, SyntheticModel::KOMMUNE);
+    QCOMPARE(shown_elements(datacube), rows_in_top_categories(kommune, sorted_elements(datacube), 0, 5));
+    QVERIFY(resetSpy.count() <= resets + 1);
+    resets = resetSpy.count();
+    model.insertRows(50, 500);
+    QCOMPARE(shown_elements(datacube), rows_in_top_categories(kommune, sorted_elements(datacube), 0, 5));
+    QVERIFY(resetSpy.count() <= resets + 1);
+    resets = resetSpy.count();
+    model.removeRows(10, 800);
+    QCOMPARE(shown_elements(datacube), rows_in_top_categories(kommune, sorted_elements(datacube), 0, 5));
+    QVERIFY(resetSpy.count() <= resets + 1);
+    QCOMPARE(aboutToBeResetSpy.count(), resetSpy.count());
+
+    // Snapshots see the same sections
+    const DatacubeSnapshot snapshot = datacube.snapshot();
+    QCOMPARE(snapshot.rowCount(), datacube.rowCount());
+    QCOMPARE(snapshot.columnCount(), datacube.columnCount());
+    for (int row = 0; row < datacube.rowCount(); ++row) {
+        for (int column = 0; column < datacube.columnCount(); ++column) {
+            QCOMPARE(snapshot.elements(row, column), datacube.elements(row, column));
+        }
+    }
+
+    // With more headers, the top is per section of the headers before. Rows left with only elements in
+    // hidden columns are hidden too.
+    AbstractAggregator::Ptr inner(new ColumnAggregator(&model, SyntheticModel::KOMMUNE));
+    Datacube nested(&model, kommune, sex);
+    nested.split(Qt::Horizontal, 1, inner);
+    nested.filterHeader(Qt::Horizontal, 1, -inf, inf, 3);
+    QList<int> expected;
+    QSet<int> kommuner;
+    for (int category = 0; category < sex->categoryCount(); ++category) {
+        QList<int> rows;
+        for (int row = 0; row < model.rowCount(); ++row) {
+            if ((*sex)(row) == category) {
+                rows << row;
+            }
+        }
+        Q_FOREACH(int row, rows_in_top_categories(inner, rows, 0, 3)) {
+            expected << row;
+            kommuner << (*inner)(row);
+        }
+    }
+    qSort(expected);
+    QCOMPARE(shown_elements(nested), expected);
+    QCOMPARE(nested.columnCount(), 3 * sex->categoryCount());
+    QCOMPARE(nested.rowCount(), kommuner.size());
+    QCOMPARE(nested.elementCount(Qt::Vertical, 0, 0), nested.elements(Qt::Vertical, 0, 0).size());
+
+    // Collapsing the header before measures over the whole header
+    nested.collapse(Qt::Horizontal, 0);
+    QVERIFY(nested.isHeaderFiltered(Qt::Horizontal, 0));
+    QCOMPARE(shown_elements(nested), rows_in_top_categories(inner, sorted_elements(nested), 0, 3));
+    QCOMPARE(nested.rowCount(), 3);
+
+    // Back to all sections
+    datacube.unfilterHeader(Qt::Horizontal, 0);
+    QVERIFY(!datacube.isHeaderFiltered(Qt::Horizontal, 0));
+    QCOMPARE(shown_elements(datacube), sorted_elements(datacube));
+
+    // Sum of a column. Editing it shows and hides sections, even when no element changes cell.
+    QStandardItemModel amounts;
+    const char* const rows[][2] = { { "a", "1" }, { "a", "2" }, { "b", "4" }, { "c", "8" } };
+    for (unsigned i = 0; i < sizeof(rows) / sizeof(rows[0]); ++i) {
+        amounts.appendRow(QList<QStandardItem*>() << new QStandardItem(rows[i][0]) << new QStandardItem(rows[i][1]) << new QStandardItem("x"));
+    }
+    AbstractAggregator::Ptr group(new ColumnAggregator(&amounts, 0));
+    AbstractAggregator::Ptr kind(new ColumnAggregator(&amounts, 2));
+    Datacube summed(&amounts, group, kind);
+    summed.filterHeader(Qt::Vertical, 0, 4, inf, 0, Qt::DescendingOrder, 1);
+    QCOMPARE(summed.rowCount(), 2);
+    QCOMPARE(summed.elements(0, 0), QList<int>() << 2);
+    QSignalSpy summedResetSpy(&summed, SIGNAL(reset()));
+    QSignalSpy rowsInsertedSpy(&summed, SIGNAL(rowsInserted(int,int)));
+    amounts.appendRow(QList<QStandardItem*>() << new QStandardItem("a") << new QStandardItem("0") << new QStandardItem("x"));
+    QCOMPARE(rowsInsertedSpy.count(), 0);
+    QCOMPARE(summedResetSpy.count(), 0);
+    QCOMPARE(summed.elementCount(), 5);
+    amounts.item(0, 1)->setText("10");
+    QCOMPARE(summedResetSpy.count(), 1);
+    QCOMPARE(summed.rowCount(), 3);
+    QCOMPARE(summed.elements(0, 0), QList<int>() << 0 << 1 << 4);
+    amounts.item(2, 1)->setText("3");
+    QCOMPARE(summedResetSpy.count(), 2);
+    QCOMPARE(summed.rowCount(), 2);
+    QCOMPARE(summed.elements(1, 0), QList<int>() << 3);
+}
+
+/**
+ * @return true if the datacubes have the same sections and elements in each cell
+ */
+static bool same_cells(const Datacube& actual, const Datacube& expected) {
+    if (actual.rowCount() != expected.rowCount() || actual.columnCount() != expected.columnCount()) {
+        return false;
+    }
+    for (int row = 0; row < actual.rowCount(); ++row) {
+        for (int column = 0; column < actual.columnCount(); ++column) {
+            QList<int> actual_elements = actual.elements(row, column);
+            QList<int> expected_elements = expected.elements(row, column);
+            qSort(actual_elements);
+            qSort(expected_elements);
+            if (actual_elements != expected_elements) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * @return the categories of the wrapped aggregator kept by aggregator, by decreasing count
+ */
+static QList<int> kept_categories(const TopCategoriesAggregator& aggregator) {
+    QVector<int> counts(aggregator.sourceAggregator()->categoryCount());
+    for (int row = 0; row < aggregator.underlyingModel()->rowCount(); ++row) {
+        ++counts[(*aggregator.sourceAggregator())(row)];
+    }
+    QList<int> rv;
+    for (int category = 0; category < aggregator.otherCategory(); ++category) {
+        rv << aggregator.sourceCategory(category);
+    }
+    std::stable_sort(rv.begin(), rv.end(), [&counts](int lhs, int rhs) { return counts.at(lhs) > counts.at(rhs); });
+    return rv;
+}
+
+void TestDatacube::testTopCategoriesAggregator() {
+    QStandardItemModel model(0, 2);
+    const QString letters("aaaaabbbbcccd");
+    for (int row = 0; row < letters.size(); ++row) {
+        model.appendRow(QList<QStandardItem*>() << new QStandardItem(QString(letters.at(row))) << new QStandardItem(row % 2 ? "odd" : "even"));
+    }
+    AbstractAggregator::Ptr letter(new ColumnAggregator(&model, 0));
+    QSharedPointer<TopCategoriesAggregator> top(new TopCategoriesAggregator(letter, 2));
+    top->setHysteresis(0.5);
+    AbstractAggregator::Ptr parity(new ColumnAggregator(&model, 1));
+    Datacube datacube(&model, top, parity);
+    QCOMPARE(top->categoryCount(), 3);
+    QCOMPARE(top->categoryHeaderData(0).toString(), QString("a"));
+    QCOMPARE(top->categoryHeaderData(1).toString(), QString("b"));
+    QCOMPARE(top->categoryHeaderData(top->otherCategory()).toString(), QString("Other"));
+    QCOMPARE(top->sourceCategory(top->otherCategory()), -1);
+    QCOMPARE(datacube.rowCount(), 3);
+    QCOMPARE(datacube.elementCount(Qt::Vertical, 0, 2), 4);
+
+    // c catching up with b does not replace it, c at more than 1.5 times b does
+    int recategorized = 0;
+    connect(top.data(), &AbstractAggregator::rowsRecategorized, [&recategorized](const Bitset& rows) { recategorized += rows.count(); });
+    model.item(12, 0)->setText("c");
+    QCOMPARE(top->categoryHeaderData(1).toString(), QString("b"));
+    QCOMPARE(recategorized, 0);
+    model.item(5, 0)->setText("c");
+    QCOMPARE(top->categoryHeaderData(1).toString(), QString("c"));
+    QCOMPARE(recategorized, 8); // 3 rows of b to "Other", 5 of c from it
+    QCOMPARE(top->categoryCount(), 3);
+    {
+        Datacube expected(&model, top, parity);
+        QVERIFY(same_cells(datacube, expected));
+    }
+
+    // Large model, the datacube following changes to the counts
+    SyntheticModel synthetic(SyntheticModel::Config(3000));
+    AbstractAggregator::Ptr kommune(new ColumnAggregator(&synthetic, SyntheticModel::KOMMUNE));
+    QSharedPointer<TopCategoriesAggregator> top_kommune(new TopCategoriesAggregator(kommune, 10));
+    AbstractAggregator::Ptr sex(new ColumnAggregator(&synthetic, SyntheticModel::SEX));
+    Datacube cube(&synthetic, sex, top_kommune);
+    QCOMPARE(top_kommune->categoryCount(), 11);
+    QVector<int> counts(kommune->categoryCount());
+    for (int row = 0; row < synthetic.rowCount(); ++row) {
+        ++counts[(*kommune)(row)];
+    }
+    QList<int> kept = kept_categories(*top_kommune);
+    int other = 0;
+    for (int category = 0; category < counts.size(); ++category) {
+        if (!kept.contains(category)) {
+            other += counts.at(category);
+            QVERIFY(counts.at(category) <= counts.at(kept.last()));
+        }
+    }
+    QCOMPARE(cube.elementCount(Qt::Horizontal, 0, top_kommune->otherCategory()), other);
+    synthetic.regenerate(0, 1499, SyntheticModel::KOMMUNE);
+    {
+        Datacube expected(&synthetic, sex, top_kommune);
+        QVERIFY(same_cells(cube, expected));
+    }
+    synthetic.insertRows(100, 500);
+    QCoreApplication::processEvents();
+    {
+        Datacube expected(&synthetic, sex, top_kommune);
+        QVERIFY(same_cells(cube, expected));
+    }
+    synthetic.removeRows(0, 700);
+    {
+        Datacube expected(&synthetic, sex, top_kommune);
+        QVERIFY(same_cells(cube, expected));
+    }
+    QVERIFY(top_kommune->categoryCount() <= 11);
+
+    // Minimum share instead of a maximum
+    top_kommune->setMaximum(0);
+    top_kommune->setMinimumShare(0.05);
+    counts = QVector<int>(kommune->categoryCount());
+    for (int row = 0; row < synthetic.rowCount(); ++row) {
+        ++counts[(*kommune)(row)];
+    }
+    kept = kept_categories(*top_kommune);
+    for (int category = 0; category < counts.size(); ++category) {
+        const double share = double(counts.at(category)) / synthetic.rowCount();
+        if (share >= 0.05 * 1.1) {
+            QVERIFY(kept.contains(category));
+        } else if (share < 0.05 * 0.9) {
+            QVERIFY(!kept.contains(category));
+        }
+    }
+    {
+        Datacube expected(&synthetic, sex, top_kommune);
+        QVERIFY(same_cells(cube, expected));
+    }
+}
+
+/**
+ * @return true if the columns of datacube, with aggregator as its only column header, hold the elements of their
+ * category and are ordered by element count as order, ties in category order
+ */
+static bool columns_sorted_by_count(const Datacube& datacube, AbstractAggregator::Ptr aggregator, Qt::SortOrder order) {
+    const QList<Datacube::HeaderDescription> headers = datacube.headers(Qt::Horizontal, 0);
+    if (headers.size() != datacube.columnCount()) {
+        return false;
+    }
+    for (int column = 0; column < headers.size(); ++column) {
+        const int category = headers.at(column).categoryIndex;
+        if (datacube.categoryIndex(Qt::Horizontal, 0, column) != category) {
+            return false;
+        }
+        for (int row = 0; row < datacube.rowCount(); ++row) {
+            Q_FOREACH(int element, datacube.elements(row, column)) {
+                if ((*aggregator)(element) != category) {
+                    return false;
+                }
+            }
+        }
+        if (column > 0) {
+            const int previous = datacube.elementCount(Qt::Horizontal, 0, column - 1);
+            const int count = datacube.elementCount(Qt::Horizontal, 0, column);
+            const bool ordered = order == Qt::DescendingOrder ? previous > count : previous < count;
+            if (!ordered && !(previous == count && headers.at(column - 1).categoryIndex < category)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void TestDatacube::testSortHeader() {
+    SyntheticModel model(SyntheticModel::Config(3000));
+    AbstractAggregator::Ptr sex(new ColumnAggregator(&model, SyntheticModel::SEX));
+    AbstractAggregator::Ptr kommune(new ColumnAggregator(&model, SyntheticModel::KOMMUNE));
+    Datacube datacube(&model, sex, kommune);
+    QSignalSpy resetSpy(&datacube, SIGNAL(reset()));
+    QSignalSpy aboutToBeResetSpy(&datacube, SIGNAL(aboutToBeReset()));
+    datacube.sortHeader(Qt::Horizontal, 0);
+    QVERIFY(datacube.isHeaderSorted(Qt::Horizontal, 0));
+    QVERIFY(!datacube.isHeaderSorted(Qt::Vertical, 0));
+    QCOMPARE(resetSpy.count(), 1);
+    QVERIFY(columns_sorted_by_count(datacube, kommune, Qt::DescendingOrder));
+
+    // The order follows the elements, with at most one reset per change to the model
+    int resets = resetSpy.count();
+    model.regenerate(0, 999, SyntheticModel::KOMMUNE);
+    QVERIFY(columns_sorted_by_count(datacube, kommune, Qt::DescendingOrder));
+    QVERIFY(resetSpy.count() <= resets + 1);
+    resets = resetSpy.count();
+    model.insertRows(100, 300);
+    QVERIFY(columns_sorted_by_count(datacube, kommune, Qt::DescendingOrder));
+    QVERIFY(resetSpy.count() <= resets + 1);
+    resets = resetSpy.count();
+    model.removeRows(0, 500);
+    QVERIFY(columns_sorted_by_count(datacube, kommune, Qt::DescendingOrder));
+    QVERIFY(resetSpy.count() <= resets + 1);
+    QCOMPARE(aboutToBeResetSpy.count(), resetSpy.count());
+    datacube.addFilter(AbstractFilter::Ptr(new FilterByAggregate(sex, 0)));
+    QVERIFY(columns_sorted_by_count(datacube, kommune, Qt::DescendingOrder));
+    datacube.resetFilter();
+    {
+        Datacube expected(&model, sex, kommune);
+        expected.sortHeader(Qt::Horizontal, 0);
+        QVERIFY(same_cells(datacube, expected));
+    }
+
+    // Snapshots see the same order
+    const DatacubeSnapshot snapshot = datacube.snapshot();
+    QCOMPARE(snapshot.columnCount(), datacube.columnCount());
+    for (int column = 0; column < datacube.columnCount(); ++column) {
+        QCOMPARE(snapshot.headers(Qt::Horizontal, 0).at(column).categoryIndex, datacube.headers(Qt::Horizontal, 0).at(column).categoryIndex);
+        QCOMPARE(snapshot.categoryIndex(Qt::Horizontal, 0, column), datacube.categoryIndex(Qt::Horizontal, 0, column));
+        for (int row = 0; row < datacube.rowCount(); ++row) {
+            QCOMPARE(snapshot.elements(row, column), datacube.elements(row, column));
+            Q_FOREACH(int element, snapshot.elements(row, column)) {
+                QCOMPARE(snapshot.internalSection(element, Qt::Horizontal), column);
+                QCOMPARE(snapshot.internalSection(element, Qt::Vertical), row);
+            }
+        }
+    }
+    const QList<int> first_cell = snapshot.elements(0, 0);
+
+    // Ascending by the sum of a column
+    datacube.sortHeader(Qt::Vertical, 0, Qt::AscendingOrder, SyntheticModel::WEIGHT);
+    QCOMPARE(snapshot.elements(0, 0), first_cell);
+    double previous = -1.0;
+    for (int row = 0; row < datacube.rowCount(); ++row) {
+        double sum = 0.0;
+        for (int column = 0; column < datacube.columnCount(); ++column) {
+            Q_FOREACH(int element, datacube.elements(row, column)) {
+                sum += model.data(model.index(element, SyntheticModel::WEIGHT)).toDouble();
+            }
+        }
+        QVERIFY(sum >= previous);
+        previous = sum;
+    }
+    QVERIFY(columns_sorted_by_count(datacube, kommune, Qt::DescendingOrder));
+
+    // Splitting and collapsing other headers keeps the order
+    datacube.split(Qt::Horizontal, 0, AbstractAggregator::Ptr(new ColumnAggregator(&model, SyntheticModel::AGE)));
+    QVERIFY(!datacube.isHeaderSorted(Qt::Horizontal, 0));
+    QVERIFY(datacube.isHeaderSorted(Qt::Horizontal, 1));
+    datacube.collapse(Qt::Horizontal, 0);
+    QVERIFY(columns_sorted_by_count(datacube, kommune, Qt::DescendingOrder));
+
+    // Editing the summed column reorders, even when no element changes cell
+    QStandardItemModel amounts;
+    const char* const rows[][2] = { { "a", "1" }, { "a", "2" }, { "b", "4" }, { "c", "8" } };
+    for (unsigned i = 0; i < sizeof(rows) / sizeof(rows[0]); ++i) {
+        amounts.appendRow(QList<QStandardItem*>() << new QStandardItem(rows[i][0]) << new QStandardItem(rows[i][1]) << new QStandardItem("x"));
+    }
+    AbstractAggregator::Ptr group(new ColumnAggregator(&amounts, 0));
+    AbstractAggregator::Ptr kind(new ColumnAggregator(&amounts, 2));
+    Datacube summed(&amounts, group, kind);
+    summed.sortHeader(Qt::Vertical, 0, Qt::AscendingOrder, 1);
+    QList<int> order;
+    Q_FOREACH(const Datacube::HeaderDescription& header, summed.headers(Qt::Vertical, 0)) {
+        order << header.categoryIndex;
+    }
+    QCOMPARE(order, QList<int>() << 0 << 1 << 2);
+    QSignalSpy summedResetSpy(&summed, SIGNAL(reset()));
+    amounts.item(0, 1)->setText("10");
+    QCOMPARE(summedResetSpy.count(), 1);
+    order.clear();
+    Q_FOREACH(const Datacube::HeaderDescription& header, summed.headers(Qt::Vertical, 0)) {
+        order << header.categoryIndex;
+    }
+    QCOMPARE(order, QList<int>() << 1 << 2 << 0);
+    QCOMPARE(summed.elements(2, 0), QList<int>() << 0 << 1);
+
+    // Back to the aggregator's order
+    datacube.unsortHeader(Qt::Horizontal, 0);
+    QVERIFY(!datacube.isHeaderSorted(Qt::Horizontal, 0));
+    const QList<Datacube::HeaderDescription> headers = datacube.headers(Qt::Horizontal, 0);
+    for (int column = 1; column < headers.size(); ++column) {
+        QVERIFY(headers.at(column - 1).categoryIndex < headers.at(column).categoryIndex);
+    }
+}
+
+void TestDatacube::testHyperLogLog() {
+    QCOMPARE(HyperLogLog(12).estimate(), 0.0);
+    const int precisions[] = { 10, 12, 14 };
+    const int counts[] = { 1000, 100000 };
+    Q_FOREACH(int precision, precisions) {
+        Q_FOREACH(int n, counts) {
+            // Duplicates do not count; a merged sketch is the sketch of the union
+            HyperLogLog all(precision);
+            HyperLogLog first(precision);
+            HyperLogLog last(precision);
+            for (int i = 0; i < n; ++i) {
+                const quint64 hash = HyperLogLog::hash(QString::number(i));
+                all.add(hash);
+                all.add(hash);
+                if (i < 2*n/3) {
+                    first.add(hash);
+                }
+                if (i >= n/3) {
+                    last.add(hash);
+                }
+            }
+            first.merge(last);
+            const double bound = 3 * HyperLogLog::relativeError(precision) * n;
+            QVERIFY(qAbs(all.estimate() - n) < bound);
+            QCOMPARE(first.estimate(), all.estimate());
+        }
+    }
+}
+
+void TestDatacube::testTDigest() {
+    QVERIFY(TDigest().quantile(0.5) != TDigest().quantile(0.5)); // NaN
+    const int n = 100000;
+    TDigest all(100.0);
+    TDigest some(100.0);
+    TDigest rest(100.0);
+    for (int i = 0; i < n; ++i) {
+        const double value = double((qint64(i) * 7919) % n); // 0 to n-1 in scrambled order
+        all.add(value);
+        (i % 3 == 0 ? some : rest).add(value);
+    }
+    some.merge(rest);
+    QCOMPARE(all.count(), double(n));
+    QCOMPARE(some.count(), double(n));
+    QVERIFY(all.centroidCount() < n / 10);
+    const double quantiles[] = { 0.001, 0.01, 0.25, 0.5, 0.75, 0.99, 0.999 };
+    Q_FOREACH(double q, quantiles) {
+        // Within 0.1% of the rank
+        QVERIFY(qAbs(all.quantile(q) - q * n) < 0.001 * n);
+        QVERIFY(qAbs(some.quantile(q) - q * n) < 0.001 * n);
+    }
+}
+
+void TestDatacube::testCellSketches() {
+    SyntheticModel model(SyntheticModel::Config(5000));
+    AbstractAggregator::Ptr sex(new ColumnAggregator(&model, SyntheticModel::SEX));
+    AbstractAggregator::Ptr kommune(new ColumnAggregator(&model, SyntheticModel::KOMMUNE));
+    Datacube datacube(&model, sex, kommune);
+    DistinctCountFormatter distinct(&model, 0L, SyntheticModel::FIRST_NAME);
+    QuantileFormatter median(&model, 0L, SyntheticModel::AGE, 0.5, 0, QString());
+    QVERIFY(distinct.mergesCells());
+    QVERIFY(median.mergesCells());
+    const int last_row = datacube.rowCount() - 1;
+    const int last_column = datacube.columnCount() - 1;
+
+    // Merging the sketches of the cells gives the sketch of all their elements
+    for (int column = 0; column <= last_column; ++column) {
+        QCOMPARE(distinct.formatCells(&datacube, 0, column, last_row, column), distinct.format(datacube.elements(Qt::Horizontal, 0, column)));
+    }
+    QCOMPARE(distinct.formatCells(&datacube, 0, 0, last_row, last_column), distinct.format(datacube.elements()));
+    QList<int> ages;
+    Q_FOREACH(int element, datacube.elements()) {
+        ages << model.data(model.index(element, SyntheticModel::AGE)).toInt();
+    }
+    std::sort(ages.begin(), ages.end());
+    QVERIFY(qAbs(median.estimate(&datacube, 0, 0, last_row, last_column) - ages.at(ages.size() / 2)) <= 1.0);
+
+    // The sketches of changed cells are rebuilt
+    model.regenerate(0, 49, SyntheticModel::FIRST_NAME);
+    model.regenerate(100, 3999, SyntheticModel::FIRST_NAME);
+    QCOMPARE(distinct.formatCells(&datacube, 0, 0, last_row, last_column), distinct.format(datacube.elements()));
+    for (int row = 0; row <= last_row; ++row) {
+        QCOMPARE(distinct.formatCells(&datacube, row, 0, row, last_column), distinct.format(datacube.elements(Qt::Vertical, 0, row)));
+    }
+    model.insertRows(10, 20);
+    QCoreApplication::processEvents();
+    model.removeRows(3000, 500);
+    QCOMPARE(datacube.rowCount(), last_row + 1);
+    QCOMPARE(distinct.formatCells(&datacube, 0, 0, datacube.rowCount() - 1, datacube.columnCount() - 1), distinct.format(datacube.elements()));
+    datacube.addFilter(AbstractFilter::Ptr(new FilterByAggregate(sex, 0)));
+    QCOMPARE(distinct.formatCells(&datacube, 0, 0, datacube.rowCount() - 1, datacube.columnCount() - 1), distinct.format(datacube.elements()));
+}
+
 #include "testdatacube.moc"
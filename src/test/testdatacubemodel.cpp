@@ -0,0 +1,127 @@
+#include "danishnamecube.h"
+#include "datacube.h"
+#include "datacubemodel.h"
+#include "abstractformatter.h"
+#include "filterbyaggregate.h"
+#include "modeltest.h"
+
+#include <QObject>
+#include <QSignalSpy>
+#include <QStandardItemModel>
+#include <QTest>
+
+using namespace qdatacube;
+
+/**
+ * Formatter showing the number of elements, counting how often it is asked
+ */
+class CallCountingFormatter : public AbstractFormatter {
+    public:
+        CallCountingFormatter(QAbstractItemModel* model) : AbstractFormatter(model), calls(0) {}
+        virtual QString format(QList<int> rows) const {
+            ++calls;
+            return QString::number(rows.size());
+        }
+        mutable int calls;
+};
+
+class TestDatacubeModel : public QObject {
+    Q_OBJECT
+private Q_SLOTS:
+
+    void testData();
+    void testStructuralChanges();
+    void testBatchedDataChanged();
+private:
+    void compareWithDatacube(const DatacubeModel& model, const Datacube& datacube);
+};
+QTEST_GUILESS_MAIN(TestDatacubeModel)
+
+void TestDatacubeModel::compareWithDatacube(const DatacubeModel& model, const Datacube& datacube) {
+    QCOMPARE(model.rowCount(), datacube.rowCount());
+    QCOMPARE(model.columnCount(), datacube.columnCount());
+    for (int row = 0; row < model.rowCount(); ++row) {
+        for (int column = 0; column < model.columnCount(); ++column) {
+            const QModelIndex index = model.index(row, column);
+            QCOMPARE(model.data(index, DatacubeModel::ElementCountRole).toInt(), datacube.elementCount(row, column));
+        }
+    }
+}
+
+void TestDatacubeModel::testData() {
+    danishnamecube_t danishModelHolder;
+    danishModelHolder.load_model_data(QFINDTESTDATA("data/plaincubedata.txt"));
+    QStandardItemModel* underlying_model = danishModelHolder.m_underlying_model;
+    Datacube datacube(underlying_model, danishModelHolder.sex_aggregator, danishModelHolder.kommune_aggregator);
+    datacube.split(Qt::Horizontal, 0, danishModelHolder.age_aggregator);
+    DatacubeModel model(&datacube);
+    ModelTest modelTest(&model);
+    CallCountingFormatter* formatter = new CallCountingFormatter(underlying_model);
+    model.addFormatter(formatter);
+    compareWithDatacube(model, datacube);
+
+    const QModelIndex index = model.index(0, 0);
+    const QString count = QString::number(datacube.elementCount(0, 0));
+    QCOMPARE(model.data(index, DatacubeModel::FormatterRole).toString(), count);
+    QCOMPARE(model.data(index).toString(), count);
+    QCOMPARE(formatter->calls, 1);
+    QCOMPARE(model.roleNames().value(DatacubeModel::FormatterRole), QByteArray("formatter0"));
+
+    const QStringList vertical = model.headerData(0, Qt::Vertical, DatacubeModel::HeaderCategoriesRole).toStringList();
+    QCOMPARE(vertical.size(), 1);
+    QCOMPARE(vertical.first(), danishModelHolder.sex_aggregator->categoryHeaderData(datacube.categoryIndex(Qt::Vertical, 0, 0)).toString());
+    const QStringList horizontal = model.headerData(0, Qt::Horizontal, DatacubeModel::HeaderCategoriesRole).toStringList();
+    QCOMPARE(horizontal.size(), 2);
+    QCOMPARE(model.headerData(0, Qt::Horizontal).toString(), horizontal.last());
+}
+
+void TestDatacubeModel::testStructuralChanges() {
+    danishnamecube_t danishModelHolder;
+    danishModelHolder.load_model_data(QFINDTESTDATA("data/plaincubedata.txt"));
+    QStandardItemModel* underlying_model = danishModelHolder.m_underlying_model;
+    Datacube datacube(underlying_model, danishModelHolder.sex_aggregator, danishModelHolder.kommune_aggregator);
+    DatacubeModel model(&datacube);
+    ModelTest modelTest(&model);
+
+    // Filtering removes rows and columns, often both for the same element
+    AbstractFilter::Ptr femaleFilter(new FilterByAggregate(danishModelHolder.sex_aggregator, "female"));
+    datacube.addFilter(femaleFilter);
+    compareWithDatacube(model, datacube);
+    datacube.removeFilter(femaleFilter);
+    compareWithDatacube(model, datacube);
+
+    underlying_model->removeRows(0, 10);
+    compareWithDatacube(model, datacube);
+
+    datacube.split(Qt::Vertical, 1, danishModelHolder.age_aggregator);
+    compareWithDatacube(model, datacube);
+    datacube.collapse(Qt::Horizontal, 0);
+    compareWithDatacube(model, datacube);
+}
+
+void TestDatacubeModel::testBatchedDataChanged() {
+    danishnamecube_t danishModelHolder;
+    danishModelHolder.load_model_data(QFINDTESTDATA("data/plaincubedata.txt"));
+    QStandardItemModel* underlying_model = danishModelHolder.m_underlying_model;
+    Datacube datacube(underlying_model, danishModelHolder.sex_aggregator, danishModelHolder.kommune_aggregator);
+    DatacubeModel model(&datacube);
+    model.addFormatter(new CallCountingFormatter(underlying_model));
+    QSignalSpy spy(&model, SIGNAL(dataChanged(QModelIndex,QModelIndex)));
+
+    for (int element = 0; element < 3; ++element) {
+        QStandardItem* age = underlying_model->item(element, danishnamecube_t::AGE);
+        age->setText(QString::number(age->text().toInt() + 1));
+    }
+    QCOMPARE(spy.count(), 0);
+    QTRY_COMPARE(spy.count(), 1);
+    const QModelIndex top_left = spy.first().at(0).value<QModelIndex>();
+    const QModelIndex bottom_right = spy.first().at(1).value<QModelIndex>();
+    for (int element = 0; element < 3; ++element) {
+        const int row = datacube.sectionForElement(element, Qt::Vertical);
+        const int column = datacube.sectionForElement(element, Qt::Horizontal);
+        QVERIFY(top_left.row() <= row && row <= bottom_right.row());
+        QVERIFY(top_left.column() <= column && column <= bottom_right.column());
+    }
+}
+
+#include "testdatacubemodel.moc"
@@ -0,0 +1,209 @@
+#include "abstractformatter.h"
+#include "danishnamecube.h"
+#include "datacube.h"
+#include "datacubeview.h"
+#include "columnsumformatter.h"
+#include "filterbyaggregate.h"
+
+#include <QApplication>
+#include <QMutex>
+#include <QObject>
+#include <QPaintEvent>
+#include <QSemaphore>
+#include <QStandardItemModel>
+#include <QTest>
+
+using namespace qdatacube;
+
+/**
+ * View recording the area repainted
+ */
+class RecordingView : public DatacubeView {
+    public:
+        using DatacubeView::corner;
+        QRegion painted;
+    protected:
+        virtual bool viewportEvent(QEvent* event) {
+            if (event->type() == QEvent::Paint) {
+                painted += static_cast<QPaintEvent*>(event)->region();
+            }
+            return DatacubeView::viewportEvent(event);
+        }
+};
+
+/**
+ * Thread safe formatter showing the number of elements, recording the elements of each call. Calls wait
+ * for the gate to open.
+ */
+class GatedFormatter : public AbstractFormatter {
+    public:
+        GatedFormatter(QAbstractItemModel* model) : AbstractFormatter(model) {}
+        virtual QString format(QList<int> rows) const {
+            {
+                QMutexLocker lock(&m_mutex);
+                m_calls << rows;
+            }
+            m_gate.acquire();
+            m_gate.release();
+            return QString::number(rows.size());
+        }
+        virtual bool isThreadSafe() const {
+            return true;
+        }
+        void open() {
+            m_gate.release();
+        }
+        QList<QList<int> > calls() const {
+            QMutexLocker lock(&m_mutex);
+            return m_calls;
+        }
+    private:
+        mutable QSemaphore m_gate;
+        mutable QMutex m_mutex;
+        mutable QList<QList<int> > m_calls;
+};
+
+class TestDatacubeView : public QObject {
+    Q_OBJECT
+private Q_SLOTS:
+
+    void testSingleCellRepaint();
+    void testAsynchronousInvalidation();
+    void testHiddenElementChange();
+private:
+    /**
+     * Show a cube formatted asynchronously, and return the elements of each call of the formatter in calls.
+     * If change, change an element while the first value is being formatted.
+     */
+    void formatGated(bool change, QList<QList<int> >* calls);
+};
+
+void TestDatacubeView::testSingleCellRepaint() {
+    danishnamecube_t danishModelHolder;
+    danishModelHolder.load_model_data(QFINDTESTDATA("data/plaincubedata.txt"));
+    QStandardItemModel* model = danishModelHolder.m_underlying_model;
+    Datacube datacube(model, danishModelHolder.sex_aggregator, danishModelHolder.kommune_aggregator);
+    RecordingView view;
+    view.addFormatter(new ColumnSumFormatter(model, &view, danishnamecube_t::AGE, 0, QString()));
+    view.setDatacube(&datacube);
+    view.resize(1600, 400);
+    view.show();
+    QVERIFY(QTest::qWaitForWindowExposed(&view));
+    QTRY_VERIFY(!view.painted.isEmpty());
+    QTest::qWait(50);
+    view.painted = QRegion();
+
+    // Change a value in the lower right cell. Its totals are to the right and below, so even if the
+    // repainted area is merged to its bounding rectangle, only one cell should be repainted.
+    const int row = datacube.rowCount() - 1;
+    const int column = datacube.columnCount() - 1;
+    const int element = datacube.elements(row, column).first();
+    QStandardItem* age = model->item(element, danishnamecube_t::AGE);
+    age->setText(QString::number(age->text().toInt() + 1));
+
+    QTRY_VERIFY(!view.painted.isEmpty());
+    const int cell_width = view.corner().width(); // One level of headers in each direction
+    const int cell_height = view.corner().height();
+    int painted_cells = 0;
+    for (int r = 0; r < datacube.rowCount(); ++r) {
+        for (int c = 0; c < datacube.columnCount(); ++c) {
+            const QRect cell(cell_width * (c+1), cell_height * (r+1), cell_width, cell_height);
+            if (view.painted.intersects(cell)) {
+                ++painted_cells;
+                QCOMPARE(r, row);
+                QCOMPARE(c, column);
+            }
+        }
+    }
+    QCOMPARE(painted_cells, 1);
+}
+
+void TestDatacubeView::formatGated(bool change, QList<QList<int> >* calls) {
+    danishnamecube_t danishModelHolder;
+    danishModelHolder.load_model_data(QFINDTESTDATA("data/plaincubedata.txt"));
+    QStandardItemModel* model = danishModelHolder.m_underlying_model;
+    Datacube datacube(model, danishModelHolder.sex_aggregator, danishModelHolder.kommune_aggregator);
+    RecordingView view;
+    GatedFormatter* formatter = new GatedFormatter(model);
+    view.addFormatter(formatter);
+    view.setAsynchronousFormatting(true);
+    view.setDatacube(&datacube);
+    view.resize(1600, 400);
+    view.show();
+    QVERIFY(QTest::qWaitForWindowExposed(&view));
+    QTRY_VERIFY(!formatter->calls().isEmpty());
+    if (change) {
+        // Change an element outside the value being formatted
+        const QList<int> blocked = formatter->calls().first();
+        int element = 0;
+        while (element < model->rowCount() && blocked.contains(element)) {
+            ++element;
+        }
+        QVERIFY(element < model->rowCount());
+        QStandardItem* age = model->item(element, danishnamecube_t::AGE);
+        age->setText(QString::number(age->text().toInt() + 1));
+    }
+    formatter->open();
+    QTest::qWait(200);
+    view.viewport()->repaint();
+    QTest::qWait(200);
+    view.takeFormatter(0);
+    *calls = formatter->calls();
+    delete formatter;
+}
+
+void TestDatacubeView::testAsynchronousInvalidation() {
+    QList<QList<int> > changed;
+    formatGated(true, &changed);
+    QList<QList<int> > unchanged;
+    formatGated(false, &unchanged);
+
+    // The value being formatted when another cell changed is still good, so its result is kept rather than
+    // formatted again
+    QVERIFY(!changed.isEmpty());
+    const QList<int> blocked = changed.first();
+    QCOMPARE(changed.count(blocked), unchanged.count(blocked));
+}
+
+void TestDatacubeView::testHiddenElementChange() {
+    danishnamecube_t danishModelHolder;
+    danishModelHolder.load_model_data(QFINDTESTDATA("data/plaincubedata.txt"));
+    QStandardItemModel* model = danishModelHolder.m_underlying_model;
+    Datacube datacube(model, danishModelHolder.sex_aggregator, danishModelHolder.kommune_aggregator);
+    datacube.addFilter(AbstractFilter::Ptr(new FilterByAggregate(danishModelHolder.sex_aggregator, 0)));
+    RecordingView view;
+    GatedFormatter* formatter = new GatedFormatter(model);
+    formatter->open();
+    view.addFormatter(formatter);
+    view.setDatacube(&datacube);
+    view.resize(1600, 400);
+    view.show();
+    QVERIFY(QTest::qWaitForWindowExposed(&view));
+    QTRY_VERIFY(!formatter->calls().isEmpty());
+    QTest::qWait(50);
+    const int formatted = formatter->calls().size();
+
+    // Change an element that is filtered out. It is in no cell or total, so every formatted value is kept.
+    int element = 0;
+    while (element < model->rowCount() && datacube.sectionForElement(element, Qt::Vertical) >= 0) {
+        ++element;
+    }
+    QVERIFY(element < model->rowCount());
+    QStandardItem* age = model->item(element, danishnamecube_t::AGE);
+    age->setText(QString::number(age->text().toInt() + 1));
+    view.viewport()->repaint();
+    QCOMPARE(formatter->calls().size(), formatted);
+    view.takeFormatter(0);
+    delete formatter;
+}
+
+int main(int argc, char** argv) {
+    if (qgetenv("QT_QPA_PLATFORM").isEmpty()) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    QApplication app(argc, argv);
+    TestDatacubeView test;
+    return QTest::qExec(&test, argc, argv);
+}
+
+#include "testdatacubeview.moc"
@@ -0,0 +1,384 @@
+#include "topcategoriesaggregator.h"
+
+#include "memoryusage_p.h"
+#include "tracer_p.h"
+
+#include <QAbstractItemModel>
+#include <QVector>
+
+#include <algorithm>
+
+namespace qdatacube {
+
+class TopCategoriesAggregatorPrivate {
+  public:
+    TopCategoriesAggregatorPrivate(TopCategoriesAggregator* q, AbstractAggregator::Ptr source, int maximum, const QString& other_label)
+      : q(q), source(source), maximum(maximum), minimum_share(0.0), hysteresis(0.1), other_label(other_label), total(0), rebalance_queued(false) {
+    }
+    /**
+     * Add sign times row to the count of its category
+     */
+    void count_row(int row, int sign);
+    /**
+     * @return the categories to keep given the current counts, sorted. Unless initial, changes to the
+     * currently kept categories must pass the hysteresis.
+     */
+    QVector<int> choose(bool initial) const;
+    /**
+     * Change the kept categories to new_kept, emitting categoryAdded() for the categories coming,
+     * rowsRecategorized() for the rows moving, then categoryRemoved() for the categories going
+     */
+    void apply(const QVector<int>& new_kept);
+    /**
+     * Rebuild mapped from kept. The categories set in leaving are mapped to "Other".
+     */
+    void remap(const Bitset& leaving = Bitset());
+    TopCategoriesAggregator* q;
+    AbstractAggregator::Ptr source;
+    int maximum;
+    double minimum_share;
+    double hysteresis;
+    QString other_label;
+    QVector<int> codes; // category of the wrapped aggregator for each row
+    QVector<int> counts; // rows in each category of the wrapped aggregator
+    int total; // sum of counts
+    QVector<int> kept; // categories of the wrapped aggregator kept, sorted
+    QVector<int> mapped; // category for each category of the wrapped aggregator, -1 for "Other"
+    bool rebalance_queued;
+};
+
+void TopCategoriesAggregatorPrivate::count_row(int row, int sign) {
+  const int category = codes.at(row);
+  if (category >= 0) {
+    counts[category] += sign;
+    total += sign;
+  }
+}
+
+namespace {
+/**
+ * Orders categories by decreasing count, ties going to the first category
+ */
+struct ByCount {
+  explicit ByCount(const QVector<int>& counts) : counts(counts) {}
+  bool operator()(int lhs, int rhs) const {
+    const int l = counts.at(lhs);
+    const int r = counts.at(rhs);
+    return l != r ? l > r : lhs < rhs;
+  }
+  const QVector<int>& counts;
+};
+}
+
+QVector<int> TopCategoriesAggregatorPrivate::choose(bool initial) const {
+  const double margin = initial ? 0.0 : hysteresis;
+  const double enter = minimum_share * (1.0 + margin) * total;
+  const double leave = minimum_share * (1.0 - margin) * total;
+  const ByCount by_count(counts);
+  QVector<int> working;
+  Bitset in_working(counts.size());
+  Q_FOREACH(int category, kept) {
+    if (counts.at(category) > 0 && counts.at(category) >= leave) {
+      working << category;
+      in_working.set(category);
+    }
+  }
+  if (maximum > 0 && working.size() > maximum) {
+    std::sort(working.begin(), working.end(), by_count);
+    working.resize(maximum);
+  }
+  QVector<int> candidates;
+  for (int category = 0, ncategories = counts.size(); category < ncategories; ++category) {
+    if (!in_working.test(category) && counts.at(category) > 0 && counts.at(category) >= enter) {
+      candidates << category;
+    }
+  }
+  if (maximum > 0 && candidates.size() > maximum) {
+    std::nth_element(candidates.begin(), candidates.begin() + maximum, candidates.end(), by_count);
+    candidates.resize(maximum);
+  }
+  std::sort(candidates.begin(), candidates.end(), by_count);
+  Q_FOREACH(int candidate, candidates) {
+    if (maximum <= 0 || working.size() < maximum) {
+      working << candidate;
+      continue;
+    }
+    // Replace the weakest kept category if the candidate beats it by the margin
+    QVector<int>::iterator weakest = std::max_element(working.begin(), working.end(), by_count);
+    if (counts.at(candidate) > counts.at(*weakest) * (1.0 + margin)) {
+      *weakest = candidate;
+    } else {
+      break;
+    }
+  }
+  std::sort(working.begin(), working.end());
+  return working;
+}
+
+void TopCategoriesAggregatorPrivate::remap(const Bitset& leaving) {
+  mapped.fill(-1, counts.size());
+  for (int category = 0, ncategories = kept.size(); category < ncategories; ++category) {
+    if (!leaving.test(kept.at(category))) {
+      mapped[kept.at(category)] = category;
+    }
+  }
+}
+
+void TopCategoriesAggregatorPrivate::apply(const QVector<int>& new_kept) {
+  QVector<int> promoted;
+  std::set_difference(new_kept.constBegin(), new_kept.constEnd(), kept.constBegin(), kept.constEnd(), std::back_inserter(promoted));
+  QVector<int> demoted;
+  std::set_difference(kept.constBegin(), kept.constEnd(), new_kept.constBegin(), new_kept.constEnd(), std::back_inserter(demoted));
+  if (promoted.isEmpty() && demoted.isEmpty()) {
+    return;
+  }
+  QDATACUBE_TRACE("TopCategoriesAggregator::apply");
+  QDATACUBE_TRACE_ARG("promoted", promoted.size());
+  QDATACUBE_TRACE_ARG("demoted", demoted.size());
+  const Bitset leaving = Bitset::fromList(demoted.toList(), counts.size());
+  const Bitset moving = Bitset::fromList((promoted + demoted).toList(), counts.size());
+  // The categories coming are added one by one, as listeners expect the category count to grow by one
+  Q_FOREACH(int category, promoted) {
+    const int index = std::lower_bound(kept.begin(), kept.end(), category) - kept.begin();
+    kept.insert(index, category);
+    remap(leaving);
+    emit q->categoryAdded(index);
+  }
+  Bitset rows(codes.size());
+  for (int row = 0, nrows = codes.size(); row < nrows; ++row) {
+    if (moving.test(codes.at(row))) {
+      rows.set(row);
+    }
+  }
+  emit q->rowsRecategorized(rows);
+  for (int i = demoted.size() - 1; i >= 0; --i) {
+    const int index = std::lower_bound(kept.begin(), kept.end(), demoted.at(i)) - kept.begin();
+    kept.remove(index);
+    remap(leaving);
+    emit q->categoryRemoved(index);
+  }
+}
+
+TopCategoriesAggregator::TopCategoriesAggregator(AbstractAggregator::Ptr aggregator, int maximum, const QString& other_label)
+  : AbstractAggregator(aggregator->underlyingModel()),
+    d(new TopCategoriesAggregatorPrivate(this, aggregator, maximum, other_label))
+{
+  setName(aggregator->name());
+  // The wrapped aggregator must update its categories before the counts are updated, so connect after it
+  connect(aggregator.data(), SIGNAL(categoryAdded(int)), SLOT(source_category_added(int)));
+  connect(aggregator.data(), SIGNAL(categoryRemoved(int)), SLOT(source_category_removed(int)));
+  connect(aggregator.data(), SIGNAL(rowsRecategorized(qdatacube::Bitset)), SLOT(source_rows_recategorized(qdatacube::Bitset)));
+  connect(aggregator.data(), SIGNAL(headerDataChanged(int,int)), SLOT(source_header_data_changed(int,int)));
+  connect(underlyingModel(), SIGNAL(dataChanged(QModelIndex,QModelIndex)), SLOT(refresh_rows(QModelIndex,QModelIndex)));
+  connect(underlyingModel(), SIGNAL(rowsInserted(QModelIndex,int,int)), SLOT(insert_rows(QModelIndex,int,int)));
+  connect(underlyingModel(), SIGNAL(rowsRemoved(QModelIndex,int,int)), SLOT(remove_rows(QModelIndex,int,int)));
+  connect(underlyingModel(), SIGNAL(modelReset()), SLOT(refresh_all()));
+  const int nrows = underlyingModel()->rowCount();
+  d->codes.resize(nrows);
+  aggregator->categorize(0, nrows, d->codes.data());
+  d->counts = QVector<int>(aggregator->categoryCount());
+  for (int row = 0; row < nrows; ++row) {
+    d->count_row(row, 1);
+  }
+  d->kept = d->choose(true);
+  d->remap();
+}
+
+TopCategoriesAggregator::~TopCategoriesAggregator() {
+  // Empty
+}
+
+int TopCategoriesAggregator::operator()(int row) const {
+  Q_ASSERT(row < d->codes.size());
+  const int code = d->codes.at(row);
+  const int category = code >= 0 ? d->mapped.at(code) : -1;
+  return category >= 0 ? category : d->kept.size();
+}
+
+void TopCategoriesAggregator::categorize(int start, int count, int* codes) const {
+  Q_ASSERT(start + count <= d->codes.size());
+  const int other = d->kept.size();
+  for (int i = 0; i < count; ++i) {
+    const int code = d->codes.at(start + i);
+    const int category = code >= 0 ? d->mapped.at(code) : -1;
+    codes[i] = category >= 0 ? category : other;
+  }
+}
+
+int TopCategoriesAggregator::categoryCount() const {
+  return d->kept.size() + 1;
+}
+
+QVariant TopCategoriesAggregator::categoryHeaderData(int category, int role) const {
+  if (category < d->kept.size()) {
+    return d->source->categoryHeaderData(d->kept.at(category), role);
+  }
+  if (category == d->kept.size() && role == Qt::DisplayRole) {
+    return d->other_label;
+  }
+  return QVariant();
+}
+
+MemoryUsage TopCategoriesAggregator::memoryUsage() const {
+  MemoryUsage rv = d->source->memoryUsage();
+  rv.add("aggregator codes", memory::vector_bytes(d->codes));
+  rv.add("aggregator category counts", memory::vector_bytes(d->counts) + memory::vector_bytes(d->kept) + memory::vector_bytes(d->mapped));
+  return rv;
+}
+
+void TopCategoriesAggregator::setMaximum(int maximum) {
+  d->maximum = maximum;
+  rebalance();
+}
+
+int TopCategoriesAggregator::maximum() const {
+  return d->maximum;
+}
+
+void TopCategoriesAggregator::setMinimumShare(double share) {
+  d->minimum_share = share;
+  rebalance();
+}
+
+double TopCategoriesAggregator::minimumShare() const {
+  return d->minimum_share;
+}
+
+void TopCategoriesAggregator::setHysteresis(double hysteresis) {
+  d->hysteresis = hysteresis;
+}
+
+double TopCategoriesAggregator::hysteresis() const {
+  return d->hysteresis;
+}
+
+AbstractAggregator::Ptr TopCategoriesAggregator::sourceAggregator() const {
+  return d->source;
+}
+
+int TopCategoriesAggregator::sourceCategory(int category) const {
+  return category < d->kept.size() ? d->kept.at(category) : -1;
+}
+
+int TopCategoriesAggregator::otherCategory() const {
+  return d->kept.size();
+}
+
+void TopCategoriesAggregator::refresh_rows(const QModelIndex& top_left, const QModelIndex& bottom_right) {
+  if (top_left.parent().isValid()) {
+    return;
+  }
+  for (int row = top_left.row(); row <= bottom_right.row(); ++row) {
+    d->count_row(row, -1);
+    d->codes[row] = (*d->source)(row);
+    d->count_row(row, 1);
+  }
+  rebalance();
+}
+
+void TopCategoriesAggregator::insert_rows(const QModelIndex& parent, int start, int end) {
+  if (parent.isValid()) {
+    return;
+  }
+  d->codes.insert(start, end - start + 1, -1);
+  for (int row = start; row <= end; ++row) {
+    d->codes[row] = (*d->source)(row);
+    d->count_row(row, 1);
+  }
+  // The datacubes have not seen the new rows yet, so report moving rows later
+  if (!d->rebalance_queued) {
+    d->rebalance_queued = true;
+    QMetaObject::invokeMethod(this, "rebalance", Qt::QueuedConnection);
+  }
+}
+
+void TopCategoriesAggregator::remove_rows(const QModelIndex& parent, int start, int end) {
+  if (parent.isValid()) {
+    return;
+  }
+  for (int row = start; row <= end; ++row) {
+    d->count_row(row, -1);
+  }
+  d->codes.remove(start, end - start + 1);
+  rebalance();
+}
+
+void TopCategoriesAggregator::refresh_all() {
+  const int nrows = underlyingModel()->rowCount();
+  d->codes.resize(nrows);
+  d->source->categorize(0, nrows, d->codes.data());
+  d->counts.fill(0, d->source->categoryCount());
+  d->total = 0;
+  for (int row = 0; row < nrows; ++row) {
+    d->count_row(row, 1);
+  }
+  rebalance();
+}
+
+void TopCategoriesAggregator::source_category_added(int index) {
+  for (QVector<int>::iterator it = d->codes.begin(), iend = d->codes.end(); it != iend; ++it) {
+    if (*it >= index) {
+      ++*it;
+    }
+  }
+  d->counts.insert(index, 0);
+  for (QVector<int>::iterator it = d->kept.begin(), iend = d->kept.end(); it != iend; ++it) {
+    if (*it >= index) {
+      ++*it;
+    }
+  }
+  d->remap();
+}
+
+void TopCategoriesAggregator::source_category_removed(int index) {
+  for (QVector<int>::iterator it = d->codes.begin(), iend = d->codes.end(); it != iend; ++it) {
+    if (*it == index) {
+      *it = -1; // Only rows about to be removed or changed can be in a removed category
+    } else if (*it > index) {
+      --*it;
+    }
+  }
+  d->total -= d->counts.at(index);
+  d->counts.remove(index);
+  const int category = d->kept.indexOf(index);
+  if (category >= 0) {
+    d->kept.remove(category);
+  }
+  for (QVector<int>::iterator it = d->kept.begin(), iend = d->kept.end(); it != iend; ++it) {
+    if (*it > index) {
+      --*it;
+    }
+  }
+  d->remap();
+  if (category >= 0) {
+    emit categoryRemoved(category);
+  }
+}
+
+void TopCategoriesAggregator::source_rows_recategorized(const qdatacube::Bitset& rows) {
+  for (int row = rows.nextSetBit(0); row >= 0 && row < d->codes.size(); row = rows.nextSetBit(row + 1)) {
+    d->count_row(row, -1);
+    d->codes[row] = (*d->source)(row);
+    d->count_row(row, 1);
+  }
+  emit rowsRecategorized(rows);
+  rebalance();
+}
+
+void TopCategoriesAggregator::source_header_data_changed(int first, int last) {
+  for (int source_category = first; source_category <= last && source_category < d->mapped.size(); ++source_category) {
+    const int category = d->mapped.at(source_category);
+    if (category >= 0) {
+      emit headerDataChanged(category, category);
+    }
+  }
+}
+
+void TopCategoriesAggregator::rebalance() {
+  d->rebalance_queued = false;
+  d->apply(d->choose(false));
+}
+
+}
+
+#include "topcategoriesaggregator.moc"
@@ -0,0 +1,100 @@
+#ifndef QDATACUBE_TOP_CATEGORIES_AGGREGATOR_H
+#define QDATACUBE_TOP_CATEGORIES_AGGREGATOR_H
+
+#include "abstractaggregator.h"
+#include "qdatacube_export.h"
+
+#include <QScopedPointer>
+#include <QSharedPointer>
+
+class QModelIndex;
+
+namespace qdatacube {
+
+/**
+ * \brief Aggregates into the most frequent categories of another aggregator, and "Other" for the rest.
+ *
+ * Splitting a datacube on an aggregator with tens of thousands of categories multiplies the number of
+ * buckets by as much, while most categories hold a handful of rows. This aggregator keeps at most
+ * maximum() of the categories of the wrapped aggregator, the ones with the most rows and, optionally, at
+ * least a minimum share of the rows, in the wrapped aggregator's order, and puts all other rows in a
+ * last "Other" category. The size of a datacube split on it is then bounded whatever the cardinality.
+ *
+ * The number of rows in each category is kept up to date as the model changes. To keep categories from
+ * coming and going as counts fluctuate, a category only replaces a kept one with more than
+ * (1 + hysteresis()) times its rows, and with a minimum share, categories are kept from above
+ * minimumShare() * (1 + hysteresis()) until they fall below minimumShare() * (1 - hysteresis()).
+ * When the kept categories change, the rows moving are reported through rowsRecategorized(). Changes
+ * due to rows inserted are made once control returns to the event loop.
+ *
+ * As with AggregatorRegistry, create this after the wrapped aggregator and before the datacubes using it.
+ */
+class TopCategoriesAggregatorPrivate;
+class QDATACUBE_EXPORT TopCategoriesAggregator : public AbstractAggregator {
+    Q_OBJECT
+    public:
+        /**
+         * Wrap aggregator, keeping at most maximum of its categories. A maximum of 0 means no limit.
+         */
+        TopCategoriesAggregator(AbstractAggregator::Ptr aggregator, int maximum, const QString& other_label = QString("Other"));
+        ~TopCategoriesAggregator();
+
+        // Inherited:
+        virtual int operator()(int row) const;
+        virtual void categorize(int start, int count, int* codes) const;
+        virtual int categoryCount() const;
+        virtual QVariant categoryHeaderData(int category, int role = Qt::DisplayRole) const;
+        virtual MemoryUsage memoryUsage() const;
+
+        /**
+         * Keep at most maximum categories, 0 for no limit
+         */
+        void setMaximum(int maximum);
+        int maximum() const;
+
+        /**
+         * Keep only categories with at least share (between 0 and 1) of the rows. Default 0.
+         */
+        void setMinimumShare(double share);
+        double minimumShare() const;
+
+        /**
+         * Set the relative margin a count must pass before the kept categories change. Default 0.1.
+         */
+        void setHysteresis(double hysteresis);
+        double hysteresis() const;
+
+        /**
+         * @return the wrapped aggregator
+         */
+        AbstractAggregator::Ptr sourceAggregator() const;
+
+        /**
+         * @return the category of the wrapped aggregator for category, or -1 for the "Other" category
+         */
+        int sourceCategory(int category) const;
+
+        /**
+         * @return the "Other" category, always the last
+         */
+        int otherCategory() const;
+
+    private Q_SLOTS:
+        void refresh_rows(const QModelIndex& top_left, const QModelIndex& bottom_right);
+        void insert_rows(const QModelIndex& parent, int start, int end);
+        void remove_rows(const QModelIndex& parent, int start, int end);
+        void refresh_all();
+        void source_category_added(int index);
+        void source_category_removed(int index);
+        void source_rows_recategorized(const qdatacube::Bitset& rows);
+        void source_header_data_changed(int first, int last);
+        void rebalance();
+
+    private:
+        QScopedPointer<TopCategoriesAggregatorPrivate> d;
+        friend class TopCategoriesAggregatorPrivate;
+};
+
+}
+
+#endif // QDATACUBE_TOP_CATEGORIES_AGGREGATOR_H
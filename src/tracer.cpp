@@ -0,0 +1,199 @@
+#include "tracer.h"
+#include "tracer_p.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QIODevice>
+#include <QList>
+#include <QMutex>
+#include <QScopedPointer>
+#include <QThread>
+#include <QThreadStorage>
+
+namespace qdatacube {
+
+QAtomicInt trace_enabled(0);
+
+namespace {
+
+/**
+ * The latest events recorded by one thread. Only that thread writes; head is published after
+ * each event, so a reader sees complete events up to head.
+ */
+class TraceBuffer {
+    public:
+        enum {
+            Size = 1 << 14
+        };
+        TraceBuffer(int tid, const QByteArray& thread_name)
+          : tid(tid), thread_name(thread_name), events(new TraceEvent[Size]), head(0), wrapped(0), retired(false) {}
+        void append(const TraceEvent& event) {
+          const int index = head.load();
+          events[index] = event;
+          const int next = (index + 1) & (Size - 1);
+          if (next == 0) {
+            wrapped.storeRelease(1);
+          }
+          head.storeRelease(next);
+        }
+        const int tid;
+        const QByteArray thread_name;
+        QScopedArrayPointer<TraceEvent> events;
+        QAtomicInt head; // index of the next event to write
+        QAtomicInt wrapped; // set when the events before head have been overwritten at least once
+        bool retired; // set when the thread finished, guarded by the registry mutex
+};
+
+struct TraceRegistry {
+    TraceRegistry() : next_tid(1) {}
+    ~TraceRegistry() {
+      qDeleteAll(buffers);
+    }
+    QMutex mutex;
+    QList<TraceBuffer*> buffers;
+    QElapsedTimer epoch;
+    int next_tid;
+};
+
+Q_GLOBAL_STATIC(TraceRegistry, registry)
+
+/**
+ * Owned by the thread's storage, and deleted when the thread finishes. The buffer is kept,
+ * so the events of finished threads can still be exported, until the next clear().
+ */
+struct TraceBufferHandle {
+    explicit TraceBufferHandle(TraceBuffer* buffer) : buffer(buffer) {}
+    ~TraceBufferHandle() {
+      if (TraceRegistry* reg = registry()) {
+        QMutexLocker lock(&reg->mutex);
+        buffer->retired = true;
+      }
+    }
+    TraceBuffer* buffer;
+};
+
+QThreadStorage<TraceBufferHandle*> current_buffer;
+
+TraceBuffer* create_buffer() {
+  TraceRegistry* reg = registry();
+  QMutexLocker lock(&reg->mutex);
+  const int tid = reg->next_tid++;
+  QByteArray name = QThread::currentThread()->objectName().toUtf8();
+  if (name.isEmpty()) {
+    const bool main_thread = QCoreApplication::instance() && QCoreApplication::instance()->thread() == QThread::currentThread();
+    name = main_thread ? QByteArray("main") : "thread " + QByteArray::number(tid);
+  }
+  TraceBuffer* buffer = new TraceBuffer(tid, name);
+  reg->buffers << buffer;
+  return buffer;
+}
+
+QByteArray json_string(const QByteArray& text) {
+  QByteArray rv("\"");
+  for (int i = 0; i < text.size(); ++i) {
+    const char c = text.at(i);
+    if (c == '"' || c == '\\') {
+      rv += '\\';
+      rv += c;
+    } else if (uchar(c) < 0x20) {
+      rv += "\\u00" + QByteArray::number(uchar(c) >> 4, 16) + QByteArray::number(uchar(c) & 0xf, 16);
+    } else {
+      rv += c;
+    }
+  }
+  rv += '"';
+  return rv;
+}
+
+QByteArray microseconds(qint64 nsecs) {
+  return QByteArray::number(nsecs / 1e3, 'f', 3);
+}
+
+}
+
+qint64 trace_now() {
+  return registry()->epoch.nsecsElapsed();
+}
+
+void trace_record(const TraceEvent& event) {
+  if (!current_buffer.hasLocalData()) {
+    current_buffer.setLocalData(new TraceBufferHandle(create_buffer()));
+  }
+  current_buffer.localData()->buffer->append(event);
+}
+
+void Tracer::setEnabled(bool enabled) {
+#ifndef QDATACUBE_NO_TRACING
+  if (enabled) {
+    TraceRegistry* reg = registry();
+    QMutexLocker lock(&reg->mutex);
+    if (!reg->epoch.isValid()) {
+      reg->epoch.start();
+    }
+  }
+  trace_enabled.storeRelease(enabled ? 1 : 0);
+#else
+  Q_UNUSED(enabled);
+#endif
+}
+
+bool Tracer::isEnabled() {
+  return trace_enabled.loadAcquire();
+}
+
+void Tracer::clear() {
+  TraceRegistry* reg = registry();
+  QMutexLocker lock(&reg->mutex);
+  for (QList<TraceBuffer*>::iterator it = reg->buffers.begin(); it != reg->buffers.end();) {
+    TraceBuffer* buffer = *it;
+    if (buffer->retired) {
+      delete buffer;
+      it = reg->buffers.erase(it);
+    } else {
+      buffer->head.storeRelease(0);
+      buffer->wrapped.storeRelease(0);
+      ++it;
+    }
+  }
+}
+
+bool Tracer::writeChromeTrace(QIODevice* device) {
+  TraceRegistry* reg = registry();
+  QMutexLocker lock(&reg->mutex);
+  const QByteArray pid = QByteArray::number(QCoreApplication::applicationPid());
+  QByteArray out("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+  bool first = true;
+  Q_FOREACH(const TraceBuffer* buffer, reg->buffers) {
+    const QByteArray tid = QByteArray::number(buffer->tid);
+    out += first ? "\n" : ",\n";
+    first = false;
+    out += "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" + pid + ",\"tid\":" + tid
+         + ",\"args\":{\"name\":" + json_string(buffer->thread_name) + "}}";
+    const int head = buffer->head.loadAcquire();
+    const bool wrapped = buffer->wrapped.loadAcquire();
+    const int count = wrapped ? int(TraceBuffer::Size) : head;
+    for (int i = 0; i < count; ++i) {
+      const TraceEvent& event = buffer->events[wrapped ? (head + i) & (TraceBuffer::Size - 1) : i];
+      out += ",\n{\"name\":" + json_string(event.name) + ",\"cat\":\"qdatacube\",\"ph\":\"X\",\"pid\":" + pid
+           + ",\"tid\":" + tid + ",\"ts\":" + microseconds(event.start) + ",\"dur\":" + microseconds(event.duration)
+           + ",\"args\":{";
+      for (int arg = 0; arg < event.nargs; ++arg) {
+        if (arg > 0) {
+          out += ',';
+        }
+        out += json_string(event.arg_names[arg]) + ':' + QByteArray::number(event.arg_values[arg]);
+      }
+      out += "}}";
+      if (out.size() > 1 << 20) {
+        if (device->write(out) != out.size()) {
+          return false;
+        }
+        out.clear();
+      }
+    }
+  }
+  out += "\n]}\n";
+  return device->write(out) == out.size();
+}
+
+}
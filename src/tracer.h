@@ -0,0 +1,49 @@
+#ifndef QDATACUBE_TRACER_H
+#define QDATACUBE_TRACER_H
+
+#include "qdatacube_export.h"
+
+class QIODevice;
+
+namespace qdatacube {
+
+/**
+ * Timeline of datacube operations, for finding out which step blocked the GUI thread.
+ *
+ * While enabled, datacubes, aggregators and views record an event with its duration and some
+ * metadata (elements, cells rebuilt, ...) for construction, split, collapse, filter changes, model
+ * changes, category resets, painting and formatting. Each thread records to its own ring buffer
+ * of the latest 16384 events without locking. When disabled, the cost is a flag check per operation.
+ * Building with QDATACUBE_NO_TRACING defined removes tracing entirely.
+ *
+ * The events are exported as Chrome trace JSON, which can be loaded into chrome://tracing or the
+ * Perfetto UI.
+ */
+class QDATACUBE_EXPORT Tracer {
+    public:
+        /**
+         * Start or stop recording events. Recorded events are kept until clear().
+         */
+        static void setEnabled(bool enabled);
+
+        /**
+         * @return true if recording events
+         */
+        static bool isEnabled();
+
+        /**
+         * Discard all recorded events. Should not be called while other threads are recording.
+         */
+        static void clear();
+
+        /**
+         * Write the recorded events to device as Chrome trace JSON. Best called while other threads are
+         * idle, as events they record during the export may be missing or incomplete.
+         * @return false if writing failed
+         */
+        static bool writeChromeTrace(QIODevice* device);
+};
+
+}
+
+#endif // QDATACUBE_TRACER_H
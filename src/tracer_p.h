@@ -0,0 +1,75 @@
+#ifndef QDATACUBE_TRACER_P_H
+#define QDATACUBE_TRACER_P_H
+
+#include <QAtomicInt>
+
+namespace qdatacube {
+
+/**
+ * A recorded event. Names must be string literals or otherwise live for the rest of the program.
+ */
+struct TraceEvent {
+    enum {
+        MaxArgs = 3
+    };
+    const char* name;
+    qint64 start; // nanoseconds since tracing was first enabled
+    qint64 duration;
+    int nargs;
+    const char* arg_names[MaxArgs];
+    qint64 arg_values[MaxArgs];
+};
+
+extern QAtomicInt trace_enabled;
+
+/**
+ * @return nanoseconds since tracing was first enabled
+ */
+qint64 trace_now();
+
+/**
+ * Append event to the ring buffer of the current thread
+ */
+void trace_record(const TraceEvent& event);
+
+/**
+ * Record the enclosing scope as an event, if tracing is enabled
+ */
+class TraceScope {
+    public:
+        explicit TraceScope(const char* name) {
+            m_event.name = name;
+            m_event.nargs = 0;
+            m_event.start = trace_enabled.load() ? trace_now() : -1;
+        }
+        ~TraceScope() {
+            if (m_event.start >= 0) {
+                m_event.duration = trace_now() - m_event.start;
+                trace_record(m_event);
+            }
+        }
+        /**
+         * Add metadata to the event. Arguments beyond TraceEvent::MaxArgs are dropped.
+         */
+        void addArg(const char* name, qint64 value) {
+            if (m_event.start >= 0 && m_event.nargs < TraceEvent::MaxArgs) {
+                m_event.arg_names[m_event.nargs] = name;
+                m_event.arg_values[m_event.nargs] = value;
+                ++m_event.nargs;
+            }
+        }
+    private:
+        TraceEvent m_event;
+};
+
+}
+
+#ifndef QDATACUBE_NO_TRACING
+#define QDATACUBE_TRACE(name) qdatacube::TraceScope trace_scope(name)
+#define QDATACUBE_TRACE_ARG(name, value) trace_scope.addArg(name, value)
+#else
+#define QDATACUBE_TRACE(name) do {} while (0)
+#define QDATACUBE_TRACE_ARG(name, value) do {} while (0)
+#endif
+
+#endif // QDATACUBE_TRACER_P_H